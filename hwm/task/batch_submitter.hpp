@@ -0,0 +1,345 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./task_queue.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! batch_flush_timerから、期限が来たことを通知される側のインターフェース
+struct batch_flush_target
+{
+    virtual ~batch_flush_target() {}
+
+    //! generationのバッチの期限が来た時に、タイマーのスレッドから呼び出される
+    /*!
+		その間にバッチがすでに積まれていた場合は、何もしてはならない。
+	*/
+    virtual void on_deadline(std::uint64_t generation) = 0;
+};
+
+//! @class batch_submitterが溜めているタスクを、期限が来たら積ませるためのタイマー
+/*!
+	一つのスレッドで、登録された期限を早い順に待機する。
+	対象はstd::weak_ptrで保持するので、期限より前に破棄された対象は無視する。
+	登録はバッチごとに一回だけなので、バッチを積むたびに取り消す必要はなく、
+	期限が来た時に対象のgenerationが進んでいれば何もしない。
+*/
+struct batch_flush_timer
+{
+    typedef std::chrono::steady_clock clock_type;
+
+    batch_flush_timer()
+        :   started_(false)
+    {}
+
+    batch_flush_timer(batch_flush_timer const &) = delete;
+    batch_flush_timer & operator=(batch_flush_timer const &) = delete;
+
+    //! deadlineにtargetのon_deadline(generation)を呼び出すように登録する
+    /*!
+		スレッドは最初に登録された時に起動する。
+	*/
+    void arm(clock_type::time_point deadline, std::weak_ptr<batch_flush_target> target, std::uint64_t generation)
+    {
+        bool earliest = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            earliest = entries_.empty() || deadline < entries_.top().deadline;
+            entries_.push(entry { deadline, std::move(target), generation });
+
+            if(!started_) {
+                thread_ = std::thread([this] { process(); });
+                started_ = true;
+            }
+        }
+
+        //! 待機している期限より後であれば、起こす必要はない
+        if(earliest) {
+            c_.notify_one();
+        }
+    }
+
+private:
+    struct entry
+    {
+        clock_type::time_point              deadline;
+        std::weak_ptr<batch_flush_target>   target;
+        std::uint64_t                       generation;
+
+        //! std::priority_queueの先頭に最も早い期限が来るように、大小を逆にする
+        bool operator<(entry const &rhs) const { return deadline > rhs.deadline; }
+    };
+
+    void process()
+    {
+        std::vector<entry> expired;
+
+        for( ; ; ) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                c_.wait(lock, [this] { return !entries_.empty(); });
+
+                auto const now = clock_type::now();
+                if(entries_.top().deadline > now) {
+                    c_.wait_until(lock, entries_.top().deadline);
+                    continue;
+                }
+
+                while(!entries_.empty() && entries_.top().deadline <= now) {
+                    expired.push_back(entries_.top());
+                    entries_.pop();
+                }
+            }
+
+            for(auto &e: expired) {
+                if(auto target = e.target.lock()) {
+                    target->on_deadline(e.generation);
+                }
+            }
+            expired.clear();
+        }
+    }
+
+    std::mutex                  mutex_;
+    std::condition_variable     c_;
+    std::priority_queue<entry>  entries_;
+    bool                        started_;
+    std::thread                 thread_;
+};
+
+//! プロセス全体で共有するbatch_flush_timerを返す
+/*!
+	default_task_queue()と同じく破棄しないので、スレッドはプログラムの終了まで残る。
+*/
+inline
+batch_flush_timer & shared_batch_flush_timer()
+{
+    static batch_flush_timer *timer = new batch_flush_timer();
+    return *timer;
+}
+
+//! @class 細かいタスクをまとめてタスクキューに積むクラス
+/*!
+	enqueue()されたタスクをすぐにはタスクキューに積まずに手元に溜めておき、
+	次のいずれかの時点で、溜まっているタスクを順に実行する一つのタスクとしてタスクキューに積む。
+		溜まっているタスクがmax_batch_sizeに達した時
+		最初のタスクを溜めてからmax_delayが経過した時
+		flush()が呼ばれた時、またはオブジェクトが破棄される時
+	タスクキューのロックの取得や待機中のスレッドへの通知が、まとめたタスクごとに一回で済むので、
+	ごく小さなタスクを大量に積む場合のオーバーヘッドを減らせる。
+	まとめられたタスクも、それぞれ個別のstd::futureで結果を受け取れる。
+
+	タスクを溜めておくバッファはタイマーのスレッドと共有するので、enqueue()のたびにロックを取る。
+	複数のスレッドから使用することもできるが、ロックを取り合うので、スレッドごとにオブジェクトを用意する方がよい。
+
+	@tparam TaskQueue タスクを実行するタスクキューの型。emplace<F>(args...)メンバ関数を持たなければならない。
+	@note max_delayが経過したバッチは、プロセスで共有するタイマーのスレッドからタスクキューに積まれる。
+	タスクキューが上限に達していると、その間はタイマーのスレッドも、このオブジェクトのenqueue()も待たされる。
+	また、一つのバッチの遅れは他のオブジェクトのバッチを積むのを遅らせることがある。
+	@note まとめられたタスクは一つのスレッドで順に実行されるので、実行に時間がかかるタスクには向かない。
+*/
+template<class TaskQueue>
+struct basic_batch_submitter
+{
+    typedef TaskQueue						task_queue_type;
+    typedef std::unique_ptr<task_base>		task_ptr_t;
+    typedef std::chrono::steady_clock		clock_type;
+
+    //! コンストラクタ
+    /*!
+		@param tq [in] タスクを実行するタスクキュー。このオブジェクトより長く生存していなければならない。
+		@param max_batch_size [in] 一つにまとめるタスク数の上限
+		@param max_delay [in] 最初のタスクを溜めてから、タスクキューに積むまでの時間。
+		ゼロを指定すると、時間による判定は行わない。
+	*/
+    explicit
+    basic_batch_submitter(
+            task_queue_type &tq,
+            size_t max_batch_size = 64,
+            clock_type::duration max_delay = std::chrono::milliseconds(1))
+        :   state_(std::make_shared<state>(tq, max_batch_size))
+        ,   max_delay_(max_delay)
+    {
+        assert(max_batch_size >= 1);
+    }
+
+    basic_batch_submitter(basic_batch_submitter const &) = delete;
+    basic_batch_submitter & operator=(basic_batch_submitter const &) = delete;
+
+    //! デストラクタ
+    /*!
+		溜まっているタスクをタスクキューに積む。
+		この後でタイマーの期限が来ても、タスクキューにはアクセスしない。
+	*/
+    ~basic_batch_submitter()
+    {
+        flush();
+    }
+
+    //! 新たなタスクを追加
+    /*!
+		@param [in] f 実行したい関数や関数オブジェクト
+		@param [in] fに対して適用したい引数。Movable可能でなければならない。
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+	*/
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&& ... args) ->
+        std::future<typename task_result<F, Args...>::type>
+    {
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef std::promise<result_t> promise_t;
+
+        promise_t promise;
+        auto future(promise.get_future());
+
+        task_ptr_t task =
+            make_task(std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+
+        bool arm = false;
+        std::uint64_t generation = 0;
+        {
+            std::unique_lock<std::mutex> lock(state_->mutex);
+            state_->tasks.push_back(std::move(task));
+
+            if(state_->tasks.size() >= state_->max_batch_size) {
+                state_->flush_locked();
+            } else if(state_->tasks.size() == 1 && max_delay_ != clock_type::duration::zero()) {
+                arm = true;
+                generation = state_->generation;
+            }
+        }
+
+        //! バッチごとに、最初のタスクを溜めた時に一回だけ期限を登録する
+        if(arm) {
+            shared_batch_flush_timer().arm(clock_type::now() + max_delay_, state_, generation);
+        }
+
+        return future;
+    }
+
+    //! 溜まっているタスクをタスクキューに積む
+    void flush()
+    {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        state_->flush_locked();
+    }
+
+    //! 溜まっているタスクの数を返す
+    size_t pending() const
+    {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        return state_->tasks.size();
+    }
+
+    size_t max_batch_size() const { return state_->max_batch_size; }
+    clock_type::duration max_delay() const { return max_delay_; }
+
+private:
+    //! まとめたタスクを順に実行する関数オブジェクト
+    /*!
+		各タスクの例外は、それぞれのstd::futureに設定されるので、ここまで伝播しない。
+	*/
+    struct run_batch
+    {
+        explicit
+        run_batch(std::vector<task_ptr_t> &&tasks)
+            :   tasks_(std::move(tasks))
+        {}
+
+        void operator()()
+        {
+            for(auto &task: tasks_) {
+                task->run();
+            }
+        }
+
+        std::vector<task_ptr_t> tasks_;
+    };
+
+    //! 溜めているタスクと、タイマーのスレッドと共有する状態
+    /*!
+		タイマーのスレッドはstd::weak_ptrで参照するので、batch_submitterが破棄された後に期限が来ることもある。
+		その場合、デストラクタでタスクは積まれていてtasksが空になっているので、タスクキューにはアクセスしない。
+	*/
+    struct state
+        :   batch_flush_target
+    {
+        state(task_queue_type &tq, size_t max_batch_size)
+            :   tq(tq)
+            ,   max_batch_size(max_batch_size)
+            ,   generation(0)
+        {
+            tasks.reserve(max_batch_size);
+        }
+
+        void on_deadline(std::uint64_t gen) override
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if(gen != generation) {
+                return;
+            }
+
+            try {
+                flush_locked();
+            } catch(...) {
+                //! タイマーのスレッドには例外を伝える先がない。
+                //! 積めなかったタスクは破棄され、それぞれのstd::futureにはbroken_promiseが設定される。
+            }
+        }
+
+        //! mutexをロックした状態で呼び出す
+        /*!
+			バッチを積む順序を保つため、タスクキューに積み終わるまでロックを保持する。
+		*/
+        void flush_locked()
+        {
+            if(tasks.empty()) {
+                return;
+            }
+
+            std::vector<task_ptr_t> batch;
+            batch.reserve(max_batch_size);
+            batch.swap(tasks);
+            ++generation;
+
+            tq.template emplace<run_batch>(std::move(batch));
+        }
+
+        task_queue_type &           tq;
+        size_t const                max_batch_size;
+        std::mutex mutable          mutex;
+        std::vector<task_ptr_t>     tasks;
+        //! タスクキューに積んだバッチの数。タイマーに登録した期限が、今のバッチのものかどうかを判定する
+        std::uint64_t               generation;
+    };
+
+    std::shared_ptr<state>      state_;
+    clock_type::duration const  max_delay_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::basic_batch_submitter;
+
+//! hwm::task_queueにタスクを積むbatch_submitter
+using batch_submitter = basic_batch_submitter<task_queue>;
+
+}   //namespace hwm
@@ -0,0 +1,84 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cstddef>
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! スレッドがブロッキング処理を開始／終了したことを受け取るインターフェース
+/*!
+	タスクキューは自分のスレッドでこのインターフェースを登録しておき、
+	blocking_scopeからの通知を受けて、補助スレッドを起動したり休止させたりする。
+*/
+struct blocking_listener
+{
+    virtual void enter_blocking() = 0;
+    virtual void leave_blocking() = 0;
+
+protected:
+    ~blocking_listener() {}
+};
+
+//! 現在のスレッドに登録されているblocking_listenerへの参照を返す
+/*!
+	タスクキューのスレッドでない場合はnullptrが登録されている。
+*/
+inline
+blocking_listener *& current_blocking_listener()
+{
+    static thread_local blocking_listener *listener = nullptr;
+    return listener;
+}
+
+//! blocking_scopeが入れ子になっている深さ
+inline
+size_t & current_blocking_depth()
+{
+    static thread_local size_t depth = 0;
+    return depth;
+}
+
+//! @class ブロッキング処理を行う範囲を表すクラス
+/*!
+	タスクの中でファイルI/Oや外部のロックの取得など、CPUを使わずに待機する処理を行う場合に、その前でこのクラスのオブジェクトを構築する。
+	オブジェクトが生存している間、タスクキューは補助スレッドを起動して、タスクを実行できるスレッドの数を保つ。
+	オブジェクトが破棄されると、補助スレッドは実行中のタスクを終えたあとで休止する。
+
+	タスクキューのスレッド以外で構築した場合は何もしない。
+	入れ子になっている場合は、最も外側のオブジェクトだけが通知を行う。
+*/
+struct blocking_scope
+{
+    blocking_scope()
+        :   listener_(current_blocking_listener())
+    {
+        if(listener_ && current_blocking_depth()++ == 0) {
+            listener_->enter_blocking();
+        }
+    }
+
+    ~blocking_scope()
+    {
+        if(listener_ && --current_blocking_depth() == 0) {
+            listener_->leave_blocking();
+        }
+    }
+
+    blocking_scope(blocking_scope const &) = delete;
+    blocking_scope & operator=(blocking_scope const &) = delete;
+
+private:
+    blocking_listener *listener_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::blocking_scope;
+
+}   //namespace hwm
@@ -0,0 +1,170 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "./task_base.hpp"
+#include "./task_queue_metrics.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! enqueue_with_deadline()で積まれたタスクが、期限までに開始されずに破棄されたことを表す例外
+/*!
+	破棄されたタスクとshared stateを共有するstd::futureに設定される。
+*/
+struct task_expired
+    :   std::runtime_error
+{
+    task_expired()
+        :   std::runtime_error("hwm::task_queue: the deadline of the task has passed before it started.")
+    {}
+};
+
+//! @class 期限の早い順にタスクを取り出すキュー
+/*!
+	std::mutexで保護した二分ヒープで、期限が同じタスクは積まれた順に取り出す。
+	取り出す時点で期限を過ぎているタスクは、実行せずに呼び出し元へ返す。
+	キューが空かどうかはロックを取らずに確認できる。
+*/
+struct deadline_queue
+{
+    typedef std::unique_ptr<task_base>      task_ptr_t;
+    typedef std::chrono::steady_clock       clock;
+
+    deadline_queue()
+        :   size_(0)
+        ,   next_sequence_(0)
+        ,   executed_(0)
+        ,   expired_(0)
+        ,   total_slack_ns_(0)
+        ,   min_slack_ns_((std::numeric_limits<std::int64_t>::max)())
+    {}
+
+    deadline_queue(deadline_queue const &) = delete;
+    deadline_queue & operator=(deadline_queue const &) = delete;
+
+    void push(clock::time_point deadline, task_ptr_t task)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        entry e;
+        e.deadline = deadline;
+        e.sequence = next_sequence_++;
+        e.task = std::move(task);
+
+        heap_.push_back(std::move(e));
+        std::push_heap(heap_.begin(), heap_.end(), later());
+        size_.store(heap_.size());
+    }
+
+    //! 期限が最も早いタスクを取り出す
+    /*!
+		nowの時点で期限を過ぎているタスクは、expiredに移す。
+		@return 実行するタスクを取り出した場合はtrue
+	*/
+    bool try_pop(clock::time_point now, task_ptr_t &task, std::vector<task_ptr_t> &expired)
+    {
+        if(empty()) {
+            return false;
+        }
+
+        clock::time_point deadline;
+        bool found = false;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            while(!heap_.empty()) {
+                std::pop_heap(heap_.begin(), heap_.end(), later());
+                entry e(std::move(heap_.back()));
+                heap_.pop_back();
+
+                if(e.deadline < now) {
+                    expired.push_back(std::move(e.task));
+                    continue;
+                }
+
+                task = std::move(e.task);
+                deadline = e.deadline;
+                found = true;
+                break;
+            }
+
+            size_.store(heap_.size());
+        }
+
+        expired_.fetch_add(expired.size(), std::memory_order_relaxed);
+
+        if(found) {
+            std::int64_t const slack =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+            executed_.fetch_add(1, std::memory_order_relaxed);
+            total_slack_ns_.fetch_add(slack, std::memory_order_relaxed);
+
+            std::int64_t min_slack = min_slack_ns_.load(std::memory_order_relaxed);
+            while(slack < min_slack && !min_slack_ns_.compare_exchange_weak(min_slack, slack, std::memory_order_relaxed)) {}
+        }
+
+        return found;
+    }
+
+    bool empty() const { return size_.load() == 0; }
+
+    size_t size() const { return size_.load(); }
+
+    //! 統計情報をmに設定する
+    void collect(task_queue_metrics &m) const
+    {
+        m.deadline.executed = executed_.load(std::memory_order_relaxed);
+        m.deadline.expired = expired_.load(std::memory_order_relaxed);
+        m.deadline.total_start_slack = std::chrono::nanoseconds(total_slack_ns_.load(std::memory_order_relaxed));
+        m.deadline.min_start_slack = std::chrono::nanoseconds(min_slack_ns_.load(std::memory_order_relaxed));
+    }
+
+private:
+    struct entry
+    {
+        clock::time_point   deadline;
+        std::uint64_t       sequence;
+        task_ptr_t          task;
+    };
+
+    //! std::push_heap()などで、期限の早いものが先頭に来るようにする比較関数
+    struct later
+    {
+        bool operator()(entry const &a, entry const &b) const
+        {
+            return a.deadline > b.deadline || (a.deadline == b.deadline && a.sequence > b.sequence);
+        }
+    };
+
+    std::mutex                  mutex_;
+    std::vector<entry>          heap_;
+    std::atomic<size_t>         size_;
+    std::uint64_t               next_sequence_;
+
+    std::atomic<std::uint64_t>  executed_;
+    std::atomic<std::uint64_t>  expired_;
+    std::atomic<std::int64_t>   total_slack_ns_;
+    std::atomic<std::int64_t>   min_slack_ns_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::task_expired;
+
+}   //namespace hwm
@@ -0,0 +1,263 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__linux__) && !defined(HWM_TASK_NO_FUTEX)
+    #define HWM_TASK_USE_FUTEX 1
+    #include <cerrno>
+    #include <ctime>
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#else
+    #include <condition_variable>
+    #include <mutex>
+#endif
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! @class イベントカウント
+/*!
+	条件が満たされるまでスレッドを休止させるための仕組み。
+	待機側は次の手順で待機する。
+		auto key = ec.prepare_wait();
+		if(条件が満たされている) { ec.cancel_wait(); }
+		else { ec.wait(key); }
+	通知側は、条件を満たす変更を行ってからnotify_one()またはnotify_all()を呼び出す。
+
+	待機しているスレッドがいない場合、通知は共有変数を一つ読むだけで終わり、ロックもシステムコールも行わない。
+	notify_one()は、待機しているスレッドを一つだけ起こす。
+	prepare_wait()に待機するスレッドの番号を指定した場合は、notify_waiter()でそのスレッドを起こせる。
+	Linuxではfutexを使用し、それ以外の環境ではstd::mutexとstd::condition_variableを使用する。
+	（HWM_TASK_NO_FUTEXを定義すると、Linuxでもfutexを使用しない）
+*/
+struct eventcount
+{
+    //! prepare_wait()が返す値
+    struct key_type
+    {
+        std::uint32_t   epoch;
+        //! futexで待機する時に指定するビット。notify_waiter()は、対象のスレッドのビットを持つスレッドだけを起こす
+        std::uint32_t   waiter_bit;
+    };
+
+    eventcount()
+        :   epoch_(0)
+        ,   waiters_(0)
+    {}
+
+    eventcount(eventcount const &) = delete;
+    eventcount & operator=(eventcount const &) = delete;
+
+    //! 待機の準備をする
+    /*!
+		この後で条件を確認し、満たされていればcancel_wait()を、満たされていなければwait()を呼び出す。
+	*/
+    key_type prepare_wait()
+    {
+        return prepare_wait_with_bit(any_waiter_bit);
+    }
+
+    //! 待機するスレッドの番号を指定して、待機の準備をする
+    /*!
+		@param waiter notify_waiter()でこのスレッドを起こすための番号
+	*/
+    key_type prepare_wait(std::uint32_t waiter)
+    {
+        return prepare_wait_with_bit(waiter_bit(waiter));
+    }
+
+    //! 待機を取りやめる
+    /*!
+		@return 待機の準備の間に行われた通知を、このスレッドが受け取っていた場合はtrue。
+		通知は実際に休止しているスレッドを起こすので、常にfalseを返す。
+	*/
+    bool cancel_wait()
+    {
+        waiters_.fetch_sub(1);
+        return false;
+    }
+
+    //! prepare_wait()以降に通知が行われるまで待機する
+    void wait(key_type key)
+    {
+#if defined(HWM_TASK_USE_FUTEX)
+        while(epoch_.load() == key.epoch) {
+            futex_wait(key, nullptr);
+        }
+#else
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this, key] { return epoch_.load() != key.epoch; });
+        }
+#endif
+        waiters_.fetch_sub(1);
+    }
+
+    //! prepare_wait()以降に通知が行われるか、指定時間が経過するまで待機する
+    /*!
+		@return 通知が行われた場合はtrue
+	*/
+    template<class Rep, class Period>
+    bool wait_for(key_type key, std::chrono::duration<Rep, Period> const &dur)
+    {
+        bool notified = false;
+
+#if defined(HWM_TASK_USE_FUTEX)
+        //! FUTEX_WAIT_BITSETのタイムアウトは、CLOCK_MONOTONICの絶対時刻で指定する
+        auto const rest = std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count();
+        timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += static_cast<time_t>(rest / 1000000000);
+        deadline.tv_nsec += static_cast<long>(rest % 1000000000);
+        if(deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        for( ; ; ) {
+            if(epoch_.load() != key.epoch) {
+                notified = true;
+                break;
+            }
+
+            if(futex_wait(key, &deadline) == ETIMEDOUT) {
+                notified = epoch_.load() != key.epoch;
+                break;
+            }
+        }
+#else
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notified = cond_.wait_for(lock, dur, [this, key] { return epoch_.load() != key.epoch; });
+        }
+#endif
+        waiters_.fetch_sub(1);
+        return notified;
+    }
+
+    //! 待機しているスレッドを一つ起こす
+    void notify_one()
+    {
+        notify(1, any_waiter_bit);
+    }
+
+    //! 待機しているスレッドをすべて起こす
+    void notify_all()
+    {
+        notify(INT_MAX_VALUE, any_waiter_bit);
+    }
+
+    //! prepare_wait()に番号を指定して待機しているスレッドのうち、waiterのスレッドを起こす
+    /*!
+		futexのビットは32個なので、番号を32で割った余りが等しいスレッドも一緒に起こされる。
+		待機しているスレッドが32個以下で、番号がそれぞれ異なる場合は、waiterのスレッドだけが起こされる。
+		futexを使用しない環境では、待機しているスレッドをすべて起こす。
+	*/
+    void notify_waiter(std::uint32_t waiter)
+    {
+#if defined(HWM_TASK_USE_FUTEX)
+        notify(INT_MAX_VALUE, waiter_bit(waiter));
+#else
+        (void)waiter;
+        notify(INT_MAX_VALUE, any_waiter_bit);
+#endif
+    }
+
+    //! 待機している（または待機の準備をしている）スレッドがいるかどうか
+    bool has_waiters() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return waiters_.load() != 0;
+    }
+
+    //! 待機している（または待機の準備をしている）スレッドの数
+    std::uint32_t num_waiters() const
+    {
+        return waiters_.load();
+    }
+
+private:
+    static int const INT_MAX_VALUE = 0x7fffffff;
+
+    //! 番号を指定せずに待機するスレッドのビット。どのnotify_waiter()でも起こされる
+    static std::uint32_t const any_waiter_bit = 0xffffffff;
+
+    static std::uint32_t waiter_bit(std::uint32_t waiter)
+    {
+        return std::uint32_t(1) << (waiter % 32);
+    }
+
+    key_type prepare_wait_with_bit(std::uint32_t bit)
+    {
+        waiters_.fetch_add(1);
+        key_type const key = { epoch_.load(), bit };
+        return key;
+    }
+
+    //! @param bits 起こすスレッドのビット。any_waiter_bitの場合はすべてのスレッドが対象になる
+    void notify(int count, std::uint32_t bits)
+    {
+        //! 呼び出し元が条件を満たす変更を行ってからwaiters_を読む。
+        //! 待機側はwaiters_を加算してから条件を確認するので、どちらかが必ず相手の変更に気づく。
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters_.load() == 0) {
+            return;
+        }
+
+#if defined(HWM_TASK_USE_FUTEX)
+        epoch_.fetch_add(1);
+        futex_wake(count, bits);
+#else
+        (void)bits;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            epoch_.fetch_add(1);
+        }
+
+        if(count == 1) {
+            cond_.notify_one();
+        } else {
+            cond_.notify_all();
+        }
+#endif
+    }
+
+#if defined(HWM_TASK_USE_FUTEX)
+    //! @return タイムアウトした場合はETIMEDOUT
+    int futex_wait(key_type key, timespec const *deadline)
+    {
+        long const r = syscall(
+            SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch_), FUTEX_WAIT_BITSET_PRIVATE,
+            key.epoch, deadline, nullptr, key.waiter_bit);
+        return r == 0 ? 0 : errno;
+    }
+
+    void futex_wake(int count, std::uint32_t bits)
+    {
+        syscall(
+            SYS_futex, reinterpret_cast<std::uint32_t *>(&epoch_), FUTEX_WAKE_BITSET_PRIVATE,
+            count, nullptr, nullptr, bits);
+    }
+#else
+    std::mutex              mutex_;
+    std::condition_variable cond_;
+#endif
+
+    std::atomic<std::uint32_t>  epoch_;
+    std::atomic<std::uint32_t>  waiters_;
+};
+
+}}  //namespace detail::ns_task
+
+}   //namespace hwm
@@ -0,0 +1,405 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "./task_queue.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! テナントの統計情報
+struct tenant_metrics
+{
+    typedef std::chrono::nanoseconds duration;
+
+    //! 待ち時間のヒストグラムの区間数。i番目の区間には、待ち時間が[2^(i-1), 2^i)ナノ秒のタスクの数を数える。
+    static size_t const num_buckets = 64;
+
+    tenant_metrics()
+        :   enqueued(0)
+        ,   started(0)
+        ,   pending(0)
+        ,   total_wait(0)
+        ,   max_wait(0)
+    {
+        wait_histogram.fill(0);
+    }
+
+    //! enqueue()されたタスクの数
+    size_t      enqueued;
+    //! 実行が開始されたタスクの数
+    size_t      started;
+    //! 実行を待っているタスクの数
+    size_t      pending;
+    //! enqueue()されてから実行が開始されるまでの時間の合計
+    duration    total_wait;
+    //! enqueue()されてから実行が開始されるまでの時間の最大値
+    duration    max_wait;
+    //! enqueue()されてから実行が開始されるまでの時間のヒストグラム
+    std::array<size_t, num_buckets> wait_histogram;
+
+    //! 待ち時間の平均を返す
+    duration mean_wait() const
+    {
+        return started == 0 ? duration(0) : duration(total_wait.count() / static_cast<duration::rep>(started));
+    }
+
+    //! 待ち時間のパーセンタイル値（の上限の目安）を返す
+    /*!
+		ヒストグラムから求めるので、実際の値以上で、2倍未満の値が返る。
+		@param [in] ratio 0より大きく1以下の値。例えば0.99を指定すると99パーセンタイル値を返す。
+	*/
+    duration wait_percentile(double ratio) const
+    {
+        if(started == 0) {
+            return duration(0);
+        }
+
+        size_t const threshold = static_cast<size_t>(std::ceil(started * ratio));
+        size_t count = 0;
+        for(size_t i = 0; i < num_buckets; ++i) {
+            count += wait_histogram[i];
+            if(count >= threshold) {
+                return (std::min)(
+                    max_wait,
+                    duration(i == 0 ? 0 : (i >= 63 ? (std::numeric_limits<duration::rep>::max)() : (duration::rep(1) << i) - 1)));
+            }
+        }
+        return max_wait;
+    }
+};
+
+//! @class 複数のテナントの間で、タスクキューのスレッドを重みに応じて公平に分け合うクラス
+/*!
+	make_tenant()で作成したテナントごとにキューを持ち、テナントに積まれたタスクを
+	Deficit Round Robinで選んで、タスクキューのスレッドで実行する。
+	各テナントは、一巡するごとに重みと同じ数だけタスクを実行できる。
+	そのため、一つのテナントが大量のタスクを積んでも、他のテナントのタスクは
+	そのテナントのタスクがすべて実行されるのを待たずに、重みに応じた割合で実行される。
+	次に実行するタスクの選択は、テナントの数によらず定数時間で行われる。
+
+	テナントにタスクが積まれるたびに、「次に実行すべきタスクを一つ選んで実行する」タスクをタスクキューに一つ積む。
+	実際に実行されるタスクは、その時点で選ばれたテナントのものになる。
+
+	@tparam TaskQueue タスクを実行するタスクキューの型
+*/
+template<class TaskQueue>
+struct basic_fair_scheduler
+{
+    typedef TaskQueue						task_queue_type;
+    typedef std::unique_ptr<task_base>		task_ptr_t;
+    typedef std::chrono::steady_clock		clock_type;
+
+private:
+    struct tenant_state
+    {
+        tenant_state(size_t weight, size_t queue_limit)
+            :   weight(weight)
+            ,   queue_limit(queue_limit)
+            ,   deficit(0)
+            ,   active(false)
+        {}
+
+        struct entry
+        {
+            task_ptr_t              task;
+            clock_type::time_point  enqueued_time;
+        };
+
+        size_t                      weight;
+        size_t const                queue_limit;
+        //! 今回の巡回で、あといくつタスクを実行できるか
+        size_t                      deficit;
+        //! 巡回の対象になっているかどうか
+        bool                        active;
+        std::deque<entry>           tasks;
+        std::condition_variable     c_enq;
+        tenant_metrics              metrics;
+    };
+
+    struct impl;
+
+public:
+    //! @class テナント
+    /*!
+		basic_fair_scheduler::make_tenant()で作成する。ムーブのみ可能。
+		テナントを破棄しても、積まれたままのタスクは実行される。
+	*/
+    struct tenant
+    {
+        tenant()
+        {}
+
+        tenant(tenant &&rhs)
+            :   impl_(std::move(rhs.impl_))
+            ,   state_(std::move(rhs.state_))
+        {}
+
+        tenant & operator=(tenant &&rhs)
+        {
+            impl_ = std::move(rhs.impl_);
+            state_ = std::move(rhs.state_);
+            return *this;
+        }
+
+        //! テナントに新たなタスクを追加
+        /*!
+			テナントのキューがqueue_limitまで埋まっている場合は、空くまで処理をブロックする。
+			@param [in] f 実行したい関数や関数オブジェクト
+			@param [in] fに対して適用したい引数。Movable可能でなければならない。
+			@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+			@exception タスクキューのenqueue()が送出した例外。その場合、タスクはテナントのキューから取り除かれる。
+		*/
+        template<class F, class... Args>
+        auto enqueue(F&& f, Args&& ... args) ->
+            std::future<typename task_result<F, Args...>::type>
+        {
+            assert(impl_);
+
+            typedef typename task_result<F, Args...>::type result_t;
+            typedef std::promise<result_t> promise_t;
+
+            promise_t promise;
+            auto future(promise.get_future());
+
+            impl_->push(
+                state_,
+                make_task(
+                    std::move(promise), std::forward<F>(f), std::forward<Args>(args)...));
+
+            return future;
+        }
+
+        //! テナントの重みを返す
+        size_t weight() const
+        {
+            std::lock_guard<std::mutex> lock(impl_->mutex_);
+            return state_->weight;
+        }
+
+        //! テナントの重みを変更する。次の巡回から反映される。
+        void set_weight(size_t weight)
+        {
+            assert(weight >= 1);
+            std::lock_guard<std::mutex> lock(impl_->mutex_);
+            state_->weight = weight;
+        }
+
+        //! テナントの統計情報を返す
+        tenant_metrics metrics() const
+        {
+            std::lock_guard<std::mutex> lock(impl_->mutex_);
+            tenant_metrics m = state_->metrics;
+            m.pending = state_->tasks.size();
+            return m;
+        }
+
+    private:
+        friend struct basic_fair_scheduler;
+
+        tenant(std::shared_ptr<impl> i, std::shared_ptr<tenant_state> s)
+            :   impl_(std::move(i))
+            ,   state_(std::move(s))
+        {}
+
+        std::shared_ptr<impl>           impl_;
+        std::shared_ptr<tenant_state>   state_;
+    };
+
+    //! コンストラクタ
+    /*!
+		@param tq [in] タスクを実行するタスクキュー。積まれたタスクがすべて実行されるまで破棄してはならない。
+	*/
+    explicit
+    basic_fair_scheduler(task_queue_type &tq)
+        :   impl_(std::make_shared<impl>(tq))
+    {}
+
+    basic_fair_scheduler(basic_fair_scheduler const &) = delete;
+    basic_fair_scheduler & operator=(basic_fair_scheduler const &) = delete;
+
+    //! テナントを作成する
+    /*!
+		@param weight [in] テナントの重み。一巡するごとに、この数だけタスクを実行する。1以上でなければならない。
+		@param queue_limit [in] テナントのキューに同時に積めるタスク数の上限
+	*/
+    tenant make_tenant(size_t weight = 1, size_t queue_limit = (std::numeric_limits<size_t>::max)())
+    {
+        assert(weight >= 1);
+        assert(queue_limit >= 1);
+        return tenant(impl_, std::make_shared<tenant_state>(weight, queue_limit));
+    }
+
+private:
+    //! タスクキューのスレッドで実行されている間も生存していなければならない部分
+    struct impl
+        :   std::enable_shared_from_this<impl>
+    {
+        explicit
+        impl(task_queue_type &tq)
+            :   tq_(tq)
+        {}
+
+        void push(std::shared_ptr<tenant_state> const &t, task_ptr_t task)
+        {
+            task_base *const pushed = task.get();
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                t->c_enq.wait(lock, [&t] { return t->tasks.size() < t->queue_limit; });
+
+                typename tenant_state::entry e;
+                e.task = std::move(task);
+                e.enqueued_time = clock_type::now();
+                t->tasks.push_back(std::move(e));
+                t->metrics.enqueued += 1;
+
+                if(!t->active) {
+                    t->active = true;
+                    t->deficit = 0;
+                    active_.push_back(t);
+                }
+            }
+
+            std::shared_ptr<impl> self = this->shared_from_this();
+            try {
+                tq_.enqueue([self] { self->run_one(); });
+            } catch(...) {
+                if(cancel(t, pushed)) {
+                    throw;
+                }
+
+                //! 追加したタスクは、他のpush()が積んだrun_one()ですでに取り出されている。
+                //! 代わりにrun_one()のないタスクが一つ残っているので、このスレッドで実行する。
+                run_one();
+            }
+        }
+
+        //! タスクキューに追加できなかったタスクを、テナントのキューから取り除く
+        /*!
+			push()一回につきrun_one()が一回呼ばれるように、積まれなかったrun_one()の分のタスクを取り除く。
+			@return タスクを取り除いた場合はtrue。すでに取り出されていた場合はfalse
+		*/
+        bool cancel(std::shared_ptr<tenant_state> const &t, task_base *pushed)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            auto const found = std::find_if(t->tasks.begin(), t->tasks.end(), [pushed](typename tenant_state::entry const &e) {
+                return e.task.get() == pushed;
+            });
+            if(found == t->tasks.end()) {
+                return false;
+            }
+
+            t->tasks.erase(found);
+            t->metrics.enqueued -= 1;
+
+            if(t->tasks.empty()) {
+                t->active = false;
+                t->deficit = 0;
+                active_.erase(std::find(active_.begin(), active_.end(), t));
+            }
+
+            if(t->queue_limit != (std::numeric_limits<size_t>::max)()) {
+                t->c_enq.notify_one();
+            }
+
+            return true;
+        }
+
+        //! Deficit Round Robinで次に実行するタスクを一つ選んで実行する
+        void run_one()
+        {
+            task_ptr_t task;
+            std::shared_ptr<tenant_state> t;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+
+                //! push()一回につきrun_one()が一回呼ばれるので、ここでは必ずタスクが存在する
+                assert(!active_.empty());
+
+                t = active_.front();
+                if(t->deficit == 0) {
+                    t->deficit = t->weight;
+                }
+
+                auto &e = t->tasks.front();
+                task = std::move(e.task);
+
+                auto const wait =
+                    std::chrono::duration_cast<tenant_metrics::duration>(clock_type::now() - e.enqueued_time);
+                record_wait(t->metrics, wait);
+
+                t->tasks.pop_front();
+                t->deficit -= 1;
+
+                if(t->tasks.empty()) {
+                    t->active = false;
+                    t->deficit = 0;
+                    active_.pop_front();
+                } else if(t->deficit == 0) {
+                    //! 今回の巡回で実行できる数を使い切ったので、末尾に回す
+                    active_.pop_front();
+                    active_.push_back(t);
+                }
+
+                if(t->queue_limit != (std::numeric_limits<size_t>::max)()) {
+                    t->c_enq.notify_one();
+                }
+            }
+
+            task->run();
+        }
+
+        static void record_wait(tenant_metrics &m, tenant_metrics::duration wait)
+        {
+            m.started += 1;
+            m.total_wait += wait;
+            if(wait > m.max_wait) {
+                m.max_wait = wait;
+            }
+
+            //! 待ち時間のビット数を区間の番号にする
+            size_t bucket = 0;
+            for(auto n = wait.count(); n > 0 && bucket + 1 < tenant_metrics::num_buckets; n >>= 1) {
+                ++bucket;
+            }
+            m.wait_histogram[bucket] += 1;
+        }
+
+        task_queue_type &                           tq_;
+        std::mutex mutable                          mutex_;
+        //! キューにタスクが積まれているテナント
+        std::deque<std::shared_ptr<tenant_state>>   active_;
+    };
+
+    std::shared_ptr<impl>   impl_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::tenant_metrics;
+using detail::ns_task::basic_fair_scheduler;
+
+//! hwm::task_queueのスレッドでタスクを実行するfair_scheduler
+using fair_scheduler = basic_fair_scheduler<task_queue>;
+
+}   //namespace hwm
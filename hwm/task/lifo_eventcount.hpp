@@ -0,0 +1,294 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+#include "./eventcount.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! lifo_eventcountで待機するスレッドごとの状態
+/*!
+	スレッドは同時に一つのイベントでしか待機しないので、スレッドごとに一つだけ用意して使い回す。
+*/
+struct lifo_waiter
+{
+    lifo_waiter()
+        :   notified(0)
+        ,   id(any_id())
+    {}
+
+    //! prepare_wait()に番号を指定しなかった場合のid
+    static std::uint32_t any_id() { return (std::numeric_limits<std::uint32_t>::max)(); }
+
+    //! 通知されたら1になる。Linuxではこの変数でfutexを使って休止する
+    std::atomic<std::uint32_t>  notified;
+    //! prepare_wait()で指定された、notify_waiter()で起こすための番号
+    std::uint32_t               id;
+#if !defined(HWM_TASK_USE_FUTEX)
+    std::mutex                  mutex;
+    std::condition_variable     cond;
+#endif
+};
+
+inline
+lifo_waiter & current_lifo_waiter()
+{
+    static thread_local lifo_waiter waiter;
+    return waiter;
+}
+
+//! @class 最後に待機を始めたスレッドから順に起こすイベントカウント
+/*!
+	eventcountと同じインターフェースを持つ。
+	eventcountのnotify_one()は待機しているスレッドのうちどれを起こすかをOSに任せるので、
+	長い間休止していて、キャッシュが冷えたコアにいるスレッドが起こされることがある。
+	このクラスは待機しているスレッドをスタックで管理し、notify_one()では最も最近待機を始めたスレッドを起こす。
+	負荷が低い間は少数のスレッドだけがタスクを実行し続け、残りのスレッドはスタックの底で休止したままになる。
+
+	待機しているスレッドがいない場合、通知は共有変数を一つ読むだけで終わる。
+	いる場合は、スタックを保護するstd::mutexをロックして、起こすスレッドを取り出す。
+*/
+struct lifo_eventcount
+{
+    typedef lifo_waiter * key_type;
+
+    lifo_eventcount()
+        :   waiters_(0)
+    {}
+
+    lifo_eventcount(lifo_eventcount const &) = delete;
+    lifo_eventcount & operator=(lifo_eventcount const &) = delete;
+
+    //! 待機の準備をする
+    /*!
+		この後で条件を確認し、満たされていればcancel_wait()を、満たされていなければwait()を呼び出す。
+	*/
+    key_type prepare_wait()
+    {
+        return prepare_wait(lifo_waiter::any_id());
+    }
+
+    //! 待機するスレッドの番号を指定して、待機の準備をする
+    /*!
+		@param waiter notify_waiter()でこのスレッドを起こすための番号
+	*/
+    key_type prepare_wait(std::uint32_t waiter)
+    {
+        lifo_waiter &w = current_lifo_waiter();
+        w.notified.store(0);
+        w.id = waiter;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stack_.push_back(&w);
+            waiters_.fetch_add(1);
+        }
+
+        return &w;
+    }
+
+    //! 待機を取りやめる
+    /*!
+		すでに通知によってスタックから取り出されていた場合、その通知はこのスレッドが受け取ったものとして扱う。
+		@return 通知を受け取っていた場合はtrue。ほかのスレッドは起こされていない。
+	*/
+    bool cancel_wait()
+    {
+        return !remove(&current_lifo_waiter());
+    }
+
+    //! prepare_wait()以降に通知が行われるまで待機する
+    void wait(key_type key)
+    {
+        assert(key == &current_lifo_waiter());
+
+#if defined(HWM_TASK_USE_FUTEX)
+        while(key->notified.load() == 0) {
+            futex_wait(key, nullptr);
+        }
+#else
+        std::unique_lock<std::mutex> lock(key->mutex);
+        key->cond.wait(lock, [key] { return key->notified.load() != 0; });
+#endif
+    }
+
+    //! prepare_wait()以降に通知が行われるか、指定時間が経過するまで待機する
+    /*!
+		@return 通知が行われた場合はtrue
+	*/
+    template<class Rep, class Period>
+    bool wait_for(key_type key, std::chrono::duration<Rep, Period> const &dur)
+    {
+        assert(key == &current_lifo_waiter());
+
+#if defined(HWM_TASK_USE_FUTEX)
+        auto const deadline = std::chrono::steady_clock::now() + dur;
+        for( ; ; ) {
+            if(key->notified.load() != 0) {
+                return true;
+            }
+
+            auto const now = std::chrono::steady_clock::now();
+            if(now >= deadline) {
+                break;
+            }
+
+            auto const rest = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+            timespec ts;
+            ts.tv_sec = static_cast<time_t>(rest / 1000000000);
+            ts.tv_nsec = static_cast<long>(rest % 1000000000);
+            futex_wait(key, &ts);
+        }
+#else
+        {
+            std::unique_lock<std::mutex> lock(key->mutex);
+            if(key->cond.wait_for(lock, dur, [key] { return key->notified.load() != 0; })) {
+                return true;
+            }
+        }
+#endif
+
+        //! スタックから取り除く前に通知されていた場合は、通知を受け取ったものとする
+        return !remove(key);
+    }
+
+    //! 最も最近待機を始めたスレッドを一つ起こす
+    void notify_one()
+    {
+        notify(1);
+    }
+
+    //! 待機しているスレッドをすべて起こす
+    void notify_all()
+    {
+        notify((std::numeric_limits<size_t>::max)());
+    }
+
+    //! prepare_wait()にwaiterを指定して待機しているスレッドを起こす
+    /*!
+		スタックの中での位置によらず、そのスレッドだけを起こす。待機していない場合は何もしない。
+	*/
+    void notify_waiter(std::uint32_t waiter)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters_.load() == 0) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto const found = std::find_if(stack_.rbegin(), stack_.rend(), [waiter](lifo_waiter const *w) {
+            return w->id == waiter;
+        });
+        if(found == stack_.rend()) {
+            return;
+        }
+
+        lifo_waiter *w = *found;
+        stack_.erase(std::next(found).base());
+        waiters_.fetch_sub(1);
+        wake(w);
+    }
+
+    //! 待機している（または待機の準備をしている）スレッドがいるかどうか
+    bool has_waiters() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return waiters_.load() != 0;
+    }
+
+    //! 待機している（または待機の準備をしている）スレッドの数
+    std::uint32_t num_waiters() const
+    {
+        return waiters_.load();
+    }
+
+private:
+    //! スタックからwを取り除く
+    /*!
+		@return wがスタックに残っていた場合はtrue。通知によってすでに取り出されていた場合はfalse
+	*/
+    bool remove(lifo_waiter *w)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        //! 待機を取りやめるのは待機の準備をした直後なので、たいていはスタックの一番上にある
+        auto const found = std::find(stack_.rbegin(), stack_.rend(), w);
+        if(found == stack_.rend()) {
+            return false;
+        }
+
+        stack_.erase(std::next(found).base());
+        waiters_.fetch_sub(1);
+        return true;
+    }
+
+    void notify(size_t count)
+    {
+        //! 呼び出し元が条件を満たす変更を行ってからwaiters_を読む。
+        //! 待機側はスタックに積んでから条件を確認するので、どちらかが必ず相手の変更に気づく。
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters_.load() == 0) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        for( ; count != 0 && !stack_.empty(); --count) {
+            lifo_waiter *w = stack_.back();
+            stack_.pop_back();
+            waiters_.fetch_sub(1);
+            wake(w);
+        }
+    }
+
+    //! notifiedを設定した後は、wのスレッドが待機を終えて次の待機を始めていることがある。
+    //! futexの場合は余分に起こすだけで、待機側はnotifiedを確認し直す。
+    void wake(lifo_waiter *w)
+    {
+#if defined(HWM_TASK_USE_FUTEX)
+        w->notified.store(1);
+        futex_wake(w);
+#else
+        std::unique_lock<std::mutex> lock(w->mutex);
+        w->notified.store(1);
+        w->cond.notify_one();
+#endif
+    }
+
+#if defined(HWM_TASK_USE_FUTEX)
+    static void futex_wait(lifo_waiter *w, timespec const *timeout)
+    {
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&w->notified), FUTEX_WAIT_PRIVATE, 0, timeout, nullptr, 0);
+    }
+
+    static void futex_wake(lifo_waiter *w)
+    {
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&w->notified), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+#endif
+
+    std::mutex                  mutex_;
+    //! 待機しているスレッド。末尾が最も最近待機を始めたスレッド
+    std::vector<lifo_waiter *>  stack_;
+    std::atomic<std::uint32_t>  waiters_;
+};
+
+}}  //namespace detail::ns_task
+
+}   //namespace hwm
@@ -0,0 +1,361 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "./eventcount.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! std::future_errc::broken_promiseを表すstd::future_errorを作成する
+/*!
+	C++11ではstd::future_errorをエラーコードから構築できないので、std::promiseを破棄して作成する。
+*/
+inline
+std::exception_ptr make_broken_promise()
+{
+    std::future<void> f;
+    {
+        std::promise<void> p;
+        f = p.get_future();
+    }
+
+    try {
+        f.get();
+    } catch(...) {
+        return std::current_exception();
+    }
+    return nullptr;
+}
+
+//! light_promiseとlight_futureが共有する状態のうち、値の型によらない部分
+/*!
+	準備完了かどうかを一つのatomicな変数で表し、待機にはeventcountを使用する。
+	std::futureのshared stateと違って、std::mutexやstd::condition_variableを持たない。
+*/
+struct light_state_base
+{
+    light_state_base()
+        :   ready_(false)
+    {}
+
+    light_state_base(light_state_base const &) = delete;
+    light_state_base & operator=(light_state_base const &) = delete;
+
+    bool is_ready() const { return ready_.load(std::memory_order_acquire); }
+
+    void wait()
+    {
+        while(!is_ready()) {
+            auto const key = event_.prepare_wait();
+            if(is_ready()) {
+                event_.cancel_wait();
+                return;
+            }
+            event_.wait(key);
+        }
+    }
+
+    template<class Rep, class Period>
+    bool wait_for(std::chrono::duration<Rep, Period> const &dur)
+    {
+        auto const deadline = std::chrono::steady_clock::now() + dur;
+        while(!is_ready()) {
+            auto const now = std::chrono::steady_clock::now();
+            if(now >= deadline) {
+                return false;
+            }
+
+            auto const key = event_.prepare_wait();
+            if(is_ready()) {
+                event_.cancel_wait();
+                return true;
+            }
+            event_.wait_for(key, deadline - now);
+        }
+        return true;
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+        error_ = e;
+        make_ready();
+    }
+
+protected:
+    void make_ready()
+    {
+        assert(!is_ready());
+        ready_.store(true, std::memory_order_release);
+        event_.notify_all();
+    }
+
+    void rethrow_if_failed() const
+    {
+        if(error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    std::atomic<bool>   ready_;
+    eventcount          event_;
+    std::exception_ptr  error_;
+};
+
+template<class R>
+struct light_state
+    :   light_state_base
+{
+    light_state()
+        :   has_value_(false)
+    {}
+
+    ~light_state()
+    {
+        if(has_value_) {
+            value_ptr()->~R();
+        }
+    }
+
+    template<class U>
+    void set_value(U &&value)
+    {
+        new(&storage_) R(std::forward<U>(value));
+        has_value_ = true;
+        make_ready();
+    }
+
+    R get()
+    {
+        wait();
+        rethrow_if_failed();
+        return std::move(*value_ptr());
+    }
+
+private:
+    R * value_ptr() { return reinterpret_cast<R *>(&storage_); }
+
+    typename std::aligned_storage<sizeof(R), std::alignment_of<R>::value>::type storage_;
+    bool    has_value_;
+};
+
+template<class R>
+struct light_state<R &>
+    :   light_state_base
+{
+    light_state()
+        :   value_(nullptr)
+    {}
+
+    void set_value(R &value)
+    {
+        value_ = &value;
+        make_ready();
+    }
+
+    R & get()
+    {
+        wait();
+        rethrow_if_failed();
+        return *value_;
+    }
+
+private:
+    R *     value_;
+};
+
+template<>
+struct light_state<void>
+    :   light_state_base
+{
+    void set_value()
+    {
+        make_ready();
+    }
+
+    void get()
+    {
+        wait();
+        rethrow_if_failed();
+    }
+};
+
+//! @class 軽量なfuture
+/*!
+	light_promiseから取得する。get()、wait()、wait_for()はstd::futureと同じように使える。
+	std::futureと違って、shared stateはstd::mutexとstd::condition_variableを持たず、
+	準備完了の確認はatomicな変数の読み込み一回で行われる。
+	std::shared_futureに相当するものや、then()のような継続は提供しない。
+*/
+template<class R>
+struct light_future
+{
+    light_future() {}
+
+    explicit
+    light_future(std::shared_ptr<light_state<R>> state)
+        :   state_(std::move(state))
+    {}
+
+    light_future(light_future &&rhs)
+        :   state_(std::move(rhs.state_))
+    {}
+
+    light_future & operator=(light_future &&rhs)
+    {
+        state_ = std::move(rhs.state_);
+        return *this;
+    }
+
+    light_future(light_future const &) = delete;
+    light_future & operator=(light_future const &) = delete;
+
+    //! 有効なshared stateを参照しているかどうか
+    bool valid() const { return static_cast<bool>(state_); }
+
+    //! 結果が準備完了になっているかどうか
+    bool is_ready() const
+    {
+        assert(valid());
+        return state_->is_ready();
+    }
+
+    //! 結果が準備完了になるまで待機する
+    void wait() const
+    {
+        assert(valid());
+        state_->wait();
+    }
+
+    //! 指定時間内で、結果が準備完了になるまで待機する
+    template<class Rep, class Period>
+    std::future_status wait_for(std::chrono::duration<Rep, Period> const &dur) const
+    {
+        assert(valid());
+        return state_->wait_for(dur) ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    //! 結果を取得する
+    /*!
+		結果が準備完了になるまで待機し、値を返すか、設定された例外を送出する。
+		呼び出した後、このオブジェクトは無効になる。
+	*/
+    R get()
+    {
+        assert(valid());
+        std::shared_ptr<light_state<R>> state(std::move(state_));
+        return state->get();
+    }
+
+private:
+    std::shared_ptr<light_state<R>> state_;
+};
+
+//! @class light_futureに結果を設定するpromise
+/*!
+	結果を設定せずに破棄した場合は、std::promiseと同じく、
+	std::future_errc::broken_promiseを表すstd::future_errorが設定される。
+*/
+template<class R>
+struct light_promise
+{
+    light_promise()
+        :   state_(std::make_shared<light_state<R>>())
+        ,   satisfied_(false)
+    {}
+
+    light_promise(light_promise &&rhs)
+        :   state_(std::move(rhs.state_))
+        ,   satisfied_(rhs.satisfied_)
+    {}
+
+    light_promise & operator=(light_promise &&rhs)
+    {
+        abandon();
+        state_ = std::move(rhs.state_);
+        satisfied_ = rhs.satisfied_;
+        return *this;
+    }
+
+    light_promise(light_promise const &) = delete;
+    light_promise & operator=(light_promise const &) = delete;
+
+    ~light_promise()
+    {
+        abandon();
+    }
+
+    light_future<R> get_future()
+    {
+        assert(state_);
+        return light_future<R>(state_);
+    }
+
+    template<class... Args>
+    void set_value(Args&&... args)
+    {
+        assert(state_ && !satisfied_);
+        satisfied_ = true;
+        state_->set_value(std::forward<Args>(args)...);
+    }
+
+    void set_exception(std::exception_ptr e)
+    {
+        assert(state_ && !satisfied_);
+        satisfied_ = true;
+        state_->set_exception(e);
+    }
+
+private:
+    void abandon()
+    {
+        if(state_ && !satisfied_) {
+            state_->set_exception(make_broken_promise());
+        }
+        state_.reset();
+    }
+
+    std::shared_ptr<light_state<R>> state_;
+    bool    satisfied_;
+};
+
+//! 結果を受け取らない場合に、enqueue()が返す型
+struct no_future {};
+
+//! 結果を捨てるpromise
+/*!
+	タスクが送出した例外も捨てられる。
+*/
+template<class R>
+struct null_promise
+{
+    no_future get_future() { return no_future(); }
+
+    template<class... Args>
+    void set_value(Args&&...) {}
+
+    void set_exception(std::exception_ptr) {}
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::light_future;
+using detail::ns_task::light_promise;
+using detail::ns_task::no_future;
+
+}   //namespace hwm
@@ -23,6 +23,8 @@ struct locked_queue
     //! デフォルトコンストラクタ
     locked_queue()
         :   capacity((std::numeric_limits<size_t>::max)())
+        ,   enq_waiters(0)
+        ,   deq_waiters(0)
     {}
 
     //! コンストラクタ
@@ -32,6 +34,8 @@ struct locked_queue
     explicit
     locked_queue(size_t capacity)
         :   capacity(capacity)
+        ,   enq_waiters(0)
+        ,   deq_waiters(0)
     {}
 
     //! @brief キューに要素を追加する。
@@ -42,9 +46,13 @@ struct locked_queue
 	*/
     void enqueue(T x) {
         std::unique_lock<std::mutex> lock(m);
-        c_enq.wait(lock, [this] { return data.size() != capacity; });
+        if(data.size() == capacity) {
+            ++enq_waiters;
+            c_enq.wait(lock, [this] { return data.size() != capacity; });
+            --enq_waiters;
+        }
         data.push(std::move(x));
-        c_deq.notify_one();
+        notify_dequeuer();
     }
 
 	//! キューの先頭から要素の取り出しを試行
@@ -59,7 +67,7 @@ struct locked_queue
 		if(!data.empty()) {
 			t = std::move(data.front());
 			data.pop();
-			c_enq.notify_one();
+			notify_enqueuer();
 			return true;
 		} else {
 			return false;
@@ -74,13 +82,15 @@ struct locked_queue
     bool try_dequeue_until(T &t, TimePoint tp)
     {
         std::unique_lock<std::mutex> lock(m);
+        ++deq_waiters;
         bool const succeeded = 
             c_deq.wait_until(lock, tp, [this] { return !data.empty(); });
+        --deq_waiters;
 
         if(succeeded) {
             t = std::move(data.front());
             data.pop();
-            c_enq.notify_one();
+            notify_enqueuer();
         }
 
         return succeeded;
@@ -102,21 +112,55 @@ struct locked_queue
     //! @detail キューが空の場合は、要素が取得できるまで処理をブロックする。
     T dequeue() {
         std::unique_lock<std::mutex> lock(m);
-        c_deq.wait(lock, [this] { return !data.empty(); });
+        if(data.empty()) {
+            ++deq_waiters;
+            c_deq.wait(lock, [this] { return !data.empty(); });
+            --deq_waiters;
+        }
 
         T ret = std::move(data.front());
         data.pop();
-        c_enq.notify_one();
+        notify_enqueuer();
 
 		return std::move(ret);
     }
 
+    //! キューに積まれている要素数を返す
+    size_t size() const
+    {
+        std::unique_lock<std::mutex> lock(m);
+        return data.size();
+    }
+
+    //! キューが空かどうかを返す
+    bool empty() const
+    {
+        std::unique_lock<std::mutex> lock(m);
+        return data.empty();
+    }
+
+private:
+    //! 以下の2つの関数は、mをロックした状態で呼び出す。
+    //! 待機しているスレッドがいない場合は、条件変数への通知を行わない。
+    void notify_enqueuer()
+    {
+        if(enq_waiters != 0) { c_enq.notify_one(); }
+    }
+
+    void notify_dequeuer()
+    {
+        if(deq_waiters != 0) { c_deq.notify_one(); }
+    }
+
 private:
-    std::mutex  m;
+    std::mutex mutable m;
     container   data;
     size_t      capacity;
     std::condition_variable c_enq;
     std::condition_variable c_deq;
+    //! c_enq, c_deqで待機しているスレッドの数
+    size_t      enq_waiters;
+    size_t      deq_waiters;
 };
 
 }}  //namespace detail::ns_task
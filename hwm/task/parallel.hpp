@@ -0,0 +1,601 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! 一つのチャンクに含める要素数の下限の目安
+size_t const parallel_min_chunk_size = 2048;
+
+//! for_each_chunk()の状態
+/*!
+	呼び出し元のスレッドと、タスクキューに積んだ補助タスクが、未処理のチャンクを一つずつ取り合って処理する。
+	タスクキューが混んでいて補助タスクが実行されない場合も、呼び出し元のスレッドがすべてのチャンクを処理するので、
+	タスクキューのスレッドから呼び出しても、タスクキューが停止することはない。
+	補助タスクが遅れて実行された場合は、チャンクが残っていないことを確認するだけで終了し、fには触れない。
+*/
+template<class F>
+struct chunk_runner
+{
+    chunk_runner(F &f, size_t num_chunks)
+        :   f_(&f)
+        ,   num_chunks_(num_chunks)
+        ,   next_(0)
+        ,   done_(0)
+        ,   failed_(false)
+    {}
+
+    void run()
+    {
+        for( ; ; ) {
+            size_t const i = next_.fetch_add(1);
+            if(i >= num_chunks_) {
+                return;
+            }
+
+            if(!failed_.load()) {
+                try {
+                    (*f_)(i);
+                } catch(...) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if(!error_) {
+                        error_ = std::current_exception();
+                    }
+                    failed_.store(true);
+                }
+            }
+
+            if(done_.fetch_add(1) + 1 == num_chunks_) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                c_done_.notify_all();
+            }
+        }
+    }
+
+    //! すべてのチャンクの処理が終わるのを待つ。いずれかのチャンクで例外が送出されていれば、最初の例外を再送出する。
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        c_done_.wait(lock, [this] { return done_.load() == num_chunks_; });
+        if(error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    F *                     f_;
+    size_t const            num_chunks_;
+    std::atomic<size_t>     next_;
+    std::atomic<size_t>     done_;
+    std::atomic<bool>       failed_;
+    std::mutex              mutex_;
+    std::condition_variable c_done_;
+    std::exception_ptr      error_;
+};
+
+//! f(0)からf(num_chunks - 1)までを、タスクキューのスレッドと呼び出し元のスレッドで並列に呼び出す
+/*!
+	すべての呼び出しが終わるまで戻らない。いずれかの呼び出しが例外を送出した場合は、
+	まだ開始されていない呼び出しを行わずに、最初の例外を再送出する。
+*/
+template<class TaskQueue, class F>
+void for_each_chunk(TaskQueue &tq, size_t num_chunks, F f)
+{
+    if(num_chunks == 0) {
+        return;
+    }
+
+    if(num_chunks == 1 || tq.num_threads() == 0) {
+        for(size_t i = 0; i < num_chunks; ++i) {
+            f(i);
+        }
+        return;
+    }
+
+    auto runner = std::make_shared<chunk_runner<F>>(f, num_chunks);
+
+    size_t const num_helpers = (std::min)(num_chunks - 1, tq.num_threads());
+    for(size_t i = 0; i < num_helpers; ++i) {
+        tq.enqueue([runner] { runner->run(); });
+    }
+
+    runner->run();
+    runner->wait();
+}
+
+//! n個の要素を分割するチャンク数を返す
+template<class TaskQueue>
+size_t num_chunks_for(TaskQueue const &tq, size_t n, size_t min_chunk_size = parallel_min_chunk_size)
+{
+    if(n == 0) {
+        return 0;
+    }
+
+    size_t const max_chunks = (std::max)(tq.num_threads(), size_t(1)) * 4;
+    return (std::max)(size_t(1), (std::min)(max_chunks, n / min_chunk_size));
+}
+
+//! n個の要素をnum_chunks個に分割した時の、i番目のチャンクの先頭のインデックス
+inline
+size_t chunk_begin(size_t i, size_t n, size_t num_chunks)
+{
+    return i * (n / num_chunks) + (std::min)(i, n % num_chunks);
+}
+
+//! 整列済みの範囲aとbをマージした結果の先頭d個に、aの要素がいくつ含まれるかを返す
+/*!
+	等しい要素はaの要素を先に並べる（安定なマージと同じ順序）。
+*/
+template<class RandomIt1, class RandomIt2, class Compare>
+size_t merge_path_split(RandomIt1 a, size_t na, RandomIt2 b, size_t nb, size_t d, Compare comp)
+{
+    size_t lo = d > nb ? d - nb : 0;
+    size_t hi = (std::min)(d, na);
+
+    while(lo < hi) {
+        size_t const mid = lo + (hi - lo) / 2;
+        if(comp(b[d - mid - 1], a[mid])) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    return lo;
+}
+
+}}  //namespace detail::ns_task
+
+//! タスクキューのスレッドで実行する並列アルゴリズム
+/*!
+	どの関数も、第一引数に渡したタスクキューのスレッドと、呼び出し元のスレッドで処理を分担し、
+	処理が終わるまで戻らない。実装が用意したスレッドプールは使用しない。
+	タスクキューが混んでいる場合は呼び出し元のスレッドが多くの処理を行うので、タスクキューのタスクの中から呼び出してもよい。
+
+	イテレータはランダムアクセスイテレータでなければならない。
+	関数オブジェクトは複数のスレッドから同時に呼び出される。
+	関数オブジェクトが例外を送出した場合は、残りの処理を打ち切って、最初の例外を再送出する。
+	その場合、出力先の範囲の内容は未規定となる。
+*/
+namespace parallel {
+
+//! 各要素にopを適用した結果をd_firstから始まる範囲に書き込む（std::transformの並列版）
+/*!
+	@return 書き込んだ範囲の末尾
+*/
+template<class TaskQueue, class RandomIt, class OutputIt, class UnaryOp>
+OutputIt transform(TaskQueue &tq, RandomIt first, RandomIt last, OutputIt d_first, UnaryOp op)
+{
+    size_t const n = std::distance(first, last);
+    size_t const num_chunks = detail::ns_task::num_chunks_for(tq, n);
+
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+        std::transform(first + b, first + e, d_first + b, op);
+    });
+
+    return d_first + n;
+}
+
+//! 各要素にtransformを適用した結果を、reduceでまとめる（std::transform_reduceの並列版）
+/*!
+	reduceは結合的でなければならない。要素をまとめる順序は規定されない。
+	@param [in] init まとめた結果に最後に一度だけ適用される初期値
+*/
+template<class TaskQueue, class RandomIt, class T, class BinaryReduceOp, class UnaryTransformOp>
+T transform_reduce(TaskQueue &tq, RandomIt first, RandomIt last, T init, BinaryReduceOp reduce, UnaryTransformOp transform)
+{
+    size_t const n = std::distance(first, last);
+    size_t const num_chunks = detail::ns_task::num_chunks_for(tq, n);
+
+    std::vector<T> partials(num_chunks, init);
+
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+
+        T acc = transform(first[b]);
+        for(size_t j = b + 1; j < e; ++j) {
+            acc = reduce(std::move(acc), transform(first[j]));
+        }
+        partials[i] = std::move(acc);
+    });
+
+    T result = std::move(init);
+    for(auto &partial: partials) {
+        result = reduce(std::move(result), std::move(partial));
+    }
+    return result;
+}
+
+//! 累積和を求める（std::inclusive_scanの並列版）
+/*!
+	d_first + kには、first[0]からfirst[k]までをopでまとめた値が書き込まれる。
+	opは結合的でなければならない。d_firstはfirstと同じでもよい。
+	@return 書き込んだ範囲の末尾
+*/
+template<class TaskQueue, class RandomIt, class OutputIt, class BinaryOp>
+OutputIt inclusive_scan(TaskQueue &tq, RandomIt first, RandomIt last, OutputIt d_first, BinaryOp op)
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+
+    size_t const n = std::distance(first, last);
+    size_t const num_chunks = detail::ns_task::num_chunks_for(tq, n);
+    if(num_chunks <= 1) {
+        return std::partial_sum(first, last, d_first, op);
+    }
+
+    //! 1. 各チャンクの合計を求める
+    std::vector<value_type> sums(num_chunks);
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+
+        value_type acc = first[b];
+        for(size_t j = b + 1; j < e; ++j) {
+            acc = op(std::move(acc), first[j]);
+        }
+        sums[i] = std::move(acc);
+    });
+
+    //! 2. チャンクの合計の累積和を求め、i番目のチャンクの手前までの合計をsums[i - 1]にする
+    for(size_t i = 1; i < num_chunks; ++i) {
+        sums[i] = op(sums[i - 1], sums[i]);
+    }
+
+    //! 3. 手前までの合計を初期値にして、各チャンクの累積和を求める
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+
+        value_type acc = (i == 0) ? value_type(first[b]) : op(sums[i - 1], first[b]);
+        d_first[b] = acc;
+        for(size_t j = b + 1; j < e; ++j) {
+            acc = op(std::move(acc), first[j]);
+            d_first[j] = acc;
+        }
+    });
+
+    return d_first + n;
+}
+
+//! operator+で累積和を求める
+template<class TaskQueue, class RandomIt, class OutputIt>
+OutputIt inclusive_scan(TaskQueue &tq, RandomIt first, RandomIt last, OutputIt d_first)
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+    return parallel::inclusive_scan(tq, first, last, d_first, std::plus<value_type>());
+}
+
+//! 自身を含まない累積和を求める（std::exclusive_scanの並列版）
+/*!
+	d_first + kには、initとfirst[0]からfirst[k - 1]までをopでまとめた値が書き込まれる。
+	opは結合的でなければならない。d_firstはfirstと同じでもよい。
+	@return 書き込んだ範囲の末尾
+*/
+template<class TaskQueue, class RandomIt, class OutputIt, class T, class BinaryOp>
+OutputIt exclusive_scan(TaskQueue &tq, RandomIt first, RandomIt last, OutputIt d_first, T init, BinaryOp op)
+{
+    size_t const n = std::distance(first, last);
+    size_t const num_chunks = detail::ns_task::num_chunks_for(tq, n);
+    if(n == 0) {
+        return d_first;
+    }
+
+    //! 1. 各チャンクの合計を求める
+    std::vector<T> sums(num_chunks, init);
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+
+        T acc = first[b];
+        for(size_t j = b + 1; j < e; ++j) {
+            acc = op(std::move(acc), first[j]);
+        }
+        sums[i] = std::move(acc);
+    });
+
+    //! 2. i番目のチャンクの手前までの合計（initを含む）をoffsets[i]にする
+    std::vector<T> offsets(num_chunks, init);
+    for(size_t i = 1; i < num_chunks; ++i) {
+        offsets[i] = op(offsets[i - 1], sums[i - 1]);
+    }
+
+    //! 3. 各チャンクの累積和を求める。入力と出力が同じ場合に備えて、書き込む前に入力を読む。
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+
+        T acc = offsets[i];
+        for(size_t j = b; j < e; ++j) {
+            T next = op(acc, first[j]);
+            d_first[j] = std::move(acc);
+            acc = std::move(next);
+        }
+    });
+
+    return d_first + n;
+}
+
+//! operator+で自身を含まない累積和を求める
+template<class TaskQueue, class RandomIt, class OutputIt, class T>
+OutputIt exclusive_scan(TaskQueue &tq, RandomIt first, RandomIt last, OutputIt d_first, T init)
+{
+    return parallel::exclusive_scan(tq, first, last, d_first, std::move(init), std::plus<T>());
+}
+
+//! predを満たす最初の要素を探す（std::find_ifの並列版）
+/*!
+	要素が見つかると、それより後ろを担当しているスレッドは探索を打ち切る。
+	@return predを満たす最初の要素を指すイテレータ。見つからなければlast
+*/
+template<class TaskQueue, class RandomIt, class UnaryPredicate>
+RandomIt find_if(TaskQueue &tq, RandomIt first, RandomIt last, UnaryPredicate pred)
+{
+    size_t const n = std::distance(first, last);
+    size_t const num_chunks = detail::ns_task::num_chunks_for(tq, n);
+
+    //! これまでに見つかった要素のうち、最も前にあるもののインデックス
+    std::atomic<size_t> found(n);
+
+    //! 打ち切るかどうかを確認する間隔
+    size_t const check_interval = 1024;
+
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+
+        for(size_t block = b; block < e; block += check_interval) {
+            if(found.load(std::memory_order_relaxed) < block) {
+                return;
+            }
+
+            size_t const block_end = (std::min)(e, block + check_interval);
+            for(size_t j = block; j < block_end; ++j) {
+                if(pred(first[j])) {
+                    size_t current = found.load();
+                    while(j < current && !found.compare_exchange_weak(current, j)) {}
+                    return;
+                }
+            }
+        }
+    });
+
+    return first + found.load();
+}
+
+//! predを満たす要素を前に、満たさない要素を後ろに並べ替える（std::partitionの並列版）
+/*!
+	並べ替えは安定ではない。
+	@return predを満たさない最初の要素を指すイテレータ
+*/
+template<class TaskQueue, class RandomIt, class UnaryPredicate>
+RandomIt partition(TaskQueue &tq, RandomIt first, RandomIt last, UnaryPredicate pred)
+{
+    size_t const n = std::distance(first, last);
+    size_t const num_chunks = detail::ns_task::num_chunks_for(tq, n);
+    if(num_chunks <= 1) {
+        return std::partition(first, last, pred);
+    }
+
+    //! 1. 各チャンクを分割する
+    std::vector<size_t> splits(num_chunks);
+    detail::ns_task::for_each_chunk(tq, num_chunks, [&](size_t i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+        splits[i] = std::partition(first + b, first + e, pred) - first;
+    });
+
+    size_t num_true = 0;
+    for(size_t i = 0; i < num_chunks; ++i) {
+        num_true += splits[i] - detail::ns_task::chunk_begin(i, n, num_chunks);
+    }
+
+    //! 2. [0, num_true)にあるpredを満たさない要素と、[num_true, n)にあるpredを満たす要素を列挙する。
+    //! 両者の数は等しいので、前から順に組にして交換すればよい。
+    struct range { size_t begin; size_t end; };
+    std::vector<range> misplaced_false;
+    std::vector<range> misplaced_true;
+
+    for(size_t i = 0; i < num_chunks; ++i) {
+        size_t const b = detail::ns_task::chunk_begin(i, n, num_chunks);
+        size_t const e = detail::ns_task::chunk_begin(i + 1, n, num_chunks);
+        size_t const s = splits[i];
+
+        if(s < num_true) {
+            range const r = { s, (std::min)(e, num_true) };
+            if(r.begin < r.end) { misplaced_false.push_back(r); }
+        }
+        if(e > num_true) {
+            range const r = { (std::max)(b, num_true), s };
+            if(r.begin < r.end) { misplaced_true.push_back(r); }
+        }
+    }
+
+    //! 範囲のリストの中で、先頭からk番目の要素のインデックスを求めるための累積数
+    auto make_prefix = [](std::vector<range> const &ranges) {
+        std::vector<size_t> prefix(ranges.size() + 1, 0);
+        for(size_t i = 0; i < ranges.size(); ++i) {
+            prefix[i + 1] = prefix[i] + (ranges[i].end - ranges[i].begin);
+        }
+        return prefix;
+    };
+
+    std::vector<size_t> const prefix_false = make_prefix(misplaced_false);
+    std::vector<size_t> const prefix_true = make_prefix(misplaced_true);
+
+    size_t const num_swaps = prefix_false.back();
+    assert(num_swaps == prefix_true.back());
+
+    size_t const num_swap_chunks = detail::ns_task::num_chunks_for(tq, num_swaps);
+
+    detail::ns_task::for_each_chunk(tq, num_swap_chunks, [&](size_t c) {
+        size_t k = detail::ns_task::chunk_begin(c, num_swaps, num_swap_chunks);
+        size_t const k_end = detail::ns_task::chunk_begin(c + 1, num_swaps, num_swap_chunks);
+
+        size_t fi = std::upper_bound(prefix_false.begin(), prefix_false.end(), k) - prefix_false.begin() - 1;
+        size_t ti = std::upper_bound(prefix_true.begin(), prefix_true.end(), k) - prefix_true.begin() - 1;
+        size_t fpos = misplaced_false[fi].begin + (k - prefix_false[fi]);
+        size_t tpos = misplaced_true[ti].begin + (k - prefix_true[ti]);
+
+        for( ; k < k_end; ++k) {
+            using std::swap;
+            swap(first[fpos], first[tpos]);
+
+            if(++fpos == misplaced_false[fi].end && fi + 1 < misplaced_false.size()) {
+                ++fi;
+                fpos = misplaced_false[fi].begin;
+            }
+            if(++tpos == misplaced_true[ti].end && ti + 1 < misplaced_true.size()) {
+                ++ti;
+                tpos = misplaced_true[ti].begin;
+            }
+        }
+    });
+
+    return first + num_true;
+}
+
+//! 要素を並べ替える（std::sortの並列版）
+/*!
+	範囲をチャンクに分けてそれぞれをstd::sortで並べ替え、
+	隣り合う整列済みの範囲を、一つのマージも複数のスレッドで分担しながら順にマージする。
+	作業領域として、要素数と同じ大きさのstd::vectorを確保する。
+	@note 要素の型は、デフォルト構築とムーブ代入が可能でなければならない。
+	@note 並べ替えは安定ではない。（チャンク内の並べ替えにstd::sortを使用するため）
+*/
+template<class TaskQueue, class RandomIt, class Compare>
+void sort(TaskQueue &tq, RandomIt first, RandomIt last, Compare comp)
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+
+    size_t const n = std::distance(first, last);
+    size_t const num_runs = detail::ns_task::num_chunks_for(tq, n, detail::ns_task::parallel_min_chunk_size * 4);
+    if(num_runs <= 1) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    //! 1. 各チャンクを並べ替える
+    std::vector<size_t> bounds(num_runs + 1);
+    for(size_t i = 0; i <= num_runs; ++i) {
+        bounds[i] = detail::ns_task::chunk_begin(i, n, num_runs);
+    }
+
+    detail::ns_task::for_each_chunk(tq, num_runs, [&](size_t i) {
+        std::sort(first + bounds[i], first + bounds[i + 1], comp);
+    });
+
+    //! 2. 隣り合う範囲を、元の範囲と作業領域の間で交互にマージする
+    std::vector<value_type> buffer(n);
+    bool in_buffer = false;
+
+    size_t const pieces_per_merge = (std::max)(tq.num_threads(), size_t(1));
+
+    while(bounds.size() > 2) {
+        size_t const num_current = bounds.size() - 1;
+        size_t const num_pairs = num_current / 2;
+        bool const has_odd = (num_current % 2) != 0;
+
+        //! (マージする組, 組の中での分担)をチャンクとして並列に処理する
+        size_t const num_tasks = num_pairs * pieces_per_merge + (has_odd ? 1 : 0);
+
+        auto merge_step = [&](value_type *buf, RandomIt data, bool from_buffer) {
+            detail::ns_task::for_each_chunk(tq, num_tasks, [&](size_t t) {
+                if(t == num_pairs * pieces_per_merge) {
+                    //! 組にならなかった最後の範囲は、そのまま移動する
+                    size_t const b = bounds[num_current - 1];
+                    size_t const e = bounds[num_current];
+                    if(from_buffer) {
+                        std::move(buf + b, buf + e, data + b);
+                    } else {
+                        std::move(data + b, data + e, buf + b);
+                    }
+                    return;
+                }
+
+                size_t const pair = t / pieces_per_merge;
+                size_t const piece = t % pieces_per_merge;
+
+                size_t const a_begin = bounds[pair * 2];
+                size_t const b_begin = bounds[pair * 2 + 1];
+                size_t const b_end = bounds[pair * 2 + 2];
+                size_t const na = b_begin - a_begin;
+                size_t const nb = b_end - b_begin;
+                size_t const total = na + nb;
+
+                size_t const d0 = detail::ns_task::chunk_begin(piece, total, pieces_per_merge);
+                size_t const d1 = detail::ns_task::chunk_begin(piece + 1, total, pieces_per_merge);
+                if(d0 == d1) {
+                    return;
+                }
+
+                if(from_buffer) {
+                    value_type *a = buf + a_begin;
+                    value_type *b = buf + b_begin;
+                    size_t const i0 = detail::ns_task::merge_path_split(a, na, b, nb, d0, comp);
+                    size_t const i1 = detail::ns_task::merge_path_split(a, na, b, nb, d1, comp);
+                    std::merge(
+                        std::make_move_iterator(a + i0), std::make_move_iterator(a + i1),
+                        std::make_move_iterator(b + (d0 - i0)), std::make_move_iterator(b + (d1 - i1)),
+                        data + a_begin + d0, comp);
+                } else {
+                    RandomIt a = data + a_begin;
+                    RandomIt b = data + b_begin;
+                    size_t const i0 = detail::ns_task::merge_path_split(a, na, b, nb, d0, comp);
+                    size_t const i1 = detail::ns_task::merge_path_split(a, na, b, nb, d1, comp);
+                    std::merge(
+                        std::make_move_iterator(a + i0), std::make_move_iterator(a + i1),
+                        std::make_move_iterator(b + (d0 - i0)), std::make_move_iterator(b + (d1 - i1)),
+                        buf + a_begin + d0, comp);
+                }
+            });
+        };
+
+        merge_step(buffer.data(), first, in_buffer);
+        in_buffer = !in_buffer;
+
+        std::vector<size_t> next_bounds;
+        for(size_t i = 0; i < num_current; i += 2) {
+            next_bounds.push_back(bounds[i]);
+        }
+        next_bounds.push_back(n);
+        bounds.swap(next_bounds);
+    }
+
+    //! 3. 結果が作業領域にある場合は、元の範囲に戻す
+    if(in_buffer) {
+        parallel::transform(tq, buffer.begin(), buffer.end(), first, [](value_type &x) { return std::move(x); });
+    }
+}
+
+//! operator<で要素を並べ替える
+template<class TaskQueue, class RandomIt>
+void sort(TaskQueue &tq, RandomIt first, RandomIt last)
+{
+    typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+    parallel::sort(tq, first, last, std::less<value_type>());
+}
+
+}   //namespace parallel
+
+}   //namespace hwm
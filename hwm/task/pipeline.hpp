@@ -0,0 +1,539 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./task_impl.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! パイプラインのステージの実行方法
+enum class stage_mode
+{
+    //! 一度に一つの要素だけを、ソースが生成した順に処理する
+    serial_in_order,
+    //! 一度に一つの要素だけを、到着した順に処理する
+    serial_out_of_order,
+    //! 複数の要素を同時に処理する
+    parallel,
+};
+
+//! パイプラインのソースに渡され、要素の生成を終了するために使用する
+struct flow_control
+{
+    flow_control()
+        :   stopped_(false)
+    {}
+
+    //! 要素の生成を終了する。この呼び出しを行ったソースの戻り値は破棄される。
+    void stop() { stopped_ = true; }
+
+    bool is_stopped() const { return stopped_; }
+
+private:
+    bool stopped_;
+};
+
+//! パイプラインを流れる値の型消去
+struct pipeline_value_base
+{
+    virtual ~pipeline_value_base() {}
+};
+
+template<class T>
+struct pipeline_value
+    :   pipeline_value_base
+{
+    explicit
+    pipeline_value(T &&x)
+        :   value(std::move(x))
+    {}
+
+    T value;
+};
+
+typedef std::unique_ptr<pipeline_value_base> pipeline_value_ptr;
+
+//! パイプラインのステージの定義
+struct pipeline_stage
+{
+    pipeline_stage(stage_mode mode, std::function<void(pipeline_value_ptr &)> fn)
+        :   mode(mode)
+        ,   fn(std::move(fn))
+    {}
+
+    stage_mode                                  mode;
+    std::function<void(pipeline_value_ptr &)>   fn;
+};
+
+struct pipeline;
+
+//! @class パイプラインを組み立てるクラス
+/*!
+	pipeline::from()で作成し、then()でステージを追加して、to()で最後のステージを追加するとpipelineが完成する。
+	@tparam T 直前のステージが出力する値の型
+*/
+template<class T>
+struct pipeline_builder
+{
+    typedef std::function<pipeline_value_ptr(flow_control &)> source_type;
+
+    pipeline_builder(source_type source, std::vector<pipeline_stage> stages)
+        :   source_(std::move(source))
+        ,   stages_(std::move(stages))
+    {}
+
+    //! 途中のステージを追加する
+    /*!
+		@param [in] mode ステージの実行方法
+		@param [in] f Tの値を受け取って、次のステージに渡す値を返す関数や関数オブジェクト
+	*/
+    template<class F>
+    auto then(stage_mode mode, F f) ->
+        pipeline_builder<typename std::decay<typename task_result<F, T>::type>::type>
+    {
+        typedef typename std::decay<typename task_result<F, T>::type>::type result_t;
+
+        stages_.emplace_back(mode, [f](pipeline_value_ptr &v) mutable {
+            auto &in = static_cast<pipeline_value<T> &>(*v);
+            v.reset(new pipeline_value<result_t>(f(std::move(in.value))));
+        });
+
+        return pipeline_builder<result_t>(std::move(source_), std::move(stages_));
+    }
+
+    //! 最後のステージを追加して、パイプラインを完成させる
+    /*!
+		@param [in] mode ステージの実行方法
+		@param [in] f Tの値を受け取る関数や関数オブジェクト。戻り値は無視される。
+	*/
+    template<class F>
+    pipeline to(stage_mode mode, F f);
+
+private:
+    source_type                 source_;
+    std::vector<pipeline_stage> stages_;
+};
+
+//! @class 複数のステージからなるパイプライン
+/*!
+	ソースが生成した要素を、各ステージで順に処理する。
+	ステージはそれぞれstage_modeで指定した方法で実行され、
+	parallelのステージは複数の要素を同時に処理し、serialのステージは一度に一つの要素だけを処理する。
+	すべてのステージは、run()に渡したタスクキューのスレッドで実行される。
+
+	同時にパイプラインの中に存在できる要素の数（トークン数）はrun()で指定する。
+	トークンがすべて使われている間はソースが呼び出されないので、
+	遅いステージの手前に要素が溜まり続けることがなく、メモリの使用量が抑えられる。
+	（locked_queueのcapacityと同じように、上限に達すると上流が待たされる）
+	ただし、スレッドがブロックして待つのではなく、トークンが返却された時にソースの呼び出しが再開される。
+
+	ソースは常に一度に一つずつ呼び出される。
+
+	@note ステージの実行や、ソースの呼び出しの再開は、タスクキューのスレッドからenqueue()を呼び出して行う。
+	キューのサイズを制限したタスクキューでは、キューが埋まっているとそのスレッドがブロックし、
+	すべてのスレッドが同時にブロックするとデッドロックになるので、キューのサイズを制限しないタスクキューを使用すること。
+
+	@code
+	auto p = hwm::pipeline::from([&](hwm::flow_control &fc) -> int {
+	             if(i == n) { fc.stop(); return 0; }
+	             return i++;
+	         })
+	         .then(hwm::stage_mode::parallel, [](int x) { return x * 2; })
+	         .to(hwm::stage_mode::serial_in_order, [&](int x) { out.push_back(x); });
+
+	p.run(tq, 16).wait();
+	@endcode
+*/
+struct pipeline
+{
+    //! パイプラインのソースを指定して、パイプラインの組み立てを開始する
+    /*!
+		@param [in] f flow_control &を受け取って、最初のステージに渡す値を返す関数や関数オブジェクト。
+		要素の生成を終える時は、flow_control::stop()を呼び出す。
+	*/
+    template<class F>
+    static auto from(F f) ->
+        pipeline_builder<typename std::decay<typename task_result<F, std::reference_wrapper<flow_control>>::type>::type>
+    {
+        typedef typename std::decay<typename task_result<F, std::reference_wrapper<flow_control>>::type>::type result_t;
+
+        return pipeline_builder<result_t>(
+            [f](flow_control &fc) mutable -> pipeline_value_ptr {
+                return pipeline_value_ptr(new pipeline_value<result_t>(f(fc)));
+            },
+            std::vector<pipeline_stage>());
+    }
+
+    pipeline(std::function<pipeline_value_ptr(flow_control &)> source, std::vector<pipeline_stage> stages)
+        :   impl_(new impl(std::move(source), std::move(stages)))
+    {}
+
+    pipeline(pipeline &&rhs)
+        :   impl_(std::move(rhs.impl_))
+    {}
+
+    pipeline & operator=(pipeline &&rhs)
+    {
+        impl_ = std::move(rhs.impl_);
+        return *this;
+    }
+
+    //! デストラクタ
+    /*!
+		@note run()で開始した実行が完了する前にデストラクタを呼び出してはならない。
+	*/
+    ~pipeline()
+    {
+        assert(!impl_ || !impl_->running_);
+    }
+
+    //! ステージの数（ソースを除く）を返す
+    size_t num_stages() const { return impl_->stages_.size(); }
+
+    //! パイプラインの実行を開始する
+    /*!
+		@tparam TaskQueue task_queue_with_allocatorのように、enqueue(f)メンバ関数を持つ型
+		@param [in] tq ソースと各ステージを実行するタスクキュー
+		@param [in] max_tokens 同時にパイプラインの中に存在できる要素の数
+		@return ソースが生成を終え、すべての要素が最後のステージまで処理されると準備完了になるstd::future。
+		いずれかのステージが例外を送出した場合は、ソースの呼び出しを止め、
+		パイプラインに残っている要素は以降のステージで処理せずに破棄して、最初に送出された例外をこのstd::futureに設定する。
+		タスクキューへの追加（enqueue()）が例外を送出した場合も同様に、その例外をこのstd::futureに設定する。
+
+		@note 実行が完了するまでは、このパイプラインを破棄したり、run()を呼び出したりしてはならない。
+	*/
+    template<class TaskQueue>
+    std::future<void> run(TaskQueue &tq, size_t max_tokens)
+    {
+        assert(max_tokens >= 1);
+        return impl_->run([&tq](std::function<void()> &&f) { tq.enqueue(std::move(f)); }, max_tokens);
+    }
+
+private:
+    //! パイプラインを流れる要素
+    struct token
+    {
+        token(size_t seq, pipeline_value_ptr value)
+            :   seq(seq)
+            ,   value(std::move(value))
+        {}
+
+        size_t              seq;
+        pipeline_value_ptr  value;
+    };
+
+    //! serialなステージに、同時に一つの要素だけが入るようにするための状態
+    struct stage_gate
+    {
+        std::mutex              mutex;
+        bool                    busy;
+        //! serial_in_orderのステージが次に処理する要素の番号
+        size_t                  next_seq;
+        //! serial_in_orderのステージで順番を待っている要素。番号 % max_tokensの位置に置く。
+        std::vector<token *>    waiting_in_order;
+        //! serial_out_of_orderのステージで順番を待っている要素
+        std::deque<token *>     waiting;
+    };
+
+    struct impl
+    {
+        impl(std::function<pipeline_value_ptr(flow_control &)> source, std::vector<pipeline_stage> stages)
+            :   source_(std::move(source))
+            ,   stages_(std::move(stages))
+            ,   gates_(stages_.size())
+            ,   running_(false)
+        {
+            for(auto &gate: gates_) {
+                gate.reset(new stage_gate());
+            }
+        }
+
+        std::future<void> run(std::function<void(std::function<void()> &&)> submit, size_t max_tokens)
+        {
+            assert(!running_);
+
+            submit_ = std::move(submit);
+            max_tokens_ = max_tokens;
+            promise_ = std::promise<void>();
+            auto future = promise_.get_future();
+
+            for(auto &gate: gates_) {
+                gate->busy = false;
+                gate->next_seq = 0;
+                gate->waiting_in_order.assign(max_tokens, nullptr);
+                gate->waiting.clear();
+            }
+
+            running_ = true;
+            stopped_.store(false);
+            failed_.store(false);
+            exception_ = nullptr;
+            next_seq_ = 0;
+            available_.store(max_tokens);
+
+            //! ソースの実行中は、その分を1つとして数える
+            active_.store(1);
+            source_running_.store(true);
+            if(!try_submit([this] { run_source(); })) {
+                source_running_.store(false);
+                release_active();
+            }
+
+            return future;
+        }
+
+        //! トークンが余っている間、ソースを呼び出して要素を生成する
+        void run_source()
+        {
+            for( ; ; ) {
+                while(!stopped_.load() && available_.load() > 0) {
+                    available_.fetch_sub(1);
+
+                    pipeline_value_ptr value;
+                    bool stop = failed_.load();
+
+                    if(!stop) {
+                        flow_control fc;
+                        try {
+                            value = source_(fc);
+                            stop = fc.is_stopped();
+                        } catch(...) {
+                            set_exception(std::current_exception());
+                            stop = true;
+                        }
+                    }
+
+                    if(stop) {
+                        available_.fetch_add(1);
+                        stopped_.store(true);
+                        break;
+                    }
+
+                    token *t = new token(next_seq_++, std::move(value));
+                    active_.fetch_add(1);
+                    if(!try_submit([this, t] { run_token(t, 0, false); })) {
+                        //! ソースの分がまだ数えられているので、ここでactive_が0になることはない
+                        delete t;
+                        available_.fetch_add(1);
+                        release_active();
+                    }
+                }
+
+                //! フラグを下ろしてから、その間にトークンが返却されていないかを確認する
+                source_running_.store(false);
+                if(stopped_.load() || available_.load() == 0 || source_running_.exchange(true)) {
+                    break;
+                }
+            }
+
+            release_active();
+        }
+
+        //! 要素をfirst_stage番目のステージから順に処理する
+        /*!
+			@param acquired first_stage番目のserialなステージに入る権利を、すでに得ているかどうか
+		*/
+        void run_token(token *t, size_t first_stage, bool acquired)
+        {
+            for(size_t i = first_stage; i < stages_.size(); ++i) {
+                pipeline_stage &stage = stages_[i];
+
+                if(stage.mode == stage_mode::parallel) {
+                    invoke_stage(stage, *t);
+                    continue;
+                }
+
+                stage_gate &gate = *gates_[i];
+                bool const in_order = stage.mode == stage_mode::serial_in_order;
+
+                if(!(acquired && i == first_stage)) {
+                    std::unique_lock<std::mutex> lock(gate.mutex);
+                    if(gate.busy || (in_order && t->seq != gate.next_seq)) {
+                        //! 順番が来るまで待たせる。スレッドはブロックせずに他のタスクの実行に戻る。
+                        if(in_order) {
+                            gate.waiting_in_order[t->seq % max_tokens_] = t;
+                        } else {
+                            gate.waiting.push_back(t);
+                        }
+                        return;
+                    }
+                    gate.busy = true;
+                }
+
+                invoke_stage(stage, *t);
+
+                token *next = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(gate.mutex);
+                    if(in_order) {
+                        ++gate.next_seq;
+                        token *&slot = gate.waiting_in_order[gate.next_seq % max_tokens_];
+                        if(slot && slot->seq == gate.next_seq) {
+                            next = slot;
+                            slot = nullptr;
+                        }
+                    } else if(!gate.waiting.empty()) {
+                        next = gate.waiting.front();
+                        gate.waiting.pop_front();
+                    }
+
+                    if(!next) {
+                        gate.busy = false;
+                    }
+                }
+
+                //! 待っていた要素に、このステージに入る権利を渡す。
+                //! タスクキューに追加できなかった場合は、このステージから先に進めなくなるので、このスレッドで処理する。
+                //! （例外が記録されているので、残りのステージは呼び出されずに要素が破棄される）
+                if(next && !try_submit([this, next, i] { run_token(next, i, true); })) {
+                    run_token(next, i, true);
+                }
+            }
+
+            finish_token(t);
+        }
+
+        void invoke_stage(pipeline_stage &stage, token &t)
+        {
+            if(failed_.load()) {
+                return;
+            }
+
+            try {
+                stage.fn(t.value);
+            } catch(...) {
+                set_exception(std::current_exception());
+            }
+        }
+
+        void finish_token(token *t)
+        {
+            delete t;
+            available_.fetch_add(1);
+
+            if(!stopped_.load()) {
+                bool expected = false;
+                if(source_running_.compare_exchange_strong(expected, true)) {
+                    active_.fetch_add(1);
+                    if(!try_submit([this] { run_source(); })) {
+                        source_running_.store(false);
+                        release_active();
+                    }
+                }
+            }
+
+            release_active();
+        }
+
+        //! タスクキューにタスクを追加する
+        /*!
+			@return enqueue()が例外を送出した場合は、その例外を記録してfalseを返す
+		*/
+        bool try_submit(std::function<void()> &&f)
+        {
+            try {
+                submit_(std::move(f));
+                return true;
+            } catch(...) {
+                set_exception(std::current_exception());
+                return false;
+            }
+        }
+
+        void set_exception(std::exception_ptr e)
+        {
+            {
+                std::lock_guard<std::mutex> lock(exception_mutex_);
+                if(!exception_) {
+                    exception_ = e;
+                }
+            }
+            failed_.store(true);
+            stopped_.store(true);
+        }
+
+        void release_active()
+        {
+            if(active_.fetch_sub(1) == 1) {
+                finish();
+            }
+        }
+
+        //! すべての要素の処理が終わった時に呼び出される
+        void finish()
+        {
+            //! promiseをローカルに移してからshared stateを準備完了にする。
+            //! 準備完了になった直後に、待機していたスレッドがこのパイプラインを破棄することがあるため、
+            //! それ以降はメンバ変数に触れないようにする。
+            std::promise<void> promise(std::move(promise_));
+            std::exception_ptr e = exception_;
+            exception_ = nullptr;
+            running_ = false;
+
+            if(e) {
+                promise.set_exception(e);
+            } else {
+                promise.set_value();
+            }
+        }
+
+        std::function<pipeline_value_ptr(flow_control &)>   source_;
+        std::vector<pipeline_stage>                         stages_;
+        std::vector<std::unique_ptr<stage_gate>>            gates_;
+
+        std::function<void(std::function<void()> &&)>       submit_;
+        size_t                                              max_tokens_;
+        bool                                                running_;
+        size_t                                              next_seq_;
+        //! 使用されていないトークンの数
+        std::atomic<size_t>                                 available_;
+        //! 処理中の要素の数と、ソースを実行中であれば1との和
+        std::atomic<size_t>                                 active_;
+        std::atomic<bool>                                   source_running_;
+        std::atomic<bool>                                   stopped_;
+        std::atomic<bool>                                   failed_;
+        std::mutex                                          exception_mutex_;
+        std::exception_ptr                                  exception_;
+        std::promise<void>                                  promise_;
+    };
+
+    std::unique_ptr<impl>   impl_;
+};
+
+template<class T>
+template<class F>
+pipeline pipeline_builder<T>::to(stage_mode mode, F f)
+{
+    stages_.emplace_back(mode, [f](pipeline_value_ptr &v) mutable {
+        auto &in = static_cast<pipeline_value<T> &>(*v);
+        f(std::move(in.value));
+        v.reset();
+    });
+
+    return pipeline(std::move(source_), std::move(stages_));
+}
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::stage_mode;
+using detail::ns_task::flow_control;
+using detail::ns_task::pipeline;
+
+}   //namespace hwm
@@ -0,0 +1,471 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#if defined(__linux__) && !defined(HWM_TASK_NO_REACTOR)
+
+#define HWM_TASK_HAS_REACTOR 1
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "./task_base.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! ファイルディスクリプタに対して待機する方向
+enum class io_direction
+{
+    read,
+    write,
+};
+
+//! reactorに登録する非同期操作
+/*!
+	reactorは、perform()で操作を試行し、完了した操作はファイルディスクリプタの登録を解除してから、
+	ロックの外でcomplete()を呼び出して結果を通知する。
+	結果を受け取った呼び出し元がファイルディスクリプタを閉じても、reactorがそのファイルディスクリプタを操作することはない。
+*/
+struct io_operation
+{
+    virtual ~io_operation() {}
+
+    //! 操作を試行する
+    /*!
+		結果は保持しておき、complete()で通知する。
+		@return 操作が完了した場合はtrue。ファイルディスクリプタの準備ができていなかった場合（EAGAIN）はfalse
+	*/
+    virtual bool perform() = 0;
+
+    //! perform()で完了した操作の結果を通知する
+    /*!
+		@param [out] ready_tasks 操作の完了によって実行できるようになったタスクを追加する
+	*/
+    virtual void complete(std::vector<std::unique_ptr<task_base>> &ready_tasks) = 0;
+
+    //! 登録した時点で、準備ができているかを確認せずに試行してよいかどうか
+    virtual bool try_immediately() const { return true; }
+};
+
+//! システムコールの戻り値を結果として返す操作
+/*!
+	@tparam R 結果の型
+*/
+template<class R>
+struct io_syscall_operation
+    :   io_operation
+{
+    io_syscall_operation(char const *name, std::promise<R> &&promise)
+        :   name_(name), promise_(std::move(promise)), result_(), error_(0)
+    {}
+
+    void complete(std::vector<std::unique_ptr<task_base>> &) override
+    {
+        if(error_ != 0) {
+            promise_.set_exception(std::make_exception_ptr(std::system_error(error_, std::system_category(), name_)));
+        } else {
+            promise_.set_value(result_);
+        }
+    }
+
+protected:
+    //! 成功した場合の結果を保持する
+    bool succeeded(R result)
+    {
+        result_ = result;
+        return true;
+    }
+
+    //! 失敗した場合のerrnoを保持する
+    bool failed(int error)
+    {
+        error_ = error;
+        return true;
+    }
+
+private:
+    char const *        name_;
+    std::promise<R>     promise_;
+    R                   result_;
+    int                 error_;
+};
+
+//! read(2)を行う操作
+struct io_read_operation
+    :   io_syscall_operation<ssize_t>
+{
+    io_read_operation(int fd, void *buf, size_t size, std::promise<ssize_t> &&promise)
+        :   io_syscall_operation<ssize_t>("read", std::move(promise)), fd_(fd), buf_(buf), size_(size)
+    {}
+
+    bool perform() override
+    {
+        for( ; ; ) {
+            ssize_t const n = ::read(fd_, buf_, size_);
+            if(n >= 0) { return succeeded(n); }
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) { return false; }
+
+            return failed(errno);
+        }
+    }
+
+private:
+    int                     fd_;
+    void *                  buf_;
+    size_t                  size_;
+};
+
+//! write(2)を行う操作
+struct io_write_operation
+    :   io_syscall_operation<ssize_t>
+{
+    io_write_operation(int fd, void const *buf, size_t size, std::promise<ssize_t> &&promise)
+        :   io_syscall_operation<ssize_t>("write", std::move(promise)), fd_(fd), buf_(buf), size_(size)
+    {}
+
+    bool perform() override
+    {
+        for( ; ; ) {
+            ssize_t const n = ::write(fd_, buf_, size_);
+            if(n >= 0) { return succeeded(n); }
+            if(errno == EINTR) { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) { return false; }
+
+            return failed(errno);
+        }
+    }
+
+private:
+    int                     fd_;
+    void const *            buf_;
+    size_t                  size_;
+};
+
+//! accept4(2)を行う操作。受け付けたソケットはノンブロッキングに設定される。
+struct io_accept_operation
+    :   io_syscall_operation<int>
+{
+    io_accept_operation(int fd, std::promise<int> &&promise)
+        :   io_syscall_operation<int>("accept", std::move(promise)), fd_(fd)
+    {}
+
+    bool perform() override
+    {
+        for( ; ; ) {
+            int const s = ::accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(s >= 0) { return succeeded(s); }
+            if(errno == EINTR || errno == ECONNABORTED) { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK) { return false; }
+
+            return failed(errno);
+        }
+    }
+
+private:
+    int                 fd_;
+};
+
+//! ファイルディスクリプタの準備ができたらタスクを実行する操作
+struct io_ready_operation
+    :   io_operation
+{
+    explicit
+    io_ready_operation(std::unique_ptr<task_base> task)
+        :   task_(std::move(task))
+    {}
+
+    bool perform() override { return true; }
+
+    void complete(std::vector<std::unique_ptr<task_base>> &ready_tasks) override
+    {
+        ready_tasks.push_back(std::move(task_));
+    }
+
+    bool try_immediately() const override { return false; }
+
+private:
+    std::unique_ptr<task_base> task_;
+};
+
+//! @class epollによるリアクター
+/*!
+	ファイルディスクリプタごとに、読み込み方向と書き込み方向の操作をそれぞれ登録順に保持し、
+	epollで準備ができたことを検知したら、先頭の操作から順に試行する。
+	ファイルディスクリプタはEPOLLONESHOTで登録し、操作が残っている間だけ再登録する。
+
+	task_queue_options::enable_reactorを指定したタスクキューが内部で使用する。
+	待機しているスレッドのうち一つがwait()でepollを待ち、完了した操作を処理する。
+
+	@note 操作を登録するファイルディスクリプタはノンブロッキングに設定しておかなければならない。
+	通常のファイルのように、epollで待機できないファイルディスクリプタに対する操作は、登録時にそのまま実行される。
+	@note 操作が残っている間に、そのファイルディスクリプタを閉じてはならない。
+	結果が通知された時点で、そのファイルディスクリプタの登録はすでに解除されているので、その後は閉じてもよい。
+*/
+struct reactor
+{
+    typedef std::unique_ptr<task_base> task_ptr_t;
+    typedef std::vector<std::unique_ptr<io_operation>> completed_ops;
+
+    reactor()
+        :   num_pending_(0)
+    {
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if(epoll_fd_ < 0) {
+            throw std::system_error(errno, std::system_category(), "epoll_create1");
+        }
+
+        event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(event_fd_ < 0) {
+            int const e = errno;
+            ::close(epoll_fd_);
+            throw std::system_error(e, std::system_category(), "eventfd");
+        }
+
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = event_fd_;
+        if(::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, event_fd_, &ev) < 0) {
+            int const e = errno;
+            ::close(event_fd_);
+            ::close(epoll_fd_);
+            throw std::system_error(e, std::system_category(), "epoll_ctl");
+        }
+    }
+
+    //! デストラクタ
+    /*!
+		完了していない操作は破棄され、対応するstd::futureはstd::future_errc::broken_promiseになる。
+	*/
+    ~reactor()
+    {
+        ::close(event_fd_);
+        ::close(epoll_fd_);
+    }
+
+    reactor(reactor const &) = delete;
+    reactor & operator=(reactor const &) = delete;
+
+    //! 操作を登録する
+    /*!
+		同じ方向に先に登録された操作がなければ、まず一度試行する。
+		@param [out] ready_tasks 操作がその場で完了して、実行できるようになったタスクを追加する
+	*/
+    void submit(int fd, io_direction dir, std::unique_ptr<io_operation> op, std::vector<task_ptr_t> &ready_tasks)
+    {
+        completed_ops completed;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            submit_locked(fd, dir, std::move(op), completed);
+        }
+
+        complete(completed, ready_tasks);
+    }
+
+    //! 準備ができたファイルディスクリプタの操作を処理する
+    /*!
+		@param [in] timeout_ms epoll_waitのタイムアウト（ミリ秒）。-1の場合は無期限に待機する。
+		@param [out] ready_tasks 操作の完了によって実行できるようになったタスクを追加する
+	*/
+    void wait(int timeout_ms, std::vector<task_ptr_t> &ready_tasks)
+    {
+        epoll_event events[64];
+        int const n = ::epoll_wait(epoll_fd_, events, 64, timeout_ms);
+
+        completed_ops completed;
+
+        for(int i = 0; i < n; ++i) {
+            int const fd = events[i].data.fd;
+            if(fd == event_fd_) {
+                std::uint64_t value;
+                while(::read(event_fd_, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto found = fds_.find(fd);
+            if(found == fds_.end()) {
+                continue;
+            }
+
+            //! EPOLLONESHOTなので、イベントが通知された時点で登録は無効になっている
+            found->second.armed_events = 0;
+            process(fd, found->second, events[i].events, completed);
+        }
+
+        complete(completed, ready_tasks);
+    }
+
+    //! wait()で待機しているスレッドを起こす
+    void wake()
+    {
+        std::uint64_t const one = 1;
+        ssize_t const written = ::write(event_fd_, &one, sizeof(one));
+        (void)written;
+    }
+
+    //! 完了していない操作の数
+    size_t num_pending() const { return num_pending_.load(std::memory_order_relaxed); }
+
+private:
+    struct fd_state
+    {
+        fd_state()
+            :   registered(false)
+            ,   armed_events(0)
+        {}
+
+        std::deque<std::unique_ptr<io_operation>> ops[2];
+        //! epollに登録済みかどうか
+        bool registered;
+        //! 待機しているイベント。待機していない場合は0
+        std::uint32_t armed_events;
+    };
+
+    static size_t index_of(io_direction dir) { return dir == io_direction::read ? 0 : 1; }
+
+    //! 完了した操作の結果を通知する
+    /*!
+		ファイルディスクリプタの登録を解除した後で、ロックの外から呼び出す。
+	*/
+    static void complete(completed_ops &completed, std::vector<task_ptr_t> &ready_tasks)
+    {
+        for(auto &op: completed) {
+            op->complete(ready_tasks);
+        }
+        completed.clear();
+    }
+
+    void submit_locked(int fd, io_direction dir, std::unique_ptr<io_operation> op, completed_ops &completed)
+    {
+        fd_state &state = fds_[fd];
+        auto &ops = state.ops[index_of(dir)];
+
+        if(ops.empty() && op->try_immediately() && op->perform()) {
+            remove_if_unused(fd, state);
+            completed.push_back(std::move(op));
+            return;
+        }
+
+        ops.push_back(std::move(op));
+        num_pending_.fetch_add(1);
+
+        if(!arm(fd, state)) {
+            //! 通常のファイルなど、epollで待機できないファイルディスクリプタ。準備ができているものとして処理する。
+            int const e = errno;
+            if(e != EPERM) {
+                ops.pop_back();
+                num_pending_.fetch_sub(1);
+                remove_if_unused(fd, state);
+                throw std::system_error(e, std::system_category(), "epoll_ctl");
+            }
+            process(fd, state, EPOLLIN | EPOLLOUT, completed);
+        }
+    }
+
+    //! 準備ができた方向の操作を、EAGAINになるまで先頭から試行し、残っていれば再登録する
+    /*!
+		完了した操作はcompletedに移す。結果の通知は、この関数がファイルディスクリプタの登録を解除した後で行う。
+	*/
+    void process(int fd, fd_state &state, std::uint32_t events, completed_ops &completed)
+    {
+        //! エラーや切断の場合も試行して、操作側でエラーや0バイトの結果を受け取らせる
+        std::uint32_t const error_events = EPOLLERR | EPOLLHUP;
+
+        if(events & (EPOLLIN | error_events)) {
+            run_ops(state.ops[0], completed);
+        }
+        if(events & (EPOLLOUT | error_events)) {
+            run_ops(state.ops[1], completed);
+        }
+
+        if(state.ops[0].empty() && state.ops[1].empty()) {
+            remove_if_unused(fd, state);
+        } else if(!arm(fd, state)) {
+            //! epollで待機できないファイルディスクリプタでは、EAGAINにならないので、ここには来ない
+            assert(false);
+        }
+    }
+
+    void run_ops(std::deque<std::unique_ptr<io_operation>> &ops, completed_ops &completed)
+    {
+        while(!ops.empty() && ops.front()->perform()) {
+            completed.push_back(std::move(ops.front()));
+            ops.pop_front();
+            num_pending_.fetch_sub(1);
+        }
+    }
+
+    //! 残っている操作に応じてepollに登録する
+    /*!
+		@return epoll_ctlが失敗した場合はfalse（errnoにエラーが設定される）
+	*/
+    bool arm(int fd, fd_state &state)
+    {
+        epoll_event ev = {};
+        ev.events = EPOLLONESHOT;
+        if(!state.ops[0].empty()) { ev.events |= EPOLLIN; }
+        if(!state.ops[1].empty()) { ev.events |= EPOLLOUT; }
+        ev.data.fd = fd;
+
+        if(state.armed_events == ev.events) {
+            return true;
+        }
+
+        if(::epoll_ctl(epoll_fd_, state.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0) {
+            return false;
+        }
+
+        state.registered = true;
+        state.armed_events = ev.events;
+        return true;
+    }
+
+    void remove_if_unused(int fd, fd_state &state)
+    {
+        if(!state.ops[0].empty() || !state.ops[1].empty()) {
+            return;
+        }
+
+        if(state.registered) {
+            ::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+        }
+        fds_.erase(fd);
+    }
+
+private:
+    int                         epoll_fd_;
+    int                         event_fd_;
+    std::mutex                  mutex_;
+    std::map<int, fd_state>     fds_;
+    std::atomic<size_t>         num_pending_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::io_direction;
+
+}   //namespace hwm
+
+#endif
@@ -0,0 +1,189 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "./spsc_ring.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! リアルタイムスレッドから積まれるタスクを保持するリングバッファ
+/*!
+	生産者は一つのスレッドに限られ、try_push()はロックもメモリ確保も行わずに一定の手順で完了する。（wait-free）
+	消費者はタスクキューの複数のスレッドだが、consuming_フラグによって同時に取り出しを行うのは一つのスレッドだけにする。
+	消費者側でフラグを取得できなかったスレッドは待機せずに諦めるので、生産者がブロックされることはない。
+*/
+struct realtime_ring
+{
+    //! タスクに渡すデータの最大サイズ
+    static size_t const payload_size = 48;
+
+    typedef void (*erased_function_t)();
+    typedef void (*thunk_t)(erased_function_t f, unsigned char const *payload);
+
+    struct slot
+    {
+        thunk_t             thunk;
+        erased_function_t   fn;
+        union {
+            std::max_align_t    align_;
+            unsigned char       payload[payload_size];
+        };
+
+        void run() const { thunk(fn, payload); }
+    };
+
+    //! @param capacity 保持できるタスク数。2のべき乗に切り上げられる。
+    explicit
+    realtime_ring(size_t capacity)
+        :   ring_(capacity)
+    {
+        consuming_.clear();
+    }
+
+    realtime_ring(realtime_ring const &) = delete;
+    realtime_ring & operator=(realtime_ring const &) = delete;
+
+    size_t capacity() const { return ring_.capacity(); }
+
+    //! タスクを追加する。生産者のスレッドからのみ呼び出せる。
+    /*!
+		@return リングバッファが一杯の場合はfalse
+	*/
+    template<class Payload>
+    bool try_push(void (*f)(Payload const &), Payload const &payload)
+    {
+        static_assert(sizeof(Payload) <= payload_size, "the payload is too large for a realtime task.");
+        static_assert(std::is_trivially_copyable<Payload>::value, "the payload must be trivially copyable.");
+
+        slot s;
+        s.thunk = &invoke_payload<Payload>;
+        s.fn = reinterpret_cast<erased_function_t>(f);
+        std::memcpy(s.payload, &payload, sizeof(Payload));
+
+        return ring_.try_push(std::move(s));
+    }
+
+    //! タスクを取り出す
+    /*!
+		他のスレッドが取り出し中の場合や、リングバッファが空の場合はfalseを返す
+	*/
+    bool try_pop(slot &out)
+    {
+        if(consuming_.test_and_set(std::memory_order_acquire)) {
+            return false;
+        }
+
+        bool const found = ring_.try_pop(out);
+
+        consuming_.clear(std::memory_order_release);
+        return found;
+    }
+
+    bool empty() const { return ring_.empty(); }
+
+    //! 生産者がいなくなったことを記録する
+    void close() { ring_.close(); }
+    bool is_closed() const { return ring_.is_closed(); }
+
+private:
+    template<class Payload>
+    static void invoke_payload(erased_function_t f, unsigned char const *data)
+    {
+        Payload payload;
+        std::memcpy(&payload, data, sizeof(Payload));
+        reinterpret_cast<void (*)(Payload const &)>(f)(payload);
+    }
+
+    spsc_ring<slot>     ring_;
+    std::atomic_flag    consuming_;
+};
+
+//! @class リアルタイムスレッドからタスクを積むためのハンドル
+/*!
+	task_queue_with_allocator::make_realtime_producer()で作成する。
+	try_enqueue()はロックもメモリ確保も行わず、タスクキューのスレッドを起こす処理も行わないので、
+	オーディオコールバックのようなリアルタイムスレッドから呼び出せる。
+	一つのハンドルは一つのスレッドからのみ使用できる。
+*/
+struct realtime_producer
+{
+    realtime_producer() {}
+
+    explicit
+    realtime_producer(std::shared_ptr<realtime_ring> ring)
+        :   ring_(std::move(ring))
+    {}
+
+    realtime_producer(realtime_producer &&rhs)
+        :   ring_(std::move(rhs.ring_))
+    {}
+
+    realtime_producer & operator=(realtime_producer &&rhs)
+    {
+        reset();
+        ring_ = std::move(rhs.ring_);
+        return *this;
+    }
+
+    realtime_producer(realtime_producer const &) = delete;
+    realtime_producer & operator=(realtime_producer const &) = delete;
+
+    //! デストラクタ
+    /*!
+		積まれたままのタスクは、ハンドルの破棄後も実行される。
+	*/
+    ~realtime_producer()
+    {
+        reset();
+    }
+
+    //! タスクを追加する
+    /*!
+		@param [in] f タスクキューのスレッドで呼び出す関数。キャプチャのないラムダ式も渡せる。
+		@param [in] payload fに渡すデータ。trivially copyableで、realtime_ring::payload_size以下のサイズでなければならない。
+		@return リングバッファが一杯の場合はタスクを追加せずにfalseを返す
+		@note 戻り値を受け取るstd::futureは返さない。また、このタスクはwait()の対象にならない。
+	*/
+    template<class Payload>
+    bool try_enqueue(void (*f)(Payload const &), Payload const &payload)
+    {
+        assert(ring_);
+        return ring_->try_push(f, payload);
+    }
+
+    //! 同時に積んでおけるタスク数を返す
+    size_t capacity() const { return ring_ ? ring_->capacity() : 0; }
+
+    //! 有効なハンドルかどうかを返す
+    explicit operator bool() const { return static_cast<bool>(ring_); }
+
+private:
+    void reset()
+    {
+        if(ring_) {
+            ring_->close();
+            ring_.reset();
+        }
+    }
+
+    std::shared_ptr<realtime_ring> ring_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::realtime_producer;
+
+}   //namespace hwm
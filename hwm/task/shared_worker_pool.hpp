@@ -0,0 +1,523 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./task_queue.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! 複数のtask_queue_viewに積まれたタスクのうち、どれを次に実行するかの選び方
+enum class view_scheduling
+{
+    //! ビューの重みに応じて、Deficit Round Robinで公平に選ぶ
+    weighted_fair,
+    //! 優先度の高いビューのタスクを先に選ぶ。優先度が同じビューの間では順番に選ぶ
+    strict_priority,
+};
+
+//! task_queue_viewの構成を指定するオプション
+struct task_queue_view_options
+{
+    task_queue_view_options()
+        :   queue_limit((std::numeric_limits<size_t>::max)())
+        ,   weight(1)
+        ,   priority(0)
+    {}
+
+    //! ビューのキューに保持できるタスク数の上限
+    size_t  queue_limit;
+    //! view_scheduling::weighted_fairの場合に、一巡するごとにこのビューから実行するタスクの数。1以上でなければならない
+    size_t  weight;
+    //! view_scheduling::strict_priorityの場合の優先度。値が大きいほど優先される
+    int     priority;
+};
+
+template<class TaskQueue>
+struct basic_task_queue_view;
+
+//! basic_shared_worker_poolのスレッドを持つ、デフォルトのタスクキュー
+/*!
+	内部のタスクキューに積むのはビューのタスクを選んで実行するタスクだけで、その結果は使わず、
+	完了もビューごとに数えるので、no_result_policyとuncounted_policyを指定する。
+	タスクごとにstd::futureのshared stateを確保したり、タスク数を数えたりしない。
+*/
+typedef basic_task_queue<
+    task_queue_policies<
+        locked_queue_policy<>,
+        blocking_idle_policy,
+        no_result_policy,
+        uncounted_policy>
+> shared_worker_task_queue;
+
+//! @class 複数のtask_queue_viewでスレッドを共有するためのワーカースレッドの集合
+/*!
+	サブシステムごとにタスクキューを作るとスレッド数がコア数を大きく超え、コンテキストスイッチが増える。
+	このクラスはスレッドを持つタスクキューを一つだけ作り、
+	その上に作成した各task_queue_viewは、自分のキュー、キューの上限、wait()、wait_before_destructed()を持ちながら、
+	このクラスのスレッドでタスクを実行する。
+
+	ビューにタスクが積まれるたびに、「次に実行すべきタスクを一つ選んで実行する」タスクを内部のタスクキューに一つ積む。
+	実際に実行されるタスクは、その時点でview_schedulingに従って選ばれたビューのものになる。
+
+	@tparam TaskQueue スレッドを持つタスクキューの型。emplace<F>(args...)メンバ関数を持たなければならない。
+	結果を使わないので、no_result_policyを指定したタスクキューが適している（shared_worker_task_queue）。
+	@note このオブジェクトより先に、作成したビューをすべて破棄しなければならない。
+*/
+template<class TaskQueue>
+struct basic_shared_worker_pool
+{
+    typedef TaskQueue                       task_queue_type;
+    typedef std::unique_ptr<task_base>      task_ptr_t;
+
+    //! コンストラクタ
+    /*!
+		@param num_threads [in] 起動するスレッドの数。デフォルトはstd::thread::hardware_concurrency()
+		@param scheduling [in] ビューの間でタスクを選ぶ方法
+	*/
+    explicit
+    basic_shared_worker_pool(
+        size_t num_threads = (std::max)(std::thread::hardware_concurrency(), 1u),
+        view_scheduling scheduling = view_scheduling::weighted_fair)
+        :   scheduling_(scheduling)
+        ,   num_views_(0)
+        ,   tq_(new task_queue_type(num_threads))
+    {}
+
+    //! コンストラクタ
+    /*!
+		@param num_threads [in] 起動するスレッドの数
+		@param queue_limit [in] 内部のタスクキューに保持できるタスク数の上限。
+		ビューごとの上限は、task_queue_view_options::queue_limitで指定する。
+		@param options [in] 内部のタスクキューの構成を指定するオプション
+		@param scheduling [in] ビューの間でタスクを選ぶ方法
+	*/
+    basic_shared_worker_pool(
+        size_t num_threads,
+        size_t queue_limit,
+        task_queue_options const &options,
+        view_scheduling scheduling = view_scheduling::weighted_fair)
+        :   scheduling_(scheduling)
+        ,   num_views_(0)
+        ,   tq_(new task_queue_type(num_threads, queue_limit, options))
+    {}
+
+    basic_shared_worker_pool(basic_shared_worker_pool const &) = delete;
+    basic_shared_worker_pool & operator=(basic_shared_worker_pool const &) = delete;
+
+    //! デストラクタ
+    /*!
+		内部のタスクキューを破棄して、スレッドを終了する。
+		ビューはすべて破棄されているので、内部のタスクキューに残っているrun_one_taskは、実行せずに破棄してよい。
+	*/
+    ~basic_shared_worker_pool()
+    {
+        assert(num_views_.load() == 0);
+        tq_.reset();
+    }
+
+    //! スレッド数を返す
+    size_t num_threads() const { return tq_->num_threads(); }
+
+    //! ビューの間でタスクを選ぶ方法を返す
+    view_scheduling scheduling() const { return scheduling_; }
+
+    //! 作成されているビューの数を返す
+    size_t num_views() const { return num_views_.load(); }
+
+private:
+    friend struct basic_task_queue_view<TaskQueue>;
+
+    //! ビューごとの状態
+    struct view_state
+    {
+        explicit
+        view_state(task_queue_view_options const &options)
+            :   queue_limit(options.queue_limit)
+            ,   weight(options.weight)
+            ,   priority(options.priority)
+            ,   deficit(0)
+            ,   active(false)
+        {}
+
+        size_t const                queue_limit;
+        size_t                      weight;
+        int                         priority;
+        //! 今回の巡回で、あといくつタスクを実行できるか
+        size_t                      deficit;
+        //! 選択の対象になっているかどうか
+        bool                        active;
+        std::deque<task_ptr_t>      tasks;
+        std::condition_variable     c_enq;
+        //! 積まれてから実行が完了するまでのタスクの数
+        task_counter                counter;
+    };
+
+    typedef std::shared_ptr<view_state> view_ptr_t;
+
+    view_ptr_t add_view(task_queue_view_options const &options)
+    {
+        assert(options.weight >= 1);
+        assert(options.queue_limit >= 1);
+
+        ++num_views_;
+        return std::make_shared<view_state>(options);
+    }
+
+    //! ビューが破棄されたことを記録する
+    /*!
+		@param discard_pending キューに積まれたままのタスクを実行せずに破棄するかどうか
+	*/
+    void remove_view(view_ptr_t const &v, bool discard_pending)
+    {
+        if(discard_pending) {
+            std::deque<task_ptr_t> discarded;
+
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                discarded.swap(v->tasks);
+                deactivate(v);
+                v->c_enq.notify_all();
+            }
+
+            //! 破棄されたタスクのstd::futureには、std::future_errc::broken_promiseが設定される
+            for(auto &task: discarded) {
+                task.reset();
+                v->counter.finish();
+            }
+        }
+
+        v->counter.wait();
+        --num_views_;
+    }
+
+    void push(view_ptr_t const &v, task_ptr_t task)
+    {
+        v->counter.add();
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            v->c_enq.wait(lock, [&v] { return v->tasks.size() < v->queue_limit; });
+
+            v->tasks.push_back(std::move(task));
+            activate(v);
+        }
+
+        tq_->template emplace<run_one_task>(this);
+    }
+
+    //! 内部のタスクキューに積む、run_one()を呼び出すタスク
+    struct run_one_task
+    {
+        explicit
+        run_one_task(basic_shared_worker_pool *pool)
+            :   pool_(pool)
+        {}
+
+        void operator()() { pool_->run_one(); }
+
+        basic_shared_worker_pool *pool_;
+    };
+
+    //! 次に実行するタスクを一つ選んで実行する
+    /*!
+		push()一回につき一回呼ばれる。ビューが破棄されてタスクが取り除かれていた場合は、実行するタスクがないこともある。
+	*/
+    void run_one()
+    {
+        task_ptr_t task;
+        view_ptr_t v;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+
+            v = (scheduling_ == view_scheduling::weighted_fair) ? select_weighted_fair() : select_strict_priority();
+            if(!v) {
+                return;
+            }
+
+            task = std::move(v->tasks.front());
+            v->tasks.pop_front();
+
+            if(v->queue_limit != (std::numeric_limits<size_t>::max)()) {
+                v->c_enq.notify_one();
+            }
+        }
+
+        task->run();
+        task.reset();
+
+        //! vを保持しているので、finish()の中でビューのデストラクタが戻っても、counterは破棄されない
+        v->counter.finish();
+    }
+
+    //! 以下の関数は、mutex_をロックした状態で呼び出す。
+
+    void activate(view_ptr_t const &v)
+    {
+        if(v->active) {
+            return;
+        }
+
+        v->active = true;
+        v->deficit = 0;
+
+        if(scheduling_ == view_scheduling::weighted_fair) {
+            fair_active_.push_back(v);
+        } else {
+            priority_active_[v->priority].push_back(v);
+        }
+    }
+
+    void deactivate(view_ptr_t const &v)
+    {
+        if(!v->active) {
+            return;
+        }
+
+        v->active = false;
+        v->deficit = 0;
+
+        if(scheduling_ == view_scheduling::weighted_fair) {
+            fair_active_.erase(std::find(fair_active_.begin(), fair_active_.end(), v));
+        } else {
+            auto found = priority_active_.find(v->priority);
+            assert(found != priority_active_.end());
+            auto &views = found->second;
+            views.erase(std::find(views.begin(), views.end(), v));
+            if(views.empty()) {
+                priority_active_.erase(found);
+            }
+        }
+    }
+
+    //! Deficit Round Robinで、タスクを実行するビューを選ぶ
+    view_ptr_t select_weighted_fair()
+    {
+        if(fair_active_.empty()) {
+            return nullptr;
+        }
+
+        view_ptr_t v = fair_active_.front();
+        if(v->deficit == 0) {
+            v->deficit = v->weight;
+        }
+        v->deficit -= 1;
+
+        if(v->tasks.size() == 1) {
+            //! このタスクを取り出すとキューが空になる
+            v->active = false;
+            v->deficit = 0;
+            fair_active_.pop_front();
+        } else if(v->deficit == 0) {
+            //! 今回の巡回で実行できる数を使い切ったので、末尾に回す
+            fair_active_.pop_front();
+            fair_active_.push_back(v);
+        }
+
+        return v;
+    }
+
+    //! 優先度の最も高いビューを選ぶ。優先度が同じビューの間では順番に選ぶ
+    view_ptr_t select_strict_priority()
+    {
+        if(priority_active_.empty()) {
+            return nullptr;
+        }
+
+        auto highest = priority_active_.begin();
+        auto &views = highest->second;
+
+        view_ptr_t v = views.front();
+        views.pop_front();
+
+        if(v->tasks.size() == 1) {
+            v->active = false;
+        } else {
+            views.push_back(v);
+        }
+
+        if(views.empty()) {
+            priority_active_.erase(highest);
+        }
+
+        return v;
+    }
+
+    view_scheduling const       scheduling_;
+    std::atomic<size_t>         num_views_;
+    std::mutex                  mutex_;
+    //! view_scheduling::weighted_fairの場合に、キューにタスクが積まれているビュー
+    std::deque<view_ptr_t>      fair_active_;
+    //! view_scheduling::strict_priorityの場合に、キューにタスクが積まれているビュー（優先度の高い順）
+    std::map<int, std::deque<view_ptr_t>, std::greater<int>>    priority_active_;
+
+    //! run_one()がこのオブジェクトのメンバを参照するので、最初に破棄されるように最後に宣言する
+    std::unique_ptr<task_queue_type>    tq_;
+};
+
+//! @class basic_shared_worker_poolのスレッドでタスクを実行するタスクキュー
+/*!
+	task_queueと同じように、自分のキューとその上限、wait()、wait_before_destructed()を持つが、スレッドを持たない。
+	タスクは、コンストラクタで指定したbasic_shared_worker_poolのスレッドで実行される。
+	コピーもムーブもできない。
+*/
+template<class TaskQueue>
+struct basic_task_queue_view
+{
+    typedef basic_shared_worker_pool<TaskQueue> pool_type;
+
+    //! コンストラクタ
+    /*!
+		@param pool [in] タスクを実行するワーカースレッドの集合。このビューより長く生存しなければならない。
+		@param options [in] キューの上限や、スケジューリングに使用する重みと優先度
+	*/
+    explicit
+    basic_task_queue_view(pool_type &pool, task_queue_view_options const &options = task_queue_view_options())
+        :   pool_(pool)
+        ,   state_(pool.add_view(options))
+        ,   wait_before_destructed_(true)
+    {}
+
+    basic_task_queue_view(basic_task_queue_view const &) = delete;
+    basic_task_queue_view & operator=(basic_task_queue_view const &) = delete;
+
+    //! デストラクタ
+    /*!
+		wait_before_destructed()がtrueの場合
+			このビューに積まれたタスクがすべて実行されるまで待機する。
+		falseの場合
+			このビューのキューに積まれたままのタスクは実行されず、
+			デストラクタ呼び出し時点で取り出されているタスクの終了を待機する。
+		いずれの場合も、スレッドはbasic_shared_worker_poolのものなので終了しない。
+	*/
+    ~basic_task_queue_view()
+    {
+        pool_.remove_view(state_, !wait_before_destructed());
+    }
+
+    //! このビューに新たなタスクを追加
+    /*!
+		このビューのキューがqueue_limitまで埋まっている場合は、空くまで処理をブロックする。
+		@param [in] f 別スレッドで実行したい関数や関数オブジェクト
+		@param [in] fに対して適用したい引数。Movable可能でなければならない。
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+	*/
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&& ... args) ->
+        std::future<typename task_result<F, Args...>::type>
+    {
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef std::promise<result_t> promise_t;
+
+        promise_t promise;
+        auto future(promise.get_future());
+
+        pool_.push(
+            state_,
+            make_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...));
+
+        return future;
+    }
+
+    //! このビューに積まれたタスクがすべて完了するまで待機する
+    /*!
+		他のビューに積まれたタスクは待機しない。
+		@note このビューのタスクの中から呼び出してはならない。
+	*/
+    void    wait() const
+    {
+        state_->counter.wait();
+    }
+
+    //! このビューに積まれたタスクがすべて完了するか、指定時刻になるまで待機する
+    /*!
+		@return 指定時刻までにすべてのタスクが完了した場合はtrue
+	*/
+    template<class TimePoint>
+    bool    wait_until(TimePoint tp) const
+    {
+        return state_->counter.wait_until(tp);
+    }
+
+    //! このビューに積まれたタスクがすべて完了するか、指定時間が経過するまで待機する
+    /*!
+		@return 指定時間内にすべてのタスクが完了した場合はtrue
+	*/
+    template<class Duration>
+    bool    wait_for(Duration dur) const
+    {
+        return state_->counter.wait_for(dur);
+    }
+
+    //! デストラクタで、積まれたタスクがすべて実行されるまで待機するかどうか
+    bool        wait_before_destructed() const
+    {
+        return wait_before_destructed_.load();
+    }
+
+    //! デストラクタで、積まれたタスクがすべて実行されるまで待機するかどうかを設定する
+    void        set_wait_before_destructed(bool state)
+    {
+        wait_before_destructed_.store(state);
+    }
+
+    //! このビューに積まれて、まだ完了していないタスクの数を返す
+    size_t      num_tasks() const
+    {
+        return state_->counter.count();
+    }
+
+    //! タスクを実行するスレッドの数を返す
+    size_t      num_threads() const
+    {
+        return pool_.num_threads();
+    }
+
+    //! view_scheduling::weighted_fairの場合の重みを変更する。次の巡回から反映される
+    void        set_weight(size_t weight)
+    {
+        assert(weight >= 1);
+        std::unique_lock<std::mutex> lock(pool_.mutex_);
+        state_->weight = weight;
+    }
+
+private:
+    pool_type &                             pool_;
+    typename pool_type::view_ptr_t const    state_;
+    std::atomic<bool>                       wait_before_destructed_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::view_scheduling;
+using detail::ns_task::task_queue_view_options;
+using detail::ns_task::shared_worker_task_queue;
+using detail::ns_task::basic_shared_worker_pool;
+using detail::ns_task::basic_task_queue_view;
+
+//! shared_worker_task_queueのスレッドを共有するワーカースレッドの集合と、そのビュー
+using shared_worker_pool = basic_shared_worker_pool<shared_worker_task_queue>;
+using task_queue_view = basic_task_queue_view<shared_worker_task_queue>;
+
+}   //namespace hwm
@@ -0,0 +1,107 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! キャッシュラインのサイズ。偽共有を避けるためのパディングに使用する。
+size_t const cache_line_size = 64;
+
+//! 生産者と消費者が一つずつのロックフリーなリングバッファ
+/*!
+	try_push()は生産者のスレッドからのみ、try_pop()は消費者のスレッドからのみ呼び出せる。
+	生産者が書き込む位置と消費者が読み出す位置は別々のキャッシュラインに置き、互いに干渉しないようにしている。
+	@tparam T 要素の型。デフォルト構築とムーブ代入が可能でなければならない。
+*/
+template<class T>
+struct spsc_ring
+{
+    //! @param capacity 保持できる要素数。2のべき乗に切り上げられる。
+    explicit
+    spsc_ring(size_t capacity)
+        :   closed_(false)
+    {
+        assert(capacity >= 1);
+
+        size_t n = 1;
+        while(n < capacity) { n <<= 1; }
+
+        slots_.resize(n);
+        mask_ = n - 1;
+        head_.store(0);
+        tail_.store(0);
+    }
+
+    spsc_ring(spsc_ring const &) = delete;
+    spsc_ring & operator=(spsc_ring const &) = delete;
+
+    size_t capacity() const { return slots_.size(); }
+
+    //! 要素を追加する
+    /*!
+		@return リングバッファが一杯の場合はfalse。その場合、xはムーブされない。
+	*/
+    bool try_push(T &&x)
+    {
+        size_t const tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+            return false;
+        }
+
+        slots_[tail & mask_] = std::move(x);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //! 要素を取り出す
+    /*!
+		@return リングバッファが空の場合はfalse
+	*/
+    bool try_pop(T &out)
+    {
+        size_t const head = head_.load(std::memory_order_relaxed);
+        if(head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        out = std::move(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    //! 生産者がいなくなったことを記録する
+    void close() { closed_.store(true); }
+    bool is_closed() const { return closed_.load(); }
+
+private:
+    std::vector<T>      slots_;
+    size_t              mask_;
+    std::atomic<bool>   closed_;
+    char                pad0_[cache_line_size];
+    //! 消費者が次に取り出す位置
+    std::atomic<size_t> head_;
+    char                pad1_[cache_line_size];
+    //! 生産者が次に書き込む位置
+    std::atomic<size_t> tail_;
+    char                pad2_[cache_line_size];
+};
+
+}}  //namespace detail::ns_task
+
+}   //namespace hwm
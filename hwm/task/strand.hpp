@@ -0,0 +1,216 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "./task_queue.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! @class ストランド
+/*!
+	タスクキューのスレッドを共有しながら、ストランドに追加されたタスクを
+	追加された順に、一つずつ重ならないように実行する。
+
+	ストランド自身はスレッドを持たず、未実行のタスクがある間だけ、
+	それらを順に実行するタスクを一つだけタスクキューに積む。
+	そのため、ストランドがタスクキューのスレッドを同時に二つ以上使うことはない。
+	また、一度にbatch_size個のタスクを実行したらタスクキューに処理を戻すので、
+	同じタスクキューを共有する他のストランドやタスクが待たされ続けることもない。
+
+	@tparam TaskQueue タスクを実行するタスクキューの型
+	@note タスクキューに処理を戻す時は、タスクキューのスレッドからenqueue()を呼び出す。
+	キューのサイズを制限したタスクキューでは、キューが埋まっているとそのスレッドがブロックし、
+	すべてのスレッドが同時にブロックするとデッドロックになるので、キューのサイズを制限しないタスクキューを使用すること。
+*/
+template<class TaskQueue>
+struct basic_strand
+{
+    typedef TaskQueue						task_queue_type;
+    typedef std::unique_ptr<task_base>		task_ptr_t;
+
+    //! コンストラクタ
+    /*!
+		@param tq [in] タスクを実行するタスクキュー。ストランドに積まれたタスクがすべて実行されるまで破棄してはならない。
+		@param batch_size [in] タスクキューに処理を戻すまでに、連続して実行するタスク数
+	*/
+    explicit
+    basic_strand(task_queue_type &tq, size_t batch_size = 16)
+        :   impl_(std::make_shared<impl>(tq, batch_size))
+    {
+        assert(batch_size >= 1);
+    }
+
+    basic_strand(basic_strand const &) = delete;
+    basic_strand & operator=(basic_strand const &) = delete;
+
+    //! デストラクタ
+    /*!
+		ストランドに積まれたままのタスクは、ストランドの破棄後も順に実行される。
+	*/
+    ~basic_strand()
+    {}
+
+    //! ストランドに新たなタスクを追加
+    /*!
+		@param [in] f 実行したい関数や関数オブジェクト
+		@param [in] fに対して適用したい引数。Movable可能でなければならない。
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+		@exception タスクキューのenqueue()が送出した例外。その場合、タスクはストランドに追加されない。
+		このタスクより前に追加されてまだ実行されていないタスクは、次にタスクが追加された時に実行される。
+	*/
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&& ... args) ->
+        std::future<typename task_result<F, Args...>::type>
+    {
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef std::promise<result_t> promise_t;
+
+        promise_t promise;
+        auto future(promise.get_future());
+
+        impl_->push(
+            make_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...));
+
+        return future;
+    }
+
+    //! タスクキューに処理を戻すまでに、連続して実行するタスク数を返す
+    size_t batch_size() const { return impl_->batch_size_; }
+
+private:
+    //! タスクキューのスレッドで実行されている間も生存していなければならない部分
+    struct impl
+        :   std::enable_shared_from_this<impl>
+    {
+        impl(task_queue_type &tq, size_t batch_size)
+            :   tq_(tq)
+            ,   batch_size_(batch_size)
+            ,   scheduled_(false)
+        {}
+
+        void push(task_ptr_t task)
+        {
+            task_base *const pushed = task.get();
+            bool should_schedule = false;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasks_.push_back(std::move(task));
+                if(!scheduled_) {
+                    scheduled_ = true;
+                    should_schedule = true;
+                }
+            }
+
+            if(should_schedule) {
+                try {
+                    schedule();
+                } catch(...) {
+                    cancel(pushed);
+                    throw;
+                }
+            }
+        }
+
+        //! schedule()に失敗した時に、追加したタスクを取り除いてscheduled_を戻す
+        /*!
+			drain()を実行するタスクは積まれていないので、scheduled_をfalseに戻して、次のpush()でschedule()できるようにする。
+		*/
+        void cancel(task_base *pushed)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            auto const found = std::find_if(tasks_.begin(), tasks_.end(), [pushed](task_ptr_t const &t) {
+                return t.get() == pushed;
+            });
+            assert(found != tasks_.end());
+            tasks_.erase(found);
+            scheduled_ = false;
+        }
+
+        //! 積まれているタスクを順に実行するタスクを、タスクキューに追加する。
+        /*!
+			drain()から呼び出された場合はタスクキューのスレッドでenqueue()を行うので、
+			キューが一杯だとブロックする。（クラスの@noteを参照）
+		*/
+        void schedule()
+        {
+            std::shared_ptr<impl> self = this->shared_from_this();
+            tq_.enqueue([self] { self->drain(); });
+        }
+
+        //! タスクキューのスレッドで、積まれているタスクを最大batch_size_個実行する。
+        /*!
+			scheduled_がtrueの間は、drain()を実行するタスクがタスクキューに一つだけ存在する。
+			タスクの実行中はロックを保持しない。
+			タスクキューに積み直せなかった場合は、続けて次のbatch_size_個を実行する。
+		*/
+        void drain()
+        {
+            for( ; ; ) {
+                for(size_t i = 0; i < batch_size_; ++i) {
+                    task_ptr_t task;
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        if(tasks_.empty()) {
+                            scheduled_ = false;
+                            return;
+                        }
+                        task = std::move(tasks_.front());
+                        tasks_.pop_front();
+                    }
+
+                    task->run();
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if(tasks_.empty()) {
+                        scheduled_ = false;
+                        return;
+                    }
+                }
+
+                //! まだタスクが残っているので、タスクキューの末尾に積み直して他のタスクに順番を譲る。
+                //! 積み直せなかった場合は、残りのタスクが取り残されないように、このスレッドで続けて実行する。
+                try {
+                    schedule();
+                    return;
+                } catch(...) {
+                }
+            }
+        }
+
+        task_queue_type &       tq_;
+        size_t const            batch_size_;
+        std::mutex              mutex_;
+        std::deque<task_ptr_t>  tasks_;
+        bool                    scheduled_;
+    };
+
+    std::shared_ptr<impl>   impl_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::basic_strand;
+
+//! hwm::task_queueのスレッドで実行するストランド
+using strand = basic_strand<task_queue>;
+
+}   //namespace hwm
@@ -5,17 +5,110 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
 namespace hwm {
 
 namespace detail { namespace ns_task {
 
+//! タスクの種類を表すタグ
+/*!
+	enqueue_with_tag()で指定する。タスクの種類ごとに統計情報を集計するために使用する。
+	タグを指定せずに積まれたタスクのタグは0。
+*/
+typedef std::uint32_t task_tag;
+
+//! 計測のためにタスクに付加する情報
+/*!
+	instrumented_policyのタスクキューが作成するタスク（instrumented_task）だけが保持する。
+*/
+struct task_instrumentation
+{
+    task_instrumentation()
+        :   extra_bytes(0)
+        ,   tag(0)
+        ,   record_id(0)
+    {}
+
+    //! タスクが別に確保しているメモリなど、storage_size()に含まれないバイト数
+    std::size_t     extra_bytes;
+    //! タスクの種類を表すタグ
+    task_tag        tag;
+    //! workload_recorderがタスクに割り当てたid。記録していない場合は0
+    std::uint32_t   record_id;
+};
+
 //! タスクキューで扱うタスクを表すベースクラス
+/*!
+	計測のための情報（task_instrumentation）は派生クラスが保持するので、
+	uninstrumented_policyのタスクキューや、strandなどが作成するタスクは、仮想関数テーブルへのポインタだけを持つ。
+	情報を持たないタスクでは、set_extra_bytes()、set_tag()、set_record_id()は何もせず、
+	extra_bytes、tag()、record_id()は0として扱われる。
+*/
 struct task_base
 {
     virtual ~task_base() {}
     virtual void run() = 0;
+
+    //! タスクを実行せずに破棄する場合に、結果として例外を設定する
+    /*!
+		run()の代わりに一度だけ呼び出される。
+	*/
+    virtual void abandon(std::exception_ptr) {}
+
+    //! タスクのオブジェクト自身のサイズ（関数オブジェクトや引数を含む）
+    virtual std::size_t storage_size() const { return sizeof(task_base); }
+
+    //! 計測のための情報。保持していない場合はnullptr
+    virtual task_instrumentation * instrumentation() { return nullptr; }
+    virtual task_instrumentation const * instrumentation() const { return nullptr; }
+
+    //! タスクキューのバイト数の上限の計算に使用する、タスクのサイズ
+    /*!
+		storage_size()に、タスクを積む時に報告された追加のバイト数を加えた値
+	*/
+    std::size_t byte_size() const
+    {
+        task_instrumentation const *info = instrumentation();
+        return storage_size() + (info ? info->extra_bytes : 0);
+    }
+
+    //! タスクが別に確保しているメモリなど、storage_size()に含まれないバイト数を設定する
+    void set_extra_bytes(std::size_t bytes)
+    {
+        if(task_instrumentation *info = instrumentation()) { info->extra_bytes = bytes; }
+    }
+
+    //! タスクの種類を表すタグ
+    task_tag tag() const
+    {
+        task_instrumentation const *info = instrumentation();
+        return info ? info->tag : 0;
+    }
+
+    //! タスクの種類を表すタグを設定する
+    void set_tag(task_tag tag)
+    {
+        if(task_instrumentation *info = instrumentation()) { info->tag = tag; }
+    }
+
+    //! workload_recorderがタスクに割り当てたid。記録していない場合は0
+    std::uint32_t record_id() const
+    {
+        task_instrumentation const *info = instrumentation();
+        return info ? info->record_id : 0;
+    }
+
+    void set_record_id(std::uint32_t id)
+    {
+        if(task_instrumentation *info = instrumentation()) { info->record_id = id; }
+    }
 };
 
 }}  //namespace detail::ns_task
 
+using detail::ns_task::task_tag;
+
 }   //namespace hwm
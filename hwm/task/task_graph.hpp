@@ -0,0 +1,317 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! @class タスクの依存関係グラフ
+/*!
+	ノード（タスク）と、ノード間の依存関係（エッジ）を登録しておき、
+	run()でタスクキューに流し込んで実行する。
+	各ノードは先行ノードの数をatomicなカウンタとして保持し、
+	最後の先行ノードが完了した時点でそのノードがタスクキューに追加される。
+	そのため、トポロジカルソートした順に一段ずつenqueue()とwait()を繰り返す場合と違って、
+	段の境目でスレッドが遊ぶことがない。
+
+	グラフの構造はrun()の後も保持されるので、同じグラフを何度でも実行し直せる。
+*/
+struct task_graph
+{
+    typedef size_t node_id;
+
+    task_graph()
+        :   running_(false)
+        ,   validated_(true)
+        ,   remaining_(0)
+        ,   failed_(false)
+    {}
+
+    task_graph(task_graph const &) = delete;
+    task_graph & operator=(task_graph const &) = delete;
+
+    //! デストラクタ
+    /*!
+		@note run()で開始した実行が完了する前にデストラクタを呼び出してはならない。
+	*/
+    ~task_graph()
+    {
+        assert(!running_);
+    }
+
+    //! ノードを追加する
+    /*!
+		@param [in] f ノードが実行される時に呼び出される関数や関数オブジェクト。
+		グラフが実行されるたびに呼び出されるので、コピー可能で繰り返し呼び出せるものでなければならない。
+		@return 追加したノードを表すid
+	*/
+    template<class F>
+    node_id add_node(F f)
+    {
+        assert(!running_);
+
+        std::unique_ptr<node> n(new node(std::function<void()>(std::move(f))));
+        nodes_.push_back(std::move(n));
+        return nodes_.size() - 1;
+    }
+
+    //! 先行ノードを指定してノードを追加する
+    /*!
+		@param [in] f ノードが実行される時に呼び出される関数や関数オブジェクト。
+		@param [in] predecessors 追加するノードより先に完了していなければならないノードのid
+		@return 追加したノードを表すid
+	*/
+    template<class F>
+    node_id add_node(F f, std::initializer_list<node_id> predecessors)
+    {
+        node_id const id = add_node(std::move(f));
+        for(node_id pred: predecessors) {
+            precede(pred, id);
+        }
+        return id;
+    }
+
+    //! ノード間に依存関係を追加する
+    /*!
+		@param [in] before 先に実行されるノード
+		@param [in] after beforeの完了後に実行されるノード
+	*/
+    void precede(node_id before, node_id after)
+    {
+        assert(!running_);
+        assert(before < nodes_.size());
+        assert(after < nodes_.size());
+        assert(before != after);
+
+        nodes_[before]->successors.push_back(after);
+        nodes_[after]->num_predecessors += 1;
+        validated_ = false;
+    }
+
+    //! 登録されているノード数を返す
+    size_t size() const { return nodes_.size(); }
+
+    //! ノードが登録されていないかどうかを返す
+    bool empty() const { return nodes_.empty(); }
+
+    //! グラフの実行を開始する
+    /*!
+		先行ノードを持たないノードをタスクキューに追加し、あとは各ノードの完了に応じて後続ノードを順次追加していく。
+		@tparam TaskQueue task_queue_with_allocatorのように、enqueue(f)メンバ関数を持つ型
+		@param [in] tq ノードを実行するタスクキュー
+		@return すべてのノードの完了とshared stateを共有するstd::future。
+		いずれかのノードが例外を送出した場合、それ以降に実行されるはずだったノードは呼び出されず、
+		最初に送出された例外がこのstd::futureに設定される。
+		ノードをタスクキューに追加できなかった場合（enqueue()が例外を送出した場合）も同様に、
+		そのノードとそれ以降のノードは呼び出されず、その例外が設定される。
+		@exception std::logic_error グラフが循環している場合
+
+		@note 実行が完了する（戻り値のstd::futureが準備完了になる）までは、このグラフを変更したり、run()を呼び出したりしてはならない。
+		@note ノードはタスクキューのスレッドから後続ノードをenqueue()するので、
+		キューのサイズを制限したタスクキューで実行すると、キューが埋まった時にスレッドがすべてブロックする可能性がある。
+	*/
+    template<class TaskQueue>
+    std::future<void> run(TaskQueue &tq)
+    {
+        assert(!running_);
+
+        if(!validated_) {
+            check_acyclic();
+            validated_ = true;
+        }
+
+        promise_ = std::promise<void>();
+        auto future = promise_.get_future();
+
+        if(nodes_.empty()) {
+            promise_.set_value();
+            return future;
+        }
+
+        running_ = true;
+        failed_.store(false);
+        exception_ = nullptr;
+        remaining_.store(nodes_.size());
+
+        for(auto &n: nodes_) {
+            n->pending.store(n->num_predecessors);
+        }
+
+        for(node_id id = 0; id < nodes_.size(); ++id) {
+            if(nodes_[id]->num_predecessors == 0 && !try_submit(tq, id)) {
+                complete(tq, id);
+            }
+        }
+
+        return future;
+    }
+
+private:
+    struct node
+    {
+        explicit
+        node(std::function<void()> f)
+            :   fn(std::move(f))
+            ,   num_predecessors(0)
+            ,   pending(0)
+        {}
+
+        std::function<void()>   fn;
+        std::vector<node_id>    successors;
+        size_t                  num_predecessors;
+        std::atomic<size_t>     pending;
+    };
+
+    std::vector<std::unique_ptr<node>>  nodes_;
+    bool                                running_;
+    bool                                validated_;
+    std::atomic<size_t>                 remaining_;
+    std::atomic<bool>                   failed_;
+    std::mutex                          exception_mutex_;
+    std::exception_ptr                  exception_;
+    std::promise<void>                  promise_;
+
+private:
+    //! ノードをタスクキューに追加する
+    /*!
+		@return enqueue()が例外を送出した場合は、その例外を記録してfalseを返す
+	*/
+    template<class TaskQueue>
+    bool try_submit(TaskQueue &tq, node_id id)
+    {
+        try {
+            tq.enqueue([this, &tq, id] { execute(tq, id); });
+            return true;
+        } catch(...) {
+            set_exception(std::current_exception());
+            return false;
+        }
+    }
+
+    template<class TaskQueue>
+    void execute(TaskQueue &tq, node_id id)
+    {
+        if(!failed_.load()) {
+            try {
+                nodes_[id]->fn();
+            } catch(...) {
+                set_exception(std::current_exception());
+            }
+        }
+
+        complete(tq, id);
+    }
+
+    //! ノードの完了を記録して、先行ノードがすべて完了した後続ノードをタスクキューに追加する
+    /*!
+		タスクキューに追加できなかったノードは、実行せずにこのスレッドで完了したものとして扱う。
+		そのノードの後続ノードも同じように辿るので、追加に失敗しても残りのノード数は0まで減り、finish()が呼び出される。
+	*/
+    template<class TaskQueue>
+    void complete(TaskQueue &tq, node_id id)
+    {
+        std::vector<node_id> unsubmitted;
+
+        for( ; ; ) {
+            for(node_id succ: nodes_[id]->successors) {
+                if(nodes_[succ]->pending.fetch_sub(1) == 1 && !try_submit(tq, succ)) {
+                    unsubmitted.push_back(succ);
+                }
+            }
+
+            //! unsubmittedに残っているノードはまだ数えられているので、ここで0になるのはunsubmittedが空の時だけ
+            if(remaining_.fetch_sub(1) == 1) {
+                assert(unsubmitted.empty());
+                finish();
+                return;
+            }
+
+            if(unsubmitted.empty()) {
+                return;
+            }
+
+            id = unsubmitted.back();
+            unsubmitted.pop_back();
+        }
+    }
+
+    //! 最初に発生した例外を記録して、以降のノードを呼び出さないようにする
+    void set_exception(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock(exception_mutex_);
+        if(!exception_) {
+            exception_ = e;
+        }
+        failed_.store(true);
+    }
+
+    //! 最後のノードが完了した時に呼び出される
+    void finish()
+    {
+        //! promiseをローカルに移してからshared stateを準備完了にする。
+        //! 準備完了になった直後に、待機していたスレッドがこのグラフを破棄することがあるため、
+        //! それ以降はメンバ変数に触れないようにする。
+        std::promise<void> promise(std::move(promise_));
+        std::exception_ptr e = exception_;
+        exception_ = nullptr;
+        running_ = false;
+
+        if(e) {
+            promise.set_exception(e);
+        } else {
+            promise.set_value();
+        }
+    }
+
+    //! グラフが循環していないかを確認する
+    void check_acyclic() const
+    {
+        std::vector<size_t> in_degree(nodes_.size());
+        std::vector<node_id> ready;
+
+        for(node_id id = 0; id < nodes_.size(); ++id) {
+            in_degree[id] = nodes_[id]->num_predecessors;
+            if(in_degree[id] == 0) {
+                ready.push_back(id);
+            }
+        }
+
+        size_t visited = 0;
+        while(!ready.empty()) {
+            node_id const id = ready.back();
+            ready.pop_back();
+            ++visited;
+
+            for(node_id succ: nodes_[id]->successors) {
+                if(--in_degree[succ] == 0) {
+                    ready.push_back(succ);
+                }
+            }
+        }
+
+        if(visited != nodes_.size()) {
+            throw std::logic_error("hwm::task_graph: the graph has a cycle.");
+        }
+    }
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::task_graph;
+
+}   //namespace hwm
@@ -6,9 +6,12 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
 #include <future>
+#include <memory>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 
 #include "./task_base.hpp"
 
@@ -45,26 +48,148 @@ struct make_index_tuple
 };
 
 
+//! std::reference_wrapperかどうかを判定する
+template<class T>
+struct is_reference_wrapper
+    :   std::false_type
+{};
+
+template<class T>
+struct is_reference_wrapper<std::reference_wrapper<T>>
+    :   std::true_type
+{};
+
+//! メンバポインタを呼び出す対象のオブジェクトを取得する（Cまたはその派生クラスのオブジェクト）
+template<class C, class T>
+auto invoke_object(T &&t,
+                   typename std::enable_if<
+                        std::is_base_of<C, typename std::decay<T>::type>::value
+                   >::type * = nullptr)
+    -> T &&
+{
+    return std::forward<T>(t);
+}
+
+//! メンバポインタを呼び出す対象のオブジェクトを取得する（std::reference_wrapper）
+template<class C, class T>
+auto invoke_object(T &&t,
+                   typename std::enable_if<
+                        is_reference_wrapper<typename std::decay<T>::type>::value
+                   >::type * = nullptr)
+    -> decltype(t.get())
+{
+    return t.get();
+}
+
+//! メンバポインタを呼び出す対象のオブジェクトを取得する（ポインタやスマートポインタ）
+template<class C, class T>
+auto invoke_object(T &&t,
+                   typename std::enable_if<
+                        !std::is_base_of<C, typename std::decay<T>::type>::value &&
+                        !is_reference_wrapper<typename std::decay<T>::type>::value
+                   >::type * = nullptr)
+    -> decltype(*std::forward<T>(t))
+{
+    return *std::forward<T>(t);
+}
+
+//! C++17のstd::invokeに相当する関数（メンバ関数へのポインタ）
+/*!
+	このライブラリはC++11でビルドできるようにしているので、std::invokeの代わりにこれを使用する。
+	std::invokeと同じく、ADLで他の関数が選ばれないように修飾名で呼び出すこと。
+*/
+template<class R, class C, class T, class... Args>
+auto invoke(R C::*f, T &&t, Args&&... args)
+    -> typename std::enable_if<
+            std::is_function<R>::value,
+            decltype((invoke_object<C>(std::forward<T>(t)).*f)(std::forward<Args>(args)...))
+       >::type
+{
+    return (invoke_object<C>(std::forward<T>(t)).*f)(std::forward<Args>(args)...);
+}
+
+//! C++17のstd::invokeに相当する関数（メンバ変数へのポインタ）
+template<class R, class C, class T>
+auto invoke(R C::*f, T &&t)
+    -> typename std::enable_if<
+            !std::is_function<R>::value,
+            decltype(invoke_object<C>(std::forward<T>(t)).*f)
+       >::type
+{
+    return invoke_object<C>(std::forward<T>(t)).*f;
+}
+
+//! C++17のstd::invokeに相当する関数（関数や関数オブジェクト）
+template<class F, class... Args>
+auto invoke(F &&f, Args&&... args)
+    -> decltype(std::forward<F>(f)(std::forward<Args>(args)...))
+{
+    return std::forward<F>(f)(std::forward<Args>(args)...);
+}
+
+//! enqueue()に渡された関数と引数から、タスクの戻り値の型を求める
+/*!
+	タスクに保持された関数と引数は、右辺値として呼び出される。（std::asyncやstd::threadと同じ）
+*/
+template<class F, class... Args>
+struct task_result
+{
+    typedef
+        decltype(ns_task::invoke(
+            std::declval<typename std::decay<F>::type>(),
+            std::declval<typename std::decay<Args>::type>()...))
+    type;
+};
+
+//! 関数オブジェクトをタスク内で直接構築することを指定するタグ
+struct in_place_t {};
+
 //! F and Args are decayed
-template<class Ret, class F, class... Args>
+/*!
+	関数と引数は、enqueue()に渡されたものから直接func_とargs_に構築される。
+	そのため、呼び出し元からタスクまでの間に、各引数は一度だけコピーまたはムーブされる。
+	ムーブのみ可能な関数オブジェクト（std::packaged_taskなど）や引数（std::unique_ptrなど）も扱える。
+	Promiseは、std::promiseやlight_promiseのように、結果の型を唯一のテンプレート引数に取り、
+	set_value()とset_exception()を持つ型。
+*/
+template<class Promise, class F, class... Args>
 struct task_impl
     :   task_base
 {
-    typedef std::promise<Ret> promise_t;
+    typedef Promise promise_t;
 
-    typedef std::tuple<typename std::decay<F>::type, typename std::decay<Args>::type...> bound_t;
+    typedef std::tuple<Args...> bound_t;
 
+    template<class Func, class... FuncArgs>
     task_impl(  promise_t && promise,
-                typename std::decay<F>::type f,
-                typename std::decay<Args>::type... args )
+                Func && f,
+                FuncArgs&&... args )
         :   promise_(std::move(promise))
-        ,   bound_(std::move(f), std::move(args)...)
+        ,   func_(std::forward<Func>(f))
+        ,   bound_(std::forward<FuncArgs>(args)...)
     {}
 
+    //! 関数オブジェクトを、コンストラクタ引数から直接構築する
+    template<class... CtorArgs>
+    task_impl(  in_place_t,
+                promise_t && promise,
+                CtorArgs&&... ctor_args )
+        :   promise_(std::move(promise))
+        ,   func_(std::forward<CtorArgs>(ctor_args)...)
+        ,   bound_()
+    {
+        static_assert(sizeof...(Args) == 0, "in-place construction does not take arguments for the function.");
+    }
+
     task_impl(task_impl const &) = delete;
     task_impl &
         operator=(task_impl const &) = delete;
 
+    std::size_t storage_size() const override
+    {
+        return sizeof(*this);
+    }
+
 private:
     void run() override final
     {
@@ -72,52 +197,103 @@ private:
         invoke_task(index_t());
     }
 
+    void abandon(std::exception_ptr e) override final
+    {
+        promise_.set_exception(e);
+    }
+
     template<std::size_t... Indecies>
     void invoke_task(index_tuple<Indecies...>)
     {
 		try {
 			invoke_impl(
 				promise_,
-				std::move(std::get<0>(bound_)),
-				std::move(std::get<Indecies+1>(bound_))... );
+				std::move(func_),
+				std::move(std::get<Indecies>(bound_))... );
 		} catch(...) {
 			promise_.set_exception(std::current_exception());
 		}
     }
 
-	template<class Func, class... FuncArgs>
-	static void invoke_impl(std::promise<void> &promise, Func &&f, FuncArgs&&... args)
+	template<template<class> class PromiseT, class Func, class... FuncArgs>
+	static void invoke_impl(PromiseT<void> &promise, Func &&f, FuncArgs&&... args)
 	{
-        std::bind(std::forward<Func>(f), std::forward<FuncArgs>(args)...)();
+        ns_task::invoke(std::forward<Func>(f), std::forward<FuncArgs>(args)...);
 		promise.set_value();
 	}
 
-	template<class FuncRet, class Func, class... FuncArgs>
-	static void invoke_impl(std::promise<FuncRet> &promise, Func &&f, FuncArgs&&... args)
+	template<template<class> class PromiseT, class FuncRet, class Func, class... FuncArgs>
+	static void invoke_impl(PromiseT<FuncRet> &promise, Func &&f, FuncArgs&&... args)
 	{
 		promise.set_value(
-			std::bind(std::forward<Func>(f), std::forward<FuncArgs>(args)...)()
+			ns_task::invoke(std::forward<Func>(f), std::forward<FuncArgs>(args)...)
 			);
 	}
 
 private:
     promise_t   promise_;
+    F           func_;
     bound_t     bound_;
 };
 
-template<class Ret, class F, class... Args>
+//! 計測のための情報を付加したタスク
+/*!
+	instrumented_policyのタスクキューは、タスクをこの型で作成する。
+	@tparam Task task_implの型
+*/
+template<class Task>
+struct instrumented_task
+    :   Task
+{
+    template<class... CtorArgs>
+    explicit
+    instrumented_task(CtorArgs&&... ctor_args)
+        :   Task(std::forward<CtorArgs>(ctor_args)...)
+    {}
+
+    std::size_t storage_size() const override final
+    {
+        return sizeof(*this);
+    }
+
+    task_instrumentation * instrumentation() override final { return &instrumentation_; }
+    task_instrumentation const * instrumentation() const override final { return &instrumentation_; }
+
+private:
+    task_instrumentation    instrumentation_;
+};
+
+template<class Promise, class F, class... Args>
 std::unique_ptr<task_base>
-    make_task(std::promise<Ret>&& promise, F f, Args... args)
+    make_task(Promise&& promise, F&& f, Args&&... args)
 {
     return
         std::unique_ptr<task_base>(
-            new task_impl<Ret, F, Args...> (
-                std::move(promise),
+            new task_impl<
+                    typename std::decay<Promise>::type,
+                    typename std::decay<F>::type,
+                    typename std::decay<Args>::type...
+                > (
+                std::forward<Promise>(promise),
                 std::forward<F>(f),
                 std::forward<Args>(args)...
             ));
 }
 
+//! 関数オブジェクトをタスク内で直接構築する
+template<class F, class Promise, class... CtorArgs>
+std::unique_ptr<task_base>
+    make_task_in_place(Promise&& promise, CtorArgs&&... ctor_args)
+{
+    return
+        std::unique_ptr<task_base>(
+            new task_impl<typename std::decay<Promise>::type, F> (
+                in_place_t(),
+                std::forward<Promise>(promise),
+                std::forward<CtorArgs>(ctor_args)...
+            ));
+}
+
 }}  //namespace detail::ns_task
 
 }   //namespace hwm
@@ -0,0 +1,378 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "./task_base.hpp"
+#include "./task_queue_metrics.hpp"
+
+#if defined(__linux__) && !defined(HWM_TASK_NO_PERF_EVENTS)
+    #define HWM_TASK_HAS_PERF_EVENTS 1
+    #include <linux/perf_event.h>
+    #include <sys/ioctl.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! @class perf_event_open()で開いたカウンタのグループ
+/*!
+	CPUサイクル数、命令数、最終レベルキャッシュのミス数、コンテキストスイッチの回数のカウンタを、
+	構築したスレッドを対象に開く。開けたカウンタのうち最初のものをグループリーダーにして、
+	read()一回でまとめて読み出せるようにする。
+	環境によって開けないカウンタは読み出し値が0のままになる。開けたかどうかはカウンタごとにis_open()で確認できる。
+	（HWM_TASK_NO_PERF_EVENTSを定義すると、Linuxでもperf_event_open()を使用しない）
+*/
+struct perf_event_group
+{
+    //! カウンタの種類
+    enum event_index {
+        cycles_index,
+        instructions_index,
+        llc_misses_index,
+        context_switches_index,
+        num_events
+    };
+
+    struct values
+    {
+        values() { std::fill(v, v + num_events, std::uint64_t(0)); }
+        std::uint64_t v[num_events];
+    };
+
+    perf_event_group()
+        :   leader_(-1)
+        ,   num_opened_(0)
+    {
+        std::fill(order_, order_ + num_events, -1);
+        std::fill(opened_, opened_ + num_events, false);
+
+#if defined(HWM_TASK_HAS_PERF_EVENTS)
+        static std::uint32_t const types[num_events] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_SOFTWARE
+        };
+        static std::uint64_t const configs[num_events] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_SW_CONTEXT_SWITCHES
+        };
+
+        for(int i = 0; i < num_events; ++i) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = types[i];
+            attr.config = configs[i];
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = (leader_ == -1) ? 1 : 0;
+            //! コンテキストスイッチはカーネルの中で数えられるので、ソフトウェアイベントはカーネルを除外しない
+            attr.exclude_kernel = (types[i] == PERF_TYPE_HARDWARE) ? 1 : 0;
+            attr.exclude_hv = 1;
+
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if(fd == -1 && !attr.exclude_kernel) {
+                //! perf_event_paranoidの設定によってはカーネルを含めて数えられないので、除外して開き直す
+                attr.exclude_kernel = 1;
+                fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            }
+            if(fd == -1) {
+                continue;
+            }
+
+            if(leader_ == -1) {
+                leader_ = fd;
+            }
+            fds_[num_opened_] = fd;
+            order_[num_opened_] = i;
+            ++num_opened_;
+            opened_[i] = true;
+        }
+
+        if(leader_ != -1) {
+            ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    ~perf_event_group()
+    {
+#if defined(HWM_TASK_HAS_PERF_EVENTS)
+        for(int i = 0; i < num_opened_; ++i) {
+            close(fds_[i]);
+        }
+#endif
+    }
+
+    perf_event_group(perf_event_group const &) = delete;
+    perf_event_group & operator=(perf_event_group const &) = delete;
+
+    //! i番目のカウンタを開けたかどうか
+    bool is_open(event_index i) const { return opened_[i]; }
+
+    //! ハードウェアカウンタ（CPUサイクル数）を開けたかどうか
+    /*!
+		ソフトウェアカウンタだけを開けた場合はfalseを返す。
+	*/
+    bool available() const { return opened_[cycles_index]; }
+
+    //! 開けたカウンタを、task_perf_countersの項目ごとに返す
+    perf_counter_availability availability() const
+    {
+        perf_counter_availability a;
+        a.cycles = opened_[cycles_index];
+        a.instructions = opened_[instructions_index];
+        a.llc_misses = opened_[llc_misses_index];
+        a.context_switches = opened_[context_switches_index];
+        return a;
+    }
+
+    //! カウンタの現在値を読み出す
+    /*!
+		@return 読み出せなかった場合はfalse
+	*/
+    bool read(values &out) const
+    {
+#if defined(HWM_TASK_HAS_PERF_EVENTS)
+        if(leader_ == -1) {
+            return false;
+        }
+
+        //! PERF_FORMAT_GROUPでは、カウンタの数に続いて、グループに追加した順に値が並ぶ
+        std::uint64_t buf[1 + num_events];
+        ssize_t const size = ::read(leader_, buf, sizeof(buf));
+        if(size < static_cast<ssize_t>(sizeof(std::uint64_t)) || buf[0] != static_cast<std::uint64_t>(num_opened_)) {
+            return false;
+        }
+
+        for(int i = 0; i < num_opened_; ++i) {
+            out.v[order_[i]] = buf[1 + i];
+        }
+        return true;
+#else
+        (void)out;
+        return false;
+#endif
+    }
+
+private:
+    int     leader_;
+    int     num_opened_;
+    int     fds_[num_events];
+    //! グループに追加したi番目のカウンタの種類
+    int     order_[num_events];
+    //! 種類ごとの、カウンタを開けたかどうか
+    bool    opened_[num_events];
+};
+
+//! @class タスクキューのスレッドごとに、タスクの実行時の統計情報を集計する
+/*!
+	スレッドの開始時に構築し、そのスレッドで実行したタスクの統計情報をタグごとに保持する。
+	集計はそのスレッドだけが行い、mutex_は統計情報を読み出すmetrics()との間でだけ競合する。
+*/
+struct task_perf_sampler
+{
+    //! タスクの実行前に読み出した値
+    struct sample
+    {
+        std::chrono::steady_clock::time_point   start;
+        perf_event_group::values                values;
+        bool                                    has_values;
+    };
+
+    sample begin() const
+    {
+        sample s;
+        s.has_values = events_.read(s.values);
+        s.start = std::chrono::steady_clock::now();
+        return s;
+    }
+
+    void end(sample const &s, task_tag tag)
+    {
+        auto const end_time = std::chrono::steady_clock::now();
+
+        task_perf_counters delta;
+        delta.num_tasks = 1;
+        delta.total_nanoseconds =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - s.start).count();
+
+        perf_event_group::values now;
+        if(s.has_values && events_.read(now)) {
+            delta.cycles = now.v[perf_event_group::cycles_index] - s.values.v[perf_event_group::cycles_index];
+            delta.instructions = now.v[perf_event_group::instructions_index] - s.values.v[perf_event_group::instructions_index];
+            delta.llc_misses = now.v[perf_event_group::llc_misses_index] - s.values.v[perf_event_group::llc_misses_index];
+            delta.context_switches = now.v[perf_event_group::context_switches_index] - s.values.v[perf_event_group::context_switches_index];
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        counters_[tag] += delta;
+    }
+
+    perf_counter_availability availability() const { return events_.availability(); }
+
+    //! 集計した値をoutに加算する
+    void collect(std::map<task_tag, task_perf_counters> &out) const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for(auto const &entry: counters_) {
+            out[entry.first] += entry.second;
+        }
+    }
+
+private:
+    perf_event_group                        events_;
+    std::mutex mutable                      mutex_;
+    std::map<task_tag, task_perf_counters>  counters_;
+};
+
+//! 現在のスレッドで統計情報を集計しているtask_perf_samplerへの参照を返す
+/*!
+	タスクキューのスレッドでない場合や、計測が有効でない場合はnullptrが登録されている。
+*/
+inline
+task_perf_sampler *& current_perf_sampler()
+{
+    static thread_local task_perf_sampler *sampler = nullptr;
+    return sampler;
+}
+
+//! @class タスクキュー全体の統計情報を管理する
+/*!
+	各スレッドはthread_scopeを構築してtask_perf_samplerを登録する。
+	スレッドが終了する時は、そのスレッドの統計情報をretired_に移してから登録を解除する。
+*/
+struct task_profiler
+{
+    task_profiler()
+        :   enabled_(false)
+    {}
+
+    task_profiler(task_profiler const &) = delete;
+    task_profiler & operator=(task_profiler const &) = delete;
+
+    //! @param enabled task_queue_options::enable_perf_countersの値
+    void setup(bool enabled) { enabled_ = enabled; }
+
+    bool enabled() const { return enabled_; }
+
+    //! スレッドの処理の間、そのスレッドのtask_perf_samplerを登録しておくためのクラス
+    struct thread_scope
+    {
+        explicit
+        thread_scope(task_profiler &profiler)
+            :   profiler_(profiler.enabled() ? &profiler : nullptr)
+        {
+            if(profiler_) {
+                sampler_.reset(new task_perf_sampler());
+                profiler_->add(sampler_.get());
+                current_perf_sampler() = sampler_.get();
+            }
+        }
+
+        ~thread_scope()
+        {
+            if(profiler_) {
+                current_perf_sampler() = nullptr;
+                profiler_->remove(sampler_.get());
+            }
+        }
+
+        thread_scope(thread_scope const &) = delete;
+        thread_scope & operator=(thread_scope const &) = delete;
+
+    private:
+        task_profiler *                     profiler_;
+        std::unique_ptr<task_perf_sampler>  sampler_;
+    };
+
+    //! タスクを実行して、現在のスレッドのtask_perf_samplerに集計する
+    template<class Task>
+    void run(Task &task)
+    {
+        task_perf_sampler *sampler = current_perf_sampler();
+        if(!sampler) {
+            task.run();
+            return;
+        }
+
+        auto const s = sampler->begin();
+        task.run();
+        sampler->end(s, task.tag());
+    }
+
+    //! 集計した統計情報をmに設定する
+    void collect(task_queue_metrics &m) const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        m.task_counters = retired_;
+        m.perf_counters_available = available_.cycles;
+        m.available_perf_counters = available_;
+        for(auto const *sampler: samplers_) {
+            sampler->collect(m.task_counters);
+        }
+    }
+
+private:
+    void add(task_perf_sampler *sampler)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        samplers_.push_back(sampler);
+        available_ |= sampler->availability();
+    }
+
+    void remove(task_perf_sampler *sampler)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        sampler->collect(retired_);
+        samplers_.erase(std::find(samplers_.begin(), samplers_.end(), sampler));
+    }
+
+    bool                                    enabled_;
+    std::mutex mutable                      mutex_;
+    std::vector<task_perf_sampler *>        samplers_;
+    //! 終了したスレッドで集計された統計情報
+    std::map<task_tag, task_perf_counters>  retired_;
+    //! いずれかのスレッドで開けたカウンタ
+    perf_counter_availability               available_;
+};
+
+//! 統計情報を集計しない
+struct null_task_profiler
+{
+    void setup(bool enabled)
+    {
+        assert(!enabled && "enable_perf_counters requires instrumented_policy.");
+        (void)enabled;
+    }
+
+    static bool enabled() { return false; }
+
+    struct thread_scope
+    {
+        explicit
+        thread_scope(null_task_profiler &) {}
+    };
+
+    template<class Task>
+    void run(Task &task) { task.run(); }
+
+    void collect(task_queue_metrics &) const {}
+};
+
+}}  //namespace detail::ns_task
+
+}   //namespace hwm
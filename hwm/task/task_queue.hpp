@@ -6,14 +6,33 @@
 #pragma once
 
 #include <cassert>
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
 #include <limits>
+#include <memory>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "./blocking_scope.hpp"
+#include "./deadline_queue.hpp"
+#include "./eventcount.hpp"
 #include "./locked_queue.hpp"
+#include "./reactor.hpp"
+#include "./realtime_ring.hpp"
 #include "./task_impl.hpp"
+#include "./task_queue_metrics.hpp"
+#include "./task_queue_options.hpp"
+#include "./task_queue_policies.hpp"
+#include "./task_ring.hpp"
+#include "./task_stream.hpp"
+#include "./task_watchdog.hpp"
+#include "./worker_local.hpp"
 
 namespace hwm {
 
@@ -22,25 +41,37 @@ namespace detail { namespace ns_task {
 //! @class タスクキュークラス
 /*!
 	内部にスレッドプールを持ち、enqueue()メソッドに渡された関数をいずれかのスレッドで実行する。
+	@tparam Policies キューの実装や、待機の方法、結果の返し方などをコンパイル時に指定するtask_queue_policies。
+	デフォルトの構成はtask_queueと同じ。
 */
-template<template<class...> class Allocator = std::allocator>
-struct task_queue_with_allocator
+template<class Policies = task_queue_policies<>>
+struct basic_task_queue
+    :   private blocking_listener
 {
+    typedef Policies                            policies;
     typedef std::unique_ptr<task_base>			task_ptr_t;
-	typedef Allocator<task_ptr_t>				allocator;
-	typedef locked_queue<task_ptr_t, std::deque<task_ptr_t, allocator>>
+	typedef typename Policies::queue_policy::template queue<task_ptr_t>::type
 												queue_type;
+    typedef typename Policies::result_policy    result_policy;
+
+    //! 結果の型がRのタスクについて、enqueue()が返す型
+    template<class R>
+    using future_type = typename result_policy::template future<R>::type;
+
+    //! 結果の型がRのタスクが保持するpromiseの型
+    template<class R>
+    using promise_type = typename result_policy::template promise<R>::type;
 
     //! デフォルトコンストラクタ
     //! std::thread::hardware_concurrency()分だけスレッドを起動する
-    task_queue_with_allocator()
-        :   task_queue_()
-        ,   terminated_flag_(false)
-        ,   task_count_(0)
+    basic_task_queue()
+        :   terminated_flag_(false)
         ,   wait_before_destructed_(true)
     {
         setup(
-            (std::max)(std::thread::hardware_concurrency(), 1u)
+            (std::max)(std::thread::hardware_concurrency(), 1u),
+            (std::numeric_limits<size_t>::max)(),
+            task_queue_options()
             );
     }
 
@@ -54,16 +85,33 @@ struct task_queue_with_allocator
 		同時に実行されるタスク数の上限を設定したい場合は、@a queue_limitよりも @a num_threadsを使用するほうが良い
 	*/
     explicit
-    task_queue_with_allocator(size_t num_threads, size_t queue_limit = ((std::numeric_limits<size_t>::max)()))
-        :   task_queue_(queue_limit)
-        ,   terminated_flag_(false)
-        ,   task_count_(0)
+    basic_task_queue(size_t num_threads, size_t queue_limit = ((std::numeric_limits<size_t>::max)()))
+        :   terminated_flag_(false)
+        ,   wait_before_destructed_(true)
+    {
+        assert(num_threads >= 1);
+        assert(queue_limit >= 1);
+
+        setup(num_threads, queue_limit, task_queue_options());
+    }
+
+    //! コンストラクタ
+    /*
+		引数に指定された値だけスレッドを起動し、オプションに従ってキューを構成する
+		@param thread_limit [in] 起動する引数の数
+		@param queue_limit [in] キューに保持できるタスク数の限界。
+		シャードごとに適用するか、全体に適用するかは@a options.limit_scopeで指定する。
+		@param options [in] キューの構成を指定するオプション
+	*/
+    basic_task_queue(size_t num_threads, size_t queue_limit, task_queue_options const &options)
+        :   terminated_flag_(false)
         ,   wait_before_destructed_(true)
     {
         assert(num_threads >= 1);
         assert(queue_limit >= 1);
+        assert(options.num_shards >= 1);
 
-        setup(num_threads);
+        setup(num_threads, queue_limit, options);
     }
 
     //! デストラクタ
@@ -74,82 +122,569 @@ struct task_queue_with_allocator
 			キューに積まれたままのタスクは実行されず、
 			デストラクタ呼び出し時点で取り出されているタスクの終了を待機してからスレッドを終了する。
 		@note wait_before_destructed()はデフォルトでtrue
+		@note uncounted_policyを指定した場合はタスク数を数えないので、wait_before_destructed()によらず、
+		積まれたままのタスクは実行されない。
 	*/
-    ~task_queue_with_allocator()
+    ~basic_task_queue()
     {
         if(wait_before_destructed()) {
-            wait();
+            wait_all_tasks(std::integral_constant<bool, task_counter_type::enabled>());
         }
 
-		set_terminate_flag(true);
+        //! スロットの登録はスレッドの終了時に解除されるので、ウォッチドッグのオブジェクトはjoin_threads()の後まで残す。
+        stop_watchdog(watchdog_tag());
 
-		//! Add dummy tasks to resume all threads,
-		//! so the threads check terminate flag and then terminate itself.
-		for(size_t i = 0; i < num_threads(); ++i) {
-			enqueue([]{});
+		{
+			//! 待機中の補償スレッドがis_terminated()の変化を見逃さないように、
+			//! compensation_mutexをロックした状態でフラグを変更する。
+			//! また、新たにスレッドが起動されないように、startup_mutexもロックする。
+			std::unique_lock<std::mutex> lock_compensation(lock_compensation_state(compensation_tag()));
+			std::unique_lock<std::mutex> lock_startup(lock_startup_state(lazy_startup_tag()));
+			set_terminate_flag(true);
 		}
+		wake_all_idle_threads();
+		wake_all_compensation_threads(compensation_tag());
 
         join_threads();
     }
 
 	//! 起動しているスレッド数を返す
+	/*!
+		@note task_queue_options::lazy_startupを指定した場合は、起動できるスレッド数の上限を返す。
+	*/
 	size_t num_threads() const { return threads_.size(); }
 
+	//! 実際に起動されたスレッド数を返す
+	size_t num_started_threads() const { return num_started_threads(lazy_startup_tag()); }
+
+	//! enqueue()で積まれたタスクを保持するシャードの数を返す
+	size_t num_shards() const { return shards_.size(); }
+
+	//! blocking_scopeを補うために起動された補助スレッドの数を返す（休止しているスレッドも含み、終了したスレッドは含まない）
+	size_t num_compensation_threads() const { return num_compensation_threads(compensation_tag()); }
+
+	//! 呼び出したスレッドが、このタスクキューの何番目のスレッドかを返す
+	/*!
+		タスクの中から呼び出すと、0以上num_threads()未満の値を返す。
+		このタスクキューのスレッドでない場合（補助スレッドを含む）は、not_worker_thread()を返す。
+		worker_localの値をインデックスで参照する場合などに使用する。
+	*/
+	size_t current_thread_index() const
+	{
+		auto const &identity = current_worker_identity();
+		return identity.owner == this ? identity.index : not_worker_thread();
+	}
+
     //! タスクキューに新たなタスクを追加
 	/*!
 		内部のタスクキューが一杯の時は、キューが空くまで処理をブロックする
 		@param [in] f 別スレッドで実行したい関数や関数オブジェクト
 		@param [in] fに対して適用したい引数。Movable可能でなければならない。
-		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト。
+		結果ポリシーにlight_future_result_policyを指定した場合はlight_future、no_result_policyを指定した場合はno_futureを返す。
 
+		@note fと引数は、タスクの中に一度だけコピーまたはムーブされて保持される。
+		タスクの実行時には、fと引数は右辺値としてfに渡される。（std::asyncと同じ）
+		そのため、std::unique_ptrのようなムーブのみ可能な型も引数として渡せる。
+		参照として渡したい場合はstd::ref()やstd::cref()でくるむ。
 		@note enqueue()に渡された関数は関数オブジェクトはタスクとして、クラス内部のキューに保持される。
 		そして、クラス内部のスレッドプールで管理されているいずれかのスレッドが、キューにタスクが追加されたことを検知して、
 		キューからタスクを取り出した後で、そのタスクを実行する。
 	*/
     template<class F, class... Args>
     auto enqueue(F&& f, Args&& ... args) -> 
-        std::future<decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)())>
+        future_type<typename task_result<F, Args...>::type>
     {
-        typedef decltype(std::bind(std::forward<F>(f), std::forward<Args>(args)...)()) result_t;
-        typedef std::promise<result_t> promise_t;
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef promise_type<result_t> promise_t;
 
         promise_t promise;
-        auto future(promise.get_future());
+        auto future(result_policy::get_future(promise));
 
         task_ptr_t ptask =
-            make_task(
+            make_queue_task(
                 std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
 
-        {
-            task_count_lock_t lock(task_count_mutex_);
-            ++task_count_;
-        }
+        push_shared_task(std::move(ptask));
+        notify_task_pushed(no_target_thread());
+
+        return future;
+    }
+
+    //! タスクが別に保持しているデータのサイズを指定して、タスクキューに新たなタスクを追加
+    /*!
+		task_queue_options::queue_byte_limitを指定した場合、タスクのサイズは、
+		タスクのオブジェクトのsizeofにextra_bytesを加えたものとして計算される。
+		引数として渡すstd::vectorの要素など、タスクのオブジェクトの外に確保されているメモリの量を報告するために使用する。
+		それ以外はenqueue()と同じ。
+		@param [in] extra_bytes タスクのオブジェクトの外に確保されているデータのバイト数
+	*/
+    template<class F, class... Args>
+    auto enqueue_with_size(size_t extra_bytes, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef promise_type<result_t> promise_t;
+
+        promise_t promise;
+        auto future(result_policy::get_future(promise));
+
+        task_ptr_t ptask =
+            make_queue_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+        ptask->set_extra_bytes(extra_bytes);
+
+        push_shared_task(std::move(ptask));
+        notify_task_pushed(no_target_thread());
+
+        return future;
+    }
+
+    //! タスクの種類を表すタグを指定して、タスクキューに新たなタスクを追加
+    /*!
+		task_queue_options::enable_perf_countersを指定した場合、タスクの実行時の統計情報はタグごとに集計され、
+		metrics()のtask_countersで取得できる。
+		uninstrumented_policyを指定した場合、タスクはタグを保持しないので、tagは無視される。
+		それ以外はenqueue()と同じ。
+		@param [in] tag タスクの種類を表すタグ
+	*/
+    template<class F, class... Args>
+    auto enqueue_with_tag(task_tag tag, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef promise_type<result_t> promise_t;
+
+        promise_t promise;
+        auto future(result_policy::get_future(promise));
+
+        task_ptr_t ptask =
+            make_queue_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+        ptask->set_tag(tag);
+
+        push_shared_task(std::move(ptask));
+        notify_task_pushed(no_target_thread());
+
+        return future;
+    }
+
+    //! 期限を指定して、タスクキューに新たなタスクを追加
+    /*!
+		期限付きのタスクは、通常のタスクより優先して、期限の早いものから順に実行される。
+		スレッドがタスクを取り出す時点で期限を過ぎている場合、そのタスクは実行されずに破棄され、
+		戻り値のstd::futureにはhwm::task_expired例外が設定される。
+		実行されたタスクや破棄されたタスクの数と、開始時点での期限までの残り時間は、metrics()のdeadlineで取得できる。
+
+		期限付きのタスクはtask_queue_options::queue_limitやqueue_byte_limitの制限を受けず、この関数はブロックしない。
+		@param [in] deadline タスクの実行を開始しなければならない時刻
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+	*/
+    template<class F, class... Args>
+    auto enqueue_with_deadline(std::chrono::steady_clock::time_point deadline, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        static_assert(deadline_tag::value, "task_queue_feature::deadlines is disabled by the feature policy.");
+
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef promise_type<result_t> promise_t;
+
+        promise_t promise;
+        auto future(result_policy::get_future(promise));
+
+        task_ptr_t ptask =
+            make_queue_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+
+        record_submit(*ptask);
+        task_counter_.add();
 
         try {
-            task_queue_.enqueue(std::move(ptask));
+            features_.deadline_tasks.push(deadline, std::move(ptask));
         } catch(...) {
-            task_count_lock_t lock(task_count_mutex_);
-            --task_count_;
-            if(task_count_ == 0) {
-                c_task_.notify_all();
-            }
+            finish_task_count();
             throw;
         }
 
+        notify_task_pushed(no_target_thread());
+
+        return future;
+    }
+
+    //! 複数の値を順に生成するタスクを、タスクキューに追加
+    /*!
+		fはstream_sink<T>&を第一引数に受け取り、生成した値をstream_sink::push()で一つずつ渡す。
+		呼び出し元は戻り値のstream_channelから、タスクの実行と並行して値を受け取れる。
+		チャネルに保持される値はdefault_stream_capacity個までで、それを超えるとpush()は値が取り出されるまで待機する。
+		fが例外を送出した場合は、stream_channelから残りの値を取り出した後でその例外が送出される。
+		それ以外はenqueue()と同じ。
+		@tparam T 生成する値の型。デフォルト構築とムーブ代入が可能でなければならない。
+		@return タスクが生成する値を受け取るstream_channel
+	*/
+    template<class T, class F, class... Args>
+    stream_channel<T> enqueue_stream(F&& f, Args&& ... args)
+    {
+        return enqueue_stream<T>(
+            stream_capacity(default_stream_capacity), std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    //! チャネルの容量を指定して、複数の値を順に生成するタスクを、タスクキューに追加
+    /*!
+		@param [in] capacity チャネルに保持できる値の数。2のべき乗に切り上げられる。
+	*/
+    template<class T, class F, class... Args>
+    stream_channel<T> enqueue_stream(stream_capacity capacity, F&& f, Args&& ... args)
+    {
+        typedef typename std::decay<F>::type func_t;
+
+        auto state = std::make_shared<stream_state<T>>(capacity.value);
+        enqueue(stream_task<T, func_t>(state, std::forward<F>(f)), std::forward<Args>(args)...);
+
+        return stream_channel<T>(std::move(state));
+    }
+
+    //! 関数オブジェクトをタスク内で直接構築して、タスクキューに新たなタスクを追加
+	/*!
+		内部のタスクキューが一杯の時は、キューが空くまで処理をブロックする
+		@tparam F 別スレッドで実行したい関数オブジェクトの型。引数なしで呼び出せなければならない。
+		@param [in] ctor_args Fのコンストラクタに渡す引数
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+
+		@note Fのオブジェクトはタスクの中に直接構築されるので、コピーやムーブが行われない。
+	*/
+    template<class F, class... CtorArgs>
+    auto emplace(CtorArgs&& ... ctor_args) ->
+        future_type<typename task_result<F>::type>
+    {
+        typedef typename task_result<F>::type result_t;
+        typedef promise_type<result_t> promise_t;
+
+        promise_t promise;
+        auto future(result_policy::get_future(promise));
+
+        task_ptr_t ptask =
+            make_queue_task_in_place<F>(
+                std::move(promise), std::forward<CtorArgs>(ctor_args)...);
+
+        push_shared_task(std::move(ptask));
+        notify_task_pushed(no_target_thread());
+
+        return future;
+    }
+
+    //! キーに対応するスレッドで実行されるように、タスクキューに新たなタスクを追加
+	/*!
+		同じキーを指定したタスクは同じスレッドで実行されるので、
+		キーごとに分割したデータを扱うタスクが、そのデータをキャッシュに載せたまま処理できる。
+		キーはstd::hashでハッシュ化され、スレッド数で割った余りのインデックスのスレッドが持つキューに追加される。
+		そのキューが一杯の時は、キューが空くまで処理をブロックする
+		@param [in] key タスクを実行するスレッドを決めるためのキー。std::hashでハッシュ化できなければならない。
+		@param [in] f 別スレッドで実行したい関数や関数オブジェクト
+		@param [in] fに対して適用したい引数。Movable可能でなければならない。
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+
+		@note set_steal_threshold()で閾値が設定されている場合は、
+		キューに閾値を超えてタスクが溜まったスレッドから、手の空いている別のスレッドがタスクを取り出して実行することがある。
+	*/
+    template<class Key, class F, class... Args>
+    auto enqueue_to(Key const &key, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        static_assert(targeted_tag::value, "task_queue_feature::targeted is disabled by the feature policy.");
+
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef promise_type<result_t> promise_t;
+
+        promise_t promise;
+        auto future(result_policy::get_future(promise));
+
+        task_ptr_t ptask =
+            make_queue_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+
+        size_t const index = std::hash<Key>()(key) % num_threads();
+        push_task(*features_.local_queues[index], std::move(ptask));
+        notify_task_pushed(index);
+        notify_stealer(index);
+
+        return future;
+    }
+
+    typedef task_ring               producer_ring_type;
+
+    //! @class 単一のスレッドからタスクを積むためのハンドル
+    /*!
+		make_producer()で作成する。
+		スレッドごとに、生産者と消費者が一つずつのロックフリーなリングバッファを持ち、
+		enqueue()はそれらに順番にタスクを書き込む。
+		そのため、通常のenqueue()と違って、タスクを積む時にキューのロックを取得しない。
+		また、task_ring::inline_size以下のサイズのタスクはリングバッファの要素の中に直接構築されるので、
+		タスクのためのメモリ確保も行わない。（std::futureを返す場合は、shared stateの確保は行われる）
+		一つのハンドルは一つのスレッドからのみ使用できる。
+
+		@note リングバッファに積まれたタスクは、そのリングバッファを持つスレッドだけが実行する。
+		実行時間の長いタスクが混ざると、同じスレッドのリングバッファにあるタスクが待たされるので、短いタスクを大量に積む場合に使用する。
+		@note ハンドルはタスクキューより先に破棄しなければならない。
+	*/
+    struct producer
+    {
+        producer()
+            :   owner_(nullptr)
+            ,   next_(0)
+        {}
+
+        producer(producer &&rhs)
+            :   owner_(rhs.owner_)
+            ,   rings_(std::move(rhs.rings_))
+            ,   next_(rhs.next_)
+        {
+            rhs.owner_ = nullptr;
+        }
+
+        producer & operator=(producer &&rhs)
+        {
+            close();
+            owner_ = rhs.owner_;
+            rings_ = std::move(rhs.rings_);
+            next_ = rhs.next_;
+            rhs.owner_ = nullptr;
+            return *this;
+        }
+
+        producer(producer const &) = delete;
+        producer & operator=(producer const &) = delete;
+
+        //! デストラクタ
+        /*!
+			積まれたままのタスクは、ハンドルの破棄後も実行される。
+		*/
+        ~producer()
+        {
+            close();
+        }
+
+        //! タスクキューに新たなタスクを追加
+        /*!
+			いずれかのスレッドのリングバッファに空きがあればそこに書き込む。
+			すべてのリングバッファが一杯の場合は、通常のenqueue()と同じくタスクキューのキューに追加する。
+			@param [in] f 別スレッドで実行したい関数や関数オブジェクト
+			@param [in] fに対して適用したい引数。Movable可能でなければならない。
+			@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+		*/
+        template<class F, class... Args>
+        auto enqueue(F&& f, Args&& ... args) ->
+            future_type<typename task_result<F, Args...>::type>
+        {
+            assert(owner_);
+
+            typedef typename task_result<F, Args...>::type result_t;
+            typedef promise_type<result_t> promise_t;
+            typedef typename task_type<
+                        promise_t,
+                        typename std::decay<F>::type,
+                        typename std::decay<Args>::type...
+                    >::type task_t;
+
+            promise_t promise;
+            auto future(result_policy::get_future(promise));
+
+            owner_->template push_from_producer<task_t>(
+                *this, std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+
+            return future;
+        }
+
+        //! 有効なハンドルかどうかを返す
+        explicit operator bool() const { return owner_ != nullptr; }
+
+    private:
+        friend struct basic_task_queue;
+
+        void close()
+        {
+            for(auto &ring: rings_) {
+                ring->close();
+            }
+            rings_.clear();
+            owner_ = nullptr;
+        }
+
+        basic_task_queue *              owner_;
+        std::vector<std::shared_ptr<producer_ring_type>>    rings_;
+        //! 次にタスクを書き込むリングバッファ
+        size_t                          next_;
+    };
+
+    //! 単一のスレッドからタスクを積むためのハンドルを作成する
+    /*!
+		@param [in] capacity_per_thread スレッドごとのリングバッファに同時に積んでおけるタスク数。2のべき乗に切り上げられる。
+		リングバッファの要素一つはキャッシュライン二つ分のサイズを持つ。
+		@note task_queue_options::lazy_startupを指定している場合も、この時点ですべてのスレッドを起動する。
+	*/
+    producer make_producer(size_t capacity_per_thread = 1024)
+    {
+        static_assert(producer_tag::value, "task_queue_feature::producers is disabled by the feature policy.");
+
+        producer p;
+        p.owner_ = this;
+
+        for(size_t i = 0; i < features_.thread_rings.size(); ++i) {
+            auto ring = std::make_shared<producer_ring_type>(capacity_per_thread);
+
+            producer_rings &pr = *features_.thread_rings[i];
+            std::unique_lock<std::mutex> lock(pr.mutex);
+            pr.rings.push_back(ring);
+            ++pr.count;
+
+            p.rings_.push_back(std::move(ring));
+        }
+
+        start_all_threads(lazy_startup_tag());
+
+        return p;
+    }
+
+    //! リアルタイムスレッドからタスクを積むためのハンドルを作成する
+	/*!
+		ハンドルごとに、容量が固定されたリングバッファを確保する。
+		ハンドルのtry_enqueue()はロックもメモリ確保も行わないので、リアルタイムスレッドから呼び出せる。
+		リングバッファに積まれたタスクは、タスクキューのスレッドが通常のタスクよりも優先して取り出して実行する。
+		タスクキューのスレッドがすべて待機している間は、そのうち少なくとも一つがtask_queue_options::realtime_poll_intervalの間隔で
+		リングバッファを確認する。
+		@param [in] capacity リングバッファに同時に積んでおけるタスク数。2のべき乗に切り上げられる。
+		@note この関数自体はメモリ確保とロックを行うので、リアルタイムスレッドの外で呼び出すこと。
+	*/
+    realtime_producer make_realtime_producer(size_t capacity)
+    {
+        static_assert(realtime_tag::value, "task_queue_feature::realtime is disabled by the feature policy.");
+
+        auto ring = std::make_shared<realtime_ring>(capacity);
+
+        {
+            std::unique_lock<std::mutex> lock(features_.realtime_mutex);
+            features_.realtime_rings.push_back(ring);
+            ++features_.realtime_ring_count;
+        }
+
+        //! 待機中のスレッドを一つ起こして、リングバッファを定期的に確認する待機方法に切り替えさせる。
+        //! 残りのスレッドは、次に待機を始める時から切り替わる。
+        idle_event_.notify_one();
+
+        start_first_thread(lazy_startup_tag());
+
+        return realtime_producer(std::move(ring));
+    }
+
+#if defined(HWM_TASK_HAS_REACTOR)
+    //! ファイルディスクリプタからの読み込みを非同期に行う
+    /*!
+		task_queue_options::enable_reactorを指定した場合だけ使用できる。
+		読み込める状態であればその場でread(2)を行い、そうでなければ読み込めるようになった時点で、
+		epollを待機しているタスクキューのスレッドがread(2)を行う。
+		@param [in] fd ノンブロッキングに設定されたファイルディスクリプタ。通常のファイルも指定できる（その場で読み込む）。
+		@param [in] buf 読み込んだデータを書き込む領域。std::futureが準備完了になるまで有効でなければならない。
+		@param [in] size 読み込む最大のバイト数
+		@return read(2)の戻り値を受け取るstd::future。エラーの場合はstd::system_errorが設定される。
+		@note wait()は、完了していない非同期操作を待たない。
+		@note タスクキューが破棄された時点で完了していない操作のstd::futureには、std::future_errc::broken_promiseが設定される。
+	*/
+    std::future<ssize_t> async_read(int fd, void *buf, size_t size)
+    {
+        std::promise<ssize_t> promise;
+        auto future(promise.get_future());
+        submit_io(fd, io_direction::read, std::unique_ptr<io_operation>(new io_read_operation(fd, buf, size, std::move(promise))));
+        return future;
+    }
+
+    //! ファイルディスクリプタへの書き込みを非同期に行う
+    /*!
+		@param [in] buf 書き込むデータ。std::futureが準備完了になるまで有効でなければならない。
+		@return write(2)の戻り値を受け取るstd::future。エラーの場合はstd::system_errorが設定される。
+		@note そのほかはasync_read()と同じ。
+	*/
+    std::future<ssize_t> async_write(int fd, void const *buf, size_t size)
+    {
+        std::promise<ssize_t> promise;
+        auto future(promise.get_future());
+        submit_io(fd, io_direction::write, std::unique_ptr<io_operation>(new io_write_operation(fd, buf, size, std::move(promise))));
+        return future;
+    }
+
+    //! 接続の受け付けを非同期に行う
+    /*!
+		@param [in] fd listen(2)を呼び出したノンブロッキングのソケット
+		@return 受け付けたソケットを受け取るstd::future。受け付けたソケットはノンブロッキングに設定される。
+		@note そのほかはasync_read()と同じ。
+	*/
+    std::future<int> async_accept(int fd)
+    {
+        std::promise<int> promise;
+        auto future(promise.get_future());
+        submit_io(fd, io_direction::read, std::unique_ptr<io_operation>(new io_accept_operation(fd, std::move(promise))));
         return future;
     }
 
+    //! ファイルディスクリプタが読み込める状態になったら、タスクを実行する
+    /*!
+		タスクは、epollで準備ができたことを検知したタスクキューのスレッドで、そのまま実行される。
+		@return タスクとshared stateを共有するstd::futureクラスのオブジェクト
+		@note タスクは実行できるようになった時点でタスクキューのタスク数に数えられるので、
+		それまではwait()の対象にならない。
+	*/
+    template<class F, class... Args>
+    auto on_readable(int fd, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        return on_ready(fd, io_direction::read, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    //! ファイルディスクリプタが書き込める状態になったら、タスクを実行する
+    /*!
+		@note そのほかはon_readable()と同じ。
+	*/
+    template<class F, class... Args>
+    auto on_writable(int fd, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        return on_ready(fd, io_direction::write, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+#endif
+
+    //! enqueue_to()で積まれたタスクを、他のスレッドが横取りする閾値を返す
+    size_t      steal_threshold() const
+    {
+        static_assert(targeted_tag::value, "task_queue_feature::targeted is disabled by the feature policy.");
+
+        return features_.steal_threshold.load();
+    }
+
+    //! enqueue_to()で積まれたタスクを、他のスレッドが横取りする閾値を設定する
+	/*!
+		いずれかのスレッドのキューに、この閾値を超える数のタスクが溜まっている場合、
+		手の空いているスレッドはそのキューからタスクを取り出して実行する。
+		@param [in] threshold 閾値。std::numeric_limits<size_t>::max()を指定すると横取りを行わない。（デフォルト）
+	*/
+    void        set_steal_threshold(size_t threshold)
+    {
+        static_assert(targeted_tag::value, "task_queue_feature::targeted is disabled by the feature policy.");
+
+        features_.steal_threshold.store(threshold);
+
+        //! 閾値を超えたキューごとに、横取りするスレッドを一つ起こす
+        for(size_t i = 0; i < features_.local_queues.size(); ++i) {
+            notify_stealer(i);
+        }
+    }
+
     //! すべてのタスクが実行され終わるのを待機する
     /*!
+		@note uncounted_policyを指定した場合は使用できない。（wait_until()とwait_for()も同様）
 		@note wait()は、タスクの実行を待機するだけで、enqueue()の呼び出しはブロックしない。
 		そのため、wait()で待機している間にenqueue()が行われ続けると、wait()は待機状態のまま戻らないことになる。
 	*/
     void    wait() const
     {
-        task_count_lock_t lock(task_count_mutex_);
-        scoped_add sa(waiting_count_);
-
-        c_task_.wait(lock, [this]{ return task_count_ == 0; });
+        task_counter_.wait();
     }
 
     //! 指定時刻まですべてのタスクが実行され終わるのを待機する
@@ -163,10 +698,7 @@ struct task_queue_with_allocator
     template<class TimePoint>
     bool    wait_until(TimePoint tp) const
     {
-        task_count_lock_t lock(task_count_mutex_);
-        scoped_add sa(waiting_count_);
-
-        return c_task_.wait_until(lock, tp, [this]{ return task_count_ == 0; });
+        return task_counter_.wait_until(tp);
     }
 
     //! 指定時間内ですべてのタスクが実行され終わるのを待機する
@@ -180,10 +712,7 @@ struct task_queue_with_allocator
     template<class Duration>
     bool    wait_for(Duration dur) const
     {
-        task_count_lock_t lock(task_count_mutex_);
-        scoped_add sa(waiting_count_);
-
-        return c_task_.wait_for(lock, dur, [this]{ return task_count_ == 0; });
+        return task_counter_.wait_for(dur);
     }
 
     //! デストラクタが呼び出された時に、積まれているタスクがすべて実行されるまで待機するかどうかを返す。
@@ -204,112 +733,1650 @@ struct task_queue_with_allocator
         wait_before_destructed_.store(state);
     }
 
+    //! キューに積まれているタスクのサイズの合計（バイト数）を返す
+    /*!
+		task_queue_options::queue_byte_limitかtrack_pending_bytesを指定していない場合は、常に0を返す。
+		uninstrumented_policyを指定した場合も、常に0を返す。
+	*/
+    size_t      pending_bytes() const
+    {
+        return bytes_.pending();
+    }
+
+    //! タスクキューの統計情報を返す
+    task_queue_metrics metrics() const
+    {
+        task_queue_metrics m;
+        m.num_tasks = task_counter_.count();
+        m.pending_bytes = bytes_.pending();
+        m.peak_pending_bytes = bytes_.peak();
+        m.queue_byte_limit = bytes_.limit();
+        profiler_.collect(m);
+        collect_deadline_metrics(m, deadline_tag());
+        collect_watchdog_metrics(m, watchdog_tag());
+        return m;
+    }
+
 private:
-	typedef std::unique_lock<std::mutex> task_count_lock_t;
+    typedef typename Policies::counting_policy::counter_type            task_counter_type;
+    typedef typename Policies::instrumentation_policy::accounting_type  byte_accounting_type;
+    typedef typename Policies::idle_policy::event_type                  idle_event_type;
+    typedef typename Policies::instrumentation_policy::profiler_type    profiler_type;
+    typedef typename Policies::instrumentation_policy::recording_type   recording_type;
 
-    queue_type				    task_queue_;
-    std::vector<std::thread>    threads_;
-    std::atomic<bool>           terminated_flag_;
-    std::mutex mutable          task_count_mutex_;
-  
-    size_t                      task_count_;
-    std::atomic<size_t> mutable waiting_count_;
-    std::condition_variable mutable c_task_;
-    std::atomic<bool>           wait_before_destructed_;
+    //! このタスクキューが作成するタスクの型
+    /*!
+		計測ポリシーによって、計測のための情報を付加したinstrumented_taskか、task_implそのものになる。
+		F、Argsはdecayされた型。
+	*/
+    template<class Promise, class F, class... Args>
+    struct task_type
+    {
+        typedef typename Policies::instrumentation_policy::template task<
+                    task_impl<Promise, F, Args...>
+                >::type type;
+    };
 
-    struct scoped_add
+    //! make_task()と同じく、task_typeのタスクを作成する
+    template<class Promise, class F, class... Args>
+    static task_ptr_t make_queue_task(Promise&& promise, F&& f, Args&&... args)
     {
-        scoped_add(std::atomic<size_t> &value)
-            :   v_(value)
-        {
-            ++v_;
-        }
+        typedef typename task_type<
+                    typename std::decay<Promise>::type,
+                    typename std::decay<F>::type,
+                    typename std::decay<Args>::type...
+                >::type task_t;
 
-        ~scoped_add()
-        {
-            --v_;
-        }
+        return task_ptr_t(
+            new task_t(std::forward<Promise>(promise), std::forward<F>(f), std::forward<Args>(args)...));
+    }
 
-		//! 明示的にコピーコンストラクタ／コピー代入演算子を削除
-		//! これによって暗黙的なムーブコンストラクタ／ムーブ代入演算子も定義されなくなる
-        scoped_add(scoped_add const &) = delete;
-        scoped_add& operator=(scoped_add const &) = delete;
+    //! make_task_in_place()と同じく、関数オブジェクトをtask_typeのタスク内で直接構築する
+    template<class F, class Promise, class... CtorArgs>
+    static task_ptr_t make_queue_task_in_place(Promise&& promise, CtorArgs&&... ctor_args)
+    {
+        typedef typename task_type<typename std::decay<Promise>::type, F>::type task_t;
+
+        return task_ptr_t(
+            new task_t(in_place_t(), std::forward<Promise>(promise), std::forward<CtorArgs>(ctor_args)...));
+    }
+
+    //! enqueue()で積まれたタスクを保持するキュー
+    struct shard
+    {
+        explicit
+        shard(size_t capacity)
+            :   queue(capacity)
+            ,   depth(0)
+        {}
+
+        queue_type          queue;
+        //! power_of_two_choicesでシャードを選ぶための、おおよそのタスク数
+        std::atomic<size_t> depth;
+    };
+
+    std::vector<std::unique_ptr<shard>>         shards_;
+    shard_selection             shard_selection_;
+
+    //! キューに積まれているタスクのbyte_size()の合計と、task_queue_options::queue_byte_limitによる制限
+    byte_accounting_type        bytes_;
+    //! task_queue_options::enable_perf_countersの場合に、タスクの種類ごとの統計情報を集計する
+    profiler_type               profiler_;
+    //! task_queue_options::recorderで指定された、タスクの投入と実行を記録するオブジェクト
+    recording_type              recording_;
+
+    std::vector<std::thread>    threads_;
+    std::atomic<bool>           terminated_flag_;
+
+    //! 積まれてから実行が完了していないタスク数
+    task_counter_type           task_counter_;
+    std::atomic<bool>           wait_before_destructed_;
+
+    //! 実行するタスクがないスレッドは、idle_event_で新たなタスクが積まれるのを待機する。
+    //! 待機しているスレッドがいない間は、タスクを積む側はidle_event_への通知でロックもシステムコールも行わない。
+    idle_event_type             idle_event_;
+
+    //! make_producer()で作成したリングバッファのうち、あるスレッドが消費するもの
+    struct producer_rings
+    {
+        producer_rings()
+            :   count(0)
+        {}
+
+        std::mutex mutable  mutex;
+        std::vector<std::shared_ptr<producer_ring_type>>    rings;
+        std::atomic<size_t> count;
+    };
+
+    //! 機能ポリシーで有効にした機能を表す、task_queue_featureの値の論理和
+    static unsigned const features = Policies::feature_policy::features;
+
+    template<unsigned Feature>
+    using feature_tag = std::integral_constant<bool, (features & Feature) != 0>;
+
+    typedef feature_tag<task_queue_feature::targeted>       targeted_tag;
+    typedef feature_tag<task_queue_feature::producers>      producer_tag;
+    typedef feature_tag<task_queue_feature::realtime>       realtime_tag;
+    typedef feature_tag<task_queue_feature::deadlines>      deadline_tag;
+    typedef feature_tag<task_queue_feature::compensation>   compensation_tag;
+    typedef feature_tag<task_queue_feature::watchdog>       watchdog_tag;
+    typedef feature_tag<task_queue_feature::lazy_startup>   lazy_startup_tag;
+    typedef feature_tag<task_queue_feature::global_limit>   global_limit_tag;
+#if defined(HWM_TASK_HAS_REACTOR)
+    typedef feature_tag<task_queue_feature::reactor>        reactor_tag;
+#else
+    typedef std::false_type                                 reactor_tag;
+#endif
+
+    template<unsigned Feature, class State>
+    using feature_state_t =
+        typename std::conditional<(features & Feature) != 0, State, disabled_feature<Feature>>::type;
+
+    //! enqueue_to()で積まれたタスクを保持する、スレッドごとのキュー
+    struct targeted_state
+    {
+        targeted_state()
+            :   steal_threshold((std::numeric_limits<size_t>::max)())
+        {}
+
+        std::vector<std::unique_ptr<queue_type>>    local_queues;
+        std::atomic<size_t>                         steal_threshold;
+    };
+
+    //! make_producer()で作成したリングバッファを、消費するスレッドごとにまとめたもの
+    struct producer_state
+    {
+        std::vector<std::unique_ptr<producer_rings>>    thread_rings;
+    };
+
+    //! make_realtime_producer()で作成したリングバッファ
+    struct realtime_state
+    {
+        realtime_state()
+            :   realtime_ring_count(0)
+            ,   realtime_cursor(0)
+        {}
+
+        std::mutex mutable          realtime_mutex;
+        std::vector<std::shared_ptr<realtime_ring>> realtime_rings;
+        std::atomic<size_t>         realtime_ring_count;
+        size_t                      realtime_cursor;
+        std::chrono::microseconds   realtime_poll_interval;
+    };
+
+    //! enqueue_with_deadline()で積まれたタスクを保持するキュー
+    struct deadline_state
+    {
+        deadline_queue              deadline_tasks;
+    };
+
+    //! task_queue_options::stuck_task_thresholdの場合に、実行時間が長すぎるタスクを検出する
+    struct watchdog_state
+    {
+        std::unique_ptr<task_watchdog>  watchdog;
+    };
+
+    //! task_queue_options::lazy_startupの場合に、threads_にスレッドを起動する時のロック
+    struct lazy_startup_state
+    {
+        lazy_startup_state()
+            :   lazy_startup(false)
+            ,   started_count(0)
+        {}
+
+        std::mutex                  startup_mutex;
+        bool                        lazy_startup;
+        std::atomic<size_t>         started_count;
+    };
+
+    //! queue_limit_scope::globalの場合に、全シャードのタスク数の合計に適用する上限
+    struct global_limit_state
+    {
+        global_limit_state()
+            :   global_limit((std::numeric_limits<size_t>::max)())
+            ,   global_count(0)
+            ,   global_limit_waiters(0)
+        {}
+
+        size_t                      global_limit;
+        std::atomic<size_t>         global_count;
+        std::atomic<size_t>         global_limit_waiters;
+        std::mutex                  global_limit_mutex;
+        std::condition_variable     c_global_limit;
+    };
+
+    //! blocking_scopeを補うための補助スレッド
+    /*!
+		blocking_scopeの中にいるタスクの数（blocked_count）だけ、補助スレッドがタスクを実行する。
+		不要になった補助スレッドは、c_compensationで再び必要になるまで休止し、
+		compensation_idle_timeoutを過ぎても必要にならなければ終了する。
+		終了したスレッドの要素（retired_slots）は、次に補助スレッドを起動する時に再利用する。
+	*/
+    struct compensation_state
+    {
+        compensation_state()
+            :   max_compensation_threads(0)
+            ,   compensation_idle_timeout(0)
+            ,   blocked_count(0)
+            ,   running_compensation_count(0)
+            ,   parked_compensation_count(0)
+            ,   compensation_wakeups(0)
+        {}
+
+        std::vector<std::thread>    compensation_threads;
+        std::mutex mutable          compensation_mutex;
+        std::condition_variable     c_compensation;
+        size_t                      max_compensation_threads;
+        std::chrono::milliseconds   compensation_idle_timeout;
+        //! 終了した補助スレッドの、compensation_threadsでの位置
+        std::vector<size_t>         retired_slots;
+        size_t                      blocked_count;
+        //! 休止せずにタスクを実行している補助スレッドの数
+        size_t                      running_compensation_count;
+        //! 休止している補助スレッドの数
+        size_t                      parked_compensation_count;
+        //! 休止している補助スレッドのうち、再開させる数
+        size_t                      compensation_wakeups;
+    };
+
+#if defined(HWM_TASK_HAS_REACTOR)
+    //! task_queue_options::enable_reactorの場合に使用するリアクター
+    struct reactor_state
+    {
+        reactor_state()
+            :   poller_claimed(false)
+            ,   poller_sleeping(false)
+            ,   poller_thread(no_target_thread())
+        {}
+
+        std::unique_ptr<reactor>    io_reactor;
+        //! 待機中のスレッドのうち一つが、idle_event_の代わりにリアクターで待機する
+        std::atomic<bool>           poller_claimed;
+        //! リアクターで待機しているスレッドがいるかどうか
+        std::atomic<bool>           poller_sleeping;
+        //! リアクターで待機しているスレッドのインデックス。いない場合はno_target_thread()
+        std::atomic<size_t>         poller_thread;
+    };
+#else
+    typedef disabled_feature<task_queue_feature::reactor>   reactor_state;
+#endif
+
+    //! 機能ポリシーで有効にした機能ごとの状態
+    /*!
+		無効にした機能の状態はdisabled_featureに置き換えられて、空の基底クラスとして領域を取らない。
+		状態を参照するメンバ関数は、機能が有効かどうかを表すタグで呼び分けて、無効な場合の版では何もしない。
+	*/
+    struct feature_state
+        :   feature_state_t<task_queue_feature::targeted,       targeted_state>
+        ,   feature_state_t<task_queue_feature::producers,      producer_state>
+        ,   feature_state_t<task_queue_feature::realtime,       realtime_state>
+        ,   feature_state_t<task_queue_feature::deadlines,      deadline_state>
+        ,   feature_state_t<task_queue_feature::watchdog,       watchdog_state>
+        ,   feature_state_t<task_queue_feature::lazy_startup,   lazy_startup_state>
+        ,   feature_state_t<task_queue_feature::global_limit,   global_limit_state>
+        ,   feature_state_t<task_queue_feature::compensation,   compensation_state>
+        ,   feature_state_t<task_queue_feature::reactor,        reactor_state>
+    {};
+
+    feature_state               features_;
+
+    struct scoped_add
+    {
+        scoped_add(std::atomic<size_t> &value)
+            :   v_(value)
+        {
+            ++v_;
+        }
+
+        ~scoped_add()
+        {
+            --v_;
+        }
+
+		//! 明示的にコピーコンストラクタ／コピー代入演算子を削除
+		//! これによって暗黙的なムーブコンストラクタ／ムーブ代入演算子も定義されなくなる
+        scoped_add(scoped_add const &) = delete;
+        scoped_add& operator=(scoped_add const &) = delete;
 
     private:
         std::atomic<size_t> &v_;
     };
 
-private:
+private:
+
+    void    set_terminate_flag(bool state)
+    {
+        terminated_flag_.store(state);
+    }
+
+    bool    is_terminated() const
+    {
+        return terminated_flag_.load();
+    }
+
+    //! デストラクタで、積まれているタスクがすべて実行されるまで待機する
+    void    wait_all_tasks(std::true_type) { wait(); }
+
+    //! タスク数を数えていない場合は待機できない
+    void    wait_all_tasks(std::false_type) {}
+
+    //! タスクの実行が完了した（または積まれなかった）ことを記録する
+    void    finish_task_count()
+    {
+        task_counter_.finish();
+    }
+
+    //! タスクを実行する
+    /*!
+		ウォッチドッグが有効な場合は、実行中のタスクをこのスレッドのwatchdog_slotに公開する。
+	*/
+    void    run_task(task_base &task)
+    {
+        typename recording_type::run_scope record_scope(recording_, task);
+
+        watchdog_slot *slot = current_slot(watchdog_tag());
+        if(!slot) {
+            profiler_.run(task);
+            return;
+        }
+
+        slot->begin(task.tag());
+        profiler_.run(task);
+        slot->end(*this);
+    }
+
+    //! task_queue_options::recorderが指定されている場合に、タスクが積まれたことを記録する
+    /*!
+		producerのリングバッファが一杯で通常のキューに積み直す場合などに、二重に記録しないようにする。
+	*/
+    void    record_submit(task_base &task)
+    {
+        recording_.on_submit(task);
+    }
+
+    //! タスク数を加算してから、タスクをキューに追加する
+    void    push_task(queue_type &queue, task_ptr_t task)
+    {
+        size_t const bytes = bytes_.tracking() ? task->byte_size() : 0;
+        if(bytes_.tracking()) {
+            bytes_.acquire(bytes);
+        }
+
+        record_submit(*task);
+        task_counter_.add();
+
+        try {
+            queue.enqueue(std::move(task));
+        } catch(...) {
+            finish_task_count();
+            if(bytes_.tracking()) {
+                bytes_.release(bytes);
+            }
+            throw;
+        }
+    }
+
+    //! notify_task_pushed()で、特定のスレッドを対象にしないことを表す値
+    static size_t no_target_thread() { return (std::numeric_limits<size_t>::max)(); }
+
+    //! 新たなタスクが積まれたことを待機中のスレッドに通知する
+    /*!
+		@param target_thread タスクを実行するスレッドが決まっている場合はそのインデックス。
+		決まっていない場合はno_target_thread()
+	*/
+    void    notify_task_pushed(size_t target_thread)
+    {
+        bool const has_idle_thread = idle_event_.has_waiters();
+
+        if(target_thread == no_target_thread()) {
+            //! どのスレッドが実行してもよいので、積まれたタスク一つにつき一つのスレッドだけを起こす。
+            //! idle_event_で待機しているスレッドがいなければ、リアクターで待機しているスレッドを起こす。
+            idle_event_.notify_one();
+            if(!has_idle_thread) {
+                wake_poller(reactor_tag());
+            }
+        } else {
+            //! 積まれたタスクを実行できるのは対象のスレッドだけなので、そのスレッドだけを起こす。
+            //! 対象のスレッドがリアクターで待機している場合は、リアクターから起こす。
+            idle_event_.notify_waiter(static_cast<std::uint32_t>(target_thread));
+            if(is_polling_thread(target_thread, reactor_tag())) {
+                wake_poller(reactor_tag());
+            }
+        }
+
+        start_pushed_thread(target_thread, has_idle_thread, lazy_startup_tag());
+    }
+
+    //! enqueue_to()で積まれたタスクを横取りできる場合に、待機中のスレッドを一つ起こす
+    /*!
+		@param index タスクが積まれたキューを持つスレッドのインデックス
+	*/
+    void    notify_stealer(size_t index)
+    {
+        size_t const threshold = features_.steal_threshold.load();
+        if(threshold != (std::numeric_limits<size_t>::max)()
+           && idle_event_.has_waiters()
+           && features_.local_queues[index]->size() > threshold)
+        {
+            idle_event_.notify_one();
+        }
+    }
+
+    //! 待機中のスレッドをすべて起こす
+    /*!
+		タスクキューの終了時にだけ使用する。
+	*/
+    void    wake_all_idle_threads()
+    {
+        idle_event_.notify_all();
+        wake_poller(reactor_tag());
+    }
+
+    //! リアクターを使用しない場合は、起こすスレッドがいない
+    void    wake_poller(std::false_type) {}
+
+    bool    is_polling_thread(size_t, std::false_type) const { return false; }
+
+#if defined(HWM_TASK_HAS_REACTOR)
+    //! リアクターで待機しているスレッドがいれば起こす
+    /*!
+		呼び出し元は、タスクを積むなどの変更を行ってから、seq_cstのフェンスを経てこの関数を呼び出す。
+		（idle_event_のhas_waiters()やnotify_one()などがフェンスを含む）
+	*/
+    void    wake_poller(std::true_type)
+    {
+        if(features_.io_reactor && features_.poller_sleeping.load()) {
+            features_.io_reactor->wake();
+        }
+    }
+
+    //! thread_index番目のスレッドがリアクターで待機しているかどうか
+    bool    is_polling_thread(size_t thread_index, std::true_type) const
+    {
+        return features_.poller_thread.load() == thread_index;
+    }
+
+    template<class F, class... Args>
+    auto on_ready(int fd, io_direction dir, F&& f, Args&& ... args) ->
+        future_type<typename task_result<F, Args...>::type>
+    {
+        static_assert(reactor_tag::value, "task_queue_feature::reactor is disabled by the feature policy.");
+
+        typedef typename task_result<F, Args...>::type result_t;
+        typedef promise_type<result_t> promise_t;
+
+        promise_t promise;
+        auto future(result_policy::get_future(promise));
+
+        task_ptr_t ptask =
+            make_queue_task(
+                std::move(promise), std::forward<F>(f), std::forward<Args>(args)...);
+
+        submit_io(fd, dir, std::unique_ptr<io_operation>(new io_ready_operation(std::move(ptask))));
+
+        return future;
+    }
+
+    //! リアクターに非同期操作を登録する
+    void    submit_io(int fd, io_direction dir, std::unique_ptr<io_operation> op)
+    {
+        static_assert(reactor_tag::value, "task_queue_feature::reactor is disabled by the feature policy.");
+
+        if(!features_.io_reactor) {
+            throw std::logic_error("hwm::task_queue: the reactor is not enabled.");
+        }
+
+        std::vector<task_ptr_t> ready_tasks;
+        features_.io_reactor->submit(fd, dir, std::move(op), ready_tasks);
+
+        //! その場で実行できるようになったタスクは、通常のタスクとして積む
+        for(auto &task: ready_tasks) {
+            push_shared_task(std::move(task));
+            notify_task_pushed(no_target_thread());
+        }
+
+        //! 登録した操作を待機するスレッドが必要なので、lazy_startupでまだ起動していなければ起動する
+        start_first_thread(lazy_startup_tag());
+    }
+
+    //! リアクターで完了した操作によって実行できるようになったタスクを、このスレッドで実行する
+    void    run_ready_tasks(std::vector<task_ptr_t> &ready_tasks)
+    {
+        for(auto &task: ready_tasks) {
+            record_submit(*task);
+            task_counter_.add();
+            run_task(*task);
+            finish_task_count();
+        }
+        ready_tasks.clear();
+    }
+
+    //! このスレッドがリアクターでの待機を引き受ける
+    /*!
+		他のスレッドがすでにリアクターで待機している場合はfalseを返す。
+	*/
+    bool    poll_reactor(size_t thread_index, std::true_type)
+    {
+        if(!features_.io_reactor || features_.poller_claimed.exchange(true)) {
+            return false;
+        }
+
+        //! タスクを積む側は、タスクを積んでからpoller_sleepingを確認するので、
+        //! ここではpoller_sleepingを設定してからタスクを確認する。
+        features_.poller_thread.store(thread_index);
+        features_.poller_sleeping.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::vector<task_ptr_t> ready_tasks;
+
+        if(!is_terminated() && !has_any_task(thread_index)) {
+            features_.io_reactor->wait(reactor_timeout_ms(realtime_tag()), ready_tasks);
+        }
+
+        features_.poller_sleeping.store(false);
+        features_.poller_thread.store(no_target_thread());
+        features_.poller_claimed.store(false);
+
+        //! このスレッドがタスクの実行に戻る間、待機中の別のスレッドにリアクターでの待機を引き継がせる
+        if(features_.io_reactor->num_pending() != 0) {
+            idle_event_.notify_one();
+        }
+
+        run_ready_tasks(ready_tasks);
+        return true;
+    }
+
+    //! タスクを実行しているスレッドが、待機せずにリアクターを確認する
+    /*!
+		すべてのスレッドがタスクを実行し続けている間も、完了した操作が放置されないようにする。
+	*/
+    void    poll_reactor_nonblocking(std::true_type)
+    {
+        if(!features_.io_reactor
+           || features_.io_reactor->num_pending() == 0
+           || features_.poller_claimed.exchange(true))
+        {
+            return;
+        }
+
+        std::vector<task_ptr_t> ready_tasks;
+        features_.io_reactor->wait(0, ready_tasks);
+        features_.poller_claimed.store(false);
+
+        run_ready_tasks(ready_tasks);
+    }
+
+    //! リアルタイムスレッドのリングバッファがある間は、リアクターでもその間隔で待機を中断する
+    int     reactor_timeout_ms(std::true_type) const
+    {
+        if(features_.realtime_ring_count.load() == 0) {
+            return -1;
+        }
+
+        auto const ms = std::chrono::duration_cast<std::chrono::milliseconds>(features_.realtime_poll_interval).count();
+        return ms < 1 ? 1 : static_cast<int>(ms);
+    }
+
+    int     reactor_timeout_ms(std::false_type) const { return -1; }
+#endif
+
+    //! リアクターを使用しない場合は、idle_event_で待機する
+    bool    poll_reactor(size_t, std::false_type) { return false; }
+
+    void    poll_reactor_nonblocking(std::false_type) {}
+
+    //! index番目のスレッドがまだ起動されていなければ起動する
+    void    start_thread(size_t index)
+    {
+        if(features_.started_count.load() == threads_.size()) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(features_.startup_mutex);
+        if(is_terminated() || threads_[index].joinable()) {
+            return;
+        }
+
+        threads_[index] = std::thread([this, index] { process(index); });
+        ++features_.started_count;
+    }
+
+    //! まだ起動されていないスレッドがあれば、一つ起動する
+    void    start_next_thread()
+    {
+        if(features_.started_count.load() == threads_.size()) {
+            return;
+        }
+
+        std::unique_lock<std::mutex> lock(features_.startup_mutex);
+        if(is_terminated()) {
+            return;
+        }
+
+        for(size_t i = 0; i < threads_.size(); ++i) {
+            if(!threads_[i].joinable()) {
+                threads_[i] = std::thread([this, i] { process(i); });
+                ++features_.started_count;
+                return;
+            }
+        }
+    }
+
+    //! タスクが積まれた時に、lazy_startupでまだ起動していないスレッドを起動する
+    /*!
+		実行するスレッドが決まっている場合はそのスレッドを、決まっていない場合は待機中のスレッドがいなければ一つ起動する。
+	*/
+    void    start_pushed_thread(size_t target_thread, bool has_idle_thread, std::true_type)
+    {
+        if(!features_.lazy_startup) {
+            return;
+        }
+
+        if(target_thread != no_target_thread()) {
+            start_thread(target_thread);
+        } else if(!has_idle_thread) {
+            start_next_thread();
+        }
+    }
+
+    void    start_pushed_thread(size_t, bool, std::false_type) {}
+
+    //! lazy_startupでまだ起動していないスレッドをすべて起動する
+    void    start_all_threads(std::true_type)
+    {
+        if(features_.lazy_startup) {
+            for(size_t i = 0; i < threads_.size(); ++i) {
+                start_thread(i);
+            }
+        }
+    }
+
+    void    start_all_threads(std::false_type) {}
+
+    //! lazy_startupでまだ一つもスレッドを起動していなければ、一つ起動する
+    void    start_first_thread(std::true_type)
+    {
+        if(features_.lazy_startup && features_.started_count.load() == 0) {
+            start_next_thread();
+        }
+    }
+
+    void    start_first_thread(std::false_type) {}
+
+    size_t  num_started_threads(std::true_type) const { return features_.started_count.load(); }
+
+    //! lazy_startupを使用しない場合は、すべてのスレッドを構築時に起動している
+    size_t  num_started_threads(std::false_type) const { return threads_.size(); }
+
+    std::unique_lock<std::mutex>    lock_startup_state(std::true_type)
+    {
+        return std::unique_lock<std::mutex>(features_.startup_mutex);
+    }
+
+    std::unique_lock<std::mutex>    lock_startup_state(std::false_type)
+    {
+        return std::unique_lock<std::mutex>();
+    }
+
+    //! queue_limit_scope::globalの場合に、タスクを一つ追加できるようになるまで待機する
+    void    acquire_global_slot(std::true_type)
+    {
+        if(!uses_global_limit()) {
+            return;
+        }
+
+        size_t n = features_.global_count.load();
+        for( ; ; ) {
+            if(n < features_.global_limit) {
+                if(features_.global_count.compare_exchange_weak(n, n + 1)) {
+                    return;
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(features_.global_limit_mutex);
+            scoped_add sa(features_.global_limit_waiters);
+            features_.c_global_limit.wait(lock, [this, &n] {
+                n = features_.global_count.load();
+                return n < features_.global_limit;
+            });
+        }
+    }
+
+    //! queue_limit_scope::globalの場合に、タスクが取り出されたことを通知する
+    void    release_global_slot(std::true_type)
+    {
+        if(!uses_global_limit()) {
+            return;
+        }
+
+        features_.global_count.fetch_sub(1);
+        if(features_.global_limit_waiters.load() != 0) {
+            {
+                std::unique_lock<std::mutex> lock(features_.global_limit_mutex);
+            }
+            features_.c_global_limit.notify_one();
+        }
+    }
+
+    //! 全体の上限を使用しない場合は、シャードのlocked_queueの上限だけが適用される
+    void    acquire_global_slot(std::false_type) {}
+
+    void    release_global_slot(std::false_type) {}
+
+    bool    uses_global_limit() const
+    {
+        return features_.global_limit != (std::numeric_limits<size_t>::max)();
+    }
+
+    //! enqueue()で積まれたタスクを追加するシャードを選ぶ
+    size_t  select_shard()
+    {
+        size_t const num = shards_.size();
+        if(num == 1) {
+            return 0;
+        }
+
+        //! スレッドごとに異なる値から開始するように、スレッドIDのハッシュ値で初期化する
+        static thread_local size_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+
+        if(shard_selection_ == shard_selection::round_robin) {
+            return state++ % num;
+        }
+
+        //! xorshift
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+
+        size_t const a = state % num;
+        size_t const b = (a + 1 + (state >> 16) % (num - 1)) % num;
+
+        return
+            (shards_[a]->depth.load(std::memory_order_relaxed) <= shards_[b]->depth.load(std::memory_order_relaxed))
+            ? a : b;
+    }
+
+    //! enqueue()で積まれたタスクをいずれかのシャードに追加する
+    void    push_shared_task(task_ptr_t task)
+    {
+        shard &s = *shards_[select_shard()];
+
+        acquire_global_slot(global_limit_tag());
+
+        s.depth.fetch_add(1, std::memory_order_relaxed);
+
+        try {
+            push_task(s.queue, std::move(task));
+        } catch(...) {
+            s.depth.fetch_sub(1, std::memory_order_relaxed);
+            release_global_slot(global_limit_tag());
+            throw;
+        }
+    }
+
+    //! シャードからタスクを取り出す
+    bool    try_pop_shared_task(shard &s, task_ptr_t &task)
+    {
+        if(!s.queue.try_dequeue(task)) {
+            return false;
+        }
+
+        s.depth.fetch_sub(1, std::memory_order_relaxed);
+        release_global_slot(global_limit_tag());
+
+        return true;
+    }
+
+    //! thread_index番目のスレッドが横取りできるタスクを持つキューを探す
+    queue_type * find_stealable_queue(size_t thread_index, std::true_type) const
+    {
+        size_t const threshold = features_.steal_threshold.load();
+        if(threshold == (std::numeric_limits<size_t>::max)()) {
+            return nullptr;
+        }
+
+        auto const &local_queues = features_.local_queues;
+        for(size_t i = 1; i <= local_queues.size(); ++i) {
+            size_t const victim = (thread_index + i) % local_queues.size();
+            if(victim == thread_index) {
+                continue;
+            }
+
+            queue_type &q = *local_queues[victim];
+            if(q.size() > threshold) {
+                return &q;
+            }
+        }
+
+        return nullptr;
+    }
+
+    queue_type * find_stealable_queue(size_t, std::false_type) const { return nullptr; }
+
+    //! thread_index番目のスレッドが持つ、enqueue_to()で積まれたタスクのキュー
+    /*!
+		補助スレッドは自分のキューを持たないので、nullptrを返す。
+	*/
+    queue_type * own_queue(size_t thread_index, std::true_type) const
+    {
+        return thread_index < features_.local_queues.size() ? features_.local_queues[thread_index].get() : nullptr;
+    }
+
+    queue_type * own_queue(size_t, std::false_type) const { return nullptr; }
+
+    //! thread_index番目のスレッドが実行できるタスクがあるかどうか
+    bool    has_task(size_t thread_index) const
+    {
+        queue_type const *own = own_queue(thread_index, targeted_tag());
+        if(own && !own->empty()) {
+            return true;
+        }
+
+        for(auto const &s: shards_) {
+            if(!s->queue.empty()) {
+                return true;
+            }
+        }
+
+        return find_stealable_queue(thread_index, targeted_tag()) != nullptr;
+    }
+
+    //! thread_index番目のスレッドが、待機せずに実行できるタスクがあるかどうか
+    /*!
+		機能ポリシーで無効にした機能のキューは確認しない。
+	*/
+    bool    has_any_task(size_t thread_index) const
+    {
+        return has_task(thread_index)
+            || has_producer_task(thread_index, producer_tag())
+            || has_realtime_task(realtime_tag())
+            || has_deadline_task(deadline_tag());
+    }
+
+    //! thread_index番目のスレッドが実行するタスクを取り出す
+    /*!
+		自分のキュー、自分に割り当てられたシャード、他のシャード、他のスレッドのキューの順に取り出しを試行する。
+	*/
+    bool    try_pop_task(size_t thread_index, task_ptr_t &task)
+    {
+        if(!try_pop_queued_task(thread_index, task)) {
+            return false;
+        }
+
+        if(bytes_.tracking()) {
+            bytes_.release(task->byte_size());
+        }
+
+        return true;
+    }
+
+    //! try_pop_task()の取り出し処理。bytes_の更新は呼び出し元で行う
+    bool    try_pop_queued_task(size_t thread_index, task_ptr_t &task)
+    {
+        queue_type *own = own_queue(thread_index, targeted_tag());
+        if(own && own->try_dequeue(task)) {
+            return true;
+        }
+
+        size_t const home = thread_index % shards_.size();
+        for(size_t i = 0; i < shards_.size(); ++i) {
+            if(try_pop_shared_task(*shards_[(home + i) % shards_.size()], task)) {
+                return true;
+            }
+        }
+
+        queue_type *victim = find_stealable_queue(thread_index, targeted_tag());
+        return victim && victim->try_dequeue(task);
+    }
+
+    //! producerからタスクを積む
+    /*!
+		空きのあるリングバッファの要素の中に、Taskのオブジェクトを直接構築する。
+	*/
+    template<class Task, class... CtorArgs>
+    void    push_from_producer(producer &p, CtorArgs&&... args)
+    {
+        task_counter_.add();
+
+        try {
+            size_t const num = p.rings_.size();
+            for(size_t i = 0; i < num; ++i) {
+                size_t const index = (p.next_ + i) % num;
+                producer_ring_type &ring = *p.rings_[index];
+
+                //! try_emplace()は、リングバッファが一杯の場合は引数をムーブしない
+                task_base *task = ring.template try_emplace<Task>(std::forward<CtorArgs>(args)...);
+                if(task) {
+                    //! 記録に失敗した場合は、まだ消費者から見えていないタスクを破棄して、要素を空けておく
+                    try {
+                        record_submit(*task);
+                    } catch(...) {
+                        ring.cancel_emplace();
+                        throw;
+                    }
+                    ring.publish();
+                    p.next_ = index + 1;
+
+                    //! リングバッファを読むのは対応するスレッドだけなので、そのスレッドだけを起こす。
+                    //! 待機中のスレッドがいなければ、idle_event_は何もしない。
+                    notify_task_pushed(index);
+                    return;
+                }
+            }
+
+            //! すべてのリングバッファが一杯なので、通常のキューに積む。
+            //! 先に加算したタスク数は、通常のキューに積んでから取り消す。（途中でタスク数が0にならないように）
+            push_shared_task(task_ptr_t(new Task(std::forward<CtorArgs>(args)...)));
+        } catch(...) {
+            finish_task_count();
+            throw;
+        }
+        notify_task_pushed(no_target_thread());
+        finish_task_count();
+    }
+
+    //! thread_index番目のスレッドが消費するリングバッファに、タスクがあるかどうか
+    bool    has_producer_task(size_t thread_index, std::true_type) const
+    {
+        if(thread_index >= features_.thread_rings.size()) {
+            return false;
+        }
+
+        producer_rings const &pr = *features_.thread_rings[thread_index];
+        if(pr.count.load() == 0) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(pr.mutex);
+        for(auto const &ring: pr.rings) {
+            if(!ring->empty()) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //! thread_index番目のスレッドが消費するリングバッファから、タスクを一つ取り出して実行する
+    /*!
+		ハンドルが破棄されて空になったリングバッファは、ここで取り除く。
+		@return 実行するタスクがなかった場合はfalseを返す
+	*/
+    bool    run_producer_task(size_t thread_index, std::true_type)
+    {
+        if(thread_index >= features_.thread_rings.size()) {
+            return false;
+        }
+
+        producer_rings &pr = *features_.thread_rings[thread_index];
+        if(pr.count.load() == 0) {
+            return false;
+        }
+
+        //! リングバッファを取り除くのはこのスレッドだけなので、ロックを外した後もringは有効
+        producer_ring_type *ring = nullptr;
 
-    void    set_terminate_flag(bool state)
+        {
+            std::unique_lock<std::mutex> lock(pr.mutex);
+
+            for(auto it = pr.rings.begin(); it != pr.rings.end(); ) {
+                if(!ring && !(*it)->empty()) {
+                    ring = it->get();
+                }
+
+                if((*it)->is_closed() && (*it)->empty()) {
+                    it = pr.rings.erase(it);
+                    --pr.count;
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        //! タスクはリングバッファの要素の中に置かれたまま実行される
+        if(!ring || !ring->try_run([this](task_base &task) { run_task(task); })) {
+            return false;
+        }
+
+        finish_task_count();
+
+        return true;
+    }
+
+    bool    has_producer_task(size_t, std::false_type) const { return false; }
+
+    bool    run_producer_task(size_t, std::false_type) { return false; }
+
+    //! 期限付きのタスクを、期限の早いものから一つ取り出して実行する
+    /*!
+		取り出す時点で期限を過ぎているタスクは、実行せずにtask_expired例外を設定して破棄する。
+		@return 実行するタスクも破棄したタスクもなかった場合はfalseを返す
+	*/
+    bool    run_deadline_task(std::true_type)
     {
-        terminated_flag_.store(state);
+        if(features_.deadline_tasks.empty()) {
+            return false;
+        }
+
+        task_ptr_t task;
+        std::vector<task_ptr_t> expired;
+        bool const found =
+            features_.deadline_tasks.try_pop(std::chrono::steady_clock::now(), task, expired);
+
+        for(auto &t: expired) {
+            t->abandon(std::make_exception_ptr(task_expired()));
+            finish_task_count();
+        }
+
+        if(found) {
+            run_task(*task);
+            finish_task_count();
+        }
+
+        return found || !expired.empty();
     }
 
-    bool    is_terminated() const
+    bool    run_deadline_task(std::false_type) { return false; }
+
+    bool    has_deadline_task(std::true_type) const { return !features_.deadline_tasks.empty(); }
+
+    bool    has_deadline_task(std::false_type) const { return false; }
+
+    void    collect_deadline_metrics(task_queue_metrics &m, std::true_type) const
     {
-        return terminated_flag_.load();
+        features_.deadline_tasks.collect(m);
+    }
+
+    void    collect_deadline_metrics(task_queue_metrics &, std::false_type) const {}
+
+    //! リングバッファに積まれたタスクがあるかどうか
+    bool    has_realtime_task(std::true_type) const
+    {
+        if(features_.realtime_ring_count.load() == 0) {
+            return false;
+        }
+
+        std::unique_lock<std::mutex> lock(features_.realtime_mutex);
+        for(auto const &ring: features_.realtime_rings) {
+            if(!ring->empty()) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    //! リングバッファに積まれたタスクを一つ取り出して実行する
+    /*!
+		生産者のハンドルが破棄されて空になったリングバッファは、ここで取り除く。
+		@return 実行するタスクがなかった場合はfalseを返す
+	*/
+    bool    run_realtime_task(std::true_type)
+    {
+        if(features_.realtime_ring_count.load() == 0) {
+            return false;
+        }
+
+        realtime_ring::slot task;
+        bool found = false;
+
+        {
+            std::unique_lock<std::mutex> lock(features_.realtime_mutex);
+
+            auto &rings = features_.realtime_rings;
+            for(size_t i = 0; i < rings.size() && !found; ++i) {
+                size_t const index = (features_.realtime_cursor + i) % rings.size();
+                found = rings[index]->try_pop(task);
+            }
+            ++features_.realtime_cursor;
+
+            for(auto it = rings.begin(); it != rings.end(); ) {
+                if((*it)->is_closed() && (*it)->empty()) {
+                    it = rings.erase(it);
+                    --features_.realtime_ring_count;
+                } else {
+                    ++it;
+                }
+            }
+        }
+
+        if(found) {
+            //! 結果を受け取るstd::futureがないので、例外は捨てる。
+            try {
+                task.run();
+            } catch(...) {
+            }
+        }
+
+        return found;
+    }
+
+    bool    has_realtime_task(std::false_type) const { return false; }
+
+    bool    run_realtime_task(std::false_type) { return false; }
+
+    //! idle_event_で待機する
+    /*!
+		リアルタイムスレッドは通知を行わないので、リングバッファがある間は一定間隔で確認する。
+		リングバッファがない間に待機を始めた場合も、make_realtime_producer()からの通知で待機方法を切り替える。
+	*/
+    bool    wait_idle_event(typename idle_event_type::key_type key, std::true_type)
+    {
+        if(features_.realtime_ring_count.load() != 0) {
+            return idle_event_.wait_for(key, features_.realtime_poll_interval);
+        }
+
+        idle_event_.wait(key);
+        return true;
+    }
+
+    bool    wait_idle_event(typename idle_event_type::key_type key, std::false_type)
+    {
+        idle_event_.wait(key);
+        return true;
+    }
+
+    bool    wait_idle_event(typename idle_event_type::key_type key, std::chrono::milliseconds timeout, std::true_type)
+    {
+        if(features_.realtime_ring_count.load() != 0) {
+            std::chrono::microseconds const t = timeout;
+            return idle_event_.wait_for(key, (std::min)(t, features_.realtime_poll_interval));
+        }
+
+        return idle_event_.wait_for(key, timeout);
+    }
+
+    bool    wait_idle_event(typename idle_event_type::key_type key, std::chrono::milliseconds timeout, std::false_type)
+    {
+        return idle_event_.wait_for(key, timeout);
+    }
+
+    //! タスクを一つ取り出して実行する
+    /*!
+		@return 実行するタスクがなかった場合はfalseを返す
+	*/
+    bool    run_next_task(size_t thread_index)
+    {
+        task_ptr_t task;
+        if(!try_pop_task(thread_index, task)) {
+            return false;
+        }
+
+        run_task(*task);
+        finish_task_count();
+
+        return true;
+    }
+
+    //! 新たなタスクが積まれるか、終了が要求されるまで待機する
+    /*!
+		@return idle_event_への通知を受け取った可能性がある場合はtrue。
+		リアクターで待機した場合も、wake_poller()で起こされた可能性があるのでtrueを返す。
+	*/
+    bool    wait_for_task(size_t thread_index)
+    {
+        //! リアクターを使用する場合は、待機中のスレッドのうち一つがepollで待機する
+        if(poll_reactor(thread_index, reactor_tag())) {
+            return true;
+        }
+
+        //! タスクを積む側は、タスクを積んでからidle_event_の待機スレッド数を確認するので、
+        //! ここでは待機の準備をしてからタスクを確認する。
+        //! enqueue_to()やproducerで積まれたタスクを、notify_waiter()でこのスレッドに通知できるようにする。
+        auto const key = idle_event_.prepare_wait(static_cast<std::uint32_t>(thread_index));
+
+        if(is_terminated() || has_any_task(thread_index)) {
+            return idle_event_.cancel_wait();
+        }
+
+        return wait_idle_event(key, realtime_tag());
     }
 
-    bool    is_waiting() const
+    //! 補助スレッドが、新たなタスクが積まれるか、終了が要求されるか、timeoutが経過するまで待機する
+    /*!
+		補助スレッドは休止や終了をするので、リアクターでは待機しない。
+		@return idle_event_への通知を受け取った可能性がある場合はtrue
+	*/
+    bool    wait_for_task(size_t thread_index, std::chrono::milliseconds timeout)
     {
-        return waiting_count_.load() != 0;
+        auto const key = idle_event_.prepare_wait(static_cast<std::uint32_t>(thread_index));
+
+        if(is_terminated() || has_any_task(thread_index)) {
+            return idle_event_.cancel_wait();
+        }
+
+        return wait_idle_event(key, timeout, realtime_tag());
     }
 
-	void	process(int thread_index)
+	void	process(size_t thread_index)
 	{
-		(void)(thread_index); //currently unused, but maybe useful on debugging.
+		register_blocking_listener(compensation_tag());
+
+		worker_identity const identity = { this, thread_index };
+		current_worker_identity() = identity;
+
+		typename profiler_type::thread_scope profiler_scope(profiler_);
+		task_watchdog::thread_scope watchdog_scope(watchdog(watchdog_tag()), thread_index);
+
+		size_t num_iterations = 0;
 
 		for( ; ; ) {
 			if(is_terminated()) {
 				break;
 			}
 
-			task_ptr_t task = task_queue_.dequeue();
+			if(!run_realtime_task(realtime_tag())
+			   && !run_deadline_task(deadline_tag())
+			   && !run_producer_task(thread_index, producer_tag())
+			   && !run_next_task(thread_index))
+			{
+				wait_for_task(thread_index);
+			}
+
+			//! タスクを実行し続けている間も、一定回数ごとにリアクターを確認する
+			if(reactor_tag::value && ++num_iterations % 32 == 0) {
+				poll_reactor_nonblocking(reactor_tag());
+			}
+        }
+	}
+
+    //! 補助スレッドの処理
+    /*!
+		blocking_scopeの中にいるタスクの数より多くの補助スレッドがタスクを実行している場合は、
+		再び必要になるまで休止する。compensation_idle_timeoutの間に再開されなければ終了する。
+	*/
+	void	process_compensation(size_t thread_index)
+	{
+		current_blocking_listener() = this;
 
-			bool should_notify = false;
+		typename profiler_type::thread_scope profiler_scope(profiler_);
+		task_watchdog::thread_scope watchdog_scope(watchdog(watchdog_tag()), thread_index);
 
-			task->run();
+		//! 直前のwait_for_task()で、idle_event_への通知を受け取った可能性があるかどうか
+		bool notified = false;
 
+		for( ; ; ) {
 			{
-				task_count_lock_t lock(task_count_mutex_);
-				--task_count_;
+				std::unique_lock<std::mutex> lock(features_.compensation_mutex);
+				if(features_.running_compensation_count > features_.blocked_count) {
+					--features_.running_compensation_count;
+					++features_.parked_compensation_count;
+
+					//! idle_event_からの通知でこのスレッドが起こされていた場合、
+					//! そのまま休止すると積まれたタスクを実行するスレッドがいなくなるので、ほかの待機中のスレッドに通知を引き継ぐ。
+					if(notified) {
+						idle_event_.notify_one();
+						notified = false;
+					}
+
+					bool const woken = features_.c_compensation.wait_for(
+						lock, features_.compensation_idle_timeout, [this] {
+							return is_terminated() || features_.compensation_wakeups > 0;
+						});
 
-				if(is_waiting() && task_count_ == 0) {
-					should_notify = true;
+					--features_.parked_compensation_count;
+					if(is_terminated()) {
+						break;
+					}
+
+					//! 再開させる数は0なので、このスレッドの再開を待っているタスクはない。
+					//! スレッドのオブジェクトは、要素を再利用する時かデストラクタでjoinする。
+					if(!woken) {
+						features_.retired_slots.push_back(thread_index - threads_.size());
+						break;
+					}
+
+					//! running_compensation_countは、再開させたスレッドが加算済み
+					--features_.compensation_wakeups;
 				}
 			}
 
-			if(should_notify) {
-				c_task_.notify_all();
+			if(is_terminated()) {
+				break;
+			}
+
+			notified = false;
+			if(!run_realtime_task(realtime_tag())
+			   && !run_deadline_task(deadline_tag())
+			   && !run_next_task(thread_index))
+			{
+				//! タスクを待っている間に余分になった場合も休止できるように、一定時間で確認し直す
+				notified = wait_for_task(thread_index, features_.compensation_idle_timeout);
 			}
-        }
+		}
 	}
 
-    void    setup(size_t num_threads)
+    //! blocking_scopeの中に入ったタスクを補うために、補助スレッドを再開または起動する
+    void    enter_blocking() override
+    {
+        enter_blocking(compensation_tag());
+    }
+
+    //! blocking_scopeから出たことを記録する。余った補助スレッドは、実行中のタスクを終えたあとで休止する。
+    void    leave_blocking() override
     {
+        leave_blocking(compensation_tag());
+    }
+
+    void    enter_blocking(std::true_type)
+    {
+        //! 要素を再利用する場合、終了した補助スレッドはロックを解放してからjoinする
+        std::thread retired;
+
+        {
+            std::unique_lock<std::mutex> lock(features_.compensation_mutex);
+            ++features_.blocked_count;
+
+            if(is_terminated() || features_.running_compensation_count >= features_.blocked_count) {
+                return;
+            }
+
+            if(features_.parked_compensation_count > features_.compensation_wakeups) {
+                ++features_.running_compensation_count;
+                ++features_.compensation_wakeups;
+                features_.c_compensation.notify_one();
+            } else if(num_live_compensation_threads() < features_.max_compensation_threads) {
+                auto &slots = features_.retired_slots;
+                size_t const slot = slots.empty() ? features_.compensation_threads.size() : slots.back();
+                size_t const index = threads_.size() + slot;
+                std::thread th([this, index] { process_compensation(index); });
+
+                if(slots.empty()) {
+                    features_.compensation_threads.push_back(std::move(th));
+                } else {
+                    slots.pop_back();
+                    retired = std::move(features_.compensation_threads[slot]);
+                    features_.compensation_threads[slot] = std::move(th);
+                }
+                ++features_.running_compensation_count;
+            }
+        }
+
+        if(retired.joinable()) {
+            retired.join();
+        }
+    }
+
+    //! 終了していない補助スレッドの数（休止しているスレッドも含む）。compensation_mutexをロックして呼び出す。
+    size_t  num_live_compensation_threads() const
+    {
+        return features_.compensation_threads.size() - features_.retired_slots.size();
+    }
+
+    void    leave_blocking(std::true_type)
+    {
+        std::unique_lock<std::mutex> lock(features_.compensation_mutex);
+        --features_.blocked_count;
+    }
+
+    //! 補助スレッドを使用しない場合は、ウォッチドッグからの通知も無視する
+    void    enter_blocking(std::false_type) {}
+
+    void    leave_blocking(std::false_type) {}
+
+    //! blocking_scopeの通知をこのタスクキューで受け取るように、スレッドに登録する
+    void    register_blocking_listener(std::true_type)
+    {
+        current_blocking_listener() = this;
+    }
+
+    //! 補助スレッドを使用しない場合は登録しないので、blocking_scopeは何もしない
+    void    register_blocking_listener(std::false_type) {}
+
+    size_t  num_compensation_threads(std::true_type) const
+    {
+        std::unique_lock<std::mutex> lock(features_.compensation_mutex);
+        return num_live_compensation_threads();
+    }
+
+    size_t  num_compensation_threads(std::false_type) const { return 0; }
+
+    std::unique_lock<std::mutex>    lock_compensation_state(std::true_type)
+    {
+        return std::unique_lock<std::mutex>(features_.compensation_mutex);
+    }
+
+    std::unique_lock<std::mutex>    lock_compensation_state(std::false_type)
+    {
+        return std::unique_lock<std::mutex>();
+    }
+
+    void    wake_all_compensation_threads(std::true_type)
+    {
+        features_.c_compensation.notify_all();
+    }
+
+    void    wake_all_compensation_threads(std::false_type) {}
+
+    task_watchdog * watchdog(std::true_type) const { return features_.watchdog.get(); }
+
+    task_watchdog * watchdog(std::false_type) const { return nullptr; }
+
+    //! 実行中のタスクを公開するスロット。ウォッチドッグを使用しない場合はnullptr
+    watchdog_slot * current_slot(std::true_type) const { return current_watchdog_slot(); }
+
+    watchdog_slot * current_slot(std::false_type) const { return nullptr; }
+
+    void    stop_watchdog(std::true_type)
+    {
+        if(features_.watchdog) {
+            features_.watchdog->stop();
+        }
+    }
+
+    void    stop_watchdog(std::false_type) {}
+
+    void    collect_watchdog_metrics(task_queue_metrics &m, std::true_type) const
+    {
+        if(features_.watchdog) {
+            features_.watchdog->collect(m);
+        }
+    }
+
+    void    collect_watchdog_metrics(task_queue_metrics &, std::false_type) const {}
+
+    void    setup(size_t num_threads, size_t queue_limit, task_queue_options const &options)
+    {
+		//! シャードが一つの場合は、シャードの上限とキュー全体の上限が一致するので、locked_queueの上限だけを使う。
+		bool const global_limit =
+			options.limit_scope == queue_limit_scope::global && options.num_shards > 1;
+
+		setup_global_limit(global_limit ? queue_limit : (std::numeric_limits<size_t>::max)(), global_limit_tag());
+		shard_selection_ = options.selection;
+
+		setup_reactor(options, reactor_tag());
+
+		bytes_.setup(options.queue_byte_limit, options.track_pending_bytes);
+		profiler_.setup(options.enable_perf_counters);
+		recording_.setup(options.recorder);
+
+		setup_compensation(options, compensation_tag());
+
+		shards_.resize(options.num_shards);
+		for(size_t i = 0; i < options.num_shards; ++i) {
+			shards_[i].reset(
+				new shard(global_limit ? (std::numeric_limits<size_t>::max)() : queue_limit));
+		}
+
+		setup_local_queues(num_threads, queue_limit, targeted_tag());
+		setup_producer_rings(num_threads, producer_tag());
+		setup_realtime(options, realtime_tag());
+
+		//! スレッドはウォッチドッグにスロットを登録するので、ウォッチドッグはスレッドより先に起動する。
+		setup_watchdog(options, watchdog_tag());
+
+		//! lazy_startupの場合は、タスクが積まれた時にnotify_task_pushed()から起動する。
 		threads_.resize(num_threads);
-		for(size_t i = 0; i < num_threads; ++i) {
-			threads_[i] = std::thread([this, i] { process(i); });
+		if(!setup_lazy_startup(num_threads, options, lazy_startup_tag())) {
+			for(size_t i = 0; i < num_threads; ++i) {
+				threads_[i] = std::thread([this, i] { process(i); });
+			}
+		}
+    }
+
+    void    setup_global_limit(size_t limit, std::true_type)
+    {
+        features_.global_limit = limit;
+    }
+
+    void    setup_global_limit(size_t limit, std::false_type)
+    {
+        assert(limit == (std::numeric_limits<size_t>::max)()
+               && "queue_limit_scope::global with multiple shards requires task_queue_feature::global_limit.");
+        (void)limit;
+    }
+
+    void    setup_reactor(task_queue_options const &options, std::false_type)
+    {
+        assert(!options.enable_reactor && "enable_reactor requires task_queue_feature::reactor.");
+        (void)options;
+    }
+
+#if defined(HWM_TASK_HAS_REACTOR)
+    void    setup_reactor(task_queue_options const &options, std::true_type)
+    {
+        if(options.enable_reactor) {
+            features_.io_reactor.reset(new reactor());
+        }
+    }
+#endif
+
+    //! 補助スレッドを使用しない場合、max_compensation_threadsは無視する
+    void    setup_compensation(task_queue_options const &options, std::true_type)
+    {
+        features_.max_compensation_threads = options.max_compensation_threads;
+        features_.compensation_idle_timeout = options.compensation_idle_timeout;
+        assert(options.compensation_idle_timeout.count() > 0
+               && "compensation_idle_timeout must be positive.");
+    }
+
+    void    setup_compensation(task_queue_options const &, std::false_type) {}
+
+    void    setup_local_queues(size_t num_threads, size_t queue_limit, std::true_type)
+    {
+        features_.local_queues.resize(num_threads);
+        for(size_t i = 0; i < num_threads; ++i) {
+            features_.local_queues[i].reset(new queue_type(queue_limit));
+        }
+    }
+
+    void    setup_local_queues(size_t, size_t, std::false_type) {}
+
+    void    setup_producer_rings(size_t num_threads, std::true_type)
+    {
+        features_.thread_rings.resize(num_threads);
+        for(size_t i = 0; i < num_threads; ++i) {
+            features_.thread_rings[i].reset(new producer_rings());
+        }
+    }
+
+    void    setup_producer_rings(size_t, std::false_type) {}
+
+    void    setup_realtime(task_queue_options const &options, std::true_type)
+    {
+        features_.realtime_poll_interval = options.realtime_poll_interval;
+    }
+
+    void    setup_realtime(task_queue_options const &, std::false_type) {}
+
+    void    setup_watchdog(task_queue_options const &options, std::true_type)
+    {
+        assert((!options.compensate_stuck_tasks || compensation_tag::value)
+               && "compensate_stuck_tasks requires task_queue_feature::compensation.");
+
+        if(options.stuck_task_threshold.count() > 0) {
+            features_.watchdog.reset(
+                new task_watchdog(
+                    *this, options.stuck_task_threshold, options.on_stuck_task, options.compensate_stuck_tasks));
         }
     }
 
+    void    setup_watchdog(task_queue_options const &options, std::false_type)
+    {
+        assert(options.stuck_task_threshold.count() == 0
+               && "stuck_task_threshold requires task_queue_feature::watchdog.");
+        (void)options;
+    }
+
+    //! @return lazy_startupを指定した場合はtrue。その場合、スレッドはまだ起動しない
+    bool    setup_lazy_startup(size_t num_threads, task_queue_options const &options, std::true_type)
+    {
+        features_.lazy_startup = options.lazy_startup;
+        features_.started_count.store(options.lazy_startup ? 0 : num_threads);
+        return options.lazy_startup;
+    }
+
+    bool    setup_lazy_startup(size_t, task_queue_options const &options, std::false_type)
+    {
+        assert(!options.lazy_startup && "lazy_startup requires task_queue_feature::lazy_startup.");
+        (void)options;
+        return false;
+    }
+
     void    join_threads()
     {
         assert(is_terminated());
 
+        //! 終了フラグが設定された後はスレッドが起動されないので、ロックせずに参照できる。
         for(auto &th: threads_) {
+            if(th.joinable()) {
+                th.join();
+            }
+        }
+
+        join_compensation_threads(compensation_tag());
+    }
+
+    //! 終了フラグが設定された後は補助スレッドが追加されないので、ロックせずに参照できる。
+    void    join_compensation_threads(std::true_type)
+    {
+        for(auto &th: features_.compensation_threads) {
             th.join();
         }
     }
+
+    void    join_compensation_threads(std::false_type) {}
 };
 
+//! アロケータだけを指定する版のタスクキュー
+/*!
+	キューポリシー以外はデフォルトの構成になる。
+*/
+template<template<class...> class Allocator = std::allocator>
+using task_queue_with_allocator = basic_task_queue<task_queue_policies<locked_queue_policy<Allocator>>>;
+
 }}  //detail::ns_task
 
 //! hwm::detail::ns_task内のtask_queueクラスをhwm名前空間で使えるように
+using detail::ns_task::basic_task_queue;
 using detail::ns_task::task_queue_with_allocator;
 
 //! 標準アロケータを指定する版のタスクキュー
 using task_queue = task_queue_with_allocator<std::allocator>;
 
+//! プロセス全体で共有するデフォルトのタスクキューを返す
+/*!
+	最初に呼び出された時に、std::thread::hardware_concurrency()を上限として
+	task_queue_options::lazy_startupを指定したタスクキューを構築する。
+	スレッドはタスクが積まれるまで起動されない。
+
+	このタスクキューは破棄されないので、静的オブジェクトの初期化や破棄の途中からでも呼び出せる。
+	@note プログラムの終了時に実行中のタスクは待機されない。タスクの完了が必要な場合はwait()で待機すること。
+*/
+inline
+task_queue & default_task_queue()
+{
+    static task_queue *tq = [] {
+        task_queue_options options;
+        options.lazy_startup = true;
+        return new task_queue(
+            (std::max)(std::thread::hardware_concurrency(), 1u),
+            (std::numeric_limits<size_t>::max)(),
+            options);
+    }();
+
+    return *tq;
+}
+
 }   //namespace hwm
@@ -0,0 +1,214 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "./task_base.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! タスクの種類（タグ）ごとに集計した、タスクの実行時の統計情報
+/*!
+	task_queue_options::enable_perf_countersを指定した場合に計測される。
+	ハードウェアカウンタの値は、perf_event_open()で開いたカウンタをタスクの実行の前後で読んだ差分の合計。
+	カウンタを開けなかった環境（Linux以外や、権限が不足している場合など）では、num_tasksとtotal_nanosecondsだけが計測される。
+	カウンタはユーザー空間で実行された分だけを数える。
+*/
+struct task_perf_counters
+{
+    task_perf_counters()
+        :   num_tasks(0)
+        ,   total_nanoseconds(0)
+        ,   cycles(0)
+        ,   instructions(0)
+        ,   llc_misses(0)
+        ,   context_switches(0)
+    {}
+
+    //! 実行されたタスクの数
+    std::uint64_t   num_tasks;
+    //! タスクの実行にかかった時間の合計（ナノ秒）
+    std::uint64_t   total_nanoseconds;
+    //! CPUサイクル数
+    std::uint64_t   cycles;
+    //! 実行された命令数
+    std::uint64_t   instructions;
+    //! 最終レベルキャッシュのミス数
+    std::uint64_t   llc_misses;
+    //! コンテキストスイッチの回数
+    std::uint64_t   context_switches;
+
+    //! サイクルあたりの命令数（IPC）
+    double ipc() const
+    {
+        return cycles == 0 ? 0.0 : static_cast<double>(instructions) / static_cast<double>(cycles);
+    }
+
+    task_perf_counters & operator+=(task_perf_counters const &rhs)
+    {
+        num_tasks += rhs.num_tasks;
+        total_nanoseconds += rhs.total_nanoseconds;
+        cycles += rhs.cycles;
+        instructions += rhs.instructions;
+        llc_misses += rhs.llc_misses;
+        context_switches += rhs.context_switches;
+        return *this;
+    }
+};
+
+//! task_perf_countersの各カウンタを、いずれかのスレッドで開けたかどうか
+/*!
+	開けなかったカウンタの値は0のままになる。
+	仮想環境などでは、ハードウェアカウンタを開けずにソフトウェアカウンタ（context_switches）だけが開けることがある。
+*/
+struct perf_counter_availability
+{
+    perf_counter_availability()
+        :   cycles(false)
+        ,   instructions(false)
+        ,   llc_misses(false)
+        ,   context_switches(false)
+    {}
+
+    bool    cycles;
+    bool    instructions;
+    bool    llc_misses;
+    bool    context_switches;
+
+    perf_counter_availability & operator|=(perf_counter_availability const &rhs)
+    {
+        cycles = cycles || rhs.cycles;
+        instructions = instructions || rhs.instructions;
+        llc_misses = llc_misses || rhs.llc_misses;
+        context_switches = context_switches || rhs.context_switches;
+        return *this;
+    }
+};
+
+//! ウォッチドッグが検出した、実行時間が閾値を超えたタスクの情報
+/*!
+	task_queue_options::stuck_task_thresholdを指定した場合に記録される。
+*/
+struct stuck_task_info
+{
+    stuck_task_info()
+        :   thread_index(0)
+        ,   tag(0)
+        ,   duration(0)
+        ,   compensated(false)
+    {}
+
+    //! タスクを実行しているスレッドのインデックス（補助スレッドの場合はnum_threads()以上の値）
+    size_t                      thread_index;
+    //! タスクのタグ
+    task_tag                    tag;
+    //! 検出した時点での実行時間
+    std::chrono::nanoseconds    duration;
+    //! 補助スレッドを起動してスレッド数を補ったかどうか
+    bool                        compensated;
+};
+
+//! enqueue_with_deadline()で積まれたタスクの統計情報
+struct deadline_task_metrics
+{
+    deadline_task_metrics()
+        :   executed(0)
+        ,   expired(0)
+        ,   total_start_slack(0)
+        ,   min_start_slack(0)
+    {}
+
+    //! 期限までに開始されたタスクの数
+    std::uint64_t               executed;
+    //! 期限を過ぎたために実行されずに破棄されたタスクの数
+    std::uint64_t               expired;
+    //! 実行されたタスクについて、開始した時点から期限までの残り時間の合計
+    std::chrono::nanoseconds    total_start_slack;
+    //! 実行されたタスクについて、開始した時点から期限までの残り時間の最小値（期限に最も迫って開始されたもの）
+    /*!
+		まだタスクが実行されていない場合は、std::chrono::nanoseconds::max()になる。
+	*/
+    std::chrono::nanoseconds    min_start_slack;
+
+    //! 開始した時点から期限までの残り時間の平均
+    std::chrono::nanoseconds mean_start_slack() const
+    {
+        return executed == 0 ? std::chrono::nanoseconds(0) : total_start_slack / static_cast<std::int64_t>(executed);
+    }
+};
+
+//! タスクキューの状態を表す統計情報
+/*!
+	basic_task_queue::metrics()で取得する。
+	各値は別々に読み出されるので、互いに厳密に整合しているとは限らない。
+*/
+struct task_queue_metrics
+{
+    task_queue_metrics()
+        :   num_tasks(0)
+        ,   pending_bytes(0)
+        ,   peak_pending_bytes(0)
+        ,   queue_byte_limit(0)
+        ,   perf_counters_available(false)
+        ,   num_stuck_tasks(0)
+    {}
+
+    //! 積まれてから実行が完了していないタスクの数（実行中のタスクを含む）
+    size_t  num_tasks;
+
+    //! キューに積まれているタスクのサイズの合計（バイト数）
+    /*!
+		task_queue_options::queue_byte_limitかtrack_pending_bytesを指定した場合だけ計測される。
+	*/
+    size_t  pending_bytes;
+
+    //! pending_bytesの最大値
+    size_t  peak_pending_bytes;
+
+    //! task_queue_options::queue_byte_limitに指定した値
+    size_t  queue_byte_limit;
+
+    //! タスクの種類（タグ）ごとの統計情報
+    /*!
+		task_queue_options::enable_perf_countersを指定した場合だけ集計される。
+	*/
+    std::map<task_tag, task_perf_counters>  task_counters;
+
+    //! いずれかのスレッドでハードウェアカウンタ（CPUサイクル数）を開けたかどうか
+    /*!
+		ソフトウェアカウンタだけを開けた場合はfalseになる。各カウンタの状態はavailable_perf_countersで取得できる。
+	*/
+    bool    perf_counters_available;
+
+    //! カウンタごとの、開けたかどうか
+    perf_counter_availability   available_perf_counters;
+
+    //! ウォッチドッグが検出した、実行時間が閾値を超えたタスクの数
+    size_t  num_stuck_tasks;
+
+    //! ウォッチドッグが最近検出したタスクの情報（古いものから順に、最大64件）
+    std::vector<stuck_task_info>    recent_stuck_tasks;
+
+    //! enqueue_with_deadline()で積まれたタスクの統計情報
+    deadline_task_metrics   deadline;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::deadline_task_metrics;
+using detail::ns_task::perf_counter_availability;
+using detail::ns_task::stuck_task_info;
+using detail::ns_task::task_perf_counters;
+using detail::ns_task::task_queue_metrics;
+
+}   //namespace hwm
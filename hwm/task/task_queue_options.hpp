@@ -0,0 +1,178 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include "./task_queue_metrics.hpp"
+#include "./workload_recorder.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! enqueue()でタスクを追加するシャードの選び方
+enum class shard_selection
+{
+    //! スレッドごとに、シャードを順番に選ぶ
+    round_robin,
+    //! ランダムに選んだ二つのシャードのうち、積まれているタスクが少ない方を選ぶ
+    power_of_two_choices,
+};
+
+//! queue_limitをどの範囲のタスク数に適用するか
+enum class queue_limit_scope
+{
+    //! すべてのシャードに積まれているタスク数の合計に適用する
+    global,
+    //! シャードごとに適用する
+    per_shard,
+};
+
+//! タスクキューの構成を指定するオプション
+struct task_queue_options
+{
+    task_queue_options()
+        :   num_shards(1)
+        ,   selection(shard_selection::round_robin)
+        ,   limit_scope(queue_limit_scope::global)
+        ,   max_compensation_threads((std::max)(std::thread::hardware_concurrency(), 1u))
+        ,   compensation_idle_timeout(std::chrono::milliseconds(10000))
+        ,   lazy_startup(false)
+        ,   realtime_poll_interval(std::chrono::microseconds(1000))
+        ,   queue_byte_limit((std::numeric_limits<size_t>::max)())
+        ,   track_pending_bytes(false)
+        ,   enable_reactor(false)
+        ,   enable_perf_counters(false)
+        ,   stuck_task_threshold(0)
+        ,   compensate_stuck_tasks(false)
+    {}
+
+    //! enqueue()で積まれたタスクを保持するキュー（シャード）の数
+    /*!
+		シャードごとに独立したロックを持つので、多数のスレッドから同時にenqueue()する場合の競合を分散できる。
+		各スレッドは自分に割り当てられたシャードから先にタスクを取り出し、そこが空の場合は他のシャードを探す。
+	*/
+    size_t              num_shards;
+
+    //! enqueue()でタスクを追加するシャードの選び方
+    shard_selection     selection;
+
+    //! queue_limitをどの範囲のタスク数に適用するか
+    queue_limit_scope   limit_scope;
+
+    //! blocking_scopeの中で待機しているタスクを補うために起動する、補助スレッドの最大数
+    /*!
+		デフォルトはstd::thread::hardware_concurrency()（取得できない場合は1）。
+		休止している補助スレッドも含めて数える。
+	*/
+    size_t              max_compensation_threads;
+
+    //! 休止している補助スレッドが、再び必要にならないまま終了するまでの時間
+    /*!
+		タスクを待っている補助スレッドも、この間隔で余分になっていないかを確認して休止する。
+		終了した補助スレッドは、再び必要になった時に起動し直す。0より大きい値を指定しなければならない。
+	*/
+    std::chrono::milliseconds   compensation_idle_timeout;
+
+    //! スレッドをコンストラクタで起動せず、必要になった時点で起動する
+    /*!
+		trueの場合、タスクが積まれた時に待機中のスレッドがなければ、num_threadsを上限としてスレッドを一つ起動する。
+		そのため、タスクキューの構築にかかる時間が短くなり、使われないスレッドも起動されない。
+	*/
+    bool                lazy_startup;
+
+    //! make_realtime_producer()で作成したハンドルが存在する間、待機中のスレッドがリングバッファを確認する間隔
+    /*!
+		リアルタイムスレッドはタスクキューのスレッドを起こす処理を行わないので、
+		待機中のスレッドはこの間隔でリングバッファを確認する。
+	*/
+    std::chrono::microseconds   realtime_poll_interval;
+
+    //! キューに積まれているタスクのサイズの合計の上限（バイト数）
+    /*!
+		タスクのサイズは、タスクのオブジェクト（関数オブジェクトと引数を保持するtupleを含む）のsizeofに、
+		enqueue_with_size()で報告されたバイト数を加えたもの。
+		上限を超える場合、タスクを積む処理は、タスクが取り出されて上限に収まるようになるまでブロックする。
+		ただし、キューが空の場合は、上限より大きなタスクでも積むことができる。
+		queue_limitと両方を指定した場合は、両方の上限が適用される。
+		producerやrealtime_producerのリングバッファに積まれたタスクは対象外。
+	*/
+    size_t              queue_byte_limit;
+
+    //! queue_byte_limitを指定しない場合も、キューに積まれているタスクのサイズの合計を計測する
+    /*!
+		計測した値はbasic_task_queue::metrics()で取得できる。
+		queue_byte_limitを指定した場合は、この値によらず計測する。
+	*/
+    bool                track_pending_bytes;
+
+    //! epollによるリアクターを有効にする（Linuxのみ）
+    /*!
+		trueの場合、待機中のスレッドのうち一つが、新たなタスクと一緒にepollでファイルディスクリプタの準備を待つ。
+		async_read()、async_write()、async_accept()、on_readable()、on_writable()で登録した操作は、
+		準備ができた時点でそのスレッドが処理するので、別のイベントループからenqueue()でタスクを積み直す必要がない。
+		これらの関数は、リアクターに対応した環境（HWM_TASK_HAS_REACTORが定義される環境）でだけ定義される。
+	*/
+    bool                enable_reactor;
+
+    //! タスクの種類（タグ）ごとに、実行時間とハードウェアカウンタの値を集計する
+    /*!
+		trueの場合、各スレッドはperf_event_open()でCPUサイクル数、命令数、最終レベルキャッシュのミス数、
+		コンテキストスイッチの回数のカウンタをグループとして開き、タスクの実行の前後で読み出す。
+		集計した値はbasic_task_queue::metrics()のtask_countersで取得できる。
+		カウンタの読み出しはタスクごとにシステムコールを伴うので、実行時間の短いタスクを大量に実行する場合は負荷が大きい。
+		uninstrumented_policyを指定したタスクキューでは使用できない。
+	*/
+    bool                enable_perf_counters;
+
+    //! ウォッチドッグが、実行時間が長すぎるタスクとして検出する閾値
+    /*!
+		0より大きい値を指定すると、タスクキューはウォッチドッグのスレッドを起動する。
+		ウォッチドッグは閾値の1/4の間隔で各スレッドが実行中のタスクの開始時刻を確認し、
+		閾値を超えて実行されているタスクを見つけると、タスク一つにつき一度だけ、
+		そのタグと実行時間を記録してon_stuck_taskを呼び出す。
+		記録した情報はbasic_task_queue::metrics()で取得できる。
+	*/
+    std::chrono::milliseconds   stuck_task_threshold;
+
+    //! 実行時間が長すぎるタスクを検出した時に呼び出される関数
+    /*!
+		ウォッチドッグのスレッドから呼び出される。この関数の中でタスクキューを破棄してはならない。
+	*/
+    std::function<void(stuck_task_info const &)>    on_stuck_task;
+
+    //! 実行時間が長すぎるタスクを検出した時に、そのタスクがblocking_scopeに入ったものとみなして補助スレッドを起動する
+    /*!
+		検出したタスクが終了するまで、補助スレッドがタスクを実行してスレッド数を補う。
+		（max_compensation_threadsの上限が適用される）
+		ハングしたタスクがスレッドを一つ占有しても、残りのタスクの処理は続けられる。
+		ただし、そのタスクが終了しない限り、wait()は戻らない。
+	*/
+    bool                compensate_stuck_tasks;
+
+    //! タスクの投入と実行を記録するworkload_recorder
+    /*!
+		指定すると、タスクが積まれた時刻、積んだスレッド、タグ、積んだタスク、実行時間を記録する。
+		nullptrの場合は記録しない。
+		uninstrumented_policyを指定したタスクキューでは使用できない。
+	*/
+    std::shared_ptr<workload_recorder>  recorder;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::shard_selection;
+using detail::ns_task::queue_limit_scope;
+using detail::ns_task::task_queue_options;
+
+}   //namespace hwm
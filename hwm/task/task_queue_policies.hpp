@@ -0,0 +1,584 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "./eventcount.hpp"
+#include "./lifo_eventcount.hpp"
+#include "./light_future.hpp"
+#include "./locked_queue.hpp"
+#include "./task_impl.hpp"
+#include "./task_profiler.hpp"
+#include "./workload_recorder.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! @file
+/*!
+	basic_task_queueの構成をコンパイル時に指定するポリシー。
+	task_queue_policiesに各ポリシーをまとめて、basic_task_queueのテンプレート引数に渡す。
+	uncounted_policyはタスク数のカウンタとそのミューテックス、条件変数を、
+	uninstrumented_policyはバイト数の計測、統計情報の集計、記録のための状態と、タスクごとに付加するその情報を取り除く。
+	機能ポリシーで無効にした機能の状態（キュー、リングバッファ、ミューテックス、条件変数など）もタスクキューに含まれず、
+	スレッドはタスクを探す時にその機能のキューを確認しない。
+	@note blocking_scopeの通知を受け取るための仮想関数テーブルへのポインタは、どの構成でも残る。
+*/
+
+/////////////////////////////////////////////////////////////////////////////
+// キューポリシー
+//   template<class T> struct queue { typedef ... type; };
+//   typeは、locked_queueと同じくenqueue(T)、try_dequeue(T &)、size()、empty()と、
+//   容量を受け取るコンストラクタを持たなければならない。
+
+//! std::dequeをstd::mutexで保護したlocked_queueを使用する（デフォルト）
+template<template<class...> class Allocator = std::allocator>
+struct locked_queue_policy
+{
+    template<class T>
+    struct queue
+    {
+        typedef locked_queue<T, std::deque<T, Allocator<T>>> type;
+    };
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// 待機ポリシー
+//   event_typeは、eventcountと同じインターフェースを持たなければならない。
+//   cancel_wait()は、待機の準備の間に行われた通知をそのスレッドが受け取っていた場合にtrueを返す。
+//   タスクキューのスレッドはprepare_wait()にスレッドのインデックスを指定して待機し、
+//   enqueue_to()やproducerで特定のスレッドにタスクを積んだ時は、notify_waiter()でそのスレッドだけを起こす。
+
+//! 実行するタスクがないスレッドを、eventcountで休止させる（デフォルト）
+struct blocking_idle_policy
+{
+    typedef eventcount event_type;
+};
+
+//! @class 休止せずにstd::this_thread::yield()を繰り返して待機するイベント
+/*!
+	eventcountと同じインターフェースを持つ。
+	待機側はシステムコールで休止しないので、タスクが積まれてから実行が始まるまでの遅延は小さいが、
+	タスクがない間もCPUを使い続ける。通知はatomicな変数の加算だけで終わる。
+*/
+struct spinning_event
+{
+    typedef std::uint32_t key_type;
+
+    spinning_event()
+        :   epoch_(0)
+        ,   waiters_(0)
+    {}
+
+    spinning_event(spinning_event const &) = delete;
+    spinning_event & operator=(spinning_event const &) = delete;
+
+    key_type prepare_wait()
+    {
+        waiters_.fetch_add(1);
+        return epoch_.load();
+    }
+
+    //! 待機側はepoch_を見ているだけなので、番号によらず同じ
+    key_type prepare_wait(std::uint32_t)
+    {
+        return prepare_wait();
+    }
+
+    //! 通知は待機しているすべてのスレッドに見えるので、このスレッドが受け取ってしまうことはない
+    bool cancel_wait()
+    {
+        waiters_.fetch_sub(1);
+        return false;
+    }
+
+    void wait(key_type key)
+    {
+        while(epoch_.load() == key) {
+            std::this_thread::yield();
+        }
+        waiters_.fetch_sub(1);
+    }
+
+    template<class Rep, class Period>
+    bool wait_for(key_type key, std::chrono::duration<Rep, Period> const &dur)
+    {
+        auto const deadline = std::chrono::steady_clock::now() + dur;
+        bool notified = false;
+        for( ; ; ) {
+            if(epoch_.load() != key) {
+                notified = true;
+                break;
+            }
+            if(std::chrono::steady_clock::now() >= deadline) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+        waiters_.fetch_sub(1);
+        return notified;
+    }
+
+    void notify_one() { notify(); }
+    void notify_all() { notify(); }
+    //! どのスレッドも休止していないので、epoch_を変更するだけで済む
+    void notify_waiter(std::uint32_t) { notify(); }
+
+    bool has_waiters() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return waiters_.load() != 0;
+    }
+
+    std::uint32_t num_waiters() const
+    {
+        return waiters_.load();
+    }
+
+private:
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(waiters_.load() != 0) {
+            epoch_.fetch_add(1);
+        }
+    }
+
+    std::atomic<std::uint32_t>  epoch_;
+    std::atomic<std::uint32_t>  waiters_;
+};
+
+//! 実行するタスクがないスレッドを、lifo_eventcountで休止させる
+/*!
+	タスクが積まれると、最も最近休止したスレッドから順に起こす。
+	スレッド数に対して負荷が低い場合に、タスクを実行するスレッドが少数に偏るので、
+	キャッシュが温まったコアでタスクが実行されやすくなる。
+*/
+struct lifo_idle_policy
+{
+    typedef lifo_eventcount event_type;
+};
+
+//! 実行するタスクがないスレッドを、休止させずにspinning_eventで待機させる
+/*!
+	スレッド数がコア数以下で、タスクが途切れずに積まれ続ける場合に使用する。
+*/
+struct spinning_idle_policy
+{
+    typedef spinning_event event_type;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// 結果ポリシー
+//   template<class R> struct promise { typedef ... type; };
+//   template<class R> struct future { typedef ... type; };
+//   template<class R> static future<R>::type get_future(promise<R>::type &);
+//   promise<R>::typeは、set_value()とset_exception()を持たなければならない。
+
+//! タスクの結果をstd::futureで返す（デフォルト）
+struct future_result_policy
+{
+    template<class R> struct promise { typedef std::promise<R> type; };
+    template<class R> struct future { typedef std::future<R> type; };
+
+    template<class R>
+    static std::future<R> get_future(std::promise<R> &p) { return p.get_future(); }
+};
+
+//! タスクの結果をlight_futureで返す
+struct light_future_result_policy
+{
+    template<class R> struct promise { typedef light_promise<R> type; };
+    template<class R> struct future { typedef light_future<R> type; };
+
+    template<class R>
+    static light_future<R> get_future(light_promise<R> &p) { return p.get_future(); }
+};
+
+//! タスクの結果を返さない。enqueue()はno_futureを返し、タスクの戻り値と例外は捨てられる
+struct no_result_policy
+{
+    template<class R> struct promise { typedef null_promise<R> type; };
+    template<class R> struct future { typedef no_future type; };
+
+    template<class R>
+    static no_future get_future(null_promise<R> &) { return no_future(); }
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// 計数ポリシー
+//   counter_typeは、enabled、add()、finish()、count()を持ち、
+//   enabledがtrueの場合はwait()、wait_until()、wait_for()も持たなければならない。
+
+//! 積まれてから実行が完了していないタスク数を数える
+struct task_counter
+{
+    static bool const enabled = true;
+
+    task_counter()
+        :   count_(0)
+        ,   waiting_(0)
+    {}
+
+    task_counter(task_counter const &) = delete;
+    task_counter & operator=(task_counter const &) = delete;
+
+    //! タスクが積まれたことを記録する
+    void add() { ++count_; }
+
+    //! タスクの実行が完了した（または積まれなかった）ことを記録する
+    /*!
+		wait()で待機しているスレッドは、waiting_を加算してからcount_を確認し、
+		ここでは逆にcount_を減算してからwaiting_を確認する。
+		そのため、どちらかが必ず相手の変更に気づくので、通知を見逃すことはない。
+	*/
+    void finish()
+    {
+        if(--count_ == 0 && waiting_.load() != 0) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+            }
+            c_task_.notify_all();
+        }
+    }
+
+    size_t count() const { return count_.load(); }
+
+    void wait() const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        scoped_waiting sw(waiting_);
+        c_task_.wait(lock, [this]{ return count_.load() == 0; });
+    }
+
+    template<class TimePoint>
+    bool wait_until(TimePoint tp) const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        scoped_waiting sw(waiting_);
+        return c_task_.wait_until(lock, tp, [this]{ return count_.load() == 0; });
+    }
+
+    template<class Duration>
+    bool wait_for(Duration dur) const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        scoped_waiting sw(waiting_);
+        return c_task_.wait_for(lock, dur, [this]{ return count_.load() == 0; });
+    }
+
+private:
+    struct scoped_waiting
+    {
+        scoped_waiting(std::atomic<size_t> &waiting) : waiting_(waiting) { ++waiting_; }
+        ~scoped_waiting() { --waiting_; }
+
+        scoped_waiting(scoped_waiting const &) = delete;
+        scoped_waiting & operator=(scoped_waiting const &) = delete;
+
+    private:
+        std::atomic<size_t> &waiting_;
+    };
+
+    std::atomic<size_t>             count_;
+    std::atomic<size_t> mutable     waiting_;
+    std::mutex mutable              mutex_;
+    std::condition_variable mutable c_task_;
+};
+
+//! タスク数を数えない
+/*!
+	タスクを積む時と実行し終えた時のatomicな操作がなくなる代わりに、
+	wait()、wait_until()、wait_for()は使用できず、デストラクタも積まれたままのタスクを待機しない。
+*/
+struct null_task_counter
+{
+    static bool const enabled = false;
+
+    void add() {}
+    void finish() {}
+    size_t count() const { return 0; }
+};
+
+//! タスク数を数えて、wait()で待機できるようにする（デフォルト）
+struct counted_policy
+{
+    typedef task_counter counter_type;
+};
+
+//! タスク数を数えない
+struct uncounted_policy
+{
+    typedef null_task_counter counter_type;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// 計測ポリシー
+//   accounting_typeは、キューに積まれているタスクのバイト数の計測と、
+//   task_queue_options::queue_byte_limitによる制限を行う。
+//   profiler_typeは、task_queue_options::enable_perf_countersによるタスクの種類ごとの統計情報の集計を行う。
+//   recording_typeは、task_queue_options::recorderによるタスクの投入と実行の記録を行う。
+//   template<class Task> struct task { typedef ... type; };
+//   typeは、タスクキューがtask_implの代わりに作成するタスクの型。
+//   バイト数、タグ、記録のidを保持する場合はinstrumented_task<Task>、保持しない場合はTaskとする。
+
+//! キューに積まれているタスクのバイト数を計測する
+struct byte_accounting
+{
+    byte_accounting()
+        :   limit_((std::numeric_limits<size_t>::max)())
+        ,   tracking_(false)
+        ,   pending_(0)
+        ,   peak_(0)
+        ,   waiters_(0)
+    {}
+
+    byte_accounting(byte_accounting const &) = delete;
+    byte_accounting & operator=(byte_accounting const &) = delete;
+
+    //! @param limit task_queue_options::queue_byte_limitの値
+    //! @param track task_queue_options::track_pending_bytesの値
+    void setup(size_t limit, bool track)
+    {
+        limit_ = limit;
+        tracking_ = track || limit != (std::numeric_limits<size_t>::max)();
+    }
+
+    //! バイト数を計測するかどうか
+    bool tracking() const { return tracking_; }
+
+    //! タスクのサイズを加算する。上限を超える場合は、収まるようになるまで待機する
+    /*!
+		キューが空の場合は、上限より大きなタスクでも追加できる。
+	*/
+    void acquire(size_t bytes)
+    {
+        auto fits = [this, bytes](size_t current) {
+            return current == 0 || (current <= limit_ && bytes <= limit_ - current);
+        };
+
+        size_t n = pending_.load();
+        for( ; ; ) {
+            if(fits(n)) {
+                if(pending_.compare_exchange_weak(n, n + bytes)) {
+                    break;
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++waiters_;
+            c_limit_.wait(lock, [this, &n, &fits] {
+                n = pending_.load();
+                return fits(n);
+            });
+            --waiters_;
+        }
+
+        size_t const total = n + bytes;
+        size_t peak = peak_.load(std::memory_order_relaxed);
+        while(peak < total && !peak_.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {}
+    }
+
+    //! キューから取り出されたタスクのサイズを減算する
+    void release(size_t bytes)
+    {
+        pending_.fetch_sub(bytes);
+        if(waiters_.load() != 0) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+            }
+            //! 待機しているタスクのサイズはそれぞれ異なるので、すべて起こして確認させる
+            c_limit_.notify_all();
+        }
+    }
+
+    size_t pending() const { return pending_.load(); }
+    size_t peak() const { return peak_.load(); }
+    size_t limit() const { return limit_; }
+
+private:
+    size_t                  limit_;
+    bool                    tracking_;
+    std::atomic<size_t>     pending_;
+    std::atomic<size_t>     peak_;
+    std::atomic<size_t>     waiters_;
+    std::mutex              mutex_;
+    std::condition_variable c_limit_;
+};
+
+//! バイト数を計測しない
+struct null_byte_accounting
+{
+    void setup(size_t limit, bool track)
+    {
+        assert(limit == (std::numeric_limits<size_t>::max)() && !track
+               && "queue_byte_limit and track_pending_bytes require instrumented_policy.");
+        (void)limit;
+        (void)track;
+    }
+
+    static bool tracking() { return false; }
+    void acquire(size_t) {}
+    void release(size_t) {}
+    size_t pending() const { return 0; }
+    size_t peak() const { return 0; }
+    size_t limit() const { return (std::numeric_limits<size_t>::max)(); }
+};
+
+//! task_queue_options::queue_byte_limit、track_pending_bytes、enable_perf_counters、recorderを使用できるようにする（デフォルト）
+struct instrumented_policy
+{
+    typedef byte_accounting     accounting_type;
+    typedef task_profiler       profiler_type;
+    typedef workload_recording  recording_type;
+
+    template<class Task>
+    struct task
+    {
+        typedef instrumented_task<Task> type;
+    };
+};
+
+//! 計測を行わない。queue_byte_limit、track_pending_bytes、enable_perf_counters、recorderは指定できない
+/*!
+	タスクはタグを保持しないので、enqueue_with_tag()で指定したタグは無視され、ウォッチドッグが記録するタグも0になる。
+*/
+struct uninstrumented_policy
+{
+    typedef null_byte_accounting    accounting_type;
+    typedef null_task_profiler      profiler_type;
+    typedef null_workload_recording recording_type;
+
+    template<class Task>
+    struct task
+    {
+        typedef Task type;
+    };
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// 機能ポリシー
+//   static unsigned const features;
+//   featuresは、basic_task_queueで使用する機能を表すtask_queue_featureの値の論理和。
+//   無効にした機能のメンバ関数を呼び出すとコンパイルエラーになり、
+//   その機能を使用するtask_queue_optionsを指定するとアサーションに失敗する。
+
+//! basic_task_queueの機能
+struct task_queue_feature
+{
+    enum : unsigned {
+        //! enqueue_to()、set_steal_threshold()
+        targeted        = 1u << 0,
+        //! make_producer()
+        producers       = 1u << 1,
+        //! make_realtime_producer()
+        realtime        = 1u << 2,
+        //! enqueue_with_deadline()
+        deadlines       = 1u << 3,
+        //! blocking_scopeを補う補助スレッド（task_queue_options::max_compensation_threads）
+        compensation    = 1u << 4,
+        //! task_queue_options::stuck_task_threshold
+        watchdog        = 1u << 5,
+        //! task_queue_options::lazy_startup
+        lazy_startup    = 1u << 6,
+        //! 複数のシャードに対するqueue_limit_scope::globalの上限
+        global_limit    = 1u << 7,
+        //! task_queue_options::enable_reactorと、async_read()などの非同期操作
+        reactor         = 1u << 8,
+
+        none            = 0,
+        all             = (1u << 9) - 1,
+    };
+};
+
+//! task_queue_featureの値の論理和で、使用する機能を指定する
+template<unsigned Features>
+struct feature_policy
+{
+    static unsigned const features = Features;
+};
+
+//! すべての機能を使用する（デフォルト）
+typedef feature_policy<task_queue_feature::all>     all_features_policy;
+
+//! enqueue()系の関数とwait()だけを使用する
+typedef feature_policy<task_queue_feature::none>    core_features_policy;
+
+//! 無効にした機能の状態の代わりに使用する空の型
+/*!
+	機能ごとに異なる型にして、空の基底クラスの最適化で領域を取らないようにする。
+*/
+template<unsigned Feature>
+struct disabled_feature
+{};
+
+/////////////////////////////////////////////////////////////////////////////
+
+//! basic_task_queueの構成
+/*!
+	デフォルトの構成は、task_queueと同じ。
+	例えば、結果を受け取らず、wait()も使用しないスループット重視のタスクキューは次のように定義できる。
+		typedef hwm::basic_task_queue<
+			hwm::task_queue_policies<
+				hwm::locked_queue_policy<>,
+				hwm::blocking_idle_policy,
+				hwm::no_result_policy,
+				hwm::uncounted_policy,
+				hwm::uninstrumented_policy,
+				hwm::core_features_policy>
+		> fire_and_forget_queue;
+*/
+template<
+    class QueuePolicy = locked_queue_policy<>,
+    class IdlePolicy = blocking_idle_policy,
+    class ResultPolicy = future_result_policy,
+    class CountingPolicy = counted_policy,
+    class InstrumentationPolicy = instrumented_policy,
+    class FeaturePolicy = all_features_policy
+>
+struct task_queue_policies
+{
+    typedef QueuePolicy             queue_policy;
+    typedef IdlePolicy              idle_policy;
+    typedef ResultPolicy            result_policy;
+    typedef CountingPolicy          counting_policy;
+    typedef InstrumentationPolicy   instrumentation_policy;
+    typedef FeaturePolicy           feature_policy;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::task_queue_policies;
+using detail::ns_task::locked_queue_policy;
+using detail::ns_task::blocking_idle_policy;
+using detail::ns_task::spinning_idle_policy;
+using detail::ns_task::lifo_idle_policy;
+using detail::ns_task::future_result_policy;
+using detail::ns_task::light_future_result_policy;
+using detail::ns_task::no_result_policy;
+using detail::ns_task::counted_policy;
+using detail::ns_task::uncounted_policy;
+using detail::ns_task::instrumented_policy;
+using detail::ns_task::uninstrumented_policy;
+using detail::ns_task::task_queue_feature;
+using detail::ns_task::feature_policy;
+using detail::ns_task::all_features_policy;
+using detail::ns_task::core_features_policy;
+
+}   //namespace hwm
@@ -0,0 +1,179 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "./spsc_ring.hpp"
+#include "./task_base.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! タスクのオブジェクトを要素の中に直接構築する、生産者と消費者が一つずつのリングバッファ
+/*!
+	spsc_ringと同じく、try_emplace()、publish()、cancel_emplace()は生産者のスレッドからのみ、try_run()は消費者のスレッドからのみ呼び出せる。
+	inline_size以下のサイズのタスクは要素の中に直接構築し、その場で実行してから破棄するので、メモリ確保を行わない。
+	それより大きいタスクはヒープに確保して、要素にはそのポインタだけを保持する。
+	タスクを要素の間でムーブすることはないので、ムーブできないタスクも扱える。
+*/
+struct task_ring
+{
+    //! 要素の中に直接構築できるタスクの最大サイズ。要素一つがキャッシュライン二つ分になるようにしている
+    static size_t const inline_size = cache_line_size * 2 - alignof(std::max_align_t);
+
+    //! @param capacity 保持できるタスク数。2のべき乗に切り上げられる。
+    explicit
+    task_ring(size_t capacity)
+        :   closed_(false)
+    {
+        assert(capacity >= 1);
+
+        size_t n = 1;
+        while(n < capacity) { n <<= 1; }
+        slots_.resize(n);
+        mask_ = n - 1;
+        head_.store(0);
+        tail_.store(0);
+    }
+
+    task_ring(task_ring const &) = delete;
+    task_ring & operator=(task_ring const &) = delete;
+
+    //! 実行されずに残っているタスクを破棄する
+    ~task_ring()
+    {
+        size_t const tail = tail_.load();
+        for(size_t i = head_.load(); i != tail; ++i) {
+            destroy(slots_[i & mask_]);
+        }
+    }
+
+    size_t capacity() const { return slots_.size(); }
+
+    //! Taskのオブジェクトを、次に追加する要素の中に構築する
+    /*!
+		構築したタスクは、publish()を呼び出すまで消費者から見えない。
+		@return リングバッファが一杯の場合は何もせずにnullptrを返す。その場合、argsはムーブされない。
+	*/
+    template<class Task, class... CtorArgs>
+    task_base * try_emplace(CtorArgs&&... args)
+    {
+        size_t const tail = tail_.load(std::memory_order_relaxed);
+        if(tail - head_.load(std::memory_order_acquire) == slots_.size()) {
+            return nullptr;
+        }
+
+        slot &s = slots_[tail & mask_];
+        s.task = construct<Task>(s, fits_inline<Task>(), std::forward<CtorArgs>(args)...);
+        return s.task;
+    }
+
+    //! try_emplace()で構築したタスクを、消費者から見えるようにする
+    void publish()
+    {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    //! try_emplace()で構築して、まだpublish()していないタスクを破棄する
+    void cancel_emplace()
+    {
+        destroy(slots_[tail_.load(std::memory_order_relaxed) & mask_]);
+    }
+
+    //! 先頭のタスクをfに渡して実行し、破棄する
+    /*!
+		タスクは要素の中に置かれたまま実行されるので、実行中もその要素は空かない。
+		@return リングバッファが空の場合はfalse
+	*/
+    template<class F>
+    bool try_run(F f)
+    {
+        size_t const head = head_.load(std::memory_order_relaxed);
+        if(head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        slot &s = slots_[head & mask_];
+        f(*s.task);
+        destroy(s);
+
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    //! 生産者がいなくなったことを記録する
+    void close() { closed_.store(true); }
+    bool is_closed() const { return closed_.load(); }
+
+private:
+    struct slot
+    {
+        union {
+            std::max_align_t    align_;
+            unsigned char       storage[inline_size];
+        };
+        //! 構築されたタスク。storageの中に構築した場合はstorageを指す
+        task_base *             task;
+    };
+
+    template<class Task>
+    struct fits_inline
+        :   std::integral_constant<
+                bool,
+                sizeof(Task) <= inline_size && alignof(Task) <= alignof(std::max_align_t)
+            >
+    {};
+
+    template<class Task, class... CtorArgs>
+    static task_base * construct(slot &s, std::true_type, CtorArgs&&... args)
+    {
+        return ::new(static_cast<void *>(s.storage)) Task(std::forward<CtorArgs>(args)...);
+    }
+
+    template<class Task, class... CtorArgs>
+    static task_base * construct(slot &, std::false_type, CtorArgs&&... args)
+    {
+        return new Task(std::forward<CtorArgs>(args)...);
+    }
+
+    static void destroy(slot &s)
+    {
+        if(static_cast<void *>(s.task) == static_cast<void *>(s.storage)) {
+            s.task->~task_base();
+        } else {
+            delete s.task;
+        }
+        s.task = nullptr;
+    }
+
+    std::vector<slot>   slots_;
+    size_t              mask_;
+    std::atomic<bool>   closed_;
+    char                pad0_[cache_line_size];
+    //! 消費者が次に実行する位置
+    std::atomic<size_t> head_;
+    char                pad1_[cache_line_size];
+    //! 生産者が次に書き込む位置
+    std::atomic<size_t> tail_;
+    char                pad2_[cache_line_size];
+};
+
+}}  //namespace detail::ns_task
+
+}   //namespace hwm
@@ -0,0 +1,419 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <utility>
+
+#include "./blocking_scope.hpp"
+#include "./eventcount.hpp"
+#include "./light_future.hpp"
+#include "./spsc_ring.hpp"
+#include "./task_impl.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! enqueue_stream()で容量を指定しなかった場合のチャネルの容量
+size_t const default_stream_capacity = 64;
+
+//! enqueue_stream()にチャネルの容量を指定するためのクラス
+struct stream_capacity
+{
+    explicit
+    stream_capacity(size_t n)
+        :   value(n)
+    {}
+
+    size_t value;
+};
+
+//! stream_sinkとstream_channelが共有する状態
+/*!
+	値はspsc_ringで受け渡し、一杯になった時と空になった時の待機にはeventcountを使用する。
+*/
+template<class T>
+struct stream_state
+{
+    explicit
+    stream_state(size_t capacity)
+        :   ring_(capacity)
+        ,   closed_(false)
+        ,   cancelled_(false)
+    {}
+
+    stream_state(stream_state const &) = delete;
+    stream_state & operator=(stream_state const &) = delete;
+
+    //! 値を追加する。チャネルが一杯の場合は空きができるまで待機する
+    /*!
+		@return 消費者がチャネルを破棄していた場合はfalse。その場合、xは捨てられる。
+	*/
+    bool push(T &&x)
+    {
+        for( ; ; ) {
+            if(cancelled_.load()) {
+                return false;
+            }
+
+            if(ring_.try_push(std::move(x))) {
+                not_empty_.notify_one();
+                return true;
+            }
+
+            auto const key = not_full_.prepare_wait();
+            if(cancelled_.load()) {
+                not_full_.cancel_wait();
+                continue;
+            }
+
+            if(ring_.try_push(std::move(x))) {
+                not_full_.cancel_wait();
+                not_empty_.notify_one();
+                return true;
+            }
+
+            blocking_scope scope;
+            not_full_.wait(key);
+        }
+    }
+
+    bool try_push(T &&x)
+    {
+        if(cancelled_.load() || !ring_.try_push(std::move(x))) {
+            return false;
+        }
+
+        not_empty_.notify_one();
+        return true;
+    }
+
+    //! 値を取り出す。チャネルが空の場合は、値が追加されるかストリームが終了するまで待機する
+    /*!
+		@return ストリームが終了していて、取り出す値がない場合はfalse
+		@exception 生産者の関数が例外を送出して終了していた場合は、残っている値をすべて取り出した後でその例外
+	*/
+    bool pop(T &out)
+    {
+        for( ; ; ) {
+            if(try_pop_value(out)) {
+                return true;
+            }
+
+            if(closed_.load()) {
+                return finish(out);
+            }
+
+            auto const key = not_empty_.prepare_wait();
+            if(closed_.load() || !ring_.empty()) {
+                not_empty_.cancel_wait();
+                continue;
+            }
+
+            blocking_scope scope;
+            not_empty_.wait(key);
+        }
+    }
+
+    //! 値を取り出す。チャネルが空の場合は待機せずにfalseを返す
+    bool try_pop(T &out)
+    {
+        if(try_pop_value(out)) {
+            return true;
+        }
+
+        if(closed_.load()) {
+            return finish(out);
+        }
+
+        return false;
+    }
+
+    //! 生産者がこれ以上値を追加しないことを記録する
+    /*!
+		@param e 生産者の関数が送出した例外。正常に終了した場合はnullptr
+	*/
+    void close(std::exception_ptr e)
+    {
+        error_ = e;
+        closed_.store(true);
+        not_empty_.notify_all();
+    }
+
+    //! 消費者がチャネルを破棄したことを記録する
+    void cancel()
+    {
+        cancelled_.store(true);
+        not_full_.notify_all();
+    }
+
+    bool is_cancelled() const { return cancelled_.load(); }
+
+    //! ストリームが終了していて、すべての値を取り出したかどうか
+    bool is_finished() const { return closed_.load() && ring_.empty(); }
+
+private:
+    bool try_pop_value(T &out)
+    {
+        if(!ring_.try_pop(out)) {
+            return false;
+        }
+
+        not_full_.notify_one();
+        return true;
+    }
+
+    //! closed_を確認した後で呼び出す。close()の直前に追加された値を取りこぼさないように、もう一度リングバッファを確認する
+    bool finish(T &out)
+    {
+        if(try_pop_value(out)) {
+            return true;
+        }
+
+        if(error_) {
+            std::rethrow_exception(error_);
+        }
+
+        return false;
+    }
+
+    spsc_ring<T>        ring_;
+    eventcount          not_empty_;
+    eventcount          not_full_;
+    std::exception_ptr  error_;
+    std::atomic<bool>   closed_;
+    std::atomic<bool>   cancelled_;
+};
+
+//! @class enqueue_stream()に渡した関数が、値を一つずつ追加するためのクラス
+/*!
+	チャネルが一杯の場合、push()は消費者が値を取り出すまで待機する。
+	タスクキューのスレッドで待機する場合は、blocking_scopeと同様に補助スレッドが起動される。
+*/
+template<class T>
+struct stream_sink
+{
+    typedef T value_type;
+
+    explicit
+    stream_sink(std::shared_ptr<stream_state<T>> state)
+        :   state_(std::move(state))
+    {}
+
+    stream_sink(stream_sink const &) = delete;
+    stream_sink & operator=(stream_sink const &) = delete;
+
+    //! 値を追加する
+    /*!
+		@return 消費者がstream_channelを破棄していた場合はfalse。
+		その場合はそれ以上値を生成しても受け取られないので、関数から戻ってよい。
+	*/
+    bool push(T x) { return state_->push(std::move(x)); }
+
+    //! 値の追加を試行する
+    /*!
+		@return チャネルが一杯の場合と、消費者がstream_channelを破棄していた場合はfalse。
+		その場合、xはムーブされない。
+	*/
+    bool try_push(T &x) { return state_->try_push(std::move(x)); }
+
+    //! 消費者がstream_channelを破棄したかどうか
+    bool is_cancelled() const { return state_->is_cancelled(); }
+
+private:
+    std::shared_ptr<stream_state<T>> state_;
+};
+
+//! @class enqueue_stream()で積んだタスクが生成する値を、順に受け取るためのクラス
+/*!
+	pop()で一つずつ取り出すか、範囲for文で列挙する。
+	タスクが例外を送出して終了した場合は、それまでに追加された値をすべて取り出した後で、その例外が送出される。
+	タスクの実行が完了する前に破棄すると、以降のstream_sink::push()はfalseを返すようになる。
+*/
+template<class T>
+struct stream_channel
+{
+    typedef T value_type;
+
+    struct iterator
+    {
+        typedef std::input_iterator_tag iterator_category;
+        typedef T                       value_type;
+        typedef std::ptrdiff_t          difference_type;
+        typedef T *                     pointer;
+        typedef T &                     reference;
+
+        iterator()
+            :   channel_(nullptr)
+            ,   value_()
+        {}
+
+        explicit
+        iterator(stream_channel *channel)
+            :   channel_(channel)
+            ,   value_()
+        {
+            fetch();
+        }
+
+        reference operator*() { return value_; }
+        pointer operator->() { return &value_; }
+
+        iterator & operator++()
+        {
+            fetch();
+            return *this;
+        }
+
+        bool operator==(iterator const &rhs) const { return channel_ == rhs.channel_; }
+        bool operator!=(iterator const &rhs) const { return !(*this == rhs); }
+
+    private:
+        void fetch()
+        {
+            if(!channel_->pop(value_)) {
+                channel_ = nullptr;
+            }
+        }
+
+        stream_channel *channel_;
+        T value_;
+    };
+
+    stream_channel()
+    {}
+
+    explicit
+    stream_channel(std::shared_ptr<stream_state<T>> state)
+        :   state_(std::move(state))
+    {}
+
+    stream_channel(stream_channel &&rhs)
+        :   state_(std::move(rhs.state_))
+    {}
+
+    stream_channel & operator=(stream_channel &&rhs)
+    {
+        cancel();
+        state_ = std::move(rhs.state_);
+        return *this;
+    }
+
+    stream_channel(stream_channel const &) = delete;
+    stream_channel & operator=(stream_channel const &) = delete;
+
+    ~stream_channel()
+    {
+        cancel();
+    }
+
+    bool valid() const { return static_cast<bool>(state_); }
+
+    //! 値を取り出す。値が追加されるかストリームが終了するまで待機する
+    /*!
+		@return ストリームが終了していて、取り出す値がない場合はfalse
+	*/
+    bool pop(T &out)
+    {
+        assert(state_);
+        return state_->pop(out);
+    }
+
+    //! 値の取り出しを試行する
+    /*!
+		@return 値を取り出した場合はtrue。チャネルが空の場合や、ストリームが終了している場合はfalse。
+		ストリームが終了したかどうかはis_finished()で確認する。
+	*/
+    bool try_pop(T &out)
+    {
+        assert(state_);
+        return state_->try_pop(out);
+    }
+
+    //! ストリームが終了していて、すべての値を取り出したかどうか
+    bool is_finished() const
+    {
+        assert(state_);
+        return state_->is_finished();
+    }
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    void cancel()
+    {
+        if(state_) {
+            state_->cancel();
+            state_.reset();
+        }
+    }
+
+    std::shared_ptr<stream_state<T>> state_;
+};
+
+//! enqueue_stream()でタスクキューに積まれる関数オブジェクト
+/*!
+	関数から戻るか例外が送出されたらストリームを終了する。
+	実行されずに破棄された場合は、std::future_errc::broken_promiseでストリームを終了する。
+*/
+template<class T, class F>
+struct stream_task
+{
+    stream_task(std::shared_ptr<stream_state<T>> state, F f)
+        :   state_(std::move(state))
+        ,   f_(std::move(f))
+    {}
+
+    stream_task(stream_task &&rhs)
+        :   state_(std::move(rhs.state_))
+        ,   f_(std::move(rhs.f_))
+    {}
+
+    stream_task(stream_task const &) = delete;
+    stream_task & operator=(stream_task const &) = delete;
+
+    ~stream_task()
+    {
+        if(state_) {
+            state_->close(make_broken_promise());
+        }
+    }
+
+    template<class... Args>
+    void operator()(Args&&... args)
+    {
+        std::shared_ptr<stream_state<T>> state(std::move(state_));
+        stream_sink<T> sink(state);
+
+        try {
+            ns_task::invoke(std::move(f_), sink, std::forward<Args>(args)...);
+        } catch(...) {
+            state->close(std::current_exception());
+            return;
+        }
+
+        state->close(nullptr);
+    }
+
+private:
+    std::shared_ptr<stream_state<T>> state_;
+    F f_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::stream_capacity;
+using detail::ns_task::stream_channel;
+using detail::ns_task::stream_sink;
+
+}   //namespace hwm
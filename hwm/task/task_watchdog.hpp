@@ -0,0 +1,296 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "./blocking_scope.hpp"
+#include "./task_base.hpp"
+#include "./task_queue_metrics.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! @class スレッドが実行中のタスクを、ウォッチドッグに公開するためのスロット
+/*!
+	タスクを実行するスレッドだけが書き込み、ウォッチドッグのスレッドが読み出す。
+	書き込みはatomicな変数へのストアだけで、ロックは取らない。
+*/
+struct watchdog_slot
+{
+    explicit
+    watchdog_slot(size_t thread_index)
+        :   thread_index(thread_index)
+        ,   start_ns(0)
+        ,   tag(0)
+        ,   sequence(0)
+        ,   compensated(false)
+        ,   reported_sequence(0)
+    {}
+
+    static std::int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    //! タスクの実行を開始したことを公開する
+    void begin(task_tag t)
+    {
+        tag.store(t, std::memory_order_relaxed);
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        start_ns.store((std::max)(now_ns(), std::int64_t(1)), std::memory_order_release);
+    }
+
+    //! タスクの実行を終了したことを公開する
+    /*!
+		ウォッチドッグがこのタスクのために補助スレッドを起動していた場合は、ここで取り消す。
+		ウォッチドッグは補助スレッドを起動してからcompensatedを設定し、その後でタスクが終了していないかを確認する。
+		こちらは逆にstart_nsを0にしてからcompensatedを確認するので、取り消しはどちらか一方だけが必ず行う。
+	*/
+    void end(blocking_listener &listener)
+    {
+        start_ns.store(0);
+        if(compensated.exchange(false)) {
+            listener.leave_blocking();
+        }
+    }
+
+    size_t const                thread_index;
+    //! 実行中のタスクの開始時刻。実行中でなければ0
+    std::atomic<std::int64_t>   start_ns;
+    std::atomic<task_tag>       tag;
+    //! 実行したタスクの通し番号
+    std::atomic<std::uint64_t>  sequence;
+    //! ウォッチドッグが補助スレッドを起動したかどうか
+    std::atomic<bool>           compensated;
+    //! ウォッチドッグが最後に報告したタスクの通し番号（ウォッチドッグのスレッドだけが使用する）
+    std::uint64_t               reported_sequence;
+};
+
+//! 現在のスレッドのwatchdog_slotへの参照を返す
+/*!
+	タスクキューのスレッドでない場合や、ウォッチドッグが有効でない場合はnullptrが登録されている。
+*/
+inline
+watchdog_slot *& current_watchdog_slot()
+{
+    static thread_local watchdog_slot *slot = nullptr;
+    return slot;
+}
+
+//! @class 実行時間が長すぎるタスクを検出するウォッチドッグ
+/*!
+	専用のスレッドで一定間隔ごとに各スレッドのwatchdog_slotを確認し、
+	閾値を超えて実行されているタスクを見つけると、記録してコールバックを呼び出す。
+	必要に応じて、blocking_listenerに通知して補助スレッドを起動させる。
+*/
+struct task_watchdog
+{
+    //! 記録しておく、検出したタスクの情報の最大数
+    static size_t max_history() { return 64; }
+
+    task_watchdog(blocking_listener &listener,
+                  std::chrono::nanoseconds threshold,
+                  std::function<void(stuck_task_info const &)> callback,
+                  bool compensate)
+        :   listener_(listener)
+        ,   threshold_(threshold)
+        ,   callback_(std::move(callback))
+        ,   compensate_(compensate)
+        ,   num_stuck_(0)
+        ,   stopped_(false)
+    {
+        thread_ = std::thread([this] { process(); });
+    }
+
+    ~task_watchdog()
+    {
+        stop();
+    }
+
+    task_watchdog(task_watchdog const &) = delete;
+    task_watchdog & operator=(task_watchdog const &) = delete;
+
+    //! ウォッチドッグのスレッドを停止する
+    void stop()
+    {
+        {
+            std::unique_lock<std::mutex> lock(stop_mutex_);
+            stopped_ = true;
+        }
+        c_stop_.notify_all();
+
+        if(thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    //! スレッドの処理の間、そのスレッドのwatchdog_slotを登録しておくためのクラス
+    struct thread_scope
+    {
+        thread_scope(task_watchdog *watchdog, size_t thread_index)
+            :   watchdog_(watchdog)
+        {
+            if(watchdog_) {
+                slot_.reset(new watchdog_slot(thread_index));
+                watchdog_->add(slot_.get());
+                current_watchdog_slot() = slot_.get();
+            }
+        }
+
+        ~thread_scope()
+        {
+            if(watchdog_) {
+                current_watchdog_slot() = nullptr;
+                watchdog_->remove(slot_.get());
+            }
+        }
+
+        thread_scope(thread_scope const &) = delete;
+        thread_scope & operator=(thread_scope const &) = delete;
+
+    private:
+        task_watchdog *                 watchdog_;
+        std::unique_ptr<watchdog_slot>  slot_;
+    };
+
+    //! 検出したタスクの情報をmに設定する
+    void collect(task_queue_metrics &m) const
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        m.num_stuck_tasks = num_stuck_;
+        m.recent_stuck_tasks.assign(history_.begin(), history_.end());
+    }
+
+private:
+    void add(watchdog_slot *slot)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slots_.push_back(slot);
+    }
+
+    void remove(watchdog_slot *slot)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        slots_.erase(std::find(slots_.begin(), slots_.end(), slot));
+    }
+
+    void process()
+    {
+        auto const interval =
+            (std::max)(std::chrono::duration_cast<std::chrono::nanoseconds>(threshold_ / 4),
+                       std::chrono::nanoseconds(std::chrono::milliseconds(1)));
+
+        std::vector<stuck_task_info> detected;
+
+        for( ; ; ) {
+            {
+                std::unique_lock<std::mutex> lock(stop_mutex_);
+                if(c_stop_.wait_for(lock, interval, [this] { return stopped_; })) {
+                    return;
+                }
+            }
+
+            scan(detected);
+
+            if(callback_) {
+                for(auto const &info: detected) {
+                    callback_(info);
+                }
+            }
+            detected.clear();
+        }
+    }
+
+    //! 各スロットを確認して、閾値を超えて実行されているタスクをdetectedに追加する
+    void scan(std::vector<stuck_task_info> &detected)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::int64_t const now = watchdog_slot::now_ns();
+
+        for(auto *slot: slots_) {
+            std::uint64_t const seq = slot->sequence.load(std::memory_order_acquire);
+            std::int64_t const start = slot->start_ns.load(std::memory_order_acquire);
+            task_tag const tag = slot->tag.load(std::memory_order_relaxed);
+
+            //! 読んでいる間に別のタスクに切り替わっていないかを確認する
+            if(start == 0
+               || slot->sequence.load() != seq
+               || slot->reported_sequence == seq
+               || std::chrono::nanoseconds(now - start) < threshold_)
+            {
+                continue;
+            }
+
+            slot->reported_sequence = seq;
+
+            stuck_task_info info;
+            info.thread_index = slot->thread_index;
+            info.tag = tag;
+            info.duration = std::chrono::nanoseconds(now - start);
+            info.compensated = compensate_ && compensate(*slot, seq);
+
+            ++num_stuck_;
+            history_.push_back(info);
+            if(history_.size() > max_history()) {
+                history_.pop_front();
+            }
+            detected.push_back(info);
+        }
+    }
+
+    //! タスクがblocking_scopeに入ったものとみなして、補助スレッドを起動させる
+    /*!
+		@return タスクがまだ実行中で、補助スレッドを起動させたままにした場合はtrue
+	*/
+    bool compensate(watchdog_slot &slot, std::uint64_t seq)
+    {
+        listener_.enter_blocking();
+        slot.compensated.store(true);
+
+        //! その間にタスクが終了していた場合は、タスクを実行していたスレッドが取り消したかどうかを確認し、
+        //! 取り消されていなければこちらで取り消す。
+        if(slot.start_ns.load() == 0 || slot.sequence.load() != seq) {
+            if(slot.compensated.exchange(false)) {
+                listener_.leave_blocking();
+            }
+            return false;
+        }
+
+        return true;
+    }
+
+    blocking_listener &                             listener_;
+    std::chrono::nanoseconds const                  threshold_;
+    std::function<void(stuck_task_info const &)>    callback_;
+    bool const                                      compensate_;
+
+    std::mutex mutable                  mutex_;
+    std::vector<watchdog_slot *>        slots_;
+    size_t                              num_stuck_;
+    std::deque<stuck_task_info>         history_;
+
+    std::mutex                          stop_mutex_;
+    std::condition_variable             c_stop_;
+    bool                                stopped_;
+    std::thread                         thread_;
+};
+
+}}  //namespace detail::ns_task
+
+}   //namespace hwm
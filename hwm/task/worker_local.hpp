@@ -0,0 +1,230 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "./spsc_ring.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! タスクキューのスレッドを識別する情報
+struct worker_identity
+{
+    //! スレッドを所有するタスクキュー。タスクキューのスレッドでない場合はnullptr
+    void const *owner;
+    //! タスクキューの中でのスレッドのインデックス
+    size_t      index;
+};
+
+//! 現在のスレッドに登録されているworker_identityへの参照を返す
+/*!
+	タスクキューは自分のスレッドを開始する時にこの値を登録する。
+*/
+inline
+worker_identity & current_worker_identity()
+{
+    static thread_local worker_identity identity = { nullptr, 0 };
+    return identity;
+}
+
+//! タスクキューのスレッドでないことを表すインデックス
+inline
+size_t not_worker_thread() { return (std::numeric_limits<size_t>::max)(); }
+
+//! 現在のスレッドのインデックスを返す
+/*!
+	タスクの中から呼び出すと、そのタスクを実行しているスレッドのインデックス（0以上num_threads()未満）を返す。
+	タスクキューのスレッドでない場合（補助スレッドを含む）は、not_worker_thread()を返す。
+*/
+inline
+size_t current_worker_index()
+{
+    auto const &identity = current_worker_identity();
+    return identity.owner ? identity.index : not_worker_thread();
+}
+
+//! @class タスクキューのスレッドごとに値を保持するクラス
+/*!
+	タスクキューのスレッド数だけ値を用意し、各スレッドはlocal()で自分の値にアクセスする。
+	値はそれぞれ別のキャッシュラインに置かれるので、複数のスレッドから同時に更新しても、ロックや偽共有が発生しない。
+	集計が終わったら、combine()やfor_each()ですべての値をまとめる。
+
+	対象のタスクキューのスレッド以外（補助スレッドや、タスクキューの外のスレッド）からlocal()を呼び出した場合は、
+	ロックを取得して、そのスレッド用の値を探す（なければ作成する）。
+
+	@tparam T 値の型。コピー構築可能でなければならない。
+	@note combine()とfor_each()は、local()で値を更新しているタスクがすべて完了してから呼び出す。
+*/
+template<class T>
+struct worker_local
+{
+    typedef T value_type;
+
+    //! コンストラクタ
+    /*!
+		@tparam TaskQueue task_queue_with_allocatorのように、num_threads()メンバ関数を持つ型
+		@param [in] tq 値を使用するタスクキュー
+		@param [in] init 各スレッドの値の初期値
+	*/
+    template<class TaskQueue>
+    explicit
+    worker_local(TaskQueue const &tq, T const &init = T())
+        :   owner_(&tq)
+        ,   init_(init)
+        ,   size_(tq.num_threads())
+        ,   stride_((sizeof(T) + cache_line_size - 1) / cache_line_size * cache_line_size)
+    {
+        static_assert(alignof(T) <= cache_line_size, "T must not be over-aligned beyond a cache line.");
+
+        //! 先頭をキャッシュラインの境界に揃えるため、一つ分余分に確保する。
+        buffer_.reset(new char[stride_ * size_ + cache_line_size]);
+        void *p = buffer_.get();
+        size_t space = stride_ * size_ + cache_line_size;
+        base_ = static_cast<char *>(std::align(cache_line_size, stride_ * size_, p, space));
+
+        size_t constructed = 0;
+        try {
+            for( ; constructed < size_; ++constructed) {
+                new(base_ + stride_ * constructed) T(init_);
+            }
+        } catch(...) {
+            destroy(constructed);
+            throw;
+        }
+    }
+
+    ~worker_local()
+    {
+        destroy(size_);
+    }
+
+    worker_local(worker_local const &) = delete;
+    worker_local & operator=(worker_local const &) = delete;
+
+    //! 現在のスレッドの値を返す
+    T & local()
+    {
+        auto const &identity = current_worker_identity();
+        if(identity.owner == owner_) {
+            assert(identity.index < size_);
+            return at(identity.index);
+        }
+
+        return local_of_external_thread();
+    }
+
+    //! index番目のスレッドの値を返す
+    T &         operator[](size_t index)        { assert(index < size_); return at(index); }
+    T const &   operator[](size_t index) const  { assert(index < size_); return at(index); }
+
+    //! タスクキューのスレッドの値の数（num_threads()）を返す
+    size_t size() const { return size_; }
+
+    //! すべての値に関数を適用する
+    /*!
+		タスクキューのスレッドの値をインデックス順に渡したあとで、それ以外のスレッドの値を渡す。
+	*/
+    template<class F>
+    void for_each(F f)
+    {
+        for(size_t i = 0; i < size_; ++i) {
+            f(at(i));
+        }
+
+        std::unique_lock<std::mutex> lock(external_mutex_);
+        for(auto &entry: external_) {
+            f(*entry.second);
+        }
+    }
+
+    template<class F>
+    void for_each(F f) const
+    {
+        for(size_t i = 0; i < size_; ++i) {
+            f(at(i));
+        }
+
+        std::unique_lock<std::mutex> lock(external_mutex_);
+        for(auto const &entry: external_) {
+            f(static_cast<T const &>(*entry.second));
+        }
+    }
+
+    //! すべての値を二項演算でまとめる
+    /*!
+		0番目のスレッドの値から順に、op(op(v0, v1), v2)...のようにまとめた値を返す。
+	*/
+    template<class BinaryOp>
+    T combine(BinaryOp op) const
+    {
+        T result = at(0);
+        bool first = true;
+        for_each([&](T const &value) {
+            if(first) {
+                first = false;
+            } else {
+                result = op(std::move(result), value);
+            }
+        });
+        return result;
+    }
+
+private:
+    T &         at(size_t index)        { return *reinterpret_cast<T *>(base_ + stride_ * index); }
+    T const &   at(size_t index) const  { return *reinterpret_cast<T const *>(base_ + stride_ * index); }
+
+    T & local_of_external_thread()
+    {
+        auto const id = std::this_thread::get_id();
+
+        std::unique_lock<std::mutex> lock(external_mutex_);
+        for(auto &entry: external_) {
+            if(entry.first == id) {
+                return *entry.second;
+            }
+        }
+
+        external_.emplace_back(id, std::unique_ptr<T>(new T(init_)));
+        return *external_.back().second;
+    }
+
+    void destroy(size_t n)
+    {
+        for(size_t i = 0; i < n; ++i) {
+            at(i).~T();
+        }
+    }
+
+private:
+    void const *                owner_;
+    T                           init_;
+    size_t                      size_;
+    size_t                      stride_;
+    std::unique_ptr<char[]>     buffer_;
+    char *                      base_;
+
+    std::mutex mutable          external_mutex_;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<T>>> external_;
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::worker_local;
+using detail::ns_task::current_worker_index;
+using detail::ns_task::not_worker_thread;
+
+}   //namespace hwm
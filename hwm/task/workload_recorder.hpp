@@ -0,0 +1,477 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "./task_base.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! タスクが積まれたことを表す記録
+struct workload_submit_record
+{
+    //! 記録の中でタスクを識別するid。1から順に割り当てられる
+    std::uint32_t   task_id;
+    //! このタスクを積んだタスクのid。タスクキューのスレッド以外から積まれた場合は0
+    std::uint32_t   parent_id;
+    //! タスクを積んだスレッドの、記録の中でのインデックス
+    std::uint32_t   thread;
+    //! タスクの種類を表すタグ
+    task_tag        tag;
+    //! 記録を開始してから、タスクが積まれるまでの時間（ナノ秒）
+    std::uint64_t   submit_ns;
+};
+
+//! タスクが実行されたことを表す記録
+struct workload_run_record
+{
+    std::uint32_t   task_id;
+    //! タスクを実行したスレッドの、記録の中でのインデックス
+    std::uint32_t   thread;
+    //! 記録を開始してから、タスクの実行を開始するまでの時間（ナノ秒）
+    std::uint64_t   start_ns;
+    //! タスクの実行にかかった時間（ナノ秒）
+    std::uint64_t   duration_ns;
+};
+
+//! workload_recorderで記録したタスクの投入と実行の履歴
+/*!
+	save()で保存するファイルは、8バイトのマジックナンバーと各記録の数に続いて、
+	記録をリトルエンディアンの固定長で並べたもの。
+*/
+struct workload_trace
+{
+    std::vector<workload_submit_record> submits;
+    std::vector<workload_run_record>    runs;
+
+    //! ファイルに保存する
+    /*!
+		@exception std::runtime_error ファイルに書き込めなかった場合
+	*/
+    void save(std::string const &path) const
+    {
+        std::ofstream os(path.c_str(), std::ios::binary | std::ios::trunc);
+        if(!os) {
+            throw std::runtime_error("hwm::workload_trace: failed to open " + path);
+        }
+
+        os.write(magic(), 8);
+        put(os, static_cast<std::uint64_t>(submits.size()));
+        put(os, static_cast<std::uint64_t>(runs.size()));
+
+        for(auto const &s: submits) {
+            put(os, s.task_id);
+            put(os, s.parent_id);
+            put(os, s.thread);
+            put(os, s.tag);
+            put(os, s.submit_ns);
+        }
+
+        for(auto const &r: runs) {
+            put(os, r.task_id);
+            put(os, r.thread);
+            put(os, r.start_ns);
+            put(os, r.duration_ns);
+        }
+
+        if(!os) {
+            throw std::runtime_error("hwm::workload_trace: failed to write " + path);
+        }
+    }
+
+    //! save()で保存したファイルを読み込む
+    /*!
+		@exception std::runtime_error ファイルを読み込めなかった場合や、形式が正しくない場合
+	*/
+    static workload_trace load(std::string const &path)
+    {
+        std::ifstream is(path.c_str(), std::ios::binary);
+        if(!is) {
+            throw std::runtime_error("hwm::workload_trace: failed to open " + path);
+        }
+
+        char header[8];
+        if(!is.read(header, 8) || !std::equal(header, header + 8, magic())) {
+            throw std::runtime_error("hwm::workload_trace: " + path + " is not a workload trace");
+        }
+
+        std::uint64_t num_submits = 0;
+        std::uint64_t num_runs = 0;
+        get(is, num_submits);
+        get(is, num_runs);
+
+        workload_trace trace;
+
+        for(std::uint64_t i = 0; i < num_submits && is; ++i) {
+            workload_submit_record s;
+            get(is, s.task_id);
+            get(is, s.parent_id);
+            get(is, s.thread);
+            get(is, s.tag);
+            get(is, s.submit_ns);
+            trace.submits.push_back(s);
+        }
+
+        for(std::uint64_t i = 0; i < num_runs && is; ++i) {
+            workload_run_record r;
+            get(is, r.task_id);
+            get(is, r.thread);
+            get(is, r.start_ns);
+            get(is, r.duration_ns);
+            trace.runs.push_back(r);
+        }
+
+        if(!is) {
+            throw std::runtime_error("hwm::workload_trace: " + path + " is truncated");
+        }
+
+        return trace;
+    }
+
+private:
+    static char const * magic() { return "HWMWKLD1"; }
+
+    template<class UInt>
+    static void put(std::ostream &os, UInt x)
+    {
+        char buf[sizeof(UInt)];
+        for(size_t i = 0; i < sizeof(UInt); ++i) {
+            buf[i] = static_cast<char>((x >> (8 * i)) & 0xff);
+        }
+        os.write(buf, sizeof(UInt));
+    }
+
+    template<class UInt>
+    static void get(std::istream &is, UInt &x)
+    {
+        unsigned char buf[sizeof(UInt)] = {};
+        is.read(reinterpret_cast<char *>(buf), sizeof(UInt));
+
+        x = 0;
+        for(size_t i = 0; i < sizeof(UInt); ++i) {
+            x |= static_cast<UInt>(buf[i]) << (8 * i);
+        }
+    }
+};
+
+struct workload_recorder;
+
+//! 現在のスレッドで実行中の、記録対象のタスク
+struct recorded_task
+{
+    workload_recorder const *recorder;
+    std::uint32_t           task_id;
+};
+
+inline
+recorded_task & current_recorded_task()
+{
+    static thread_local recorded_task task = { nullptr, 0 };
+    return task;
+}
+
+//! workload_recorderが、記録するスレッドごとに用意するバッファ
+/*!
+	書き込むのはそのスレッドだけで、mutexはtrace()で読み出す時との間でだけ競合する。
+	スレッドが終了した後も、記録を残すためにworkload_recorderが保持し続ける。
+*/
+struct workload_thread_buffer
+{
+    explicit
+    workload_thread_buffer(std::uint32_t thread)
+        :   thread(thread)
+    {}
+
+    //! このスレッドの、記録の中でのインデックス
+    std::uint32_t const                 thread;
+    std::mutex                          mutex;
+    std::vector<workload_submit_record> submits;
+    std::vector<workload_run_record>    runs;
+};
+
+//! 現在のスレッドが最後に記録したworkload_recorderと、そのバッファ
+/*!
+	workload_recorderのアドレスは破棄された後に再利用されることがあるので、構築ごとに割り当てるidで識別する。
+*/
+struct workload_buffer_cache
+{
+    std::uint64_t           recorder_id;
+    workload_thread_buffer  *buffer;
+};
+
+inline
+workload_buffer_cache & current_workload_buffer_cache()
+{
+    static thread_local workload_buffer_cache cache = { 0, nullptr };
+    return cache;
+}
+
+//! @class タスクキューに積まれたタスクと、その実行時間を記録するクラス
+/*!
+	task_queue_options::recorderに指定すると、タスクが積まれるたびにその時刻と積んだスレッド、タグ、
+	積んだタスク（タスクの中から積まれた場合）を記録し、タスクの実行が終わるとその開始時刻と実行時間を記録する。
+	記録した内容はtrace()やsave()で取り出し、replay_workload()で別の構成のタスクキューに対して再現できる。
+
+	複数のタスクキューで一つのオブジェクトを共有してもよい。
+	記録はスレッドごとのバッファに追加し、trace()でまとめるので、記録するスレッドどうしはロックを取り合わない。
+	スレッドが最初に記録する時と、一つのスレッドが複数のworkload_recorderに交互に記録する場合は、
+	バッファを探すためにstd::mutexをロックする。
+	make_realtime_producer()で積まれたタスクは記録されない。
+	uninstrumented_policyを指定したタスクキューでは使用できない。
+*/
+struct workload_recorder
+{
+    typedef std::chrono::steady_clock clock;
+
+    workload_recorder()
+        :   origin_(clock::now())
+        ,   id_(next_recorder_id())
+        ,   next_id_(1)
+    {}
+
+    workload_recorder(workload_recorder const &) = delete;
+    workload_recorder & operator=(workload_recorder const &) = delete;
+
+    //! タスクが積まれたことを記録する
+    /*!
+		@return タスクに割り当てたid
+	*/
+    std::uint32_t on_submit(task_tag tag)
+    {
+        std::uint64_t const now = elapsed_ns();
+
+        recorded_task const &current = current_recorded_task();
+        std::uint32_t const parent = (current.recorder == this) ? current.task_id : 0;
+
+        //! 0は「記録していないタスク」を表すので使わない
+        std::uint32_t id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        if(id == 0) {
+            id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        workload_thread_buffer &buffer = current_buffer();
+
+        workload_submit_record s;
+        s.task_id = id;
+        s.parent_id = parent;
+        s.thread = buffer.thread;
+        s.tag = tag;
+        s.submit_ns = now;
+
+        std::unique_lock<std::mutex> lock(buffer.mutex);
+        buffer.submits.push_back(s);
+
+        return id;
+    }
+
+    //! タスクの実行を記録する範囲
+    /*!
+		この範囲の中で積まれたタスクは、taskから積まれたものとして記録される。
+		recorderがnullptrの場合や、taskが記録対象でない場合は何もしない。
+	*/
+    struct run_scope
+    {
+        run_scope(workload_recorder *recorder, task_base const &task)
+            :   recorder_(recorder && task.record_id() != 0 ? recorder : nullptr)
+            ,   task_id_(task.record_id())
+            ,   start_ns_(0)
+        {
+            if(!recorder_) {
+                return;
+            }
+
+            recorded_task &current = current_recorded_task();
+            saved_ = current;
+            current.recorder = recorder_;
+            current.task_id = task_id_;
+
+            start_ns_ = recorder_->elapsed_ns();
+        }
+
+        ~run_scope()
+        {
+            if(!recorder_) {
+                return;
+            }
+
+            std::uint64_t const end_ns = recorder_->elapsed_ns();
+            current_recorded_task() = saved_;
+            recorder_->on_run(task_id_, start_ns_, end_ns - start_ns_);
+        }
+
+        run_scope(run_scope const &) = delete;
+        run_scope & operator=(run_scope const &) = delete;
+
+    private:
+        workload_recorder   *recorder_;
+        std::uint32_t       task_id_;
+        std::uint64_t       start_ns_;
+        recorded_task       saved_;
+    };
+
+    //! これまでの記録を返す
+    /*!
+		各スレッドのバッファをまとめ、投入の記録は投入された時刻順に、実行の記録は実行を開始した時刻順に並べる。
+	*/
+    workload_trace trace() const
+    {
+        workload_trace result;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for(auto const &buffer: buffers_) {
+                std::unique_lock<std::mutex> buffer_lock(buffer->mutex);
+                result.submits.insert(result.submits.end(), buffer->submits.begin(), buffer->submits.end());
+                result.runs.insert(result.runs.end(), buffer->runs.begin(), buffer->runs.end());
+            }
+        }
+
+        std::stable_sort(result.submits.begin(), result.submits.end(),
+                         [](workload_submit_record const &a, workload_submit_record const &b) {
+                             return a.submit_ns < b.submit_ns;
+                         });
+        std::stable_sort(result.runs.begin(), result.runs.end(),
+                         [](workload_run_record const &a, workload_run_record const &b) {
+                             return a.start_ns < b.start_ns;
+                         });
+
+        return result;
+    }
+
+    //! これまでの記録をファイルに保存する
+    void save(std::string const &path) const
+    {
+        trace().save(path);
+    }
+
+private:
+    static std::uint64_t next_recorder_id()
+    {
+        static std::atomic<std::uint64_t> next(1);
+        return next.fetch_add(1);
+    }
+
+    std::uint64_t elapsed_ns() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin_).count();
+    }
+
+    void on_run(std::uint32_t task_id, std::uint64_t start_ns, std::uint64_t duration_ns)
+    {
+        workload_thread_buffer &buffer = current_buffer();
+
+        workload_run_record r;
+        r.task_id = task_id;
+        r.thread = buffer.thread;
+        r.start_ns = start_ns;
+        r.duration_ns = duration_ns;
+
+        std::unique_lock<std::mutex> lock(buffer.mutex);
+        buffer.runs.push_back(r);
+    }
+
+    //! 現在のスレッドのバッファを返す。まだなければ作成する
+    workload_thread_buffer & current_buffer()
+    {
+        workload_buffer_cache &cache = current_workload_buffer_cache();
+        if(cache.recorder_id == id_) {
+            return *cache.buffer;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        auto const found = threads_.find(std::this_thread::get_id());
+        workload_thread_buffer *buffer = nullptr;
+        if(found != threads_.end()) {
+            buffer = found->second;
+        } else {
+            buffers_.emplace_back(new workload_thread_buffer(static_cast<std::uint32_t>(buffers_.size())));
+            buffer = buffers_.back().get();
+            threads_.insert(std::make_pair(std::this_thread::get_id(), buffer));
+        }
+
+        cache.recorder_id = id_;
+        cache.buffer = buffer;
+        return *buffer;
+    }
+
+    clock::time_point           origin_;
+    std::uint64_t const         id_;
+    std::atomic<std::uint32_t>  next_id_;
+
+    //! buffers_とthreads_を保護する
+    std::mutex mutable                                              mutex_;
+    std::vector<std::unique_ptr<workload_thread_buffer>>            buffers_;
+    std::unordered_map<std::thread::id, workload_thread_buffer *>   threads_;
+};
+
+//! task_queue_options::recorderで指定されたworkload_recorderに、タスクの投入と実行を記録する
+struct workload_recording
+{
+    //! @param recorder task_queue_options::recorderの値
+    void setup(std::shared_ptr<workload_recorder> recorder) { recorder_ = std::move(recorder); }
+
+    //! タスクが積まれたことを記録する。すでに記録したタスクは記録し直さない
+    void on_submit(task_base &task)
+    {
+        if(recorder_ && task.record_id() == 0) {
+            task.set_record_id(recorder_->on_submit(task.tag()));
+        }
+    }
+
+    //! タスクの実行を記録する範囲
+    struct run_scope
+        :   workload_recorder::run_scope
+    {
+        run_scope(workload_recording &recording, task_base const &task)
+            :   workload_recorder::run_scope(recording.recorder_.get(), task)
+        {}
+    };
+
+private:
+    std::shared_ptr<workload_recorder>  recorder_;
+};
+
+//! 記録しない
+struct null_workload_recording
+{
+    void setup(std::shared_ptr<workload_recorder> const &recorder)
+    {
+        assert(!recorder && "recorder requires instrumented_policy.");
+        (void)recorder;
+    }
+
+    void on_submit(task_base &) {}
+
+    struct run_scope
+    {
+        run_scope(null_workload_recording &, task_base const &) {}
+    };
+};
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::workload_recorder;
+using detail::ns_task::workload_run_record;
+using detail::ns_task::workload_submit_record;
+using detail::ns_task::workload_trace;
+
+}   //namespace hwm
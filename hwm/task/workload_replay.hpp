@@ -0,0 +1,332 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#pragma once
+
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <limits>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "./workload_recorder.hpp"
+
+namespace hwm {
+
+namespace detail { namespace ns_task {
+
+//! replay_workload()の動作を指定するオプション
+struct workload_replay_options
+{
+    workload_replay_options()
+        :   time_scale(1.0)
+        ,   precise_arrival(false)
+    {}
+
+    //! タスクを積む間隔と、タスクの実行時間に掛ける係数
+    /*!
+		2.0を指定すると、記録の2倍の時間をかけて再現する。
+	*/
+    double  time_scale;
+
+    //! タスクを積む時刻の直前をスピンして待ち、記録した時刻に正確に積む
+    /*!
+		falseの場合はスリープで待つので、OSのタイマーの精度（数十マイクロ秒程度）だけ遅れることがある。
+		trueの場合は、タスクを積むスレッドがCPUを消費するので、コア数が少ない環境では再現するタスクの実行を妨げる。
+	*/
+    bool    precise_arrival;
+};
+
+//! replay_workload()の結果
+struct workload_replay_result
+{
+    workload_replay_result()
+        :   num_tasks(0)
+        ,   elapsed(0)
+    {}
+
+    //! 再現したタスクの数
+    size_t                      num_tasks;
+    //! 最初のタスクを積んでから、最後のタスクが完了するまでの時間
+    std::chrono::nanoseconds    elapsed;
+    //! 再現した各タスクが、積まれてから実行を開始するまでの時間（ナノ秒、昇順）
+    std::vector<std::int64_t>   latencies_ns;
+    //! 記録した各タスクが、積まれてから実行を開始するまでの時間（ナノ秒、昇順）
+    std::vector<std::int64_t>   recorded_latencies_ns;
+
+    //! 一秒あたりに完了したタスクの数
+    double throughput() const
+    {
+        return elapsed.count() == 0 ? 0.0 : num_tasks / (elapsed.count() / 1e9);
+    }
+
+    //! 再現したタスクの遅延のパーセンタイル
+    /*!
+		@param p 0.0から1.0の範囲の値。0.99を指定すると99パーセンタイルを返す
+	*/
+    std::chrono::nanoseconds latency_percentile(double p) const
+    {
+        return std::chrono::nanoseconds(percentile(latencies_ns, p));
+    }
+
+    //! 記録したタスクの遅延のパーセンタイル
+    std::chrono::nanoseconds recorded_latency_percentile(double p) const
+    {
+        return std::chrono::nanoseconds(percentile(recorded_latencies_ns, p));
+    }
+
+private:
+    static std::int64_t percentile(std::vector<std::int64_t> const &sorted, double p)
+    {
+        if(sorted.empty()) {
+            return 0;
+        }
+
+        size_t const index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+        return sorted[(std::min)(index, sorted.size() - 1)];
+    }
+};
+
+//! replay_workload()で、記録したタスク一つを再現するための情報
+struct replay_node
+{
+    replay_node()
+        :   submit_ns(0)
+        ,   offset_ns(0)
+        ,   duration_ns(0)
+        ,   recorded_latency_ns(-1)
+        ,   thread(0)
+        ,   is_root(true)
+    {}
+
+    //! 記録を開始してから積まれるまでの時間
+    std::int64_t    submit_ns;
+    //! 親タスクから積まれた場合、親タスクが開始してから積まれるまでの時間
+    std::int64_t    offset_ns;
+    std::int64_t    duration_ns;
+    //! 記録した遅延。タスクが実行されなかった場合は-1
+    std::int64_t    recorded_latency_ns;
+    std::uint32_t   thread;
+    bool            is_root;
+    //! このタスクから積まれたタスクのインデックス（offset_nsの昇順）
+    std::vector<size_t> children;
+};
+
+//! replay_workload()の実行中に、各タスクから共有される状態
+template<class TaskQueue>
+struct replay_context
+{
+    typedef std::chrono::steady_clock clock;
+
+    replay_context(TaskQueue &tq, std::vector<replay_node> nodes, double scale)
+        :   tq(tq)
+        ,   nodes(std::move(nodes))
+        ,   scale(scale)
+        ,   submitted(this->nodes.size())
+        ,   latencies(this->nodes.size())
+        ,   remaining(this->nodes.size())
+    {}
+
+    std::chrono::nanoseconds scaled(std::int64_t ns) const
+    {
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(ns * scale));
+    }
+
+    void submit(size_t index)
+    {
+        submitted[index] = clock::now();
+        tq.enqueue([this, index] { run(index); });
+    }
+
+    //! 記録した実行時間だけスピンしながら、その間に記録した時刻で子タスクを積む
+    void run(size_t index)
+    {
+        auto const start = clock::now();
+        latencies[index] = std::chrono::duration_cast<std::chrono::nanoseconds>(start - submitted[index]).count();
+
+        replay_node const &node = nodes[index];
+        auto const end = start + scaled(node.duration_ns);
+
+        size_t next_child = 0;
+        for( ; ; ) {
+            auto const now = clock::now();
+
+            while(next_child < node.children.size()
+                  && start + scaled(nodes[node.children[next_child]].offset_ns) <= now)
+            {
+                submit(node.children[next_child++]);
+            }
+
+            if(now >= end) {
+                break;
+            }
+        }
+
+        //! 記録の上で親タスクの終了後に積まれたことになっている子タスク
+        while(next_child < node.children.size()) {
+            submit(node.children[next_child++]);
+        }
+
+        if(remaining.fetch_sub(1) == 1) {
+            finished_at = clock::now();
+
+            //! 準備完了になった直後にreplay_workload()から戻ってこのオブジェクトが破棄されることがあるので、
+            //! promiseをローカルに移してから準備完了にする。
+            std::promise<void> p(std::move(done));
+            p.set_value();
+        }
+    }
+
+    TaskQueue                       &tq;
+    std::vector<replay_node> const  nodes;
+    double const                    scale;
+    std::vector<clock::time_point>  submitted;
+    std::vector<std::int64_t>       latencies;
+    std::atomic<size_t>             remaining;
+    clock::time_point               finished_at;
+    std::promise<void>              done;
+};
+
+//! workload_traceから、replay_nodeの配列を作成する
+inline
+std::vector<replay_node> make_replay_nodes(workload_trace const &trace)
+{
+    std::vector<replay_node> nodes(trace.submits.size());
+    std::unordered_map<std::uint32_t, size_t> index_of;
+
+    for(size_t i = 0; i < trace.submits.size(); ++i) {
+        index_of[trace.submits[i].task_id] = i;
+        nodes[i].submit_ns = static_cast<std::int64_t>(trace.submits[i].submit_ns);
+        nodes[i].thread = trace.submits[i].thread;
+    }
+
+    std::vector<std::int64_t> start_ns(nodes.size(), -1);
+    for(auto const &r: trace.runs) {
+        auto const found = index_of.find(r.task_id);
+        if(found == index_of.end()) {
+            continue;
+        }
+
+        replay_node &node = nodes[found->second];
+        node.duration_ns = static_cast<std::int64_t>(r.duration_ns);
+        node.recorded_latency_ns = static_cast<std::int64_t>(r.start_ns) - node.submit_ns;
+        start_ns[found->second] = static_cast<std::int64_t>(r.start_ns);
+    }
+
+    //! 親タスクが記録されていないか、実行されなかった場合は、外部から積まれたタスクとして扱う
+    for(size_t i = 0; i < trace.submits.size(); ++i) {
+        auto const parent = index_of.find(trace.submits[i].parent_id);
+        if(trace.submits[i].parent_id == 0 || parent == index_of.end() || start_ns[parent->second] < 0) {
+            continue;
+        }
+
+        nodes[i].is_root = false;
+        nodes[i].offset_ns = (std::max)(nodes[i].submit_ns - start_ns[parent->second], std::int64_t(0));
+        nodes[parent->second].children.push_back(i);
+    }
+
+    for(auto &node: nodes) {
+        std::stable_sort(node.children.begin(), node.children.end(), [&nodes](size_t a, size_t b) {
+            return nodes[a].offset_ns < nodes[b].offset_ns;
+        });
+    }
+
+    return nodes;
+}
+
+//! 記録したワークロードを、タスクキューに対して再現する
+/*!
+	タスクキューのスレッド以外から積まれたタスクは、記録したスレッドごとに一つずつ起動するスレッドから、記録した時刻に積む。
+	タスクの中から積まれたタスクは、再現した親タスクの中から、親タスクの開始からの記録した経過時間に積む。
+	各タスクは記録した実行時間だけスピンする。
+	これによって、実際の到着パターンとタスクの親子関係を保ったまま、異なる構成のタスクキューの性能を比較できる。
+	@tparam TaskQueue enqueue(f)メンバ関数を持つ型
+	@param [in] tq ワークロードを再現するタスクキュー
+	@param [in] trace workload_recorderで記録した内容
+	@return スループットと遅延の統計情報
+*/
+template<class TaskQueue>
+workload_replay_result replay_workload(TaskQueue &tq, workload_trace const &trace, workload_replay_options const &options = workload_replay_options())
+{
+    typedef replay_context<TaskQueue> context_t;
+    typedef typename context_t::clock clock;
+
+    workload_replay_result result;
+
+    std::vector<replay_node> nodes = make_replay_nodes(trace);
+    if(nodes.empty()) {
+        return result;
+    }
+
+    //! 記録したスレッドごとに、外部から積まれたタスクをまとめる
+    std::map<std::uint32_t, std::vector<size_t>> roots;
+    std::int64_t first_submit_ns = (std::numeric_limits<std::int64_t>::max)();
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        if(nodes[i].is_root) {
+            roots[nodes[i].thread].push_back(i);
+            first_submit_ns = (std::min)(first_submit_ns, nodes[i].submit_ns);
+        }
+        if(nodes[i].recorded_latency_ns >= 0) {
+            result.recorded_latencies_ns.push_back(nodes[i].recorded_latency_ns);
+        }
+    }
+
+    context_t ctx(tq, std::move(nodes), options.time_scale);
+    auto done = ctx.done.get_future();
+
+    auto const origin = clock::now();
+
+    std::vector<std::thread> drivers;
+    for(auto const &r: roots) {
+        std::vector<size_t> const *indices = &r.second;
+        bool const precise = options.precise_arrival;
+        drivers.push_back(std::thread([&ctx, indices, origin, first_submit_ns, precise] {
+            for(size_t index: *indices) {
+                auto const at = origin + ctx.scaled(ctx.nodes[index].submit_ns - first_submit_ns);
+                if(!precise) {
+                    std::this_thread::sleep_until(at);
+                } else {
+                    //! スリープの精度は粗いので、直前まではスリープし、残りはスピンして待つ
+                    auto const coarse = at - std::chrono::microseconds(100);
+                    if(clock::now() < coarse) {
+                        std::this_thread::sleep_until(coarse);
+                    }
+                    while(clock::now() < at) {}
+                }
+
+                ctx.submit(index);
+            }
+        }));
+    }
+
+    for(auto &th: drivers) {
+        th.join();
+    }
+    done.wait();
+
+    result.num_tasks = ctx.nodes.size();
+    result.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(ctx.finished_at - origin);
+    result.latencies_ns = ctx.latencies;
+
+    std::sort(result.latencies_ns.begin(), result.latencies_ns.end());
+    std::sort(result.recorded_latencies_ns.begin(), result.recorded_latencies_ns.end());
+
+    return result;
+}
+
+}}  //namespace detail::ns_task
+
+using detail::ns_task::replay_workload;
+using detail::ns_task::workload_replay_options;
+using detail::ns_task::workload_replay_result;
+
+}   //namespace hwm
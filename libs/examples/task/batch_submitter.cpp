@@ -0,0 +1,93 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <vector>
+#include <hwm/task/batch_submitter.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! batch_submitterを使用して、ごく小さなタスクをまとめてタスクキューに積むサンプル
+//! まとめられたタスクも、それぞれ個別のstd::futureで結果を受け取れる。
+//! 比較のため、同じ数のタスクをenqueue()で一つずつ積んだ場合の実行時間も計測する。
+
+int const kNumTasks = 1000000;
+
+int main()
+{
+    hwm::task_queue tq;
+
+    {
+        //! 個別のstd::futureで結果を受け取る
+        hwm::batch_submitter submitter(tq);
+
+        std::vector<std::future<int>> futures;
+        for(int i = 0; i < 1000; ++i) {
+            futures.push_back(submitter.enqueue([](int x) { return x * 2; }, i));
+        }
+
+        //! 例外もそれぞれのstd::futureに設定される
+        auto failed = submitter.enqueue([] { throw std::runtime_error("error in batched task"); });
+
+        submitter.flush();
+
+        long long sum = 0;
+        for(auto &f: futures) { sum += f.get(); }
+
+        hwm::mcout << "sum : " << sum << " (expected " << 999 * 1000 << ")" << std::endl;
+
+        try {
+            failed.get();
+        } catch(std::exception &e) {
+            hwm::mcout << "exception : " << e.what() << std::endl;
+        }
+
+        if(sum != 999 * 1000) {
+            return 1;
+        }
+    }
+
+    {
+        //! flush()を呼び出さなくても、最初のタスクを溜めてからmax_delayが経過すればタスクキューに積まれる
+        hwm::batch_submitter submitter(tq, 64, std::chrono::milliseconds(1));
+        auto tail = submitter.enqueue([] { return 1; });
+
+        if(tail.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+            hwm::mcout << "the batch was not flushed after max_delay" << std::endl;
+            return 1;
+        }
+        hwm::mcout << "flushed after max_delay : " << tail.get() << std::endl;
+    }
+
+    std::atomic<int> counter(0);
+    auto const increment = [&counter] { counter.fetch_add(1, std::memory_order_relaxed); };
+
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < kNumTasks; ++i) {
+        tq.enqueue(increment);
+    }
+    tq.wait();
+    auto const one_by_one = std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    {
+        hwm::batch_submitter submitter(tq, 256);
+        for(int i = 0; i < kNumTasks; ++i) {
+            submitter.enqueue(increment);
+        }
+    }
+    tq.wait();
+    auto const batched = std::chrono::steady_clock::now() - start;
+
+    hwm::mcout << "executed : " << counter.load() << " (expected " << kNumTasks * 2 << ")" << std::endl;
+    hwm::mcout << "enqueue() : "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(one_by_one).count() << " ms, "
+               << "batch_submitter : "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(batched).count() << " ms" << std::endl;
+
+    return counter.load() == kNumTasks * 2 ? 0 : 1;
+}
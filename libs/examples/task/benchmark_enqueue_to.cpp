@@ -0,0 +1,92 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! enqueue()とenqueue_to()の実行時間を比較するベンチマーク
+//! 各タスクはいずれかのパーティションのデータを走査する。
+//! enqueue_to()でパーティション番号をキーにすると、同じパーティションを扱うタスクは同じスレッドで実行されるので、
+//! パーティションのデータがそのスレッドのコアのキャッシュに載ったまま処理できる。 //
+
+size_t const kPartitionSize = 64 * 1024;   // 256KB (int)
+size_t const kNumTasks = 20000;
+
+struct partition
+{
+    std::vector<int> data;
+};
+
+template<class Enqueue>
+double measure(hwm::task_queue &tq, std::vector<partition> const &partitions, std::vector<size_t> const &order, Enqueue enqueue)
+{
+    std::atomic<long long> total(0);
+
+    auto const start = std::chrono::steady_clock::now();
+
+    for(size_t i = 0; i < order.size(); ++i) {
+        size_t const key = order[i];
+        partition const *p = &partitions[key];
+
+        enqueue(tq, key, [p, &total] {
+            long long sum = 0;
+            for(int x: p->data) { sum += x; }
+            total += sum;
+        });
+    }
+
+    tq.wait();
+
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main()
+{
+    hwm::task_queue tq;
+
+    size_t const num_partitions = tq.num_threads() * 4;
+    std::vector<partition> partitions(num_partitions);
+    for(auto &p: partitions) {
+        p.data.assign(kPartitionSize, 1);
+    }
+
+    std::mt19937 engine;
+    std::uniform_int_distribution<size_t> dist(0, num_partitions - 1);
+    std::vector<size_t> order(kNumTasks);
+    for(auto &key: order) {
+        key = dist(engine);
+    }
+
+    std::cout << "threads : " << tq.num_threads() << ", partitions : " << num_partitions << ", tasks : " << kNumTasks << std::endl;
+
+    for(int trial = 0; trial < 3; ++trial) {
+        double const shared =
+            measure(tq, partitions, order, [](hwm::task_queue &tq, size_t, std::function<void()> f) {
+                tq.enqueue(std::move(f));
+            });
+
+        double const affinity =
+            measure(tq, partitions, order, [](hwm::task_queue &tq, size_t key, std::function<void()> f) {
+                tq.enqueue_to(key, std::move(f));
+            });
+
+        tq.set_steal_threshold(8);
+        double const stealing =
+            measure(tq, partitions, order, [](hwm::task_queue &tq, size_t key, std::function<void()> f) {
+                tq.enqueue_to(key, std::move(f));
+            });
+        tq.set_steal_threshold((std::numeric_limits<size_t>::max)());
+
+        std::cout
+            << "enqueue() : " << shared << " ms, "
+            << "enqueue_to() : " << affinity << " ms, "
+            << "enqueue_to() with stealing : " << stealing << " ms" << std::endl;
+    }
+}
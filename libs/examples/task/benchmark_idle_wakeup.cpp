@@ -0,0 +1,77 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <iostream>
+#include <hwm/task/task_queue.hpp>
+
+//! ほとんどのスレッドが待機している状態のタスクキューに、タスクを一つずつ積んで完了を待つことを繰り返し、
+//! 一つのタスクが待機中のスレッドに渡って実行されるまでの平均時間を計測するベンチマーク。
+//! タスク一つにつき一つのスレッドだけが起こされるので、スレッド数を増やしても時間はほとんど変わらない。
+//! enqueue_to()で特定のスレッドにタスクを積む場合と、producerで積む場合も同様に、そのスレッドだけが起こされる。
+
+int const kNumRounds = 20000;
+
+struct shared_round
+{
+    template<class TaskQueue>
+    void operator()(TaskQueue &tq, int i) const { tq.enqueue([i] { return i; }).wait(); }
+};
+
+struct targeted_round
+{
+    template<class TaskQueue>
+    void operator()(TaskQueue &tq, int i) const { tq.enqueue_to(i, [i] { return i; }).wait(); }
+};
+
+template<class Round>
+double measure(size_t num_threads, Round round)
+{
+    hwm::task_queue tq(num_threads);
+
+    //! スレッドが起動して待機状態に入るまで待つ
+    tq.enqueue([] {}).wait();
+
+    auto const start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < kNumRounds; ++i) {
+        round(tq, i);
+    }
+
+    auto const end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::micro>(end - start).count() / kNumRounds;
+}
+
+double measure_producer(size_t num_threads)
+{
+    hwm::task_queue tq(num_threads);
+    tq.enqueue([] {}).wait();
+
+    auto producer = tq.make_producer();
+
+    auto const start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < kNumRounds; ++i) {
+        producer.enqueue([i] { return i; }).wait();
+    }
+
+    auto const end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::micro>(end - start).count() / kNumRounds;
+}
+
+int main()
+{
+    std::cout << "rounds : " << kNumRounds << std::endl;
+
+    for(size_t num_threads = 1; num_threads <= 32; num_threads *= 2) {
+        std::cout
+            << "threads : " << num_threads
+            << ", enqueue() " << measure(num_threads, shared_round()) << " us/round"
+            << ", enqueue_to() " << measure(num_threads, targeted_round()) << " us/round"
+            << ", producer::enqueue() " << measure_producer(num_threads) << " us/round" << std::endl;
+    }
+}
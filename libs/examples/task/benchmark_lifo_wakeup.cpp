@@ -0,0 +1,107 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <set>
+#include <thread>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! スレッド数に対して負荷が低い状態で、待機中のスレッドを起こす順序による違いを計測するベンチマーク
+//! 数個ずつのタスクを積んで完了を待ち、少し間を空けてスレッドがすべて休止してから次を積むことを繰り返す。
+//! 各タスクは共有の配列を読むので、最近タスクを実行したコアで実行されればキャッシュに当たりやすい。
+//! blocking_idle_policy（どのスレッドを起こすかはOSに任せる）とlifo_idle_policy（最も最近休止したスレッドを起こす）について、
+//! タスクを積んでから実行が始まるまでの遅延、タスクを実行したスレッドの数、タスクあたりのキャッシュミス数を表示する。
+//! （キャッシュミス数は、perf_event_open()でハードウェアカウンタを使用できる環境でのみ表示される）
+
+int const kNumRounds = 2000;
+hwm::task_tag const kTag = 1;
+
+typedef hwm::basic_task_queue<
+    hwm::task_queue_policies<hwm::locked_queue_policy<>, hwm::blocking_idle_policy>
+> blocking_task_queue;
+
+typedef hwm::basic_task_queue<
+    hwm::task_queue_policies<hwm::locked_queue_policy<>, hwm::lifo_idle_policy>
+> lifo_task_queue;
+
+template<class TaskQueue>
+void measure(char const *name, size_t num_threads, size_t burst)
+{
+    typedef std::chrono::steady_clock clock;
+
+    hwm::task_queue_options options;
+    options.enable_perf_counters = true;
+
+    TaskQueue tq(num_threads, (std::numeric_limits<size_t>::max)(), options);
+
+    std::vector<int> data(64 * 1024, 1);
+    size_t const num_tasks = kNumRounds * burst;
+    std::vector<std::int64_t> latencies(num_tasks);
+    std::vector<std::thread::id> runners(num_tasks);
+
+    for(int round = 0; round < kNumRounds; ++round) {
+        std::vector<std::future<long long>> futures;
+
+        for(size_t b = 0; b < burst; ++b) {
+            size_t const index = round * burst + b;
+            auto const submitted = clock::now();
+
+            futures.push_back(tq.enqueue_with_tag(kTag, [&, index, submitted] {
+                latencies[index] = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - submitted).count();
+                runners[index] = std::this_thread::get_id();
+
+                long long sum = 0;
+                for(int x: data) { sum += x; }
+                return sum;
+            }));
+        }
+
+        for(auto &f: futures) {
+            f.get();
+        }
+
+        //! すべてのスレッドが休止するまで待つ
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::set<std::thread::id> const distinct(runners.begin(), runners.end());
+
+    hwm::task_queue_metrics m = tq.metrics();
+    hwm::task_perf_counters const &c = m.task_counters[kTag];
+
+    std::cout
+        << name
+        << " threads : " << num_threads
+        << ", burst : " << burst
+        << ", wake latency p50 : " << latencies[num_tasks / 2] / 1000.0 << "us"
+        << ", p99 : " << latencies[num_tasks * 99 / 100] / 1000.0 << "us"
+        << ", workers used : " << distinct.size();
+
+    if(m.available_perf_counters.llc_misses) {
+        std::cout << ", cache misses/task : " << static_cast<double>(c.llc_misses) / c.num_tasks;
+    }
+    if(m.available_perf_counters.cycles) {
+        std::cout << ", cycles/task : " << static_cast<double>(c.cycles) / c.num_tasks;
+    }
+
+    std::cout << std::endl;
+}
+
+int main()
+{
+    size_t const num_threads = (std::max)(std::thread::hardware_concurrency(), 8u);
+
+    std::cout << "rounds : " << kNumRounds << std::endl;
+
+    for(size_t burst = 1; burst <= 4; burst *= 2) {
+        measure<blocking_task_queue>("blocking", num_threads, burst);
+        measure<lifo_task_queue>("lifo    ", num_threads, burst);
+    }
+}
@@ -0,0 +1,71 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <numeric>
+#include <vector>
+#include <hwm/task/parallel.hpp>
+#include <hwm/task/task_queue.hpp>
+
+//! hwm::parallel::sortとstd::sort、hwm::parallel::inclusive_scanとstd::partial_sumの実行時間を、
+//! 要素数を1e4から10倍ずつ増やしながら比較するベンチマーク
+//! 最大の要素数はコマンドライン引数で指定する（デフォルトは1e7）。
+//! 1e9を指定すると、作業領域を含めて10GB程度のメモリを使用する。
+
+unsigned int next_random(unsigned int &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+template<class F>
+double measure(F f)
+{
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t const max_size = (argc > 1) ? static_cast<size_t>(std::atof(argv[1])) : 10000000;
+
+    hwm::task_queue tq;
+    std::cout << "threads : " << tq.num_threads() << std::endl;
+
+    for(size_t n = 10000; n <= max_size; n *= 10) {
+        std::vector<int> data(n);
+        unsigned int seed = 12345;
+        for(auto &x: data) { x = static_cast<int>(next_random(seed)); }
+
+        std::vector<int> v;
+
+        v = data;
+        double const std_sort = measure([&] { std::sort(v.begin(), v.end()); });
+
+        v = data;
+        double const par_sort = measure([&] { hwm::parallel::sort(tq, v.begin(), v.end()); });
+
+        std::vector<long long> const values(data.begin(), data.end());
+        std::vector<long long> out(n);
+
+        double const std_scan = measure([&] { std::partial_sum(values.begin(), values.end(), out.begin()); });
+        double const par_scan = measure([&] { hwm::parallel::inclusive_scan(tq, values.begin(), values.end(), out.begin()); });
+
+        std::cout
+            << "n : " << n
+            << ", std::sort : " << std_sort << "ms"
+            << ", parallel::sort : " << par_sort << "ms"
+            << ", std::partial_sum : " << std_scan << "ms"
+            << ", parallel::inclusive_scan : " << par_scan << "ms"
+            << std::endl;
+    }
+}
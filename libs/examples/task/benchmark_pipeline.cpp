@@ -0,0 +1,54 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <hwm/task/pipeline.hpp>
+#include <hwm/task/task_queue.hpp>
+
+//! ソース → 重い並列のステージ → 順番通りに集計するステージ、というパイプラインのスループットを、
+//! トークン数（同時にパイプラインの中に存在できる要素の数）を変えて計測するベンチマーク
+
+int const kNumItems = 200000;
+
+double heavy(int x)
+{
+    double v = x;
+    for(int i = 0; i < 200; ++i) {
+        v = std::sqrt(v + i);
+    }
+    return v;
+}
+
+int main()
+{
+    hwm::task_queue tq;
+
+    std::cout << "threads : " << tq.num_threads() << ", items : " << kNumItems << std::endl;
+
+    for(size_t tokens = 1; tokens <= 256; tokens *= 4) {
+        int next = 0;
+        double sum = 0;
+
+        auto p =
+            hwm::pipeline::from([&](hwm::flow_control &fc) -> int {
+                if(next == kNumItems) { fc.stop(); }
+                return next++;
+            })
+            .then(hwm::stage_mode::parallel, [](int x) { return heavy(x); })
+            .to(hwm::stage_mode::serial_in_order, [&](double v) { sum += v; });
+
+        auto const start = std::chrono::steady_clock::now();
+        p.run(tq, tokens).get();
+        auto const end = std::chrono::steady_clock::now();
+
+        double const sec = std::chrono::duration<double>(end - start).count();
+        std::cout
+            << "tokens : " << tokens
+            << ", " << static_cast<long long>(kNumItems / sec) << " items/s"
+            << " (sum " << sum << ")" << std::endl;
+    }
+}
@@ -0,0 +1,121 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <hwm/task/task_queue.hpp>
+
+//! 一つのスレッドから小さなタスクを大量に積む場合に、
+//! 通常のenqueue()と、make_producer()で作成したハンドルのenqueue()の実行時間を比較するベンチマーク
+//! （enqueue_task_from_one_thread.cppのような使い方を想定している）
+//! タスクはラムダ式のまま積むので、std::functionへの変換によるメモリ確保は含まれない。 //
+
+int const kNumTasks = 1000000;
+
+//! 結果を受け取らないタスクキュー。wait()で完了を待つので、タスク数は数える。 //
+typedef hwm::basic_task_queue<
+    hwm::task_queue_policies<
+        hwm::locked_queue_policy<>,
+        hwm::blocking_idle_policy,
+        hwm::no_result_policy,
+        hwm::counted_policy,
+        hwm::uninstrumented_policy>
+> fire_and_forget_queue;
+
+struct result
+{
+    double submit;
+    double total;
+};
+
+template<class TaskQueue>
+struct shared_enqueue
+{
+    TaskQueue &tq;
+
+    template<class F>
+    void operator()(F f) const { tq.enqueue(std::move(f)); }
+};
+
+template<class Producer>
+struct producer_enqueue
+{
+    Producer &producer;
+
+    template<class F>
+    void operator()(F f) const { producer.enqueue(std::move(f)); }
+};
+
+//! busyがtrueの場合は、タスクを積み終えるまですべてのスレッドを別のタスクで待たせておく。
+//! スレッドを起こす処理が行われないので、タスクを積む処理だけの時間を計測できる。 //
+template<class TaskQueue, class Enqueue>
+result measure(TaskQueue &tq, Enqueue enqueue, bool busy)
+{
+    std::atomic<int> counter(0);
+    std::atomic<size_t> blocked(0);
+    std::atomic<bool> gate(false);
+
+    if(busy) {
+        for(size_t i = 0; i < tq.num_threads(); ++i) {
+            tq.enqueue([&] {
+                ++blocked;
+                while(!gate.load()) { std::this_thread::yield(); }
+            });
+        }
+        while(blocked.load() != tq.num_threads()) { std::this_thread::yield(); }
+    }
+
+    auto const start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < kNumTasks; ++i) {
+        enqueue([&counter] { counter.fetch_add(1, std::memory_order_relaxed); });
+    }
+
+    auto const submitted = std::chrono::steady_clock::now();
+
+    gate.store(true);
+    tq.wait();
+
+    auto const end = std::chrono::steady_clock::now();
+
+    result r;
+    r.submit = std::chrono::duration<double, std::milli>(submitted - start).count();
+    r.total = std::chrono::duration<double, std::milli>(end - start).count();
+    return r;
+}
+
+template<class TaskQueue>
+void run(char const *name)
+{
+    TaskQueue tq;
+
+    std::cout << name << " (threads : " << tq.num_threads() << ", tasks : " << kNumTasks << ")" << std::endl;
+
+    //! タスクをすべてリングバッファに積めるだけの容量を確保する
+    auto producer = tq.make_producer(kNumTasks);
+
+    shared_enqueue<TaskQueue> const shared_arm = { tq };
+    producer_enqueue<decltype(producer)> const producer_arm = { producer };
+
+    for(int trial = 0; trial < 3; ++trial) {
+        for(int busy = 1; busy >= 0; --busy) {
+            result const shared = measure(tq, shared_arm, busy != 0);
+            result const spsc = measure(tq, producer_arm, busy != 0);
+
+            std::cout
+                << (busy ? "  busy workers : " : "  idle workers : ")
+                << "enqueue() : submit " << shared.submit << " ms, total " << shared.total << " ms / "
+                << "producer::enqueue() : submit " << spsc.submit << " ms, total " << spsc.total << " ms" << std::endl;
+        }
+    }
+}
+
+int main()
+{
+    run<hwm::task_queue>("task_queue");
+    run<fire_and_forget_queue>("no_result_policy");
+}
@@ -0,0 +1,66 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! 多数のスレッドから同時にenqueue()する場合に、シャードの数と選び方によって実行時間がどう変わるかを比較するベンチマーク
+//! enqueue_task_from_many_threads.cppと同じく30個のスレッドからタスクを追加する。 //
+
+int const kTaskPerThread = 20000;
+int const kNumProducers = 30;
+
+double measure(size_t num_shards, hwm::shard_selection selection, hwm::queue_limit_scope scope, size_t queue_limit)
+{
+    hwm::task_queue_options options;
+    options.num_shards = num_shards;
+    options.selection = selection;
+    options.limit_scope = scope;
+
+    hwm::task_queue tq((std::max)(std::thread::hardware_concurrency(), 1u), queue_limit, options);
+
+    auto const start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> producers;
+    for(int i = 0; i < kNumProducers; ++i) {
+        producers.emplace_back([&tq] {
+            for(int task_index = 0; task_index < kTaskPerThread; ++task_index) {
+                tq.enqueue([]{});
+            }
+        });
+    }
+
+    for(auto &producer: producers) {
+        producer.join();
+    }
+
+    tq.wait();
+
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main()
+{
+    size_t const num_shards = (std::max)(std::thread::hardware_concurrency(), 2u);
+    size_t const queue_limit = 1024;
+
+    std::cout << "producers : " << kNumProducers << ", tasks per producer : " << kTaskPerThread << std::endl;
+
+    std::cout << "1 shard : "
+              << measure(1, hwm::shard_selection::round_robin, hwm::queue_limit_scope::global, queue_limit) << " ms" << std::endl;
+
+    std::cout << num_shards << " shards (round robin, global limit) : "
+              << measure(num_shards, hwm::shard_selection::round_robin, hwm::queue_limit_scope::global, queue_limit) << " ms" << std::endl;
+
+    std::cout << num_shards << " shards (round robin, per-shard limit) : "
+              << measure(num_shards, hwm::shard_selection::round_robin, hwm::queue_limit_scope::per_shard, queue_limit) << " ms" << std::endl;
+
+    std::cout << num_shards << " shards (power of two choices, global limit) : "
+              << measure(num_shards, hwm::shard_selection::power_of_two_choices, hwm::queue_limit_scope::global, queue_limit) << " ms" << std::endl;
+}
@@ -0,0 +1,56 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+#include <hwm/task/blocking_scope.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! blocking_scopeでブロッキング処理を行う範囲を指定するサンプル
+//! スレッド数2のタスクキューで、ブロッキング処理を行うタスクが2つ実行されている間も、
+//! 補助スレッドが起動されるので、計算処理を行うタスクが待たされずに実行される。 //
+
+int main()
+{
+    hwm::task_queue tq(2);
+
+    auto const start = std::chrono::steady_clock::now();
+    auto elapsed = [start] {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    for(int i = 0; i < 2; ++i) {
+        tq.enqueue([i, &elapsed] {
+            hwm::mcout << "[" << elapsed() << " ms] >>> blocking task[" << i << "]" << std::endl;
+            {
+                //! この範囲ではCPUを使わずに待機する。 //
+                hwm::blocking_scope bs;
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+            hwm::mcout << "[" << elapsed() << " ms] <<< blocking task[" << i << "]" << std::endl;
+        });
+    }
+
+    //! ブロッキング処理を行うタスクが先に実行されるのを待つ。 //
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::vector<std::future<void>> futures;
+    for(int i = 0; i < 4; ++i) {
+        futures.push_back(tq.enqueue([i, &elapsed] {
+            hwm::mcout << "[" << elapsed() << " ms] --- computing task[" << i << "]" << std::endl;
+        }));
+    }
+
+    for(auto &f: futures) {
+        f.wait();
+    }
+
+    hwm::mcout << "[" << elapsed() << " ms] computing tasks finished. (before blocking tasks finish)" << std::endl;
+
+    tq.wait();
+    hwm::mcout << "compensation threads : " << tq.num_compensation_threads() << std::endl;
+}
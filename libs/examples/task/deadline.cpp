@@ -0,0 +1,89 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! 期限付きのタスクを使用するサンプル
+//! スレッドが一つしかないタスクキューで、最初のタスクがスレッドをふさいでいる間に期限付きのタスクを積む。
+//! 期限付きのタスクは期限の早い順に、通常のタスクより先に実行され、
+//! 期限を過ぎてしまったタスクは実行されずに破棄される。
+
+int main()
+{
+    hwm::task_queue tq(1);
+
+    std::atomic<bool> started(false);
+    std::atomic<bool> release(false);
+    tq.enqueue([&started, &release] {
+        started.store(true);
+        while(!release.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    //! 期限付きのタスクは先に実行されるので、スレッドがふさがってから積む
+    while(!started.load()) {
+        std::this_thread::yield();
+    }
+
+    std::mutex mutex;
+    std::vector<std::string> order;
+    auto record = [&mutex, &order](std::string name) {
+        std::unique_lock<std::mutex> lock(mutex);
+        order.push_back(name);
+    };
+
+    auto const now = std::chrono::steady_clock::now();
+    using std::chrono::milliseconds;
+
+    auto plain  = tq.enqueue(record, "plain");
+    auto late   = tq.enqueue_with_deadline(now + milliseconds(3000), record, "late");
+    auto soon   = tq.enqueue_with_deadline(now + milliseconds(1000), record, "soon");
+    auto stale  = tq.enqueue_with_deadline(now + milliseconds(10), record, "stale");
+    auto middle = tq.enqueue_with_deadline(now + milliseconds(2000), record, "middle");
+
+    //! staleの期限が過ぎるまでスレッドをふさいでおく
+    std::this_thread::sleep_for(milliseconds(50));
+    release.store(true);
+
+    tq.wait();
+
+    for(auto const &name: order) {
+        std::cout << name << std::endl;
+    }
+
+    assert((order == std::vector<std::string>{ "soon", "middle", "late", "plain" }));
+
+    try {
+        stale.get();
+        assert(false);
+    } catch(hwm::task_expired &e) {
+        std::cout << "stale : " << e.what() << std::endl;
+    }
+
+    plain.get();
+    late.get();
+    soon.get();
+    middle.get();
+
+    hwm::task_queue_metrics const m = tq.metrics();
+    std::cout << "executed : " << m.deadline.executed << std::endl;
+    std::cout << "expired : " << m.deadline.expired << std::endl;
+    std::cout << "mean start slack : "
+              << std::chrono::duration_cast<milliseconds>(m.deadline.mean_start_slack()).count() << "ms" << std::endl;
+    std::cout << "min start slack : "
+              << std::chrono::duration_cast<milliseconds>(m.deadline.min_start_slack).count() << "ms" << std::endl;
+
+    assert(m.deadline.executed == 3);
+    assert(m.deadline.expired == 1);
+}
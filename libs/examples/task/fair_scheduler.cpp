@@ -0,0 +1,87 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <future>
+#include <thread>
+#include <vector>
+#include <hwm/task/fair_scheduler.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! fair_schedulerを使用して、一つのタスクキューを複数のテナントで公平に分け合うサンプル
+//! テナントAが先に大量のタスクを積んでも、後からテナントBに積んだタスクは
+//! Aのタスクがすべて実行されるのを待たずに実行される。
+
+int const kNumFloodTasks = 2000;
+int const kNumTasks = 50;
+
+void work()
+{
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+void print(char const *name, hwm::tenant_metrics const &m)
+{
+    using std::chrono::microseconds;
+    using std::chrono::duration_cast;
+
+    hwm::mcout
+        << name << " : started " << m.started << "/" << m.enqueued
+        << ", mean wait " << duration_cast<microseconds>(m.mean_wait()).count() << " us"
+        << ", p99 wait " << duration_cast<microseconds>(m.wait_percentile(0.99)).count() << " us"
+        << ", max wait " << duration_cast<microseconds>(m.max_wait).count() << " us"
+        << std::endl;
+}
+
+int main()
+{
+    hwm::task_queue tq(2);
+    hwm::fair_scheduler scheduler(tq);
+
+    auto a = scheduler.make_tenant(1);
+    auto b = scheduler.make_tenant(1);
+
+    std::vector<std::future<void>> fa;
+    for(int i = 0; i < kNumFloodTasks; ++i) {
+        fa.push_back(a.enqueue(work));
+    }
+
+    std::vector<std::future<void>> fb;
+    for(int i = 0; i < kNumTasks; ++i) {
+        fb.push_back(b.enqueue(work));
+    }
+
+    for(auto &f: fb) { f.get(); }
+
+    //! Bのタスクがすべて終わった時点で、Aのタスクはまだ残っている
+    size_t const a_started_when_b_done = a.metrics().started;
+
+    for(auto &f: fa) { f.get(); }
+
+    hwm::mcout << "A had started " << a_started_when_b_done << " of " << kNumFloodTasks
+               << " tasks when B finished" << std::endl;
+    print("A", a.metrics());
+    print("B", b.metrics());
+
+    //! 重みを変えると、実行される割合が変わる
+    auto heavy = scheduler.make_tenant(3);
+    auto light = scheduler.make_tenant(1);
+
+    std::vector<std::future<void>> fs;
+    for(int i = 0; i < 400; ++i) {
+        fs.push_back(heavy.enqueue(work));
+        fs.push_back(light.enqueue(work));
+    }
+
+    fs[fs.size() / 2].wait();
+    hwm::mcout << "weight 3 : " << heavy.metrics().started
+               << " started, weight 1 : " << light.metrics().started << " started" << std::endl;
+
+    for(auto &f: fs) { f.get(); }
+
+    if(a_started_when_b_done >= static_cast<size_t>(kNumFloodTasks)) {
+        return 1;
+    }
+}
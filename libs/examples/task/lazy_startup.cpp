@@ -0,0 +1,67 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <iostream>
+#include <hwm/task/task_queue.hpp>
+
+//! スレッドを必要になった時点で起動するタスクキューと、デフォルトのタスクキューのサンプル
+
+//! 静的オブジェクトの初期化と破棄の途中からデフォルトのタスクキューを使う。 //
+struct static_user
+{
+    static_user()
+    {
+        int const result = hwm::default_task_queue().enqueue([] { return 1; }).get();
+        std::cout << "used default_task_queue() during static initialization : " << result << std::endl;
+    }
+
+    ~static_user()
+    {
+        int const result = hwm::default_task_queue().enqueue([] { return 2; }).get();
+        std::cout << "used default_task_queue() during static destruction : " << result << std::endl;
+    }
+};
+
+static_user g_static_user;
+
+template<class F>
+double measure(F f)
+{
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main()
+{
+    size_t const num_threads = 64;
+
+    double const eager = measure([num_threads] {
+        hwm::task_queue tq(num_threads);
+    });
+
+    hwm::task_queue_options options;
+    options.lazy_startup = true;
+
+    double const lazy = measure([num_threads, &options] {
+        hwm::task_queue tq(num_threads, (std::numeric_limits<size_t>::max)(), options);
+    });
+
+    std::cout << "construct and destruct a task_queue with " << num_threads << " threads : "
+              << eager << " ms (eager), " << lazy << " ms (lazy)" << std::endl;
+
+    //! lazy_startupの場合は、タスクが積まれた時に待機中のスレッドがなければスレッドを起動する。 //
+    hwm::task_queue tq(num_threads, (std::numeric_limits<size_t>::max)(), options);
+    std::cout << "started threads before enqueue : " << tq.num_started_threads() << std::endl;
+
+    for(int i = 0; i < 4; ++i) {
+        tq.enqueue([] { std::this_thread::sleep_for(std::chrono::milliseconds(200)); });
+    }
+    tq.wait();
+
+    std::cout << "started threads after enqueue : " << tq.num_started_threads() << " (up to " << tq.num_threads() << ")" << std::endl;
+}
@@ -0,0 +1,107 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! ムーブのみ可能な関数オブジェクトや引数を渡すサンプル
+
+//! コピーとムーブの回数を数えるクラス
+struct counted
+{
+    static int copied;
+    static int moved;
+
+    counted() {}
+    counted(counted const &) { ++copied; }
+    counted(counted &&) { ++moved; }
+};
+
+int counted::copied = 0;
+int counted::moved = 0;
+
+//! ムーブのみ可能な関数オブジェクト
+struct move_only_function
+{
+    explicit
+    move_only_function(std::unique_ptr<std::string> s)
+        :   s_(std::move(s))
+    {}
+
+    move_only_function(move_only_function &&) = default;
+    move_only_function & operator=(move_only_function &&) = default;
+
+    std::string operator()() const { return "move only function : " + *s_; }
+
+private:
+    std::unique_ptr<std::string> s_;
+};
+
+//! コピーもムーブもできない関数オブジェクト
+struct immovable_function
+{
+    immovable_function(int x, int y)
+        :   x_(x), y_(y)
+    {}
+
+    immovable_function(immovable_function const &) = delete;
+    immovable_function & operator=(immovable_function const &) = delete;
+
+    int operator()() const { return x_ * y_; }
+
+private:
+    int x_;
+    int y_;
+};
+
+int main()
+{
+    hwm::task_queue tq(1);
+
+    //! std::unique_ptrを引数として渡す。 //
+    {
+        std::unique_ptr<std::vector<int>> buffer(new std::vector<int>(1000, 1));
+
+        std::future<size_t> f =
+            tq.enqueue(
+                [](std::unique_ptr<std::vector<int>> buf) { return buf->size(); },
+                std::move(buffer)
+            );
+
+        std::cout << "unique_ptr argument : " << f.get() << std::endl;
+    }
+
+    //! ムーブのみ可能な関数オブジェクトを渡す。 //
+    {
+        move_only_function mof(std::unique_ptr<std::string>(new std::string("hello")));
+        std::future<std::string> f = tq.enqueue(std::move(mof));
+        std::cout << f.get() << std::endl;
+    }
+
+    //! std::packaged_taskを渡す。 //
+    {
+        std::packaged_task<int()> pt([] { return 42; });
+        std::future<int> result = pt.get_future();
+
+        tq.enqueue(std::move(pt)).wait();
+        std::cout << "packaged_task : " << result.get() << std::endl;
+    }
+
+    //! コピーもムーブもできない関数オブジェクトを、タスクの中に直接構築する。 //
+    {
+        std::future<int> f = tq.emplace<immovable_function>(6, 7);
+        std::cout << "emplace : " << f.get() << std::endl;
+    }
+
+    //! 引数は呼び出し元からタスクまでの間に一度だけムーブされる。 //
+    {
+        counted c;
+        tq.enqueue([](counted const &) {}, std::move(c)).wait();
+        std::cout << "copied : " << counted::copied << ", moved : " << counted::moved << " (0 and 1 are expected.)" << std::endl;
+    }
+}
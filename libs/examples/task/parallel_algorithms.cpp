@@ -0,0 +1,146 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include <hwm/task/parallel.hpp>
+#include <hwm/task/task_queue.hpp>
+
+//! hwm::parallelの各アルゴリズムの結果を、標準ライブラリの逐次版と比較するサンプル
+
+//! 簡単な疑似乱数（xorshift）
+unsigned int next_random(unsigned int &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+std::vector<int> make_random_data(size_t n, unsigned int seed)
+{
+    std::vector<int> v(n);
+    for(auto &x: v) { x = next_random(seed) % 100000; }
+    return v;
+}
+
+void check(bool cond, char const *name)
+{
+    std::cout << name << " : " << (cond ? "ok" : "NG") << std::endl;
+    assert(cond);
+}
+
+int main()
+{
+    hwm::task_queue tq;
+
+    size_t const n = 1000003;
+    std::vector<int> const data = make_random_data(n, 12345);
+
+    //! sort
+    {
+        std::vector<int> a = data;
+        std::vector<int> b = data;
+        std::sort(a.begin(), a.end());
+        hwm::parallel::sort(tq, b.begin(), b.end());
+        check(a == b, "sort");
+
+        hwm::parallel::sort(tq, b.begin(), b.end(), [](int x, int y) { return x > y; });
+        check(std::equal(a.rbegin(), a.rend(), b.begin()), "sort (greater)");
+    }
+
+    //! inclusive_scan / exclusive_scan
+    {
+        std::vector<long long> const values(data.begin(), data.end());
+        std::vector<long long> a(n);
+        std::vector<long long> b(n);
+
+        std::partial_sum(values.begin(), values.end(), a.begin());
+        hwm::parallel::inclusive_scan(tq, values.begin(), values.end(), b.begin());
+        check(a == b, "inclusive_scan");
+
+        std::vector<long long> in_place = values;
+        hwm::parallel::inclusive_scan(tq, in_place.begin(), in_place.end(), in_place.begin());
+        check(a == in_place, "inclusive_scan (in place)");
+
+        hwm::parallel::exclusive_scan(tq, values.begin(), values.end(), b.begin(), 10LL);
+        bool ok = (b[0] == 10);
+        for(size_t i = 1; i < n; ++i) {
+            ok = ok && (b[i] == a[i - 1] + 10);
+        }
+        check(ok, "exclusive_scan");
+    }
+
+    //! transform / transform_reduce
+    {
+        std::vector<int> a(n);
+        std::vector<int> b(n);
+        std::transform(data.begin(), data.end(), a.begin(), [](int x) { return x * 2 + 1; });
+        hwm::parallel::transform(tq, data.begin(), data.end(), b.begin(), [](int x) { return x * 2 + 1; });
+        check(a == b, "transform");
+
+        long long expected = 0;
+        for(int x: data) { expected += static_cast<long long>(x) * x; }
+        long long const sum_of_squares =
+            hwm::parallel::transform_reduce(
+                tq, data.begin(), data.end(), 0LL,
+                [](long long x, long long y) { return x + y; },
+                [](int x) { return static_cast<long long>(x) * x; });
+        check(sum_of_squares == expected, "transform_reduce");
+    }
+
+    //! find_if
+    {
+        std::vector<int> v(n, 0);
+        v[n / 3] = 1;
+        v[n / 2] = 1;
+        v[n - 1] = 1;
+        auto it = hwm::parallel::find_if(tq, v.begin(), v.end(), [](int x) { return x == 1; });
+        check(it - v.begin() == static_cast<std::ptrdiff_t>(n / 3), "find_if (first match)");
+
+        auto none = hwm::parallel::find_if(tq, v.begin(), v.end(), [](int x) { return x == 2; });
+        check(none == v.end(), "find_if (not found)");
+    }
+
+    //! partition
+    {
+        std::vector<int> v = data;
+        auto pred = [](int x) { return x % 3 == 0; };
+        auto mid = hwm::parallel::partition(tq, v.begin(), v.end(), pred);
+
+        std::vector<int> a = data;
+        std::vector<int> b = v;
+        std::sort(a.begin(), a.end());
+        std::sort(b.begin(), b.end());
+
+        check(std::all_of(v.begin(), mid, pred) && std::none_of(mid, v.end(), pred) && a == b, "partition");
+    }
+
+    //! 関数オブジェクトが送出した例外は、呼び出し元に再送出される
+    {
+        bool caught = false;
+        try {
+            std::vector<int> out(n);
+            hwm::parallel::transform(tq, data.begin(), data.end(), out.begin(), [](int x) -> int {
+                if(x == 99999) { throw std::runtime_error("error"); }
+                return x;
+            });
+        } catch(std::runtime_error &) {
+            caught = true;
+        }
+        check(caught, "exception");
+    }
+
+    //! タスクの中から呼び出すこともできる
+    {
+        std::vector<int> v = data;
+        tq.enqueue([&] { hwm::parallel::sort(tq, v.begin(), v.end()); }).get();
+        check(std::is_sorted(v.begin(), v.end()), "sort (from a task)");
+    }
+}
@@ -0,0 +1,87 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! task_queue_options::enable_perf_countersで、タスクの種類ごとに実行時間とハードウェアカウンタの値を集計するサンプル
+//! 計算の多いタスクと、メモリアクセスの多いタスクをそれぞれ別のタグで積み、IPCやキャッシュミスの違いを表示する。
+//! perf_event_open()を使用できない環境では、タスク数と実行時間だけが表示される。
+
+enum : hwm::task_tag {
+    compute_tag = 1,
+    memory_tag = 2,
+};
+
+double compute(int seed)
+{
+    double v = seed;
+    for(int i = 0; i < 100000; ++i) {
+        v = std::sqrt(v + i) * 1.0001;
+    }
+    return v;
+}
+
+long long touch_memory(std::vector<int> const &data, int seed)
+{
+    //! キャッシュに乗らない大きさの配列を、飛び飛びに読む
+    long long sum = 0;
+    size_t index = seed;
+    for(int i = 0; i < 100000; ++i) {
+        index = (index * 1103515245 + 12345) % data.size();
+        sum += data[index];
+    }
+    return sum;
+}
+
+int main()
+{
+    hwm::task_queue_options options;
+    options.enable_perf_counters = true;
+
+    hwm::task_queue tq(2, (std::numeric_limits<size_t>::max)(), options);
+
+    std::vector<int> data(16 * 1024 * 1024, 1);
+
+    for(int i = 0; i < 32; ++i) {
+        tq.enqueue_with_tag(compute_tag, compute, i);
+        tq.enqueue_with_tag(memory_tag, [&data, i] { return touch_memory(data, i); });
+    }
+
+    //! タグを指定しないタスクは、タグ0として集計される
+    tq.enqueue([] {});
+
+    tq.wait();
+
+    hwm::task_queue_metrics const m = tq.metrics();
+
+    //! 開けなかったカウンタの値は0になる
+    std::cout
+        << "perf counters available : " << std::boolalpha << m.perf_counters_available
+        << " (cycles " << m.available_perf_counters.cycles
+        << ", instructions " << m.available_perf_counters.instructions
+        << ", LLC misses " << m.available_perf_counters.llc_misses
+        << ", context switches " << m.available_perf_counters.context_switches << ")" << std::endl;
+    for(auto const &entry: m.task_counters) {
+        hwm::task_perf_counters const &c = entry.second;
+        std::cout
+            << "tag " << entry.first
+            << " : tasks " << c.num_tasks
+            << ", " << c.total_nanoseconds / 1000 << "us"
+            << ", cycles " << c.cycles
+            << ", instructions " << c.instructions
+            << ", IPC " << c.ipc()
+            << ", LLC misses " << c.llc_misses
+            << ", context switches " << c.context_switches
+            << std::endl;
+    }
+
+    assert(m.task_counters.at(compute_tag).num_tasks == 32);
+    assert(m.task_counters.at(memory_tag).num_tasks == 32);
+    assert(m.task_counters.at(0).num_tasks == 1);
+}
@@ -0,0 +1,90 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <hwm/task/pipeline.hpp>
+#include <hwm/task/task_queue.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! pipelineを使用して、ソース → 並列に処理するステージ → 順番通りに受け取るステージ、と要素を流すサンプル
+//! 並列のステージは要素ごとに処理時間が異なるが、serial_in_orderのステージにはソースが生成した順に届く。
+//! また、同時にパイプラインの中に存在する要素の数がmax_tokens以下に保たれていることも確認する。
+
+int const kNumItems = 200;
+size_t const kMaxTokens = 8;
+
+int main()
+{
+    hwm::task_queue tq(4);
+
+    int next = 0;
+    std::atomic<size_t> in_flight(0);
+    std::atomic<size_t> max_in_flight(0);
+    std::vector<std::string> received;
+    std::atomic<int> out_of_order_count(0);
+
+    auto p =
+        hwm::pipeline::from([&](hwm::flow_control &fc) -> int {
+            if(next == kNumItems) {
+                fc.stop();
+                return 0;
+            }
+
+            size_t const n = ++in_flight;
+            size_t m = max_in_flight.load();
+            while(n > m && !max_in_flight.compare_exchange_weak(m, n)) {}
+
+            return next++;
+        })
+        .then(hwm::stage_mode::parallel, [](int x) {
+            //! 要素ごとに処理時間を変えて、並列のステージを追い越しが起きるようにする
+            std::this_thread::sleep_for(std::chrono::microseconds((x * 7919) % 500));
+            return std::to_string(x * x);
+        })
+        .then(hwm::stage_mode::serial_out_of_order, [&](std::string s) {
+            ++out_of_order_count;
+            return s;
+        })
+        .to(hwm::stage_mode::serial_in_order, [&](std::string s) {
+            received.push_back(std::move(s));
+            --in_flight;
+        });
+
+    p.run(tq, kMaxTokens).get();
+
+    bool in_order = received.size() == static_cast<size_t>(kNumItems);
+    for(int i = 0; in_order && i < kNumItems; ++i) {
+        in_order = received[i] == std::to_string(i * i);
+    }
+
+    hwm::mcout << "received : " << received.size() << ", in order : " << std::boolalpha << in_order << std::endl;
+    hwm::mcout << "max in flight : " << max_in_flight.load() << " (max_tokens : " << kMaxTokens << ")" << std::endl;
+
+    //! ステージで送出された例外は、run()の戻り値のstd::futureに設定される
+    int count = 0;
+    auto failing =
+        hwm::pipeline::from([&](hwm::flow_control &fc) -> int {
+            if(count == 100) { fc.stop(); }
+            return count++;
+        })
+        .to(hwm::stage_mode::parallel, [](int x) {
+            if(x == 10) { throw std::runtime_error("error in stage"); }
+        });
+
+    try {
+        failing.run(tq, kMaxTokens).get();
+    } catch(std::exception &e) {
+        hwm::mcout << "exception : " << e.what() << std::endl;
+    }
+
+    if(!in_order || max_in_flight.load() > kMaxTokens || out_of_order_count.load() != kNumItems) {
+        return 1;
+    }
+}
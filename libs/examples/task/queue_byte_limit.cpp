@@ -0,0 +1,58 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <chrono>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! task_queue_options::queue_byte_limitを使用して、キューに積まれるタスクのサイズの合計を制限するサンプル
+//! 大きなバッファを引数に持つタスクを積み続けても、キューに溜まるデータは上限の範囲に収まる。
+
+size_t const kBufferSize = 1024 * 1024;
+size_t const kByteLimit = 4 * kBufferSize;
+
+int main()
+{
+    hwm::task_queue_options options;
+    options.queue_byte_limit = kByteLimit;
+
+    hwm::task_queue tq(1, (std::numeric_limits<size_t>::max)(), options);
+
+    long long total = 0;
+    for(int i = 0; i < 32; ++i) {
+        std::vector<char> buffer(kBufferSize, 1);
+        size_t const bytes = buffer.size();
+
+        //! std::vectorの要素はタスクのオブジェクトの外に確保されるので、そのサイズを報告する
+        tq.enqueue_with_size(
+            bytes,
+            [&total](std::vector<char> const &b) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                total += std::accumulate(b.begin(), b.end(), 0LL);
+            },
+            std::move(buffer));
+    }
+
+    tq.wait();
+
+    auto const m = tq.metrics();
+    hwm::mcout << "total : " << total << std::endl;
+    hwm::mcout << "byte limit : " << m.queue_byte_limit
+               << ", peak pending bytes : " << m.peak_pending_bytes
+               << ", pending bytes : " << m.pending_bytes << std::endl;
+
+    //! キューが空の時は、上限より大きなタスクも積める
+    tq.enqueue_with_size(kByteLimit * 2, [] {}).wait();
+
+    if(total != 32 * static_cast<long long>(kBufferSize)
+       || m.peak_pending_bytes > kByteLimit
+       || m.pending_bytes != 0)
+    {
+        return 1;
+    }
+}
@@ -0,0 +1,117 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <hwm/task/task_queue.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! task_queue_options::enable_reactorを使用して、パイプ、eventfd、通常のファイルへの読み書きを
+//! タスクキューのスレッドで非同期に行うサンプル（Linuxのみ）
+
+#if defined(HWM_TASK_HAS_REACTOR)
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+int main()
+{
+    hwm::task_queue_options options;
+    options.enable_reactor = true;
+
+    hwm::task_queue tq(2, (std::numeric_limits<size_t>::max)(), options);
+
+    bool ok = true;
+
+    //! パイプ : 先に読み込みを登録しておき、後から書き込む
+    {
+        int fds[2];
+        if(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) != 0) { return 1; }
+
+        char buf[64] = {};
+        auto read_result = tq.async_read(fds[0], buf, sizeof(buf));
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        char const message[] = "hello from pipe";
+        auto write_result = tq.async_write(fds[1], message, sizeof(message));
+
+        ssize_t const written = write_result.get();
+        ssize_t const read = read_result.get();
+
+        hwm::mcout << "pipe : wrote " << written << " bytes, read \"" << buf << "\"" << std::endl;
+        ok = ok && read == written && std::strcmp(buf, message) == 0;
+
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    //! eventfd : 読み込めるようになったら、タスクキューのスレッドでタスクを実行する
+    {
+        int const efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(efd < 0) { return 1; }
+
+        auto task = tq.on_readable(efd, [efd, &tq] {
+            std::uint64_t value = 0;
+            ssize_t const n = ::read(efd, &value, sizeof(value));
+            hwm::mcout << "eventfd : value " << value
+                       << " on thread " << tq.current_thread_index() << std::endl;
+            return n == sizeof(value) ? value : 0;
+        });
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        std::uint64_t const value = 42;
+        if(::write(efd, &value, sizeof(value)) != sizeof(value)) { return 1; }
+
+        ok = ok && task.get() == 42;
+        ::close(efd);
+    }
+
+    //! 通常のファイル : epollで待機できないので、その場で読み書きされる
+    {
+        char path[] = "/tmp/hwm_task_reactor_XXXXXX";
+        int const fd = ::mkstemp(path);
+        if(fd < 0) { return 1; }
+        ::unlink(path);
+
+        std::string const text = "hello from file";
+        ssize_t const written = tq.async_write(fd, text.data(), text.size()).get();
+        ::lseek(fd, 0, SEEK_SET);
+
+        char buf[64] = {};
+        ssize_t const read = tq.async_read(fd, buf, sizeof(buf)).get();
+
+        hwm::mcout << "file : wrote " << written << " bytes, read \"" << buf << "\"" << std::endl;
+        ok = ok && read == written && text == buf;
+
+        ::close(fd);
+    }
+
+    //! エラーはstd::system_errorとしてstd::futureに設定される
+    try {
+        char buf[8];
+        tq.async_read(-1, buf, sizeof(buf)).get();
+        ok = false;
+    } catch(std::system_error &e) {
+        hwm::mcout << "error : " << e.what() << std::endl;
+    }
+
+    return ok ? 0 : 1;
+}
+
+#else
+
+int main()
+{
+    hwm::mcout << "the reactor is not supported on this platform." << std::endl;
+}
+
+#endif
@@ -0,0 +1,62 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <hwm/task/task_queue.hpp>
+
+//! リアルタイムスレッドから、ロックもメモリ確保も行わずにタスクを積むサンプル
+//! オーディオコールバックを模したスレッドが、一定間隔でバッファのピーク値をタスクキューに渡す。 //
+
+//! タスクに渡すデータ。trivially copyableで、固定サイズでなければならない。 //
+struct peak_message
+{
+    int     block_index;
+    float   peak;
+};
+
+std::atomic<int> g_received(0);
+
+void on_peak(peak_message const &msg)
+{
+    if(msg.block_index % 10 == 0) {
+        std::cout << "block[" << msg.block_index << "] peak : " << msg.peak << std::endl;
+    }
+    ++g_received;
+}
+
+int const kNumBlocks = 50;
+
+int main()
+{
+    hwm::task_queue tq(2);
+
+    //! ハンドルの作成はリアルタイムスレッドの外で行う。 //
+    hwm::realtime_producer producer = tq.make_realtime_producer(64);
+
+    int dropped = 0;
+
+    std::thread audio_thread([&producer, &dropped] {
+        for(int block = 0; block < kNumBlocks; ++block) {
+            peak_message msg = { block, static_cast<float>(block % 7) / 7.0f };
+
+            //! ブロックせずに結果を返す。リングバッファが一杯なら諦める。 //
+            if(!producer.try_enqueue(&on_peak, msg)) {
+                ++dropped;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+
+    audio_thread.join();
+
+    while(g_received.load() + dropped < kNumBlocks) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    std::cout << "received : " << g_received.load() << ", dropped : " << dropped << std::endl;
+}
@@ -0,0 +1,147 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <hwm/task/shared_worker_pool.hpp>
+
+//! 複数のサブシステムが、それぞれのtask_queue_viewを通して一つのワーカースレッドの集合を共有するサンプル
+//! 各ビューはwait()やwait_before_destructed()を個別に持つが、スレッドはshared_worker_poolの分しか起動されない。
+
+void spin_for(std::chrono::microseconds dur)
+{
+    auto const end = std::chrono::steady_clock::now() + dur;
+    while(std::chrono::steady_clock::now() < end) {}
+}
+
+int main()
+{
+    //! 重みに応じた公平なスケジューリング
+    {
+        hwm::shared_worker_pool pool(2);
+
+        hwm::task_queue_view_options audio_options;
+        audio_options.weight = 4;
+        hwm::task_queue_view audio(pool, audio_options);
+
+        hwm::task_queue_view io(pool);
+
+        //! タスクを積み終えるまで、すべてのスレッドをふさいでおく
+        hwm::task_queue_view gate(pool);
+        std::promise<void> release;
+        std::shared_future<void> released(release.get_future());
+        std::atomic<size_t> num_blocked(0);
+        for(size_t i = 0; i < pool.num_threads(); ++i) {
+            gate.enqueue([released, &num_blocked] { ++num_blocked; released.wait(); });
+        }
+        while(num_blocked.load() != pool.num_threads()) {
+            std::this_thread::yield();
+        }
+
+        std::atomic<int> audio_done(0);
+        std::atomic<int> io_done(0);
+        std::atomic<int> io_done_at_audio_finish(0);
+
+        for(int i = 0; i < 400; ++i) {
+            audio.enqueue([&] {
+                spin_for(std::chrono::microseconds(20));
+                if(++audio_done == 400) {
+                    io_done_at_audio_finish = io_done.load();
+                }
+            });
+            io.enqueue([&io_done] { spin_for(std::chrono::microseconds(20)); ++io_done; });
+        }
+        release.set_value();
+
+        //! audioのタスクだけを待つ。重みが4なので、audioのタスクがすべて完了した時点で、ioのタスクはおよそ1/4しか実行されていない
+        audio.wait();
+        io.wait();
+
+        std::cout << "threads : " << pool.num_threads() << ", views : " << pool.num_views() << std::endl;
+        std::cout << "io tasks finished when audio finished : " << io_done_at_audio_finish.load() << " / 400" << std::endl;
+        assert(audio_done.load() == 400);
+        assert(io_done.load() == 400);
+    }
+
+    //! 優先度によるスケジューリング
+    {
+        hwm::shared_worker_pool pool(1, hwm::view_scheduling::strict_priority);
+
+        hwm::task_queue_view_options high_options;
+        high_options.priority = 10;
+        hwm::task_queue_view high(pool, high_options);
+        hwm::task_queue_view low(pool);
+
+        std::mutex mutex;
+        std::vector<std::string> order;
+        auto record = [&mutex, &order](std::string name) {
+            std::unique_lock<std::mutex> lock(mutex);
+            order.push_back(name);
+        };
+
+        //! 唯一のスレッドをふさいでいる間に、両方のビューにタスクを積む
+        std::promise<void> release;
+        std::shared_future<void> released(release.get_future());
+        std::promise<void> started;
+        low.enqueue([released, &started] { started.set_value(); released.wait(); });
+        started.get_future().wait();
+
+        low.enqueue(record, "low 1");
+        low.enqueue(record, "low 2");
+        high.enqueue(record, "high 1");
+        high.enqueue(record, "high 2");
+        release.set_value();
+
+        low.wait();
+        high.wait();
+
+        for(auto const &name: order) {
+            std::cout << name << std::endl;
+        }
+        assert((order == std::vector<std::string>{ "high 1", "high 2", "low 1", "low 2" }));
+    }
+
+    //! wait_before_destructed()がfalseのビューは、破棄される時に積まれたままのタスクを実行しない
+    {
+        hwm::shared_worker_pool pool(1);
+        std::future<void> discarded;
+
+        std::promise<void> release;
+        std::shared_future<void> released(release.get_future());
+        std::promise<void> started;
+        std::thread releaser;
+
+        {
+            hwm::task_queue_view view(pool);
+            view.set_wait_before_destructed(false);
+
+            view.enqueue([released, &started] { started.set_value(); released.wait(); });
+            started.get_future().wait();
+            discarded = view.enqueue([] {});
+
+            //! ビューのデストラクタは実行中のタスクを待つので、別のスレッドから解放する
+            releaser = std::thread([&release] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                release.set_value();
+            });
+        }
+        releaser.join();
+
+        try {
+            discarded.get();
+            assert(false);
+        } catch(std::future_error &e) {
+            std::cout << "discarded task : " << e.what() << std::endl;
+            assert(e.code() == std::future_errc::broken_promise);
+        }
+    }
+}
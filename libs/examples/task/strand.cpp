@@ -0,0 +1,55 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+#include <hwm/task/strand.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! ストランドを使って、セッションごとにタスクを順番通りに実行するサンプル
+//! 各セッションのタスクは追加された順に一つずつ実行されるが、
+//! 異なるセッションのタスクはタスクキューのスレッドで並列に実行される。 //
+
+int const kNumSessions = 4;
+int const kTaskPerSession = 5;
+
+int main()
+{
+    hwm::task_queue tq(2);
+
+    std::vector<std::unique_ptr<hwm::strand>> sessions;
+    for(int i = 0; i < kNumSessions; ++i) {
+        sessions.emplace_back(new hwm::strand(tq));
+    }
+
+    //! 各セッションが持つ状態。同じセッションのタスクは同時に実行されないので、ロックせずに更新できる。 //
+    std::vector<int> last_sequence(kNumSessions, -1);
+
+    std::vector<std::future<void>> futures;
+    for(int seq = 0; seq < kTaskPerSession; ++seq) {
+        for(int session = 0; session < kNumSessions; ++session) {
+            futures.push_back(
+                sessions[session]->enqueue(
+                    [&last_sequence](int session, int seq) {
+                        if(last_sequence[session] + 1 != seq) {
+                            hwm::mcout << "!!! out of order : session[" << session << "]" << std::endl;
+                        }
+                        last_sequence[session] = seq;
+                        hwm::mcout << "session[" << session << "] task[" << seq << "]" << std::endl;
+                        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                    },
+                    session, seq
+                ));
+        }
+    }
+
+    for(auto &f: futures) {
+        f.wait();
+    }
+
+    hwm::mcout << "finish" << std::endl;
+}
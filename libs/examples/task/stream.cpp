@@ -0,0 +1,94 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+
+//! 複数の値を順に生成するタスクを使用するサンプル
+//! タスクが生成した値を、タスクの実行と並行して呼び出し元で受け取る。
+//! チャネルの容量を超えて値が溜まることはないので、すべての結果を一つのコンテナに集める必要がない。
+
+int main()
+{
+    hwm::task_queue tq(2);
+
+    //! 1からnまでの値を順に生成する
+    auto numbers = tq.enqueue_stream<int>(
+        [](hwm::stream_sink<int> &sink, int n) {
+            for(int i = 1; i <= n; ++i) {
+                sink.push(i);
+            }
+        },
+        100000);
+
+    long long sum = 0;
+    for(int x: numbers) {
+        sum += x;
+    }
+    std::cout << "sum : " << sum << std::endl;
+    assert(sum == 100000LL * 100001 / 2);
+
+    //! 容量の小さいチャネルで、文字列を生成する
+    auto lines = tq.enqueue_stream<std::string>(
+        hwm::stream_capacity(4),
+        [](hwm::stream_sink<std::string> &sink) {
+            for(int i = 0; i < 10; ++i) {
+                sink.push("line " + std::to_string(i));
+            }
+        });
+
+    std::vector<std::string> received;
+    std::string line;
+    while(lines.pop(line)) {
+        received.push_back(line);
+    }
+    assert(received.size() == 10);
+    assert(received.back() == "line 9");
+
+    //! 途中で例外が送出された場合は、それまでの値を受け取った後で例外が送出される
+    auto failing = tq.enqueue_stream<int>([](hwm::stream_sink<int> &sink) {
+        sink.push(1);
+        sink.push(2);
+        throw std::runtime_error("parse error");
+    });
+
+    int count = 0;
+    try {
+        for(int x: failing) {
+            (void)x;
+            ++count;
+        }
+        assert(false);
+    } catch(std::runtime_error &e) {
+        std::cout << "received " << count << " values before : " << e.what() << std::endl;
+    }
+    assert(count == 2);
+
+    //! チャネルを途中で破棄すると、生産者のpush()がfalseを返して終了できる
+    std::atomic<int> produced(0);
+    {
+        auto endless = tq.enqueue_stream<int>(
+            hwm::stream_capacity(8),
+            [&produced](hwm::stream_sink<int> &sink) {
+                for(int i = 0; sink.push(i); ++i) {
+                    ++produced;
+                }
+            });
+
+        int x;
+        for(int i = 0; i < 100; ++i) {
+            endless.pop(x);
+        }
+    }
+
+    tq.wait();
+    std::cout << "produced before the channel was destroyed : " << produced.load() << std::endl;
+    assert(produced.load() >= 100);
+}
@@ -0,0 +1,54 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <iostream>
+#include <stdexcept>
+#include <hwm/task/task_queue.hpp>
+#include <hwm/task/task_graph.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! task_graphでタスクの依存関係を指定して実行するサンプル
+//! 
+//!          +--> [b] --+
+//!    [a] --+          +--> [d]
+//!          +--> [c] --+
+//! 
+//! [a]の完了後に[b]と[c]が並列に実行され、両方の完了後に[d]が実行される。 //
+
+int main()
+{
+    hwm::task_queue tq(3);
+    hwm::task_graph graph;
+
+    auto make_node = [](char const *name) {
+        return [name] {
+            hwm::mcout << ">>> Execute node[" << name << "]" << std::endl;
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            hwm::mcout << "<<< Execute node[" << name << "]" << std::endl;
+        };
+    };
+
+    auto a = graph.add_node(make_node("a"));
+    auto b = graph.add_node(make_node("b"), { a });
+    auto c = graph.add_node(make_node("c"), { a });
+    graph.add_node(make_node("d"), { b, c });
+
+    //! 同じグラフを何度でも実行できる。 //
+    for(int frame = 0; frame < 3; ++frame) {
+        hwm::mcout << "--- frame " << frame << std::endl;
+        graph.run(tq).get();
+    }
+
+    //! ノードが例外を送出すると、後続のノードは実行されず、run()の戻り値に例外が設定される。 //
+    hwm::task_graph failing_graph;
+    auto x = failing_graph.add_node([] { throw std::runtime_error("node[x] failed"); });
+    failing_graph.add_node(make_node("y"), { x });
+
+    try {
+        failing_graph.run(tq).get();
+    } catch(std::exception &e) {
+        hwm::mcout << "caught exception : " << e.what() << std::endl;
+    }
+}
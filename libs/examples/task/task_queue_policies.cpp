@@ -0,0 +1,117 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <hwm/task/task_queue.hpp>
+
+//! task_queue_policiesで構成を変えたタスクキューのサンプル
+//! 構成ごとのタスクキューのサイズと、短いタスクを大量に積んだ時の実行時間を表示する。
+
+//! 結果をlight_futureで受け取るタスクキュー
+typedef hwm::basic_task_queue<
+    hwm::task_queue_policies<
+        hwm::locked_queue_policy<>,
+        hwm::blocking_idle_policy,
+        hwm::light_future_result_policy
+    >
+> light_task_queue;
+
+//! 結果を受け取らず、タスク数もバイト数も数えないタスクキュー
+//! enqueue()以外の機能も使用しないので、それらの状態も持たない。
+typedef hwm::basic_task_queue<
+    hwm::task_queue_policies<
+        hwm::locked_queue_policy<>,
+        hwm::spinning_idle_policy,
+        hwm::no_result_policy,
+        hwm::uncounted_policy,
+        hwm::uninstrumented_policy,
+        hwm::core_features_policy
+    >
+> fire_and_forget_queue;
+
+int const kNumTasks = 200000;
+
+template<class F>
+double measure(F f)
+{
+    auto const start = std::chrono::steady_clock::now();
+    f();
+    auto const end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main()
+{
+    std::cout << "sizeof(task_queue) : " << sizeof(hwm::task_queue) << std::endl;
+    std::cout << "sizeof(light_task_queue) : " << sizeof(light_task_queue) << std::endl;
+    std::cout << "sizeof(fire_and_forget_queue) : " << sizeof(fire_and_forget_queue) << std::endl;
+
+    size_t const num_threads = (std::max)(std::thread::hardware_concurrency(), 1u);
+
+    //! デフォルトの構成
+    {
+        hwm::task_queue tq(num_threads);
+        std::atomic<int> count(0);
+
+        double const ms = measure([&] {
+            for(int i = 0; i < kNumTasks; ++i) {
+                tq.enqueue([&count] { ++count; });
+            }
+            tq.wait();
+        });
+
+        assert(count.load() == kNumTasks);
+        std::cout << "task_queue : " << ms << "ms" << std::endl;
+    }
+
+    //! light_futureで結果を受け取る
+    {
+        light_task_queue tq(num_threads);
+
+        hwm::light_future<int> f = tq.enqueue([](int a, int b) { return a + b; }, 10, 20);
+        assert(f.get() == 30);
+
+        hwm::light_future<void> error = tq.enqueue([] { throw std::runtime_error("error"); });
+        try {
+            error.get();
+            assert(false);
+        } catch(std::runtime_error &e) {
+            std::cout << "light_future : caught \"" << e.what() << "\"" << std::endl;
+        }
+
+        std::atomic<int> count(0);
+        double const ms = measure([&] {
+            for(int i = 0; i < kNumTasks; ++i) {
+                tq.enqueue([&count] { ++count; });
+            }
+            tq.wait();
+        });
+
+        assert(count.load() == kNumTasks);
+        std::cout << "light_task_queue : " << ms << "ms" << std::endl;
+    }
+
+    //! 結果もタスク数も扱わないので、完了はタスクの側で通知する
+    {
+        fire_and_forget_queue tq(num_threads);
+        std::atomic<int> count(0);
+
+        double const ms = measure([&] {
+            for(int i = 0; i < kNumTasks; ++i) {
+                tq.enqueue([&count] { ++count; });
+            }
+            while(count.load() != kNumTasks) {
+                std::this_thread::yield();
+            }
+        });
+
+        std::cout << "fire_and_forget_queue : " << ms << "ms" << std::endl;
+    }
+}
@@ -0,0 +1,71 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <hwm/task/task_queue.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! ウォッチドッグで、実行時間が長すぎるタスクを検出するサンプル
+//! スレッドが一つしかないタスクキューで、なかなか終わらないタスクを実行する。
+//! ウォッチドッグがそれを検出して補助スレッドを起動するので、後から積んだタスクも先に実行される。
+
+enum : hwm::task_tag {
+    hang_tag = 100,
+};
+
+int main()
+{
+    hwm::task_queue_options options;
+    options.stuck_task_threshold = std::chrono::milliseconds(100);
+    options.compensate_stuck_tasks = true;
+    options.on_stuck_task = [](hwm::stuck_task_info const &info) {
+        hwm::mcout
+            << "stuck task detected : thread " << info.thread_index
+            << ", tag " << info.tag
+            << ", running for " << std::chrono::duration_cast<std::chrono::milliseconds>(info.duration).count() << "ms"
+            << (info.compensated ? " (compensated)" : "")
+            << std::endl;
+    };
+
+    hwm::task_queue tq(1, (std::numeric_limits<size_t>::max)(), options);
+
+    std::atomic<bool> release(false);
+
+    //! 外部からの解放を待ち続けるタスク
+    tq.enqueue_with_tag(hang_tag, [&release] {
+        while(!release.load()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    });
+
+    //! 補助スレッドが起動されるので、唯一のスレッドがふさがっていても実行される
+    std::atomic<int> count(0);
+    for(int i = 0; i < 10; ++i) {
+        tq.enqueue([&count] { ++count; });
+    }
+
+    auto const deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while(count.load() != 10 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    hwm::mcout << "short tasks finished while the hanging task is running : " << count.load() << std::endl;
+    assert(count.load() == 10);
+
+    release.store(true);
+    tq.wait();
+
+    hwm::task_queue_metrics const m = tq.metrics();
+    std::cout << "num stuck tasks : " << m.num_stuck_tasks << std::endl;
+    for(auto const &info: m.recent_stuck_tasks) {
+        std::cout << "  tag " << info.tag << std::endl;
+    }
+    assert(m.num_stuck_tasks == 1);
+    assert(m.recent_stuck_tasks.front().tag == hang_tag);
+}
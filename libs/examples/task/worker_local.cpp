@@ -0,0 +1,103 @@
+//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <hwm/task/task_queue.hpp>
+#include "../utils/stream_mutex.hpp"
+
+//! worker_localを使用して、ロックを取らずにヒストグラムを作成するサンプル
+//! 比較のため、一つのヒストグラムをstd::atomicで共有した場合の実行時間も計測する。
+
+int const kNumBins = 16;
+int const kNumTasks = 256;
+int const kSamplesPerTask = 100000;
+
+typedef std::array<long long, kNumBins> histogram;
+
+//! 簡単な疑似乱数（xorshift）
+unsigned int next_random(unsigned int &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+int main()
+{
+    hwm::task_queue tq;
+
+    histogram zero;
+    zero.fill(0);
+
+    //! worker_localで、スレッドごとのヒストグラムに集計する
+    hwm::worker_local<histogram> local_histograms(tq, zero);
+
+    auto start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < kNumTasks; ++i) {
+        tq.enqueue([&local_histograms, i] {
+            histogram &h = local_histograms.local();
+            unsigned int state = i + 1;
+            for(int j = 0; j < kSamplesPerTask; ++j) {
+                h[next_random(state) % kNumBins] += 1;
+            }
+        });
+    }
+    tq.wait();
+
+    histogram const merged = local_histograms.combine([](histogram a, histogram const &b) {
+        for(int i = 0; i < kNumBins; ++i) { a[i] += b[i]; }
+        return a;
+    });
+
+    auto const local_time = std::chrono::steady_clock::now() - start;
+
+    //! すべてのスレッドから一つのヒストグラムを更新する
+    std::array<std::atomic<long long>, kNumBins> shared;
+    for(auto &bin: shared) { bin.store(0); }
+
+    start = std::chrono::steady_clock::now();
+
+    for(int i = 0; i < kNumTasks; ++i) {
+        tq.enqueue([&shared, i] {
+            unsigned int state = i + 1;
+            for(int j = 0; j < kSamplesPerTask; ++j) {
+                shared[next_random(state) % kNumBins].fetch_add(1);
+            }
+        });
+    }
+    tq.wait();
+
+    auto const shared_time = std::chrono::steady_clock::now() - start;
+
+    long long total = 0;
+    bool same = true;
+    for(int i = 0; i < kNumBins; ++i) {
+        total += merged[i];
+        same = same && merged[i] == shared[i].load();
+    }
+
+    //! タスクの中からは、実行しているスレッドのインデックスを取得できる
+    tq.enqueue([&tq] {
+        hwm::mcout << "running on thread " << tq.current_thread_index()
+                   << " of " << tq.num_threads() << std::endl;
+    }).wait();
+
+    hwm::mcout << "total samples : " << total
+               << " (expected " << static_cast<long long>(kNumTasks) * kSamplesPerTask << ")" << std::endl;
+    hwm::mcout << "same result : " << std::boolalpha << same << std::endl;
+    hwm::mcout << "worker_local : "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(local_time).count() << " ms, "
+               << "shared atomic : "
+               << std::chrono::duration_cast<std::chrono::milliseconds>(shared_time).count() << " ms" << std::endl;
+
+    if(total != static_cast<long long>(kNumTasks) * kSamplesPerTask || !same) {
+        return 1;
+    }
+}
@@ -0,0 +1,141 @@
+﻿//          Copyright hotwatermorning 2013 - 2013.
+// Distributed under the Boost Software License, Version 1.0.
+//    (See accompanying file LICENSE_1_0.txt or copy at
+//          http://www.boost.org/LICENSE_1_0.txt)
+
+#include <cassert>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <hwm/task/task_queue.hpp>
+#include <hwm/task/workload_replay.hpp>
+
+//! ワークロードを記録して、別の構成のタスクキューで再現するサンプル
+//! 引数でファイルを指定した場合は、そのファイルに保存されたワークロードを再現する。
+//! 指定しなかった場合は、二つのスレッドからリクエストを積むワークロードを記録してworkload_trace.binに保存し、それを再現する。
+//!
+//! 使い方:
+//!     workload_replay [trace file]
+
+enum : hwm::task_tag {
+    request_tag = 1,
+    subtask_tag = 2,
+};
+
+void spin_for(std::chrono::microseconds dur)
+{
+    auto const end = std::chrono::steady_clock::now() + dur;
+    while(std::chrono::steady_clock::now() < end) {}
+}
+
+//! リクエストごとにタスクを積み、各タスクはいくつかのサブタスクを積む
+hwm::workload_trace record_workload()
+{
+    auto recorder = std::make_shared<hwm::workload_recorder>();
+
+    hwm::task_queue_options options;
+    options.recorder = recorder;
+
+    hwm::task_queue tq(2, (std::numeric_limits<size_t>::max)(), options);
+
+    std::vector<std::thread> producers;
+    for(int p = 0; p < 2; ++p) {
+        producers.push_back(std::thread([&tq, p] {
+            std::mt19937 rng(p);
+            std::uniform_int_distribution<int> gap(100, 300);
+            std::uniform_int_distribution<int> work(20, 80);
+            std::uniform_int_distribution<int> num_children(0, 2);
+
+            for(int i = 0; i < 300; ++i) {
+                std::this_thread::sleep_for(std::chrono::microseconds(gap(rng)));
+
+                int const w = work(rng);
+                int const n = num_children(rng);
+                tq.enqueue_with_tag(request_tag, [&tq, w, n] {
+                    spin_for(std::chrono::microseconds(w / 2));
+                    for(int c = 0; c < n; ++c) {
+                        tq.enqueue_with_tag(subtask_tag, [] { spin_for(std::chrono::microseconds(20)); });
+                    }
+                    spin_for(std::chrono::microseconds(w / 2));
+                });
+            }
+        }));
+    }
+
+    for(auto &th: producers) {
+        th.join();
+    }
+    tq.wait();
+
+    return recorder->trace();
+}
+
+void print_result(std::string const &name, hwm::workload_replay_result const &r)
+{
+    auto us = [](std::chrono::nanoseconds ns) { return ns.count() / 1000.0; };
+
+    std::cout
+        << std::left << std::setw(24) << name
+        << " tasks/s : " << std::setw(10) << static_cast<long long>(r.throughput())
+        << " p50 : " << std::setw(8) << us(r.latency_percentile(0.5)) << "us"
+        << " p99 : " << std::setw(8) << us(r.latency_percentile(0.99)) << "us"
+        << " max : " << us(r.latency_percentile(1.0)) << "us"
+        << std::endl;
+}
+
+typedef hwm::basic_task_queue<
+    hwm::task_queue_policies<
+        hwm::locked_queue_policy<>,
+        hwm::spinning_idle_policy
+    >
+> spinning_task_queue;
+
+int main(int argc, char **argv)
+{
+    hwm::workload_trace trace;
+
+    if(argc >= 2) {
+        trace = hwm::workload_trace::load(argv[1]);
+    } else {
+        hwm::workload_trace const recorded = record_workload();
+        recorded.save("workload_trace.bin");
+        trace = hwm::workload_trace::load("workload_trace.bin");
+
+        assert(trace.submits.size() == recorded.submits.size());
+        assert(trace.runs.size() == recorded.runs.size());
+    }
+
+    std::cout << "submitted tasks : " << trace.submits.size() << std::endl;
+    std::cout << "executed tasks : " << trace.runs.size() << std::endl;
+
+    {
+        hwm::task_queue tq(1);
+        auto const r = hwm::replay_workload(tq, trace);
+
+        std::cout << "recorded p50 : " << r.recorded_latency_percentile(0.5).count() / 1000.0 << "us"
+                  << " p99 : " << r.recorded_latency_percentile(0.99).count() / 1000.0 << "us" << std::endl;
+        print_result("task_queue(1)", r);
+    }
+
+    {
+        hwm::task_queue tq(2);
+        print_result("task_queue(2)", hwm::replay_workload(tq, trace));
+    }
+
+    {
+        hwm::task_queue_options options;
+        options.num_shards = 4;
+        options.selection = hwm::shard_selection::power_of_two_choices;
+        hwm::task_queue tq(4, (std::numeric_limits<size_t>::max)(), options);
+        print_result("task_queue(4, 4 shards)", hwm::replay_workload(tq, trace));
+    }
+
+    {
+        spinning_task_queue tq(2);
+        print_result("spinning_task_queue(2)", hwm::replay_workload(tq, trace));
+    }
+}